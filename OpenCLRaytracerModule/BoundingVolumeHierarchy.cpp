@@ -0,0 +1,378 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <float.h>
+#include <algorithm>
+
+#include "BoundingVolumeHierarchy.h"
+
+/*
+* Box helpers
+*/
+static void resetBox( BoundingBox& box )
+{
+   for( int i(0); i<4; ++i )
+   {
+      box.min.s[i] =  FLT_MAX;
+      box.max.s[i] = -FLT_MAX;
+   }
+}
+
+static void growBox( BoundingBox& box, const cl_float4& min, const cl_float4& max )
+{
+   for( int i(0); i<3; ++i )
+   {
+      box.min.s[i] = (min.s[i]<box.min.s[i]) ? min.s[i] : box.min.s[i];
+      box.max.s[i] = (max.s[i]>box.max.s[i]) ? max.s[i] : box.max.s[i];
+   }
+}
+
+static float surfaceArea( const BoundingBox& box )
+{
+   float x = box.max.s[0]-box.min.s[0];
+   float y = box.max.s[1]-box.min.s[1];
+   float z = box.max.s[2]-box.min.s[2];
+   if( x<0.f || y<0.f || z<0.f ) return 0.f; // Empty box
+   return 2.f*(x*y + y*z + z*x);
+}
+
+/*
+* Orders item indices along one axis of their centroid
+*/
+struct CentroidComparator
+{
+   CentroidComparator( const std::vector<cl_float4>& centroids, int axis )
+      : m_centroids(centroids), m_axis(axis) {};
+
+   bool operator()( cl_int a, cl_int b ) const
+   {
+      return m_centroids[a].s[m_axis] < m_centroids[b].s[m_axis];
+   }
+
+   const std::vector<cl_float4>& m_centroids;
+   int m_axis;
+};
+
+/*
+* BoundingVolumeHierarchy
+*/
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+ : m_weightedArea(0.f), m_buildCost(0.f)
+{
+}
+
+void BoundingVolumeHierarchy::clear()
+{
+   m_nodes.clear();
+   m_indices.clear();
+   m_boxes.clear();
+   m_centroids.clear();
+   m_leaves.clear();
+   m_weightedArea = 0.f;
+   m_buildCost = 0.f;
+}
+
+/*
+* build
+* Top-down construction using a binned Surface Area Heuristic
+*/
+void BoundingVolumeHierarchy::build( const std::vector<BoundingBox>& boxes )
+{
+   clear();
+   cl_int nbItems = static_cast<cl_int>(boxes.size());
+   if( nbItems == 0 ) return;
+
+   m_boxes = boxes;
+   m_centroids.resize(nbItems);
+   m_indices.resize(nbItems);
+   for( cl_int i(0); i<nbItems; ++i )
+   {
+      m_indices[i] = i;
+      for( int j(0); j<4; ++j )
+      {
+         m_centroids[i].s[j] = 0.5f*(boxes[i].min.s[j]+boxes[i].max.s[j]);
+      }
+   }
+
+   m_nodes.reserve(2*nbItems);
+   buildNode( -1, 0, nbItems, 0 );
+
+   // Remember where each item ended up so that it can be refitted
+   m_leaves.resize(nbItems);
+   for( cl_int n(0); n<getNbNodes(); ++n )
+   {
+      m_weightedArea += getNodeCost( n );
+      for( cl_int i(0); i<m_nodes[n].nbPrimitives; ++i )
+      {
+         m_leaves[m_indices[m_nodes[n].left+i]] = n;
+      }
+   }
+   m_buildCost = getCost();
+}
+
+/*
+* refit
+* Updates the box of one item and enlarges or shrinks its ancestors, stopping
+* as soon as a node is left unchanged. The topology is kept as is. The nodes
+* that changed are appended to refittedNodes.
+*/
+void BoundingVolumeHierarchy::refit( 
+   cl_int               item, 
+   const BoundingBox&   box, 
+   std::vector<cl_int>& refittedNodes )
+{
+   if( item<0 || item>=static_cast<cl_int>(m_leaves.size()) ) return;
+
+   m_boxes[item] = box;
+   cl_int node = m_leaves[item];
+   while( node != -1 && updateNode( node ) )
+   {
+      refittedNodes.push_back(node);
+      node = m_nodes[node].parent;
+   }
+}
+
+/*
+* isDegraded
+* Refitting moves boxes without regrouping them, the tree is worth rebuilding
+* once its cost has drifted too far away from the one it had when built.
+*/
+bool BoundingVolumeHierarchy::isDegraded() const
+{
+   return ( m_buildCost>0.f && getCost()>m_buildCost*gBVHRebuildRatio );
+}
+
+bool BoundingVolumeHierarchy::updateNode( cl_int node )
+{
+   BoundingVolume& volume = m_nodes[node];
+   BoundingBox bounds;
+   resetBox( bounds );
+   if( volume.nbPrimitives != 0 )
+   {
+      for( cl_int i(0); i<volume.nbPrimitives; ++i )
+      {
+         cl_int item = m_indices[volume.left+i];
+         growBox( bounds, m_boxes[item].min, m_boxes[item].max );
+      }
+   }
+   else
+   {
+      growBox( bounds, m_nodes[volume.left].min,  m_nodes[volume.left].max );
+      growBox( bounds, m_nodes[volume.right].min, m_nodes[volume.right].max );
+   }
+
+   bool changed = false;
+   for( int i(0); i<3 && !changed; ++i )
+   {
+      changed = ( bounds.min.s[i] != volume.min.s[i] || bounds.max.s[i] != volume.max.s[i] );
+   }
+   if( changed )
+   {
+      m_weightedArea -= getNodeCost( node );
+      volume.min = bounds.min;
+      volume.max = bounds.max;
+      m_weightedArea += getNodeCost( node );
+   }
+   return changed;
+}
+
+float BoundingVolumeHierarchy::getNodeCost( cl_int node ) const
+{
+   const BoundingVolume& volume = m_nodes[node];
+   BoundingBox box;
+   box.min = volume.min;
+   box.max = volume.max;
+   float weight = ( volume.nbPrimitives != 0 ) ? static_cast<float>(volume.nbPrimitives) : gBVHTraversalCost;
+   return surfaceArea( box )*weight;
+}
+
+float BoundingVolumeHierarchy::getCost() const
+{
+   if( m_nodes.empty() ) return 0.f;
+   BoundingBox root;
+   root.min = m_nodes[0].min;
+   root.max = m_nodes[0].max;
+   float area = surfaceArea( root );
+   return ( area>0.f ) ? m_weightedArea/area : 0.f;
+}
+
+void BoundingVolumeHierarchy::computeBounds(
+   cl_int       begin,
+   cl_int       end,
+   BoundingBox& bounds,
+   BoundingBox& centroids )
+{
+   resetBox( bounds );
+   resetBox( centroids );
+   for( cl_int i(begin); i<end; ++i )
+   {
+      cl_int item = m_indices[i];
+      growBox( bounds, m_boxes[item].min, m_boxes[item].max );
+      growBox( centroids, m_centroids[item], m_centroids[item] );
+   }
+}
+
+cl_int BoundingVolumeHierarchy::buildNode(
+   cl_int parent,
+   cl_int begin,
+   cl_int end,
+   int    depth )
+{
+   cl_int index = static_cast<cl_int>(m_nodes.size());
+   m_nodes.push_back(BoundingVolume());
+
+   BoundingBox bounds;
+   BoundingBox centroids;
+   computeBounds( begin, end, bounds, centroids );
+
+   m_nodes[index].min          = bounds.min;
+   m_nodes[index].max          = bounds.max;
+   m_nodes[index].left         = begin;
+   m_nodes[index].right        = -1;
+   m_nodes[index].nbPrimitives = end-begin;
+   m_nodes[index].parent       = parent;
+
+   // Each level costs one stack entry in the kernel
+   cl_int count = end-begin;
+   if( count == 1 || depth >= gBVHStackSize-2 ) return index;
+
+   // Split along the largest extent of the centroids
+   int axis = 0;
+   float extent = 0.f;
+   for( int i(0); i<3; ++i )
+   {
+      float e = centroids.max.s[i]-centroids.min.s[i];
+      if( e>extent )
+      {
+         extent = e;
+         axis = i;
+      }
+   }
+
+   cl_int middle = begin;
+   if( extent > 0.f )
+   {
+      // Bin the centroids
+      BoundingBox binBoxes[gBVHNbBins];
+      cl_int      binCounts[gBVHNbBins];
+      for( int b(0); b<gBVHNbBins; ++b )
+      {
+         resetBox( binBoxes[b] );
+         binCounts[b] = 0;
+      }
+
+      float scale = gBVHNbBins/extent;
+      for( cl_int i(begin); i<end; ++i )
+      {
+         cl_int item = m_indices[i];
+         int b = static_cast<int>((m_centroids[item].s[axis]-centroids.min.s[axis])*scale);
+         b = (b>=gBVHNbBins) ? gBVHNbBins-1 : b;
+         binCounts[b]++;
+         growBox( binBoxes[b], m_boxes[item].min, m_boxes[item].max );
+      }
+
+      // Sweep from the right to get the cost of every right side
+      float  rightAreas[gBVHNbBins];
+      cl_int rightCounts[gBVHNbBins];
+      BoundingBox box;
+      resetBox( box );
+      cl_int n(0);
+      for( int b(gBVHNbBins-1); b>0; --b )
+      {
+         growBox( box, binBoxes[b].min, binBoxes[b].max );
+         n += binCounts[b];
+         rightAreas[b]  = surfaceArea( box );
+         rightCounts[b] = n;
+      }
+
+      // Then from the left to find the cheapest split
+      float bestCost  = FLT_MAX;
+      int   bestSplit = -1;
+      resetBox( box );
+      n = 0;
+      for( int b(0); b<gBVHNbBins-1; ++b )
+      {
+         growBox( box, binBoxes[b].min, binBoxes[b].max );
+         n += binCounts[b];
+         if( n != 0 && rightCounts[b+1] != 0 )
+         {
+            float cost = surfaceArea( box )*n + rightAreas[b+1]*rightCounts[b+1];
+            if( cost<bestCost )
+            {
+               bestCost  = cost;
+               bestSplit = b;
+            }
+         }
+      }
+
+      // Keep a leaf if splitting does not pay off
+      float area = surfaceArea( bounds );
+      float leafCost = area*count;
+      bestCost += area*gBVHTraversalCost;
+      if( count <= gBVHMaxLeafSize && (bestSplit == -1 || bestCost >= leafCost) ) return index;
+
+      if( bestSplit != -1 )
+      {
+         // Partition the indices around the split
+         cl_int i(begin);
+         cl_int j(end-1);
+         while( i<=j )
+         {
+            int b = static_cast<int>((m_centroids[m_indices[i]].s[axis]-centroids.min.s[axis])*scale);
+            b = (b>=gBVHNbBins) ? gBVHNbBins-1 : b;
+            if( b<=bestSplit )
+            {
+               ++i;
+            }
+            else
+            {
+               std::swap( m_indices[i], m_indices[j] );
+               --j;
+            }
+         }
+         middle = i;
+      }
+   }
+   else
+   {
+      // All centroids are at the same position
+      if( count <= gBVHMaxLeafSize ) return index;
+   }
+
+   // Falls back to a median split when binning could not separate the items
+   if( middle == begin || middle == end )
+   {
+      middle = begin+count/2;
+      std::nth_element(
+         m_indices.begin()+begin, m_indices.begin()+middle, m_indices.begin()+end,
+         CentroidComparator( m_centroids, axis ));
+   }
+
+   cl_int left  = buildNode( index, begin,  middle, depth+1 );
+   cl_int right = buildNode( index, middle, end,    depth+1 );
+
+   m_nodes[index].left         = left;
+   m_nodes[index].right        = right;
+   m_nodes[index].nbPrimitives = 0;
+   return index;
+}
@@ -0,0 +1,97 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include <CL/opencl.h>
+#include <vector>
+
+const int   gBVHStackSize     = 64;  // Must match the traversal stack size in Kernel.cl
+const int   gBVHSortGroupSize = 256; // Must match the work-group size of the sort in Kernel.cl
+const int   gBVHSortChunk     = 4;   // Keys sorted by each work-item, must match Kernel.cl
+const int   gBVHRadixSize     = 16;  // Must match the digits of the sort in Kernel.cl
+const int   gBVHRadixPasses   = 8;
+const int   gBVHMaxLeafSize   = 4;
+const int   gBVHNbBins        = 12;
+const float gBVHTraversalCost = 1.f; // Cost of visiting a node relatively to testing a primitive
+const float gBVHRebuildRatio  = 1.5f; // Refitted trees are rebuilt once their cost grew by that much
+
+/*
+* Node of the hierarchy, as seen by the kernel. Nodes are stored in a flat
+* array, the root being the first element.
+*/
+struct BoundingVolume
+{
+   cl_float4 min;
+   cl_float4 max;
+   cl_int    left;         // Interior: left child, Leaf: first entry in the index array
+   cl_int    right;        // Interior: right child
+   cl_int    nbPrimitives; // 0 for interior nodes
+   cl_int    parent;       // -1 for the root
+};
+
+struct BoundingBox
+{
+   cl_float4 min;
+   cl_float4 max;
+};
+
+/*
+* Host side builder. Works on a list of bounding boxes so that it does not
+* depend on the kind of object it is built over.
+*/
+class BoundingVolumeHierarchy
+{
+public:
+   BoundingVolumeHierarchy();
+
+public:
+   void build( const std::vector<BoundingBox>& boxes );
+   void refit( cl_int item, const BoundingBox& box, std::vector<cl_int>& refittedNodes );
+   bool isDegraded() const;
+   void clear();
+
+public:
+   const BoundingVolume* getNodes()     const { return m_nodes.empty() ? 0 : &m_nodes[0]; };
+   const cl_int*         getIndices()   const { return m_indices.empty() ? 0 : &m_indices[0]; };
+   cl_int                getNbNodes()   const { return static_cast<cl_int>(m_nodes.size()); };
+   cl_int                getNbIndices() const { return static_cast<cl_int>(m_indices.size()); };
+
+private:
+   cl_int buildNode( cl_int parent, cl_int begin, cl_int end, int depth );
+   void   computeBounds( cl_int begin, cl_int end, BoundingBox& bounds, BoundingBox& centroids );
+   bool   updateNode( cl_int node );
+   float  getNodeCost( cl_int node ) const;
+   float  getCost() const;
+
+private:
+   std::vector<BoundingVolume> m_nodes;
+   std::vector<cl_int>         m_indices;
+   std::vector<BoundingBox>    m_boxes;
+   std::vector<cl_float4>      m_centroids;
+   std::vector<cl_int>         m_leaves;    // Leaf holding each item
+
+   // Surface Area Heuristic, not normalized by the root area
+   float m_weightedArea;
+   float m_buildCost;
+};
@@ -0,0 +1,1276 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <math.h>
+#include <iostream>
+#include <sstream>
+
+#define LOG_INFO( msg ) std::cout << msg << std::endl;
+
+#include "CPUKernel.h"
+#include "CPUKernelAVX.h"
+
+#include <intrin.h>
+#include <emmintrin.h>
+
+// Spheres tested at once with SSE, closestSphereAVX tests 8 of them. Packs are
+// padded for the widest of the two.
+const int gSimdWidth      = 4;
+const int gSpherePackSize = 8;
+typedef __m128 SimdFloat;
+#define simdSet( v )          _mm_set1_ps( v )
+#define simdLoad( p )         _mm_loadu_ps( p )
+#define simdStore( p, v )     _mm_storeu_ps( p, v )
+#define simdAdd( a, b )       _mm_add_ps( a, b )
+#define simdSub( a, b )       _mm_sub_ps( a, b )
+#define simdMul( a, b )       _mm_mul_ps( a, b )
+#define simdMax( a, b )       _mm_max_ps( a, b )
+#define simdSqrt( a )         _mm_sqrt_ps( a )
+#define simdGreater( a, b )   _mm_cmpgt_ps( a, b )
+#define simdAnd( a, b )       _mm_and_ps( a, b )
+#define simdSelect( m, a, b ) _mm_or_ps( _mm_and_ps( m, a ), _mm_andnot_ps( m, b ) )
+#define simdLanes()           _mm_setr_ps( 0.f, 1.f, 2.f, 3.f )
+
+// Must match Kernel.cl
+const float gMaxViewDistance       = 3000.f;
+const int   gNbMaxShadowCollisions = 3;
+const int   NO_TEXTURE             = -1;
+const float EPSILON                = 1.f;
+
+// ________________________________________________________________________________
+static inline Vector makeVector( float x, float y, float z, float w )
+{
+   Vector v = { x, y, z, w };
+   return v;
+}
+
+static inline Vector makeVector( const cl_float4& v )
+{
+   return makeVector( v.s[0], v.s[1], v.s[2], v.s[3] );
+}
+
+static inline Vector operator+( const Vector& a, const Vector& b ) { return makeVector( a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w ); }
+static inline Vector operator-( const Vector& a, const Vector& b ) { return makeVector( a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w ); }
+static inline Vector operator*( const Vector& a, const Vector& b ) { return makeVector( a.x*b.x, a.y*b.y, a.z*b.z, a.w*b.w ); }
+static inline Vector operator*( const Vector& a, float s )         { return makeVector( a.x*s, a.y*s, a.z*s, a.w*s ); }
+static inline Vector operator*( float s, const Vector& a )         { return a*s; }
+static inline Vector operator/( const Vector& a, float s )         { return makeVector( a.x/s, a.y/s, a.z/s, a.w/s ); }
+static inline Vector operator+( const Vector& a, float s )         { return makeVector( a.x+s, a.y+s, a.z+s, a.w+s ); }
+static inline Vector operator-( const Vector& a, float s )         { return makeVector( a.x-s, a.y-s, a.z-s, a.w-s ); }
+
+static inline float dotProduct( const Vector& v1, const Vector& v2 )
+{
+   return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
+}
+
+static inline float vectorLength( const Vector& v )
+{
+   return sqrtf( dotProduct( v, v ) );
+}
+
+static inline void normalizeVector( Vector& v )
+{
+   v = v/vectorLength( v );
+}
+
+static inline bool isTextured( const Material& material )
+{
+   return material.textureId != NO_TEXTURE;
+}
+
+static inline bool isTransparent( const Material& material )
+{
+   return material.transparency != 0.f;
+}
+
+/*
+* vectorRotation
+* Rotation around the X, then the Y axis (center of rotations at the origin)
+*/
+static void vectorRotation( Vector& v, const cl_float4& angles )
+{
+   Vector r = v;
+   r.y = v.y*cosf(angles.s[0]) - v.z*sinf(angles.s[0]);
+   r.z = v.y*sinf(angles.s[0]) + v.z*cosf(angles.s[0]);
+   v = r;
+   r.z = v.z*cosf(angles.s[1]) - v.x*sinf(angles.s[1]);
+   r.x = v.z*sinf(angles.s[1]) + v.x*cosf(angles.s[1]);
+   v = r;
+}
+
+static void vectorRefraction( Vector& refracted, Vector incident, float n1, Vector normal, float n2 )
+{
+   refracted = incident;
+   if( n1!=n2 && n2!=0.f )
+   {
+      float r = n1/n2;
+      float cosI = dotProduct( incident, normal );
+      float cosT2 = 1.f - r*r*(1.f - cosI*cosI);
+      refracted = r*incident + (r*cosI-sqrtf( fabs(cosT2) ))*normal;
+   }
+}
+
+static void makeOpenGLColor( Vector color, BYTE* bitmap, int index )
+{
+   int mdc_index = index*gColorDepth;
+   bitmap[mdc_index  ] = static_cast<BYTE>(((color.x>1.f) ? 1.f : color.x)*255.f); // Red
+   bitmap[mdc_index+1] = static_cast<BYTE>(((color.y>1.f) ? 1.f : color.y)*255.f); // Green
+   bitmap[mdc_index+2] = static_cast<BYTE>(((color.z>1.f) ? 1.f : color.z)*255.f); // Blue
+   bitmap[mdc_index+3] = static_cast<BYTE>(((color.w>1.f) ? 1.f : color.w)*255.f); // Alpha
+}
+
+/*
+* sphereRecordIntersection
+* sphere.w holds the square of the radius. As in Kernel.cl, the normal
+* points to the center of the sphere.
+*/
+static bool sphereRecordIntersection(
+   Vector  sphere,
+   Vector  origin,
+   Vector  ray,
+   Vector& intersection,
+   Vector& normal,
+   bool&   back )
+{
+   Vector O_C = origin-sphere;
+   Vector dir = ray;
+   normalizeVector( dir );
+
+   float a = 2.f*dotProduct(dir,dir);
+   float b = 2.f*dotProduct(O_C,dir);
+   float c = dotProduct(O_C,O_C) - sphere.w;
+   float d = b*b-2.f*a*c;
+
+   if( d<=0.f || a == 0.f ) return false;
+   float r = sqrtf(d);
+   float t1 = (-b-r)/a;
+   float t2 = (-b+r)/a;
+
+   if( t1<=EPSILON && t2<=EPSILON ) return false; // Both intersections are behind the ray origin
+   back = (t1<=EPSILON || t2<=EPSILON); // Inside the sphere
+
+   float t = (t1<=EPSILON) ? t2 : (t2<=EPSILON) ? t1 : (t1<t2) ? t1 : t2;
+   if( t<EPSILON ) return false;
+   intersection = origin+t*dir;
+
+   normal = intersection-sphere;
+   normal.w = 0.f;
+   normal = normal*-1.f;
+   normalizeVector( normal );
+   return true;
+}
+
+static bool lampIntersection(
+   const Lamp& lamp,
+   Vector      origin,
+   Vector      ray,
+   Vector      O_C,
+   Vector&     intersection )
+{
+   float si_A = 2.f*(ray.x*ray.x + ray.y*ray.y + ray.z*ray.z);
+   if( si_A == 0.f ) return false;
+
+   float si_B = 2.f*(O_C.x*ray.x + O_C.y*ray.y + O_C.z*ray.z);
+   float si_C = O_C.x*O_C.x+O_C.y*O_C.y+O_C.z*O_C.z-lamp.center.s[3]*lamp.center.s[3];
+   float si_radius = si_B*si_B-2.f*si_A*si_C;
+   float si_t1 = (-si_B-sqrtf(si_radius))/si_A;
+
+   if( si_t1>0.f )
+   {
+      intersection = origin+si_t1*ray;
+      return true;
+   }
+   return false;
+}
+
+/*
+* supportsAVX
+* The processor has to support AVX and the system to save its registers
+*/
+static bool supportsAVX()
+{
+   int info[4];
+   __cpuid( info, 1 );
+   bool avx     = (info[2] & (1<<28)) != 0;
+   bool osxsave = (info[2] & (1<<27)) != 0;
+   return avx && osxsave && (_xgetbv( 0 ) & 6) == 6;
+}
+
+/*
+* CPUKernel constructor
+*/
+CPUKernel::CPUKernel( int nbThreads )
+ : m_nbThreads(nbThreads), m_stopping(false), m_tileSize(gDefaultTileSize), m_nbTilesX(0),
+   m_width(0), m_height(0), m_bitmap(0), m_timer(0.f), m_transparentColor(0.f), m_avx(supportsAVX())
+{
+   if( m_nbThreads<=0 )
+   {
+      SYSTEM_INFO info;
+      GetSystemInfo( &info );
+      m_nbThreads = info.dwNumberOfProcessors;
+   }
+
+   // Threads live as long as the renderer, they wait for the frames on their 
+   // start event
+   m_threads.resize( m_nbThreads );
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      m_threads[i].owner  = this;
+      m_threads[i].index  = i;
+      m_threads[i].start  = CreateEvent( NULL, FALSE, FALSE, NULL );
+      m_threads[i].done   = CreateEvent( NULL, FALSE, FALSE, NULL );
+      InitializeCriticalSection( &m_threads[i].lock );
+   }
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      m_threads[i].thread = CreateThread( NULL, 0, renderThread, &m_threads[i], 0, NULL );
+   }
+   resetThreadStatistics();
+
+   std::stringstream s;
+   s << "Native renderer: " << m_nbThreads << " threads, " << (m_avx ? 8 : 4) << " spheres per SIMD test\n";
+   LOG_INFO( s.str() );
+}
+
+CPUKernel::~CPUKernel()
+{
+   m_stopping = true;
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      if( m_threads[i].thread ) SetEvent( m_threads[i].start );
+   }
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      if( m_threads[i].thread )
+      {
+         WaitForSingleObject( m_threads[i].thread, INFINITE );
+         CloseHandle( m_threads[i].thread );
+      }
+      CloseHandle( m_threads[i].start );
+      CloseHandle( m_threads[i].done );
+      DeleteCriticalSection( &m_threads[i].lock );
+   }
+}
+
+void CPUKernel::initializeDevice(
+   int        width,
+   int        height,
+   int        nbPrimitives,
+   int        nbLamps,
+   int        nbMaterials,
+   int        nbTextures,
+   BYTE*      bitmap)
+{
+   // Nothing but the host copies of the scene
+   allocateScene( nbPrimitives, nbLamps, nbMaterials, nbTextures );
+}
+
+/*
+* render
+* Each thread is dealt a contiguous run of tiles, so that neighbouring
+* pixels share the caches. Runs do not cost the same, threads done with
+* their own steal the tiles left at the end of the others.
+*/
+void CPUKernel::render(
+   int   width,
+   int   height,
+   BYTE* bitmap,
+   float timer,
+   float transparentColor)
+{
+   if( bitmap == 0 ) return;
+
+   // Spheres are packed again whenever a primitive changes, other edits are
+   // read from the scene directly
+   if( !m_dirtyPrimitives.empty() ) buildSpherePacks();
+   m_dirtyPrimitives.clear();
+   m_dirtyLamps.clear();
+   m_dirtyMaterials.clear();
+   m_featuresDirty = false;
+
+   m_width            = width;
+   m_height           = height;
+   m_bitmap           = bitmap;
+   m_timer            = timer;
+   m_transparentColor = transparentColor;
+
+   m_nbTilesX = (width+m_tileSize-1)/m_tileSize;
+   int nbTiles = m_nbTilesX*((height+m_tileSize-1)/m_tileSize);
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      RenderThread& thread = m_threads[i];
+      thread.tiles.clear();
+      for( int tile(i*nbTiles/m_nbThreads); tile<(i+1)*nbTiles/m_nbThreads; ++tile )
+      {
+         thread.tiles.push_back( tile );
+      }
+      thread.frameBusy = 0.0;
+   }
+
+   LARGE_INTEGER frequency, start, end;
+   QueryPerformanceFrequency( &frequency );
+   QueryPerformanceCounter( &start );
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      if( m_threads[i].thread ) SetEvent( m_threads[i].start );
+   }
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      // Threads that could not be created leave their tiles to the caller
+      if( m_threads[i].thread ) 
+      {
+         WaitForSingleObject( m_threads[i].done, INFINITE );
+      }
+      else
+      {
+         renderTiles( m_threads[i] );
+      }
+   }
+   QueryPerformanceCounter( &end );
+
+   // Threads are idle for the part of the frame they did not trace
+   double frame = static_cast<double>(end.QuadPart-start.QuadPart)/frequency.QuadPart;
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      ThreadStatistics& statistics = m_threads[i].statistics;
+      statistics.busy += m_threads[i].frameBusy;
+      statistics.idle += (frame>m_threads[i].frameBusy) ? frame-m_threads[i].frameBusy : 0.0;
+   }
+}
+
+// ---------- Instances ----------
+long CPUKernel::addGeometry()
+{
+   return -1;
+}
+
+long CPUKernel::addGeometryPrimitive(
+   int geometry,
+   int type )
+{
+   return -1;
+}
+
+void CPUKernel::setGeometryPrimitive(
+   int   geometry,
+   int   index,
+   float x,
+   float y,
+   float z,
+   float width,
+   float height,
+   int   materialId,
+   int   materialPadding )
+{
+}
+
+long CPUKernel::addInstance( int geometry )
+{
+   return -1;
+}
+
+void CPUKernel::setInstance(
+   int   index,
+   float x,
+   float y,
+   float z,
+   float scale,
+   int   materialId )
+{
+}
+
+DWORD WINAPI CPUKernel::renderThread( LPVOID parameter )
+{
+   RenderThread* thread = static_cast<RenderThread*>(parameter);
+   CPUKernel*    owner  = thread->owner;
+   while( true )
+   {
+      WaitForSingleObject( thread->start, INFINITE );
+      if( owner->m_stopping ) break;
+      owner->renderTiles( *thread );
+      SetEvent( thread->done );
+   }
+   return 0;
+}
+
+/*
+* renderTiles
+* No tile is added during a frame, the thread is done once its deque and
+* the deques of the others are empty.
+*/
+void CPUKernel::renderTiles( RenderThread& thread )
+{
+   LARGE_INTEGER frequency, start, end;
+   QueryPerformanceFrequency( &frequency );
+
+   int tile;
+   bool stolen(false);
+   while( true )
+   {
+      if( !popTile( thread, tile ) )
+      {
+         if( !stealTile( thread, tile ) ) break;
+         stolen = true;
+      }
+
+      QueryPerformanceCounter( &start );
+      renderTile( tile );
+      QueryPerformanceCounter( &end );
+
+      thread.frameBusy += static_cast<double>(end.QuadPart-start.QuadPart)/frequency.QuadPart;
+      thread.statistics.tiles++;
+      if( stolen ) thread.statistics.stolenTiles++;
+      stolen = false;
+   }
+}
+
+bool CPUKernel::popTile( RenderThread& thread, int& tile )
+{
+   bool result(false);
+   EnterCriticalSection( &thread.lock );
+   if( !thread.tiles.empty() )
+   {
+      tile = thread.tiles.front();
+      thread.tiles.pop_front();
+      result = true;
+   }
+   LeaveCriticalSection( &thread.lock );
+   return result;
+}
+
+/*
+* stealTile
+* Takes the last tile of the first thread found with some left, the one
+* its owner would have traced last
+*/
+bool CPUKernel::stealTile( RenderThread& thread, int& tile )
+{
+   for( int i(1); i<m_nbThreads; ++i )
+   {
+      RenderThread& victim = m_threads[(thread.index+i)%m_nbThreads];
+      bool result(false);
+      EnterCriticalSection( &victim.lock );
+      if( !victim.tiles.empty() )
+      {
+         tile = victim.tiles.back();
+         victim.tiles.pop_back();
+         result = true;
+      }
+      LeaveCriticalSection( &victim.lock );
+      if( result ) return true;
+   }
+   return false;
+}
+
+void CPUKernel::renderTile( int tile )
+{
+   int x0 = (tile%m_nbTilesX)*m_tileSize;
+   int y0 = (tile/m_nbTilesX)*m_tileSize;
+   for( int y(y0); y<y0+m_tileSize && y<m_height; ++y )
+   {
+      for( int x(x0); x<x0+m_tileSize && x<m_width; ++x )
+      {
+         renderPixel( x, y );
+      }
+   }
+}
+
+void CPUKernel::setTileSize( int size )
+{
+   m_tileSize = (size<1) ? 1 : size;
+}
+
+ThreadStatistics CPUKernel::getThreadStatistics( int thread )
+{
+   ThreadStatistics statistics = { 0.0, 0.0, 0, 0 };
+   if( thread>=0 && thread<m_nbThreads ) statistics = m_threads[thread].statistics;
+   return statistics;
+}
+
+void CPUKernel::resetThreadStatistics()
+{
+   ThreadStatistics statistics = { 0.0, 0.0, 0, 0 };
+   for( int i(0); i<m_nbThreads; ++i )
+   {
+      m_threads[i].statistics = statistics;
+   }
+}
+
+/*
+* renderPixel
+* Same ray as renderPixel in Kernel.cl
+*/
+void CPUKernel::renderPixel( int x, int y )
+{
+   Vector origin = makeVector( m_viewPos );
+   Vector target = makeVector( m_viewDir );
+   target.x += static_cast<float>(x - (m_width/2));
+   target.y += static_cast<float>(y - (m_height/2));
+
+   vectorRotation( origin, m_angles );
+   vectorRotation( target, m_angles );
+
+   Vector intersection;
+   Vector color = launchRay( origin, target, intersection );
+   color.w = gMaxViewDistance/intersection.z;
+   makeOpenGLColor( color, m_bitmap, y*m_width+x );
+}
+
+/*
+* buildSpherePacks
+* Spheres go to the packs tested with SIMD instructions, the other
+* primitives to the list tested one by one.
+*/
+void CPUKernel::buildSpherePacks()
+{
+   m_sphereX.clear();
+   m_sphereY.clear();
+   m_sphereZ.clear();
+   m_sphereRadius2.clear();
+   m_sphereIndex.clear();
+   m_shapes.clear();
+
+   for( int i(0); i<m_nbActivePrimitives; ++i )
+   {
+      const Primitive& primitive = m_primitives[i];
+      if( primitive.type == ptSphere )
+      {
+         m_sphereX.push_back( primitive.center.s[0] );
+         m_sphereY.push_back( primitive.center.s[1] );
+         m_sphereZ.push_back( primitive.center.s[2] );
+         m_sphereRadius2.push_back( primitive.size.s[0]*primitive.size.s[0] );
+         m_sphereIndex.push_back( i );
+      }
+      else if( primitive.type != ptTriangle )
+      {
+         m_shapes.push_back( i );
+      }
+   }
+
+   // A negative square radius keeps rays away from the padding
+   while( m_sphereX.size()%gSpherePackSize != 0 )
+   {
+      m_sphereX.push_back( 0.f );
+      m_sphereY.push_back( 0.f );
+      m_sphereZ.push_back( 0.f );
+      m_sphereRadius2.push_back( -1.f );
+      m_sphereIndex.push_back( -1 );
+   }
+}
+
+/*
+* closestSphere
+* Tests the spheres gSimdWidth at a time, or 8 at a time when the processor
+* supports AVX, dir being normalized. Returns the index of the closest 
+* sphere nearer than minDistance, -1 if none.
+*/
+int CPUKernel::closestSphere(
+   Vector origin,
+   Vector dir,
+   float& minDistance )
+{
+   if( m_sphereX.empty() ) return -1;
+
+   if( m_avx )
+   {
+      return closestSphereAVX( 
+         &m_sphereX[0], &m_sphereY[0], &m_sphereZ[0], &m_sphereRadius2[0], static_cast<int>(m_sphereX.size()),
+         &origin.x, &dir.x, EPSILON, minDistance );
+   }
+
+   SimdFloat ox = simdSet( origin.x );
+   SimdFloat oy = simdSet( origin.y );
+   SimdFloat oz = simdSet( origin.z );
+   SimdFloat dx = simdSet( dir.x );
+   SimdFloat dy = simdSet( dir.y );
+   SimdFloat dz = simdSet( dir.z );
+   SimdFloat zero    = simdSet( 0.f );
+   SimdFloat epsilon = simdSet( EPSILON );
+   SimdFloat step    = simdSet( static_cast<float>(gSimdWidth) );
+   SimdFloat lanes   = simdLanes();
+   SimdFloat closest      = simdSet( minDistance );
+   SimdFloat closestIndex = simdSet( -1.f );
+
+   for( size_t i(0); i<m_sphereX.size(); i += gSimdWidth )
+   {
+      SimdFloat ocx = simdSub( ox, simdLoad( &m_sphereX[i] ) );
+      SimdFloat ocy = simdSub( oy, simdLoad( &m_sphereY[i] ) );
+      SimdFloat ocz = simdSub( oz, simdLoad( &m_sphereZ[i] ) );
+      SimdFloat b = simdAdd( simdAdd( simdMul( ocx, dx ), simdMul( ocy, dy ) ), simdMul( ocz, dz ) );
+      SimdFloat c = simdSub(
+         simdAdd( simdAdd( simdMul( ocx, ocx ), simdMul( ocy, ocy ) ), simdMul( ocz, ocz ) ),
+         simdLoad( &m_sphereRadius2[i] ) );
+      SimdFloat d = simdSub( simdMul( b, b ), c );
+      SimdFloat r = simdSqrt( simdMax( d, zero ) );
+
+      // Nearest intersection in front of the origin
+      SimdFloat t1 = simdSub( simdSub( zero, b ), r );
+      SimdFloat t2 = simdAdd( simdSub( zero, b ), r );
+      SimdFloat t  = simdSelect( simdGreater( t1, epsilon ), t1, t2 );
+
+      SimdFloat hit = simdAnd( simdAnd( simdGreater( d, zero ), simdGreater( t, epsilon ) ), simdGreater( closest, t ) );
+      closest      = simdSelect( hit, t, closest );
+      closestIndex = simdSelect( hit, lanes, closestIndex );
+      lanes = simdAdd( lanes, step );
+   }
+
+   float distances[gSimdWidth];
+   float indices[gSimdWidth];
+   simdStore( distances, closest );
+   simdStore( indices, closestIndex );
+
+   int result(-1);
+   for( int i(0); i<gSimdWidth; ++i )
+   {
+      if( indices[i]>=0.f && distances[i]<minDistance )
+      {
+         minDistance = distances[i];
+         result = static_cast<int>(indices[i]);
+      }
+   }
+   return result;
+}
+
+/*
+* intersectionWithPrimitives
+* Closest intersection along the ray, as the linear walk of Kernel.cl
+*/
+bool CPUKernel::intersectionWithPrimitives(
+   Vector     origin,
+   Vector     target,
+   Primitive& closestObject,
+   Vector&    closestIntersection,
+   Vector&    closestNormal,
+   bool&      back )
+{
+   bool   intersections = false;
+   float  minDistance   = gMaxViewDistance;
+   Vector ray = target-origin;
+   Vector dir = ray;
+   normalizeVector( dir );
+
+   int sphere = closestSphere( origin, dir, minDistance );
+   if( sphere != -1 )
+   {
+      Vector center = makeVector( m_sphereX[sphere], m_sphereY[sphere], m_sphereZ[sphere], m_sphereRadius2[sphere] );
+      intersections = sphereRecordIntersection( center, origin, ray, closestIntersection, closestNormal, back );
+      if( intersections ) closestObject = m_primitives[m_sphereIndex[sphere]];
+   }
+
+   for( size_t i(0); i<m_shapes.size(); ++i )
+   {
+      const Primitive& primitive = m_primitives[m_shapes[i]];
+      Vector intersection = makeVector( 0.f, 0.f, 0.f, 0.f );
+      Vector normal       = makeVector( 0.f, 0.f, 0.f, 0.f );
+      float  shadowIntensity;
+      bool   hit = (primitive.type == ptCylinder) ?
+         cylinderIntersection( primitive, origin, ray, intersection, normal, false ) :
+         planeIntersection( primitive, origin, ray, false, shadowIntensity, intersection, normal );
+
+      if( hit )
+      {
+         float distance = vectorLength( origin-intersection );
+         if( distance>0.01f && distance<minDistance )
+         {
+            minDistance         = distance;
+            closestObject       = primitive;
+            closestIntersection = intersection;
+            closestNormal       = normal;
+            intersections       = true;
+         }
+      }
+   }
+   return intersections;
+}
+
+bool CPUKernel::intersectionWithLamps(
+   Vector  origin,
+   Vector  target,
+   Vector& lampColor )
+{
+   bool intersections = false;
+   for( int cptLamps(0); cptLamps<m_nbActiveLamps && !intersections; ++cptLamps )
+   {
+      const Lamp& lamp = m_lamps[cptLamps];
+      Vector center = makeVector( lamp.center );
+      Vector O_C = origin-center;
+      Vector ray = target-origin;
+      Vector intersection;
+      intersections = lampIntersection( lamp, origin, ray, O_C, intersection );
+      if( intersections )
+      {
+         Vector I_C = intersection-center;
+         normalizeVector( O_C );
+         normalizeVector( I_C );
+         float d = dotProduct( O_C, I_C )*lamp.color.s[3];
+         d = (d<0.f) ? 0.f : d;
+         lampColor = makeVector( lamp.color )*d;
+      }
+   }
+   return intersections;
+}
+
+bool CPUKernel::cylinderIntersection(
+   const Primitive& cylinder,
+   Vector           origin,
+   Vector           ray,
+   Vector&          intersection,
+   Vector&          normal,
+   bool             computingShadows )
+{
+   const Material& material = m_materials[cylinder.materialId];
+   Vector center = makeVector( cylinder.center );
+   float  radius = cylinder.size.s[0];
+   float  height = cylinder.size.s[1];
+   bool   result = false;
+
+   // Top
+   if( ray.y<0.f && origin.y>(center.y+height) )
+   {
+      float y = origin.y-center.y-height;
+      intersection = makeVector( origin.x+y*ray.x/-ray.y, center.y+height, origin.z+y*ray.z/-ray.y, 1.f );
+      Vector v = intersection-center;
+      v.y = 0.f;
+      result = (vectorLength(v)<radius);
+      normal = makeVector( 0.f, 1.f, 0.f, normal.w );
+   }
+
+   // Bottom
+   if( !result && ray.y>0.f && origin.y<(center.y-height) )
+   {
+      float y = origin.y-center.y+height;
+      intersection = makeVector( origin.x+y*ray.x/-ray.y, center.y-height, origin.z+y*ray.z/-ray.y, -1.f );
+      Vector v = intersection-center;
+      v.y = 0.f;
+      result = (vectorLength(v)<radius);
+      normal = makeVector( 0.f, -1.f, 0.f, normal.w );
+   }
+
+   if( !result )
+   {
+      Vector O_C = origin-center;
+      O_C.y = 0.f;
+      if( dotProduct( O_C, ray )>0.f && vectorLength(O_C)>center.w ) return false;
+
+      float a = 2.f*( ray.x*ray.x + ray.z*ray.z );
+      float b = 2.f*((origin.x-center.x)*ray.x + (origin.z-center.z)*ray.z);
+      float c = O_C.x*O_C.x + O_C.z*O_C.z - center.w*center.w;
+      float r = sqrtf(b*b-2.f*a*c);
+      if( r<0.f ) return false;
+
+      a = ( a==0.f ) ? 0.0001f : a;
+      float t1 = (-b-r)/a;
+      float t2 = (-b+r)/a;
+      float ta = (t1<t2) ? t1 : t2;
+      float tb = (t2<t1) ? t1 : t2;
+
+      if( ta>0.001f )
+      {
+         intersection = origin+ta*ray;
+         intersection.w = 0.f;
+         result = ( fabs(intersection.y-center.y)<=height );
+         if( result && isTransparent(material) )
+         {
+            Vector color = objectColorAtIntersection( cylinder, intersection );
+            result = ( (color.x+color.y+color.z)>=m_transparentColor );
+         }
+      }
+
+      if( !result && tb>0.001f )
+      {
+         intersection = origin+tb*ray;
+         intersection.w = 0.f;
+         result = ( fabs(intersection.y-center.y)<=height );
+         if( result && isTransparent(material) )
+         {
+            Vector color = objectColorAtIntersection( cylinder, intersection );
+            result = ( (color.x+color.y+color.z)>=m_transparentColor );
+         }
+      }
+
+      if( result )
+      {
+         normal = intersection-center;
+         normal.y = 0.f;
+      }
+   }
+
+   // Normal to surface
+   if( result && !computingShadows )
+   {
+      if( material.textured )
+      {
+         Vector newCenter = center;
+         newCenter.x = center.x + 5.f*cosf(m_timer*0.58f+intersection.x);
+         newCenter.y = center.y + 5.f*sinf(m_timer*0.85f+intersection.y) + intersection.y;
+         newCenter.z = center.z + 5.f*sinf(cosf(m_timer*1.24f+intersection.z));
+         normal = intersection-newCenter;
+      }
+      normalizeVector( normal );
+   }
+   return result;
+}
+
+bool CPUKernel::planeIntersection(
+   const Primitive& primitive,
+   Vector           origin,
+   Vector           ray,
+   bool             reverse,
+   float&           shadowIntensity,
+   Vector&          intersection,
+   Vector&          normal )
+{
+   Vector center   = makeVector( primitive.center );
+   float  width    = primitive.size.s[0];
+   float  height   = primitive.size.s[1];
+   float  reverted = reverse ? -1.f : 1.f;
+   bool   collision = false;
+   switch( primitive.type )
+   {
+   case ptCheckboard:
+      {
+         intersection.y = center.y;
+         float y = origin.y-center.y;
+         if( reverted*ray.y<0.f && reverted*origin.y>reverted*center.y )
+         {
+            intersection.x = origin.x+y*ray.x/-ray.y;
+            intersection.z = origin.z+y*ray.z/-ray.y;
+            collision = fabs(intersection.x-center.x)<width && fabs(intersection.z-center.z)<height;
+            normal = makeVector( 0.f, 1.f, 0.f, normal.w );
+         }
+         break;
+      }
+   case ptXZPlane:
+      {
+         float y = origin.y-center.y;
+         if( reverted*ray.y<0.f && reverted*origin.y>reverted*center.y )
+         {
+            normal = makeVector( 0.f, 1.f, 0.f, normal.w );
+            intersection.y = center.y;
+            intersection.x = origin.x+y*ray.x/-ray.y;
+            intersection.z = origin.z+y*ray.z/-ray.y;
+            collision = fabs(intersection.x-center.x)<width && fabs(intersection.z-center.z)<height;
+         }
+         if( !collision && reverted*ray.y>0.f && reverted*origin.y<reverted*center.y )
+         {
+            intersection.x = origin.x+y*ray.x/-ray.y;
+            intersection.z = origin.z+y*ray.z/-ray.y;
+            collision = fabs(intersection.x-center.x)<width && fabs(intersection.z-center.z)<height;
+            normal = makeVector( 0.f, -1.f, 0.f, normal.w );
+         }
+         break;
+      }
+   case ptYZPlane:
+      {
+         float x = origin.x-center.x;
+         if( reverted*ray.x<0.f && reverted*origin.x>reverted*center.x )
+         {
+            intersection.x = center.x;
+            intersection.y = origin.y+x*ray.y/-ray.x;
+            intersection.z = origin.z+x*ray.z/-ray.x;
+            collision = fabs(intersection.y-center.y)<height && fabs(intersection.z-center.z)<width;
+            normal = makeVector( 1.f, 0.f, 0.f, normal.w );
+         }
+         if( !collision && reverted*ray.x>0.f && reverted*origin.x<reverted*center.x )
+         {
+            intersection.x = center.x;
+            intersection.y = origin.y+x*ray.y/-ray.x;
+            intersection.z = origin.z+x*ray.z/-ray.x;
+            collision = fabs(intersection.y-center.y)<height && fabs(intersection.z-center.z)<width;
+            normal = makeVector( -1.f, 0.f, 0.f, normal.w );
+         }
+         break;
+      }
+   case ptXYPlane:
+   case ptCamera:
+      {
+         float z = origin.z-center.z;
+         if( primitive.type == ptXYPlane && reverted*ray.z<0.f && reverted*origin.z>reverted*center.z )
+         {
+            intersection.z = center.z;
+            intersection.x = origin.x+z*ray.x/-ray.z;
+            intersection.y = origin.y+z*ray.y/-ray.z;
+            collision = fabs(intersection.x-center.x)<width && fabs(intersection.y-center.y)<height;
+            normal = makeVector( 0.f, 0.f, 1.f, normal.w );
+         }
+         if( !collision && reverted*ray.z>0.f && reverted*origin.z<reverted*center.z )
+         {
+            intersection.z = center.z;
+            intersection.x = origin.x+z*ray.x/-ray.z;
+            intersection.y = origin.y+z*ray.y/-ray.z;
+            collision = fabs(intersection.x-center.x)<width && fabs(intersection.y-center.y)<height;
+            normal = makeVector( 0.f, 0.f, -1.f, normal.w );
+         }
+         break;
+      }
+   }
+
+   if( collision )
+   {
+      const Material& material = m_materials[primitive.materialId];
+      if( isTransparent(material) && isTextured(material) )
+      {
+         Vector color = objectColorAtIntersection( primitive, intersection );
+         shadowIntensity = (color.x+color.y+color.z)/3.f;
+         collision = ( shadowIntensity>=m_transparentColor );
+      }
+      else
+      {
+         shadowIntensity = 1.f;
+      }
+   }
+   return collision;
+}
+
+/*
+* shadow
+* Shade of the primitives between the origin and the lamp, as in Kernel.cl
+*/
+float CPUKernel::shadow(
+   Vector lampCenter,
+   Vector origin )
+{
+   float  result = 0.f;
+   Vector O_L = lampCenter-origin;
+   int    collision = 0;
+   for( int cptPrimitives(0); result<1.f && collision<gNbMaxShadowCollisions && cptPrimitives<m_nbActivePrimitives; ++cptPrimitives )
+   {
+      const Primitive& primitive = m_primitives[cptPrimitives];
+      Vector intersection = makeVector( 0.f, 0.f, 0.f, 0.f );
+      Vector normal       = makeVector( 0.f, 0.f, 0.f, 0.f );
+      float  shadowIntensity = 0.f; // Spheres only shade through the collision count
+      bool   hit = false;
+      bool   back;
+
+      switch( primitive.type )
+      {
+      case ptSphere:
+         {
+            Vector center = makeVector( primitive.center );
+            center.w = primitive.size.s[0]*primitive.size.s[0];
+            hit = sphereRecordIntersection( center, origin, O_L, intersection, normal, back );
+            break;
+         }
+      case ptCylinder:
+         hit = cylinderIntersection( primitive, origin, O_L, intersection, normal, true );
+         shadowIntensity = 1.f;
+         break;
+      case ptTriangle:
+         break;
+      default:
+         hit = planeIntersection( primitive, origin, O_L, true, shadowIntensity, intersection, normal ) &&
+               vectorLength(intersection-origin)<vectorLength(O_L);
+         break;
+      }
+
+      if( hit )
+      {
+         collision++;
+         if( collision == gNbMaxShadowCollisions )
+         {
+            result = 1.f;
+         }
+         else
+         {
+            const Material& material = m_materials[primitive.materialId];
+            shadowIntensity *= isTransparent(material) ? 1.f-material.transparency : 1.f;
+            if( primitive.type == ptSphere || primitive.type == ptCylinder )
+            {
+               // Shadow exists only if object is between origin and lamp
+               shadowIntensity = (vectorLength(intersection-origin)<vectorLength(O_L)) ? shadowIntensity : 0.f;
+            }
+            result += shadowIntensity;
+         }
+      }
+   }
+   return (result>1.f) ? 1.f : result;
+}
+
+/*
+* colorFromObject
+* Color of the intersection lighted by the lamps that are not in the shades,
+* w holding the total intensity
+*/
+Vector CPUKernel::colorFromObject(
+   Vector           origin,
+   Vector           normal,
+   const Primitive& primitive,
+   Vector           intersection,
+   Vector&          refractionFromColor,
+   float&           totalBlinn )
+{
+   const Material& material = m_materials[primitive.materialId];
+   Vector lampsColor = makeVector( 0.f, 0.f, 0.f, 0.f );
+   float  totalIntensity = 0.f;
+   totalBlinn = 0.f;
+
+   for( int cptLamps(0); cptLamps<m_nbActiveLamps; ++cptLamps )
+   {
+      const Lamp& lamp = m_lamps[cptLamps];
+      Vector center = makeVector( lamp.center );
+      float shadowIntensity = m_shadows ? shadow( center, intersection ) : 0.f;
+
+      // Lighted object, not in the shades
+      if( shadowIntensity != 1.f )
+      {
+         Vector lightRay = center-intersection;
+         lampsColor = lampsColor+makeVector( lamp.color );
+
+         // Lambert
+         normalizeVector( lightRay );
+         float lambert = dotProduct( lightRay, normal );
+         lambert = (lambert<0.f) ? 0.f : lambert;
+         lambert *= (material.refraction == 0.f) ? lamp.color.s[3] : 1.f;
+         lambert *= (1.f-shadowIntensity);
+         totalIntensity += lambert;
+
+         // Blinn - Phong
+         Vector viewRay = intersection-origin;
+         normalizeVector( viewRay );
+         Vector blinnDir = lightRay-viewRay;
+         float temp = sqrtf( dotProduct( blinnDir, blinnDir ) );
+         if( temp != 0.f )
+         {
+            blinnDir = (1.f/temp)*blinnDir;
+            float blinnTerm = dotProduct( blinnDir, normal );
+            blinnTerm = (blinnTerm<0.f) ? 0.f : blinnTerm;
+            blinnTerm = material.specular.s[0]*powf( blinnTerm, material.specular.s[1] )*material.specular.s[3];
+            totalBlinn += lamp.color.s[3]*blinnTerm;
+         }
+      }
+   }
+   lampsColor.w = totalIntensity;
+   totalBlinn = (totalBlinn>1.f) ? 1.f : totalBlinn;
+
+   Vector intersectionColor = objectColorAtIntersection( primitive, intersection );
+   Vector color = intersectionColor*lampsColor;
+   color.w = lampsColor.w;
+   refractionFromColor = intersectionColor;
+   return color;
+}
+
+Vector CPUKernel::textureMapping(
+   const Primitive& primitive,
+   const Material&  material,
+   int              x,
+   int              y )
+{
+   Vector result = makeVector( material.color );
+   x = x % gTextureWidth;
+   y = y % gTextureHeight;
+   if( x>=0 && x<gTextureWidth && y>=0 && y<gTextureHeight )
+   {
+      const BYTE* texel = m_textures+(material.textureId*gTextureWidth*gTextureHeight + y*gTextureWidth+x)*gTextureDepth;
+      result.x = texel[0]/256.f;
+      result.y = texel[1]/256.f;
+      result.z = texel[2]/256.f;
+   }
+   return result;
+}
+
+/*
+* objectColorAtIntersection
+* Sphere and cube mappings of Kernel.cl, camera planes have no video
+*/
+Vector CPUKernel::objectColorAtIntersection(
+   const Primitive& primitive,
+   Vector           intersection )
+{
+   const Material& material = m_materials[primitive.materialId];
+   Vector color = makeVector( material.color );
+   float  ratioX = primitive.materialRatioX;
+   float  ratioY = primitive.materialRatioY;
+   Vector offset = intersection-makeVector( primitive.center );
+   switch( primitive.type )
+   {
+   case ptSphere:
+   case ptCylinder:
+      if( isTextured(material) && intersection.w == 0.f )
+      {
+         color = textureMapping( primitive, material,
+            static_cast<int>((offset.x+primitive.size.s[0])*ratioX),
+            static_cast<int>((offset.y+primitive.size.s[1])*ratioY) );
+      }
+      break;
+   case ptCheckboard:
+      if( isTextured(material) )
+      {
+         color = textureMapping( primitive, material,
+            static_cast<int>((offset.x+primitive.size.s[0])*ratioX),
+            static_cast<int>((offset.z+primitive.size.s[1])*ratioY) );
+      }
+      else
+      {
+         int x = static_cast<int>(gMaxViewDistance + offset.x/50.f);
+         int z = static_cast<int>(gMaxViewDistance + offset.z/50.f);
+         if( (x%2==0) == (z%2==0) )
+         {
+            color.x = 1.f;
+            color.y = 1.f;
+            color.z = 1.f;
+         }
+      }
+      break;
+   case ptXYPlane:
+      if( isTextured(material) )
+      {
+         color = textureMapping( primitive, material,
+            static_cast<int>((offset.x+primitive.size.s[0])*ratioX),
+            static_cast<int>((offset.y+primitive.size.s[1])*ratioY) );
+      }
+      break;
+   case ptYZPlane:
+      if( isTextured(material) )
+      {
+         color = textureMapping( primitive, material,
+            static_cast<int>((offset.z+primitive.size.s[0])*ratioX),
+            static_cast<int>((offset.y+primitive.size.s[1])*ratioY) );
+      }
+      break;
+   case ptXZPlane:
+      if( isTextured(material) )
+      {
+         color = textureMapping( primitive, material,
+            static_cast<int>((offset.x+primitive.size.s[0])*ratioX),
+            static_cast<int>((offset.z+primitive.size.s[1])*ratioY) );
+      }
+      break;
+   }
+   return color;
+}
+
+/*
+* launchRay
+* Port of launchRay in Kernel.cl: the path bounces on reflective and
+* transparent materials until it stops contributing to the pixel, then
+* the colors of the bounces are combined from the last one.
+*/
+Vector CPUKernel::launchRay(
+   Vector  origin,
+   Vector  target,
+   Vector& intersection )
+{
+   Vector    zero = makeVector( 0.f, 0.f, 0.f, 0.f );
+   Vector    intersectionColor   = zero;
+   Vector    closestIntersection = zero;
+   Vector    normal              = zero;
+   Vector    rayOrigin = origin;
+   Vector    rayTarget = target;
+   Vector    reflectedTarget = target;
+   Vector    refractionFromColor;
+   Vector    O_R;
+   Vector    O_E;
+   Primitive closestObject;
+   bool      carryon = true;
+   bool      back = false;
+   float     initialRefraction = 1.f;
+   float     throughput = 1.f;
+   float     blinn = 0.f;
+   int       iteration = 0;
+   Vector    recursiveColor[gNbIterations+1];
+   Vector    recursiveRatio[gNbIterations+1];
+
+   for( int i(0); i<=gNbIterations; ++i )
+   {
+      recursiveColor[i] = zero;
+      recursiveRatio[i] = zero;
+   }
+
+   while( iteration<m_maxIterations && carryon )
+   {
+      // Lamps first, then primitives
+      carryon = !intersectionWithLamps( rayOrigin, rayTarget, intersectionColor );
+      if( carryon )
+      {
+         carryon = intersectionWithPrimitives( rayOrigin, rayTarget, closestObject, closestIntersection, normal, back );
+      }
+
+      if( carryon )
+      {
+         recursiveColor[iteration] = colorFromObject( origin, normal, closestObject, closestIntersection, refractionFromColor, blinn );
+         recursiveRatio[iteration].y = blinn;
+
+         const Material& material = m_materials[closestObject.materialId];
+         if( isTransparent(material) )
+         {
+            // Refraction, textures bend the normal
+            if( isTextured(material) )
+            {
+               normal = normal*(refractionFromColor-0.5f);
+            }
+            O_E = rayOrigin-closestIntersection;
+            normalizeVector( O_E );
+            float refraction = material.refraction;
+            refraction = (refraction == initialRefraction) ? 1.f : refraction;
+            vectorRefraction( O_R, O_E, refraction, normal, initialRefraction );
+            reflectedTarget = closestIntersection-O_R;
+            initialRefraction = refraction;
+
+            recursiveRatio[iteration].x = material.transparency;
+            recursiveRatio[iteration].z = 1.f;
+         }
+         else if( material.color.s[3] != 0.f )
+         {
+            // Reflection
+            O_E = rayOrigin-closestIntersection;
+            O_R = O_E-2.f*dotProduct( O_E, normal )*normal;
+            reflectedTarget = closestIntersection-O_R;
+            recursiveRatio[iteration].x = material.color.s[3];
+         }
+         else
+         {
+            carryon = false;
+         }
+
+         // Weight of the next bounce in the pixel
+         float w = recursiveColor[iteration].w;
+         if( recursiveRatio[iteration].z == 1.f )
+         {
+            w = recursiveColor[iteration].x + w*(1.f-recursiveColor[iteration].x);
+         }
+         throughput *= w*recursiveRatio[iteration].x;
+         if( throughput<m_contributionThreshold ) carryon = false;
+
+         rayOrigin = closestIntersection;
+         rayTarget = reflectedTarget;
+         iteration++;
+      }
+   }
+
+   for( int i(iteration-1); i>=0; --i )
+   {
+      float w = recursiveColor[i].w;
+      if( recursiveRatio[i].z == 1.f )
+      {
+         w = recursiveColor[i].x + w*(1.f-recursiveColor[i].x);
+      }
+      recursiveColor[i] = recursiveColor[i+1]*w*recursiveRatio[i].x + recursiveColor[i]*w*(1.f-recursiveRatio[i].x);
+   }
+   intersectionColor = recursiveColor[0]+recursiveRatio[0].y;
+
+   intersectionColor.x = (intersectionColor.x>1.f) ? 1.f : intersectionColor.x;
+   intersectionColor.y = (intersectionColor.y>1.f) ? 1.f : intersectionColor.y;
+   intersectionColor.z = (intersectionColor.z>1.f) ? 1.f : intersectionColor.z;
+   intersection = closestIntersection;
+   return intersectionColor;
+}
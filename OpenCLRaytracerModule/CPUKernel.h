@@ -0,0 +1,235 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include "SceneRenderer.h"
+#include <vector>
+#include <deque>
+
+const int gNativePlatform = -1; // Platform id of the native renderer
+
+const int gDefaultTileSize = 16; // Pixels on each side of the tiles handed to the threads
+
+// Vector of the native renderer, same layout and semantics as float4 in Kernel.cl
+struct Vector
+{
+   float x, y, z, w;
+};
+
+class CPUKernel;
+
+// Work of a thread since the statistics were last reset
+struct ThreadStatistics
+{
+   double busy;        // Seconds spent tracing tiles
+   double idle;        // Seconds of the frames spent without a tile to trace
+   int    tiles;       // Tiles traced
+   int    stolenTiles; // Tiles taken from the deque of another thread
+};
+
+// Thread of the renderer and its deque of tiles. The owner takes its tiles 
+// from the front, idle threads steal from the back.
+struct RenderThread
+{
+   CPUKernel*       owner;
+   int              index;
+   HANDLE           thread;
+   HANDLE           start;     // Set by render when a frame is ready
+   HANDLE           done;      // Set by the thread once no tile is left
+   CRITICAL_SECTION lock;
+   std::deque<int>  tiles;
+   double           frameBusy; // Seconds spent tracing the current frame
+   ThreadStatistics statistics;
+};
+
+/*
+* Native renderer: the scene traced on the host by a pool of threads, 
+* without any OpenCL device. Rays follow the same paths as
+* in Kernel.cl, spheres being tested several at a time with SSE, or AVX when
+* the processor supports it. Frames are cut into tiles dealt to the threads,
+* threads running out of tiles steal from the others. The threads are 
+* started with the renderer and woken for each frame.
+* Only the synchronous rendering is supported, instances and the Kinect
+* video are ignored.
+*/
+class OPENCLRAYTRACERMODULE_API CPUKernel : public SceneRenderer
+{
+public:
+   // nbThreads 0 starts one thread per processor
+   CPUKernel( int nbThreads );
+   ~CPUKernel();
+
+public:
+   // ---------- Devices ----------
+   void initializeDevice(
+      int        width,
+      int        height,
+      int        nbPrimitives,
+      int        nbLamps,
+      int        nbMaterials,
+      int        nbTextures,
+      BYTE*      bitmap);
+
+public:
+   // ---------- Rendering ----------
+   void render(
+      int   imageW,
+      int   imageH,
+      BYTE* bitmap,
+      float time,
+      float transparentColor );
+
+public:
+   // ---------- Instances ----------
+   // Not supported, geometries and instances are never created
+   long addGeometry();
+   long addGeometryPrimitive(
+      int geometry,
+      int type );
+   void setGeometryPrimitive(
+      int   geometry,
+      int   index,
+      float x,
+      float y,
+      float z,
+      float width,
+      float height,
+      int   materialId,
+      int   materialPadding );
+   long addInstance( int geometry );
+   void setInstance(
+      int   index,
+      float x,
+      float y,
+      float z,
+      float scale,
+      int   materialId );
+
+public:
+   // ---------- Threads ----------
+   void setTileSize( int size );
+   int  getNbThreads() { return m_nbThreads; };
+
+   // Busy and idle times of the threads, all of them should be busy most of
+   // the frame
+   ThreadStatistics getThreadStatistics( int thread );
+   void             resetThreadStatistics();
+
+private:
+   // ---------- Tiles ----------
+   static DWORD WINAPI renderThread( LPVOID parameter );
+   void   renderTiles( RenderThread& thread );
+   bool   popTile( RenderThread& thread, int& tile );
+   bool   stealTile( RenderThread& thread, int& tile );
+   void   renderTile( int tile );
+   void   renderPixel( int x, int y );
+
+private:
+   // ---------- Scene ----------
+   void   buildSpherePacks();
+
+private:
+   // ---------- Rays ----------
+   Vector launchRay(
+      Vector  origin,
+      Vector  target,
+      Vector& intersection );
+   bool   intersectionWithPrimitives(
+      Vector     origin,
+      Vector     target,
+      Primitive& closestObject,
+      Vector&    closestIntersection,
+      Vector&    closestNormal,
+      bool&      back );
+   int    closestSphere(
+      Vector origin,
+      Vector dir,
+      float& minDistance );
+   bool   intersectionWithLamps(
+      Vector  origin,
+      Vector  target,
+      Vector& lampColor );
+
+private:
+   // ---------- Shading ----------
+   bool   cylinderIntersection(
+      const Primitive& cylinder,
+      Vector           origin,
+      Vector           ray,
+      Vector&          intersection,
+      Vector&          normal,
+      bool             computingShadows );
+   bool   planeIntersection(
+      const Primitive& primitive,
+      Vector           origin,
+      Vector           ray,
+      bool             reverse,
+      float&           shadowIntensity,
+      Vector&          intersection,
+      Vector&          normal );
+   float  shadow(
+      Vector lampCenter,
+      Vector origin );
+   Vector colorFromObject(
+      Vector           origin,
+      Vector           normal,
+      const Primitive& primitive,
+      Vector           intersection,
+      Vector&          refractionFromColor,
+      float&           totalBlinn );
+   Vector objectColorAtIntersection(
+      const Primitive& primitive,
+      Vector           intersection );
+   Vector textureMapping(
+      const Primitive& primitive,
+      const Material&  material,
+      int              x,
+      int              y );
+
+private:
+   int                       m_nbThreads;
+   std::vector<RenderThread> m_threads;
+   volatile bool             m_stopping; // Threads leave at their next start
+   int                       m_tileSize;
+   int                       m_nbTilesX; // Tiles on a row of the current frame
+
+private:
+   // Frame being rendered
+   int         m_width;
+   int         m_height;
+   BYTE*       m_bitmap;
+   float       m_timer;
+   float       m_transparentColor;
+
+private:
+   // Spheres in packs of SIMD width, one array per coordinate. The end of
+   // the last pack is padded with spheres nothing can hit.
+   bool                m_avx;         // Spheres are tested by closestSphereAVX
+   std::vector<float>  m_sphereX;
+   std::vector<float>  m_sphereY;
+   std::vector<float>  m_sphereZ;
+   std::vector<float>  m_sphereRadius2;
+   std::vector<int>    m_sphereIndex; // Primitive of each sphere
+   std::vector<int>    m_shapes;      // Other primitives, tested one by one
+};
@@ -0,0 +1,97 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <immintrin.h>
+
+#include "CPUKernelAVX.h"
+
+/*
+* closestSphereAVX
+* Same test as CPUKernel::closestSphere. Returns the index of the closest 
+* sphere nearer than minDistance, -1 if none.
+*/
+int closestSphereAVX(
+   const float* sphereX,
+   const float* sphereY,
+   const float* sphereZ,
+   const float* sphereRadius2,
+   int          nbSpheres,
+   const float* origin,
+   const float* dir,
+   float        epsilon,
+   float&       minDistance )
+{
+   __m256 ox = _mm256_set1_ps( origin[0] );
+   __m256 oy = _mm256_set1_ps( origin[1] );
+   __m256 oz = _mm256_set1_ps( origin[2] );
+   __m256 dx = _mm256_set1_ps( dir[0] );
+   __m256 dy = _mm256_set1_ps( dir[1] );
+   __m256 dz = _mm256_set1_ps( dir[2] );
+   __m256 zero    = _mm256_set1_ps( 0.f );
+   __m256 minimum = _mm256_set1_ps( epsilon );
+   __m256 step    = _mm256_set1_ps( 8.f );
+   __m256 lanes   = _mm256_setr_ps( 0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f );
+   __m256 closest      = _mm256_set1_ps( minDistance );
+   __m256 closestIndex = _mm256_set1_ps( -1.f );
+
+   for( int i(0); i<nbSpheres; i += 8 )
+   {
+      __m256 ocx = _mm256_sub_ps( ox, _mm256_loadu_ps( sphereX+i ) );
+      __m256 ocy = _mm256_sub_ps( oy, _mm256_loadu_ps( sphereY+i ) );
+      __m256 ocz = _mm256_sub_ps( oz, _mm256_loadu_ps( sphereZ+i ) );
+      __m256 b = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ocx, dx ), _mm256_mul_ps( ocy, dy ) ), _mm256_mul_ps( ocz, dz ) );
+      __m256 c = _mm256_sub_ps(
+         _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ocx, ocx ), _mm256_mul_ps( ocy, ocy ) ), _mm256_mul_ps( ocz, ocz ) ),
+         _mm256_loadu_ps( sphereRadius2+i ) );
+      __m256 d = _mm256_sub_ps( _mm256_mul_ps( b, b ), c );
+      __m256 r = _mm256_sqrt_ps( _mm256_max_ps( d, zero ) );
+
+      // Nearest intersection in front of the origin
+      __m256 t1 = _mm256_sub_ps( _mm256_sub_ps( zero, b ), r );
+      __m256 t2 = _mm256_add_ps( _mm256_sub_ps( zero, b ), r );
+      __m256 t  = _mm256_blendv_ps( t2, t1, _mm256_cmp_ps( t1, minimum, _CMP_GT_OQ ) );
+
+      __m256 hit = _mm256_and_ps( 
+         _mm256_and_ps( _mm256_cmp_ps( d, zero, _CMP_GT_OQ ), _mm256_cmp_ps( t, minimum, _CMP_GT_OQ ) ), 
+         _mm256_cmp_ps( closest, t, _CMP_GT_OQ ) );
+      closest      = _mm256_blendv_ps( closest, t, hit );
+      closestIndex = _mm256_blendv_ps( closestIndex, lanes, hit );
+      lanes = _mm256_add_ps( lanes, step );
+   }
+
+   float distances[8];
+   float indices[8];
+   _mm256_storeu_ps( distances, closest );
+   _mm256_storeu_ps( indices, closestIndex );
+
+   int result(-1);
+   for( int i(0); i<8; ++i )
+   {
+      if( indices[i]>=0.f && distances[i]<minDistance )
+      {
+         minDistance = distances[i];
+         result = static_cast<int>(indices[i]);
+      }
+   }
+   return result;
+}
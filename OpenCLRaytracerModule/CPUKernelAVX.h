@@ -0,0 +1,42 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+/*
+* Sphere test of the native renderer with 256-bit AVX registers, 8 spheres
+* at a time. CPUKernelAVX.cpp is the only file built with /arch:AVX: it is
+* only called once supportsAVX has checked the processor and the system,
+* and includes nothing that could share inline code with the other files.
+* Arrays hold a multiple of 8 spheres, origin and dir are x, y, z.
+*/
+int closestSphereAVX(
+   const float* sphereX,
+   const float* sphereY,
+   const float* sphereZ,
+   const float* sphereRadius2,
+   int          nbSpheres,
+   const float* origin,
+   const float* dir,
+   float        epsilon,
+   float&       minDistance );
@@ -1,1338 +1,3333 @@
-/* 
- * OpenCL Raytracer
- * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- * This library is free software; you can redistribute it and/or
- * modify it under the terms of the GNU Library General Public
- * License as published by the Free Software Foundation; either
- * version 2 of the License, or (at your option) any later version.
- *
- * This library is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- * Library General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
- */
-
-/*
- * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- */
-
-// Max number of ray iterations
-#define gNbIterations 10
-// Textures
-#define gTextureWidth  512
-#define gTextureHeight 512
-#define gTextureDepth  3
-
-#define gVideoColor  4
-#define gVideoWidth  640
-#define gVideoHeight 480
-
-#define gDepthColor       2
-#define gDepthWidth       320
-#define gDepthHeight      240
-
-#define gMaxViewDistance 3000.f
-#define gTextureOffset   0.f
-
-#define gDepthOfFieldComplexity 1
-#define gNbMaxShadowCollisions 3
-
-#define NO_TEXTURE -1
-
-#define EPSILON 1.f
-
-// Enums
-enum PrimitiveType 
-{
-   ptSphere     = 0,
-   ptTriangle   = 1,
-   ptCheckboard = 2,
-   ptCamera     = 3,
-   ptXYPlane    = 4,
-   ptYZPlane    = 5,
-   ptXZPlane    = 6,
-   ptCylinder   = 7
-};
-
-typedef struct
-{
-   float4 color;
-   float  refraction;
-   int    textured;
-   float  transparency;
-   int    textureId;
-   float4 specular;    // x: value, y: power, w: coef, z:inner illuminatino
-
-} Material;
-
-typedef struct 
-{
-   float4 center;
-   //float4 rotation;
-   float4 size;
-   int    type;
-   int    materialId;
-   float  materialRatioX;
-   float  materialRatioY;
-} Primitive;
-
-typedef struct 
-{
-   float4 center;
-   float4 color;
-} Lamp;
-
-// ________________________________________________________________________________
-void makeDelphiColor( 
-   float4         color, 
-   __global char* bitmap, 
-   int            index)
-{
-   int mdc_index = index*3; 
-   color.x = (color.x>1.f) ? 1.f : color.x;
-   color.y = (color.y>1.f) ? 1.f : color.y; 
-   color.z = (color.z>1.f) ? 1.f : color.z;
-   bitmap[mdc_index  ] = (char)(color.z*255.f);
-   bitmap[mdc_index+1] = (char)(color.y*255.f);
-   bitmap[mdc_index+2] = (char)(color.x*255.f);
-}
-
-// ________________________________________________________________________________
-void makeOpenGLColor( 
-   float4         color, 
-   __global char* bitmap, 
-   int            index)
-{
-   int mdc_index = index*4; 
-   color.x = (color.x>1.f) ? 1.f : color.x;
-   color.y = (color.y>1.f) ? 1.f : color.y; 
-   color.z = (color.z>1.f) ? 1.f : color.z;
-   color.w = (color.w>1.f) ? 1.f : color.w;
-   bitmap[mdc_index  ] = (char)(color.x*255.f); // Red
-   bitmap[mdc_index+1] = (char)(color.y*255.f); // Green
-   bitmap[mdc_index+2] = (char)(color.z*255.f); // Blue
-   bitmap[mdc_index+3] = (char)(color.w*255.f); // Alpha
-}
-
-// ________________________________________________________________________________
-#if 1
-#define vectorLength( vector ) \
-   (half_sqrt( (vector).x*(vector).x + (vector).y*(vector).y + (vector).z*(vector).z ))
-#else
-#define vectorLength( vector ) \
-   fast_length(vector)
-#endif
-
-// ________________________________________________________________________________
-#define normalizeVector( v ) \
-   v /= vectorLength( v );
-
-// ________________________________________________________________________________
-#if 1
-float dotProduct( float4 v1, float4 v2 ) 
-{
-   return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
-}
-#else
-#define dotProduct( v1, v2 )\
-   dot(v1,v2)
-#endif // 0
-
-/*
-________________________________________________________________________________
-incident  : le vecteur normal inverse a la direction d'incidence de la source 
-lumineuse
-normal    : la normale a l'interface orientee dans le materiau ou se propage le 
-rayon incident
-reflected : le vecteur normal reflechi
-________________________________________________________________________________
-*/
-#define vectorReflection( __r, __i, __n ) \
-   __r = __i-2.f*dotProduct(__i,__n)*__n;
-
-/*
-________________________________________________________________________________
-incident: le vecteur norm? inverse ? la direction d?incidence de la source 
-lumineuse
-n1      : index of refraction of original medium
-n2      : index of refraction of new medium
-________________________________________________________________________________
-*/
-void vectorRefraction( float4* refracted, float4 incident, float n1, float4 normal, float n2 )
-{
-	(*refracted) = incident;
-	if(n1!=n2 && n2!=0.f) 
-	{
-		float r = n1/n2;
-		float cosI = dotProduct( incident, normal );
-		float cosT2 = 1.f - r*r*(1.f - cosI*cosI);
-		(*refracted) = r*incident + (r*cosI-sqrt( fabs(cosT2) ))*normal;
-	}
-}
-
-/*
-________________________________________________________________________________
-__v : Vector to rotate
-__c : Center of rotations
-__a : Angles
-________________________________________________________________________________
-*/
-#define vectorRotation( __v, __c, __a ) \
-{ \
-   float4 __r = __v; \
-   /* X axis */ \
-   __r.y = __v.y*half_cos(angles.x) - __v.z*half_sin(__a.x); \
-   __r.z = __v.y*half_sin(angles.x) + __v.z*half_cos(__a.x); \
-   __v = __r; \
-   __r = __v; \
-   /* Y axis */ \
-   __r.z = __v.z*half_cos(__a.y) - __v.x*half_sin(__a.y); \
-   __r.x = __v.z*half_sin(__a.y) + __v.x*half_cos(__a.y); \
-   __v = __r; \
-}
-
-/**
-* ________________________________________________________________________________
-* sphereMapping
-* ________________________________________________________________________________
-*/
-float4 sphereMapping( 
-   Primitive          primitive, 
-   float4             intersection, 
-   __global Material* materials, 
-   __global char*     textures )
-{
-   float4 result = materials[primitive.materialId].color;
-   int x = gTextureOffset+(intersection.x-primitive.center.x+primitive.size.x)*primitive.materialRatioX;
-   int y = gTextureOffset+(intersection.y-primitive.center.y+primitive.size.y)*primitive.materialRatioY;
-
-   x = x % gTextureWidth;
-   y = y % gTextureHeight;
-
-   if( x>=0 && x<gTextureWidth&& y>=0 && y<gTextureHeight )
-   {
-      int index = (materials[primitive.materialId].textureId*gTextureWidth*gTextureHeight + y*gTextureWidth+x)*gTextureDepth;
-      unsigned char r = textures[index  ];
-      unsigned char g = textures[index+1];
-      unsigned char b = textures[index+2];
-      result.x = r/256.f;
-      result.y = g/256.f;
-      result.z = b/256.f;
-   }
-   return result; 
-}
-
-/**
-* ________________________________________________________________________________
-* cubeMapping
-* ________________________________________________________________________________
-*/
-float4 cubeMapping( 
-   Primitive          primitive, 
-   float4             intersection, 
-   __global Material* materials, 
-   __global char*     textures)
-{
-   float4 result = materials[primitive.materialId].color;
-   int x = ((primitive.type == ptCheckboard) ||
-            (primitive.type == ptXZPlane)    ||
-            (primitive.type == ptXYPlane))  ? 
-        gTextureOffset+(intersection.x-primitive.center.x+primitive.size.x)*primitive.materialRatioX:
-        gTextureOffset+(intersection.z-primitive.center.z+primitive.size.x)*primitive.materialRatioX;
-
-   int y = ((primitive.type == ptCheckboard)  ||
-            (primitive.type == ptXZPlane)) ? 
-        gTextureOffset+(intersection.z-primitive.center.z+primitive.size.y)*primitive.materialRatioY:
-        gTextureOffset+(intersection.y-primitive.center.y+primitive.size.y)*primitive.materialRatioY;
-   x = x % gTextureWidth;
-   y = y % gTextureHeight;
-
-   if( x>=0 && x<gTextureWidth&& y>=0 && y<gTextureHeight )
-   {
-      int index = (materials[primitive.materialId].textureId*gTextureWidth*gTextureHeight + y*gTextureWidth+x)*gTextureDepth;
-      unsigned char r = textures[index];
-      unsigned char g = textures[index+1];
-      unsigned char b = textures[index+2];
-      result.x = r/256.f;
-      result.y = g/256.f;
-      result.z = b/256.f;
-   }
-   return result;
-}
-
-/**
-* ________________________________________________________________________________
-* Colors
-* ________________________________________________________________________________
-*/
-float4 objectColorAtIntersection( 
-   Primitive          primitive, 
-   float4             intersection,
-   __global char*     video,
-   __global char*     depth,
-   __global Material* materials,
-   __global char*     textures,
-   float              timer, 
-   bool               back )
-{
-   float4 colorAtIntersection = materials[primitive.materialId].color;
-   switch( primitive.type ) 
-   {
-   case ptSphere:
-   case ptCylinder:
-      {
-         colorAtIntersection = 
-            ((materials[primitive.materialId].textureId != NO_TEXTURE) && (intersection.w==0.f)) ? 
-            sphereMapping(primitive, intersection, materials, textures) : 
-            colorAtIntersection;
-         break;
-      }
-   case ptTriangle:
-   case ptCheckboard :
-      {
-         if( materials[primitive.materialId].textureId != NO_TEXTURE ) 
-         {
-            colorAtIntersection = cubeMapping( primitive, intersection, materials, textures );
-         }
-         else 
-         {
-            int x = gMaxViewDistance + (intersection.x - primitive.center.x)/50.f;
-            int z = gMaxViewDistance + (intersection.z - primitive.center.z)/50.f;
-            if(x%2==0) 
-            {
-               if (z%2==0) 
-               {
-                  colorAtIntersection.x = 1.0f;
-                  colorAtIntersection.y = 1.0f;
-                  colorAtIntersection.z = 1.0f;
-               }
-            }
-            else 
-            {
-               if (z%2!=0) 
-               {
-                  colorAtIntersection.x = 1.0f;
-                  colorAtIntersection.y = 1.0f;
-                  colorAtIntersection.z = 1.0f;
-               }
-            }
-         }
-         break;
-      }
-   case ptXYPlane:
-   case ptYZPlane:
-   case ptXZPlane:
-      {
-         colorAtIntersection = 
-            ( materials[primitive.materialId].textureId != NO_TEXTURE ) ? 
-            cubeMapping( primitive, intersection, materials, textures ) : 
-            colorAtIntersection;
-         break;
-      }
-   case ptCamera:
-      {
-         colorAtIntersection = materials[primitive.materialId].color;
-         int x = (primitive.center.x + intersection.x)+gVideoWidth/2;
-         int y = gVideoHeight/2 - (intersection.y - primitive.center.y);
-         if( x>=0 && x<gVideoWidth && y>=0 && y<gVideoHeight ) 
-         {
-            int index = (y*gVideoWidth+x)*4;
-            unsigned char r = video[index+2];
-            unsigned char g = video[index+1];
-            unsigned char b = video[index+0];
-            colorAtIntersection.x = r/256.f;
-            colorAtIntersection.y = g/256.f;
-            colorAtIntersection.z = b/256.f;
-         }
-#if 0
-         int x = 2.f*(primitive.center.x + intersection.x)+gDepthWidth/2;
-         int y = gDepthHeight/2 - 2.f*(intersection.y - primitive.center.y);
-         if( x>=0 && x<gDepthWidth && y>=0 && y<gDepthHeight ) {
-            int index = (y*gDepthWidth+x)*2;
-            char s = depth[index] & 0x07;
-            //if( s != 0 ) 
-            {
-               char a = depth[index] & 0x1F;
-               int realDepth = (depth[index+1]<<5)|(a>>3);
-               float intensity = 1.f - realDepth/4000.f;
-               colorAtIntersection.x = intensity;
-               colorAtIntersection.y = intensity;
-               colorAtIntersection.z = intensity;
-            }
-         }
-#endif // 0
-         break;
-      }
-   }
-   return colorAtIntersection;
-}
-
-/**
-________________________________________________________________________________
-Lamp Intersection
-Lamp         : Object on which we want to find the intersection
-origin       : Origin of the ray
-orientation  : Orientation of the ray
-intersection : Resulting intersection
-invert       : true if we want to check the front of the sphere, false for the 
-back
-returns true if there is an intersection, false otherwise
-________________________________________________________________________________
-*/
-bool lampIntersection( 
-   Lamp    lamp, 
-   float4  origin, 
-   float4  ray, 
-   float4  O_C,
-   float4* intersection)
-{
-   float si_A = 2.f*(ray.x*ray.x + ray.y*ray.y + ray.z*ray.z);
-   if ( si_A == 0.f ) return false;
-
-   bool  si_b1 = false; 
-   float si_B = 2.f*(O_C.x*ray.x + O_C.y*ray.y + O_C.z*ray.z);
-   float si_C = O_C.x*O_C.x+O_C.y*O_C.y+O_C.z*O_C.z-lamp.center.w*lamp.center.w;
-   float si_radius = si_B*si_B-2.f*si_A*si_C;
-   float si_t1 = (-si_B-half_sqrt(si_radius))/si_A;
-
-   if( si_t1>0.f ) 
-   {
-      *intersection = origin+si_t1*ray;
-      si_b1 = true;
-   }
-   return si_b1;
-}
-
-
-/**
-________________________________________________________________________________
-Sphere Intersection
-primitive    : Object on which we want to find the intersection
-origin       : Origin of the ray
-orientation  : Orientation of the ray
-intersection : Resulting intersection
-invert       : true if we want to check the front of the sphere, false for the 
-back
-returns true if there is an intersection, false otherwise
-________________________________________________________________________________
-*/
-bool sphereIntersection( 
-   Primitive          sphere, 
-   float4             origin, 
-   float4             ray, 
-   float              timer,
-   float4*            intersection,
-   float4*            normal,
-   bool               computingShadows,
-   float*             shadowIntensity,
-   __global char*     video,
-   __global char*     depth,
-   __global Material* materials,
-   __global char*     textures,
-   float              transparentColor,
-   bool*              back
-   ) 
-{
-	// solve the equation sphere-ray to find the intersections
-	float4 O_C = origin-sphere.center;
-	float4 dir = ray;
-	normalizeVector( dir );
-
-	float a = 2.f*dotProduct(dir,dir);
-	float b = 2.f*dotProduct(O_C,dir);
-	float c = dotProduct(O_C,O_C) - (sphere.size.x*sphere.size.x);
-	float d = b*b-2.f*a*c;
-
-	if( d<=0.f || a == 0.f) return false;
-	float r = sqrt(d);
-	float t1 = (-b-r)/a;
-	float t2 = (-b+r)/a;
-
-	if( t1<=EPSILON && t2<=EPSILON ) return false; // both intersections are behind the ray origin
-	*back = (t1<=EPSILON || t2<=EPSILON); // If only one intersection (t>0) then we are inside the sphere and the intersection is at the back of the sphere
-
-	float t=0.f;
-	if( t1<=EPSILON ) 
-		t = t2;
-	else 
-		if( t2<=EPSILON )
-			t = t1;
-		else
-			t=(t1<t2) ? t1 : t2;
-
-	if( t<EPSILON ) return false; // Too close to intersection
-	*intersection = origin+t*dir;
-
-	// Compute normal vector
-	(*normal) = *intersection-sphere.center;
-	(*normal).w = 0.f;
-	(*normal) *= (back) ? -1.f : 1.f;
-	normalizeVector(*normal);
-
-	return true;
-}
-
-/**
-________________________________________________________________________________
-Cylinder Intersection
-primitive    : Object on which we want to find the intersection
-origin       : Origin of the ray
-orientation  : Orientation of the ray
-intersection : Resulting intersection
-invert       : true if we want to check the front of the sphere, false for the 
-back
-returns true if there is an intersection, false otherwise
-________________________________________________________________________________
-*/
-bool cylinderIntersection( 
-   Primitive          cylinder, 
-   float4             origin, 
-   float4             ray, 
-   float              timer,
-   float4*            intersection,
-   float4*            normal,
-   bool               computingShadows,
-   float*             shadowIntensity,
-   __global char*     video,
-   __global char*     depth,
-   __global Material* materials,
-   __global char*     textures,
-   float              transparentColor
-   ) 
-{
-   // solve the equation sphere-ray to find the intersections
-   bool result = false;
-   //bool reverseNormal = false;
-
-   // Top
-   if(!result && ray.y<0.f && origin.y>(cylinder.center.y+cylinder.size.y)) 
-   {
-      (*intersection).y = cylinder.center.y+cylinder.size.y;
-      float y = origin.y-cylinder.center.y-cylinder.size.y;
-      (*intersection).x = origin.x+y*ray.x/-ray.y;
-      (*intersection).z = origin.z+y*ray.z/-ray.y;
-      (*intersection).w = 1.f; // 1 for top, -1 for bottom
-
-      float4 v=(*intersection)-cylinder.center;
-      v.y = 0.f;
-      result = (vectorLength(v)<cylinder.size.x);
-
-      (*normal).x =  0.f;
-      (*normal).y =  1.f;
-      (*normal).z =  0.f;
-   }
-
-   // Bottom
-   if( !result && ray.y>0.f && origin.y<(cylinder.center.y - cylinder.size.y) ) 
-   {
-      (*intersection).y = cylinder.center.y - cylinder.size.y;
-      float y = origin.y - cylinder.center.y + cylinder.size.y;
-      (*intersection).x = origin.x+y*ray.x/-ray.y;
-      (*intersection).z = origin.z+y*ray.z/-ray.y;
-      (*intersection).w = -1.f; // 1 for top, -1 for bottom
-
-      float4 v=(*intersection)-cylinder.center;
-      v.y = 0.f;
-      result = (vectorLength(v)<cylinder.size.x);
-
-      (*normal).x =  0.f;
-      (*normal).y = -1.f;
-      (*normal).z =  0.f;
-   }
-
-   if( !result ) 
-   {
-      float4 O_C = origin - cylinder.center;
-      O_C.y = 0.f;
-      if(( dotProduct( O_C, ray ) > 0.f ) && (vectorLength(O_C) > cylinder.center.w)) return false;
-
-      float a = 2.f * ( ray.x*ray.x + ray.z*ray.z );
-      float b = 2.f*((origin.x-cylinder.center.x)*ray.x + (origin.z-cylinder.center.z)*ray.z);
-      float c = O_C.x*O_C.x + O_C.z*O_C.z - cylinder.center.w*cylinder.center.w;
-
-      float r = half_sqrt(b*b-2.f*a*c);
-
-      // Cylinder
-      if ( r < 0.f ) return false;
-   
-      a = ( a==0.f ) ? 0.0001f : a;
-      float t1 = (-b-r)/a;
-      float t2 = (-b+r)/a;
-      float ta = (t1<t2) ? t1 : t2;
-      float tb = (t2<t1) ? t1 : t2;
-   
-      if( ta >  0.001f ) 
-      {
-         *intersection = origin+ta*ray;
-         (*intersection).w = 0.f;
-
-         result = ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y );
-         if( result && materials[cylinder.materialId].transparency != 0.f ) 
-         {
-            float4 color = objectColorAtIntersection( cylinder, *intersection, video, depth, materials, textures, timer, false );
-            result = 
-               ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y ) &&
-               ( (color.x+color.y+color.z) >= transparentColor ); 
-         }
-      }
-
-      if( !result && tb > 0.001f ) 
-      {
-         *intersection = origin+tb*ray;
-         (*intersection).w = 0.f;
-
-         result = ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y );
-         //reverseNormal = true;
-         if( result && materials[cylinder.materialId].transparency != 0.f ) 
-         {
-            float4 color = objectColorAtIntersection( cylinder, *intersection, video, depth, materials, textures, timer, false );
-            result = 
-               ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y ) &&
-               ( (color.x+color.y+color.z) >= transparentColor ); 
-         }
-      }
-
-      if( result )
-      {
-         (*normal) = (*intersection)-cylinder.center;
-         (*normal).y = 0.f;
-      }
-   }
-
-   // Normal to surface
-   if( result && !computingShadows ) 
-   {
-      if( materials[cylinder.materialId].textured ) 
-      {
-         float4 newCenter;
-         newCenter.x = cylinder.center.x + 5.f*half_cos(timer*0.58f+(*intersection).x);
-         newCenter.y = cylinder.center.y + 5.f*half_sin(timer*0.85f+(*intersection).y) + (*intersection).y;
-         newCenter.z = cylinder.center.z + 5.f*half_sin(half_cos(timer*1.24f+(*intersection).z));
-         *normal = *intersection-newCenter;
-      }
-      //*normal *= reverseNormal ? -1.f : 1.f; 
-      normalizeVector( *normal );
-   }
-
-#if 0
-   if( result && computingShadows ) 
-   {
-      float4 normal = normalToSurface( cylinder, *intersection, depth, materials, timer ); // Normal is computed twice!!!
-      normalizeVector(ray );
-      normalizeVector(normal);
-      *shadowIntensity = 5.f*fabs(dotProduct(-ray ,normal));
-      *shadowIntensity = (*shadowIntensity>1.f) ? 1.f : *shadowIntensity;
-   } 
-#else
-   *shadowIntensity = 1.f;
-#endif // 0
-   return result;
-}
-
-/**
-________________________________________________________________________________
-Checkboard Intersection
-primitive    : Object on which we want to find the intersection
-origin       : Origin of the ray
-orientation  : Orientation of the ray
-intersection : Resulting intersection
-invert       : true if we want to check the front of the sphere, false for the 
-back
-returns true if there is an intersection, false otherwise
-________________________________________________________________________________
-*/
-bool planeIntersection( 
-   Primitive          primitive, 
-   float4             origin, 
-   float4             ray, 
-   bool               reverse,
-   float*             shadowIntensity,
-   __global char*     depth,
-   __global Material* materials,
-   __global char*     textures,
-   float4*            intersection,
-   float4*            normal,
-   float              transparentColor)
-{ 
-   //vectorRotation( &origin, primitive.center, primitive.rotation );
-   //vectorRotation( &ray,    primitive.center, primitive.rotation );
-   float reverted = reverse ? -1.f : 1.f;
-   bool collision = false;
-   switch( primitive.type ) 
-   {
-      case ptCheckboard:
-         {
-            (*intersection).y = primitive.center.y;
-            float y = origin.y-primitive.center.y;
-            if( reverted*ray.y<0.f && reverted*origin.y>reverted*primitive.center.y) 
-            {
-               (*intersection).x = origin.x+y*ray.x/-ray.y;
-               (*intersection).z = origin.z+y*ray.z/-ray.y;
-               collision = 
-                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
-                  fabs((*intersection).z - primitive.center.z) < primitive.size.y;
-               (*normal).x =  0.f;
-               (*normal).y =  1.f;
-               (*normal).z =  0.f;
-            }
-            break;
-         }
-      case ptXZPlane:
-         {
-            float y = origin.y-primitive.center.y;
-            if( reverted*ray.y<0.f && reverted*origin.y>reverted*primitive.center.y) 
-            {
-               (*normal).x =  0.f;
-               (*normal).y =  1.f;
-               (*normal).z =  0.f;
-               (*intersection).y = primitive.center.y;
-               (*intersection).x = origin.x+y*ray.x/-ray.y;
-               (*intersection).z = origin.z+y*ray.z/-ray.y;
-               collision = 
-                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
-                  fabs((*intersection).z - primitive.center.z) < primitive.size.y;
-            }
-            if( !collision && reverted*ray.y>0.f && reverted*origin.y<reverted*primitive.center.y) 
-            {
-               (*intersection).x = origin.x+y*ray.x/-ray.y;
-               (*intersection).z = origin.z+y*ray.z/-ray.y;
-               collision = 
-                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
-                  fabs((*intersection).z - primitive.center.z) < primitive.size.y;
-               (*normal).x =  0.f;
-               (*normal).y =  -1.f;
-               (*normal).z =  0.f;
-            }
-            break;
-         }
-      case ptYZPlane:
-         {
-            float x = origin.x-primitive.center.x;
-            if( reverted*ray.x<0.f && reverted*origin.x>reverted*primitive.center.x ) 
-            {
-               (*intersection).x = primitive.center.x;
-               (*intersection).y = origin.y+x*ray.y/-ray.x;
-               (*intersection).z = origin.z+x*ray.z/-ray.x;
-               collision = 
-                  fabs((*intersection).y - primitive.center.y) < primitive.size.y &&
-                  fabs((*intersection).z - primitive.center.z) < primitive.size.x;
-               (*normal).x =  1.f;
-               (*normal).y =  0.f;
-               (*normal).z =  0.f;
-            }
-            if( !collision && reverted*ray.x>0.f && reverted*origin.x<reverted*primitive.center.x ) 
-            {
-               (*intersection).x = primitive.center.x;
-               (*intersection).y = origin.y+x*ray.y/-ray.x;
-               (*intersection).z = origin.z+x*ray.z/-ray.x;
-               collision = 
-                  fabs((*intersection).y - primitive.center.y) < primitive.size.y &&
-                  fabs((*intersection).z - primitive.center.z) < primitive.size.x;
-               (*normal).x = -1.f;
-               (*normal).y =  0.f;
-               (*normal).z =  0.f;
-            }
-            break;
-         }
-      case ptXYPlane:
-         {
-            float z = origin.z-primitive.center.z;
-            if( reverted*ray.z<0.f && reverted*origin.z>reverted*primitive.center.z) 
-            {
-               (*intersection).z = primitive.center.z;
-               (*intersection).x = origin.x+z*ray.x/-ray.z;
-               (*intersection).y = origin.y+z*ray.y/-ray.z;
-               collision = 
-                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
-                  fabs((*intersection).y - primitive.center.y) < primitive.size.y;
-               (*normal).x =  0.f;
-               (*normal).y =  0.f;
-               (*normal).z =  1.f;
-            }
-            if( !collision && reverted*ray.z>0.f && reverted*origin.z<reverted*primitive.center.z )
-            {
-               (*intersection).z = primitive.center.z;
-               (*intersection).x = origin.x+z*ray.x/-ray.z;
-               (*intersection).y = origin.y+z*ray.y/-ray.z;
-               collision = 
-                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
-                  fabs((*intersection).y - primitive.center.y) < primitive.size.y;
-               (*normal).x =  0.f;
-               (*normal).y =  0.f;
-               (*normal).z = -1.f;
-            }
-            break;
-         }
-      case ptCamera:
-         {
-            if( reverted*ray.z>0.f && reverted*origin.z<reverted*primitive.center.z )
-            {
-               (*intersection).z = primitive.center.z;
-               float z = origin.z-primitive.center.z;
-               (*intersection).x = origin.x+z*ray.x/-ray.z;
-               (*intersection).y = origin.y+z*ray.y/-ray.z;
-               collision =
-                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
-                  fabs((*intersection).y - primitive.center.y) < primitive.size.y;
-               (*normal).x =  0.f;
-               (*normal).y =  0.f;
-               (*normal).z = -1.f;
-            }
-            break;
-         }
-      }
-
-   if( collision ) 
-   {
-      if( /*materials[primitive.materialId].color.w != 0.f &&*/
-         materials[primitive.materialId].transparency != 0.f && 
-         materials[primitive.materialId].textureId!=NO_TEXTURE ) 
-      {
-         float4 color = cubeMapping(primitive, *intersection, materials, textures );
-         *shadowIntensity = (color.x+color.y+color.z)/3.f;
-         collision = ( *shadowIntensity >= transparentColor );
-      }
-      else 
-      {
-         *shadowIntensity = 1.f;
-      }
-   }
-   //vectorRotation( intersection, primitive.center, -primitive.rotation );
-   return collision;
-}
-
-/*
-Shadows computation
-We do not consider the object from which the ray is launched...
-This object cannot shadow itself !
-
-We now have to find the intersection between the considered object and the ray which origin is the considered 3D float4
-and which direction is defined by the light source center.
-
-* Lamp                     Ray = Origin -> Light Source Center
-\
-\##
-#### object
-##
-\
-\  Origin
---------O-------
-*/
-float shadow( 
-   __global Primitive* primitives, 
-   int                 nbPrimitives, 
-   float4              lampCenter, 
-   float4              origin, 
-   int                 objectId, 
-   float               timer,
-   __global char*      video,
-   __global char*      depth,
-   __global Material*  materials, 
-   __global char*      textures,
-   float               transparentColor)
-{
-   return 0.f; // TO REMOVE!!!!
-
-
-   float result = 0.f;
-   float4 O_L = lampCenter - origin;
-   int cptPrimitives = 0;
-   int collision = 0;
-   while( result<1.f && (collision<gNbMaxShadowCollisions) && (cptPrimitives<nbPrimitives) ) 
-   {
-      float4 intersection = 0;
-      float4 normal = 0;
-      float shadowIntensity = 0.f;
-      bool hit = false;
-      bool back;
-
-      switch(primitives[cptPrimitives].type)
-      {
-      case ptSphere  : hit = sphereIntersection( primitives[cptPrimitives], origin, O_L, timer, &intersection, &normal, true, &shadowIntensity, video, depth, materials, textures, transparentColor, &back ); break;
-      case ptCylinder: hit = cylinderIntersection( primitives[cptPrimitives], origin, O_L, timer, &intersection, &normal, true, &shadowIntensity, video, depth, materials, textures, transparentColor ); break;
-      default        : 
-         hit = planeIntersection( primitives[cptPrimitives], origin, O_L, true, &shadowIntensity, depth, materials, textures, &intersection, &normal, transparentColor ); 
-         if( hit ) 
-         {
-            float4 O_I = intersection-origin;
-            hit = ( vectorLength(O_I)<vectorLength(O_L) );
-         }
-         break;
-      }
-
-      if( hit ) 
-      {
-         collision++;
-         if( collision == gNbMaxShadowCollisions ) 
-         {
-            result = 1.f;
-         }
-         else
-         {
-            shadowIntensity *= 
-               (materials[primitives[cptPrimitives].materialId].transparency != 0.f) ?
-               1.f - materials[primitives[cptPrimitives].materialId].transparency :  // Shadow intensity of a transparent object
-               1.f;
-
-            if( primitives[cptPrimitives].type == ptSphere || primitives[cptPrimitives].type == ptCylinder )
-            {
-               float4 O_I = intersection-origin;
-               // Shadow exists only if object is between origin and lamp
-               shadowIntensity = (vectorLength(O_I) < vectorLength(O_L)) ? shadowIntensity : 0.f;
-            }
-            result += shadowIntensity;
-         }
-      }
-      cptPrimitives++; 
-   }
-
-   return (result>1.f) ? 1.f : result;
-}
-
-
-/*
-* colorFromObject 
-*/
-float4 colorFromObject(
-   __global Primitive* primitives, 
-   int                 nbPrimitives, 
-   __global Lamp*      lamps, 
-   int                 NbLamps, 
-   __global char*      video,
-   __global char*      depth,
-   __global Material*  materials,
-   __global char*      textures,
-   float4              origin,
-   float4              normal, 
-   int                 objectId, 
-   float4              intersection, 
-   float               timer,
-   float4*             refractionFromColor,
-   float*              shadowIntensity,
-   float*              totalBlinn,
-   float               transparentColor)
-{
-   float4 color = 0;
-   float4 lampsColor = 0;
-
-   // Lamp Impact
-   float lambert = 0.f;
-   float totalIntensity = 0.f;
-   *totalBlinn = 0.f;
-
-   for( int cptLamps=0; cptLamps<NbLamps; cptLamps++ ) 
-   {
-      *shadowIntensity = shadow( primitives, nbPrimitives, lamps[cptLamps].center, intersection, objectId, timer, video, depth, materials, textures, transparentColor );
-
-      // Lighted object, not in the shades
-      if( (*shadowIntensity) != 1.0f )
-      {
-         float4 lightRay = lamps[cptLamps].center - intersection;
-         lampsColor += lamps[cptLamps].color;
-
-         // Lambert
-         normalizeVector(lightRay);
-         lambert = dotProduct(lightRay, normal);
-         lambert = (lambert<0.f) ? 0.f : lambert;
-         lambert *= (materials[primitives[objectId].materialId].refraction == 0.f) ? lamps[cptLamps].color.w : 1.f;
-         lambert *= (1.f-*shadowIntensity);
-
-         totalIntensity += lambert; // + material.specular.z; // Lambert + inner illumination
-
-         // --------------------------------------------------------------------------------
-         // Blinn - Phong
-         // --------------------------------------------------------------------------------
-         float4 viewRay = intersection - origin;
-         normalizeVector(viewRay);
-
-         float4 blinnDir = lightRay - viewRay;
-         float temp = half_sqrt(dotProduct(blinnDir,blinnDir));
-         if (temp != 0.f ) 
-         {
-            // Specular reflection
-            blinnDir = (1.f / temp) * blinnDir;
-
-            float blinnTerm = dotProduct(blinnDir,normal);
-            blinnTerm = ( blinnTerm < 0.f) ? 0.f : blinnTerm;
-
-            blinnTerm = 
-               materials[primitives[objectId].materialId].specular.x * 
-               pow(blinnTerm , materials[primitives[objectId].materialId].specular.y) * 
-               materials[primitives[objectId].materialId].specular.w;
-
-            *totalBlinn += lamps[cptLamps].color.w * blinnTerm;
-         }
-      }
-   }
-
-   // Final color
-   float4 intersectionColor = objectColorAtIntersection( primitives[objectId], intersection, video, depth, materials, textures, timer, false );
-
-   color   = intersectionColor*lampsColor;
-   color.w = totalIntensity;
-   
-   *refractionFromColor = intersectionColor; // Refraction depending on color;
-   *totalBlinn = (*totalBlinn>1.f) ? 1.f : *totalBlinn;
-
-   return color;
-}
-
-/**
-________________________________________________________________________________
-Plan Intersection
-returns true if there is an intersection, false otherwise
-________________________________________________________________________________
-*/
-bool planIntersection( 
-   Primitive          plan, 
-   float4             origin, 
-   float4             ray, 
-   __global Material* materials,
-   __global char*     depth,
-   float              timer, 
-   float4*            intersection )
-{
-   bool collision  = false;
-#if 0
-   float4 normal = normalToSurface( plan, plan.center, depth, materials, timer  );
-   normalizeVector(normal);
-   float B = dotProduct( normal, ray );
-   if(B < 0.f) 
-   {
-      origin = origin + plan.center;
-      float t = -dotProduct( normal, origin )/B;
-      *intersection = origin + t*ray;
-      collision  = true;
-   } 
-#endif // 0
-   return collision;
-}
-
-/**
-* ________________________________________________________________________________
-* Intersections with Objects
-* ________________________________________________________________________________
-*/
-bool intersectionWithLamps( 
-   __global Lamp*      lamps, 
-   int                 nbLamps, 
-   float4              origin, 
-   float4              target, 
-   float4*             lampColor)
-{
-   bool intersections = false; 
-
-   for( int cptLamps = 0; cptLamps<nbLamps && !intersections; cptLamps++ ) 
-   {
-      float4 O_C = origin - lamps[cptLamps].center; 
-      float4 ray = target - origin;
-      float4 intersection;
-      intersections = lampIntersection( lamps[cptLamps], origin, ray, O_C, &intersection );
-      if( intersections ) 
-      {
-         float4 I_C = intersection - lamps[cptLamps].center;
-         normalizeVector( O_C );
-         normalizeVector( I_C );
-         float d = dotProduct( O_C, I_C ) * lamps[cptLamps].color.w;
-         d = (d<0.f) ? 0.f : d;
-         (*lampColor) = lamps[cptLamps].color*d;
-      }
-   }
-   return intersections;
-}
-
-/**
-* ________________________________________________________________________________
-* Intersections with Objects
-* ________________________________________________________________________________
-*/
-bool intersectionWithPrimitives( 
-   __global Primitive* primitives, 
-   int                 nbPrimitives, 
-   float4              origin, 
-   float4              target, 
-   float               timer, 
-   int*                closestPrimitive, 
-   float4*             closestIntersection,
-   float4*             closestNormal,
-   __global char*      video,
-   __global char*      depth,
-   __global Material*  materials,
-   __global char*      textures,
-   float               transparentColor,
-   bool* back)
-{
-   bool intersections = false; 
-   float minDistance  = gMaxViewDistance; 
-   float4 ray = target - origin; 
-   float4 intersection = 0;
-   float4 normal = 0;
-
-   for( int cptObjects = 0; cptObjects<nbPrimitives; cptObjects++ )
-   { 
-      bool i = false; 
-      float shadowIntensity;
-
-      switch( primitives[cptObjects].type )
-      {
-      case ptSphere  : i = sphereIntersection( primitives[cptObjects], origin, ray, timer, &intersection, &normal, false, &shadowIntensity, video, depth, materials, textures,transparentColor, back ); break;
-      case ptCylinder: i = cylinderIntersection( primitives[cptObjects], origin, ray, timer, &intersection, &normal, false, &shadowIntensity, video, depth, materials, textures, transparentColor); break;
-      case ptTriangle: i = planIntersection( primitives[cptObjects], origin, ray, materials, depth, timer, &intersection ); break;
-      default        : i = planeIntersection( primitives[cptObjects], origin, ray, false, &shadowIntensity, depth, materials, textures, &intersection, &normal, transparentColor); break;
-      }
-
-      if( i ) 
-      {
-         float distance = vectorLength( origin - intersection );
-
-         if(distance>0.01f && distance<minDistance) 
-         {
-            minDistance          = distance;
-            *closestPrimitive    = cptObjects;
-            *closestIntersection = intersection;
-            *closestNormal       = normal;
-            intersections = true;
-         } 
-      }
-   }
-   return intersections;
-}
-
-/**
-*  ------------------------------------------------------------------------------ 
-* Ray Intersections
-*  ============================================================================== 
-*  Calculate the reflected vector                   
-*                                                  
-*                  ^ Normal to object surface (N)  
-* Reflection (O_R)  |                              
-*                 \ |  Eye (O_E)                    
-*                  \| /                             
-*   ----------------O--------------- Object surface 
-*          closestIntersection                      
-*                                                   
-*  ============================================================================== 
-*  colours                                                                                    
-*  ------------------------------------------------------------------------------ 
-*  We now have to know the colour of this intersection                                        
-*  Color_from_object will compute the amount of light received by the
-*  intersection float4 and  will also compute the shadows. 
-*  The resulted color is stored in result.                     
-*  The first parameter is the closest object to the intersection (following 
-*  the ray). It can  be considered as a light source if its inner light rate 
-*  is > 0.                            
-*  ------------------------------------------------------------------------------ 
-*/
-float4 launchRay( 
-   __global Primitive* primitives, 
-   int                 nbPrimitives, 
-   __global Lamp*      lamps, 
-   int                 nbLamps, 
-   float4              origin, 
-   float4              target, 
-   float               timer,
-   __global Material*  materials,
-   __global char*      textures,
-   __global char*      video,
-   __global char*      depth,
-   float               transparentColor,
-   float4*             intersection)
-{
-   float4 intersectionColor = 0;
-   int    closestPrimitive;
-   float4 closestIntersection = 0;
-   bool   carryon           = true;
-   float4 rayOrigin         = origin;
-   float4 rayTarget         = target;
-   float  initialRefraction = 1.0f;
-   int    iteration         = 0;
-   float4 O_R;
-   float4 O_E;
-   float4 recursiveColor[10];
-   float4 recursiveRatio[10];
-
-   for( int i=0; i<10; i++ ) 
-   {
-      recursiveColor[i] = 0.f;
-      recursiveRatio[i] = 0.f;
-   }
-
-   // Variable declarations
-   float  shadowIntensity = 0.f;
-   float4 refractionFromColor;
-   float4 reflectedTarget;
-   float4 normal = 0;
-   float  blinn = 0.f;
-   int inters=0;
-   bool back;
-
-   while( iteration<gNbIterations && carryon ) 
-   {
-
-      // Compute intesection with lamps
-      carryon = !intersectionWithLamps( lamps, nbLamps, rayOrigin, rayTarget, &intersectionColor);
-
-      // If no intersection with lamps detected. Now compute intersection with Primitives
-      if( carryon ) 
-      {
-         carryon = intersectionWithPrimitives(
-            primitives, nbPrimitives,
-            rayOrigin, rayTarget,
-            timer, 
-            &closestPrimitive, &closestIntersection, &normal,
-            video, depth, materials, textures, transparentColor,
-            &back);
-      }
-
-      if( carryon ) 
-      {
-         inters += (back) ? -1 : 1;
-
-         // Get object color
-         recursiveColor[iteration] = colorFromObject( 
-            primitives, nbPrimitives, lamps, nbLamps, 
-            video, depth, materials, textures, 
-            origin, normal, closestPrimitive, closestIntersection, 
-            timer, &refractionFromColor, &shadowIntensity, &blinn, transparentColor );
-
-         recursiveRatio[iteration].y = blinn;
-
-         if( materials[primitives[closestPrimitive].materialId].transparency != 0.f ) 
-         {
-            // ----------
-            // Refraction
-            // ----------
-            // Replace the normal using the intersection color
-            // r,g,b become x,y,z... What the fuck!!
-            if( materials[primitives[closestPrimitive].materialId].textureId != NO_TEXTURE) 
-            {
-               refractionFromColor -= 0.5f;
-               normal *= refractionFromColor;
-            }
-             
-            O_E = rayOrigin - closestIntersection;
-            normalizeVector(O_E);
-            float refraction = materials[primitives[closestPrimitive].materialId].refraction;
-            refraction = (refraction == initialRefraction) ? 1.0f : refraction;
-            vectorRefraction( &O_R, O_E, refraction, normal, initialRefraction );
-            reflectedTarget = closestIntersection - O_R;
-               
-            initialRefraction = refraction;
-
-            recursiveRatio[iteration].x = materials[primitives[closestPrimitive].materialId].transparency;
-            recursiveRatio[iteration].z = 1.f;
-         }
-         else 
-         {
-            // ----------
-            // Reflection
-            // ----------
-            if( materials[primitives[closestPrimitive].materialId].color.w != 0.f ) 
-            {
-               O_E = rayOrigin - closestIntersection;
-               vectorReflection( O_R, O_E, normal );
-               reflectedTarget = closestIntersection - O_R;
-
-               recursiveRatio[iteration].x = materials[primitives[closestPrimitive].materialId].color.w;
-               //carryon &= (shadowIntensity!=1.f);
-            }
-            else 
-            {
-               carryon = false;
-            }
-         }
-         rayOrigin = closestIntersection; 
-         rayTarget = reflectedTarget;
-         iteration++; 
-      }
-   }
-
-   for( int i=iteration-1; i>=0; --i ) 
-   {
-      float w = recursiveColor[i].w;
-      if( recursiveRatio[i].z == 1.f ) {
-         w = recursiveColor[i].x + w*(1.f-recursiveColor[i].x);
-      }
-      recursiveColor[i] = (recursiveColor[i+1]*w*recursiveRatio[i].x + recursiveColor[i]*w*(1.f-recursiveRatio[i].x));
-   }
-   intersectionColor = recursiveColor[0];
-   
-   // Specular reflection
-   intersectionColor += recursiveRatio[0].y;
-
-   intersectionColor.x = (intersectionColor.x>1.f) ? 1.f : intersectionColor.x;
-   intersectionColor.y = (intersectionColor.y>1.f) ? 1.f : intersectionColor.y;
-   intersectionColor.z = (intersectionColor.z>1.f) ? 1.f : intersectionColor.z;
-   *intersection = closestIntersection;
-
-#if 0
-   // --------------------------------------------------
-   // Attenation effect (Fog)
-   // --------------------------------------------------
-   float4 O_I = closestIntersection - origin;
-   float len = 1.f-(vectorLength(O_I)/gMaxViewDistance);
-   len = (len>0.f) ? len : 0.f; 
-   intersectionColor *= len;
-#endif // 0
-
-   return intersectionColor;
-}
-
-
-/**
-* ________________________________________________________________________________
-* Main Kernel!!!
-* ________________________________________________________________________________
-*/
-__kernel void render_kernel( 
-   float4               origin,
-   float4               target,
-   float4               angles,
-   int                  width, 
-   int                  height, 
-   __global Primitive*  primitives, 
-   __global Lamp*       lamps, 
-   __global Material*   materials, 
-   int                  nbPrimitives,
-   int                  nbLamps,
-   int                  nbMaterials,
-   __global char*       bitmap,
-   __global char*       video,
-   __global char*       depth,
-   __global char*       textures,
-   float                timer,
-   int                  draft,
-   float                transparentColor)
-{
-   int x = get_global_id(0);
-   int y = get_global_id(1);
-   int index = y*width+x;
-
-   target.x = target.x + (float)(x - (width/2));
-   target.y = target.y + (float)(y - (height/2));
-
-   float4 rotationCenter = 0;
-
-   vectorRotation( origin, rotationCenter, angles );
-   vectorRotation( target, rotationCenter, angles );
-
-   float4 intersection;
-   float4 color = launchRay( 
-      primitives, nbPrimitives, 
-      lamps, nbLamps, 
-      origin, target, timer, 
-      materials, textures,
-      video, depth, transparentColor,
-      &intersection);
-
-   color.w = gMaxViewDistance/intersection.z;
-   for( int j=0; j<draft; j++ ) 
-   {
-      makeOpenGLColor( color, bitmap, index+j ); 
-   }
-}
+/* 
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+// Max number of ray iterations
+#ifndef gNbIterations
+#define gNbIterations 10
+#endif
+
+// Weight in the pixel under which a path stops bouncing, 0 to always bounce
+#ifndef gContributionThreshold
+#define gContributionThreshold 0.f
+#endif
+
+// Scene features. The host builds specialized variants of the kernels with the
+// -D options of the features the scene does not use set to 0
+#ifndef FEATURE_CYLINDERS
+#define FEATURE_CYLINDERS 1
+#endif
+#ifndef FEATURE_CAMERA
+#define FEATURE_CAMERA 1
+#endif
+#ifndef FEATURE_TEXTURES
+#define FEATURE_TEXTURES 1
+#endif
+#ifndef FEATURE_TRANSPARENCY
+#define FEATURE_TRANSPARENCY 1
+#endif
+#ifndef FEATURE_SHADOWS
+#define FEATURE_SHADOWS 0
+#endif
+
+// Disabled features fold to false and their code is removed by the compiler
+#define isTextured(material)    (FEATURE_TEXTURES && (material).textureId != NO_TEXTURE)
+#define isTransparent(material) (FEATURE_TRANSPARENCY && (material).transparency != 0.f)
+// Textures
+#define gTextureWidth  512
+#define gTextureHeight 512
+#define gTextureDepth  3
+
+#define gVideoColor  4
+#define gVideoWidth  640
+#define gVideoHeight 480
+
+#define gDepthColor       2
+#define gDepthWidth       320
+#define gDepthHeight      240
+
+#define gMaxViewDistance 3000.f
+#define gTextureOffset   0.f
+
+// Relative difference of depth above which a reprojected pixel is traced again
+#define gReprojectionTolerance 0.1f
+// Distance between unit normals above which reprojected neighbours disagree (about 30 degrees)
+#define gReprojectionNormalTolerance 0.5f
+
+// Post-processing passes, must match PostProcessingPass in OpenCLKernel.h
+#define PP_DENOISE      1
+#define PP_UPSCALE      2
+#define PP_TONE_MAPPING 4
+
+#define gDepthOfFieldComplexity 1
+#define gNbMaxShadowCollisions 3
+
+#define NO_TEXTURE  -1
+#define NO_MATERIAL -1
+
+#define EPSILON 1.f
+
+// Bounding volume hierarchy (must match the host constants)
+#define gBVHStackSize     64
+#define gBVHSortGroupSize 256
+#define gBVHSortChunk     4
+#define gBVHRadixBits     4
+#define gBVHRadixSize     16
+#define gBVHRadixPasses   8
+
+// Typed primitive arrays: spheres, cylinders, then one range per kind of plane
+#define gNbPrimitiveRanges 8
+#define SHAPE_TRANSPARENT  0x40000000 // Material id bit of the packed shapes
+
+// Enums
+enum PrimitiveType 
+{
+   ptSphere     = 0,
+   ptTriangle   = 1,
+   ptCheckboard = 2,
+   ptCamera     = 3,
+   ptXYPlane    = 4,
+   ptYZPlane    = 5,
+   ptXZPlane    = 6,
+   ptCylinder   = 7
+};
+
+typedef struct
+{
+   float4 color;
+   float  refraction;
+   int    textured;
+   float  transparency;
+   int    textureId;
+   float4 specular;    // x: value, y: power, w: coef, z:inner illuminatino
+
+} Material;
+
+typedef struct 
+{
+   float4 center;
+   //float4 rotation;
+   float4 size;
+   int    type;
+   int    materialId;
+   float  materialRatioX;
+   float  materialRatioY;
+} Primitive;
+
+typedef struct 
+{
+   float4 center;
+   float4 color;
+} Lamp;
+
+/*
+* Compact records, as stored in device memory. Primitives drop the deprecated
+* center.w, the unused size.z/size.w and derive the texture ratios from the 
+* material padding. Materials hold half floats. Both are unpacked by 
+* loadPrimitive and loadMaterial.
+*/
+typedef struct
+{
+   float  x, y, z;       // Center
+   float  width, height; // Size
+   short  materialId;
+   uchar  type;
+   uchar  padding;       // Material padding
+} PrimitiveRecord;
+
+typedef struct
+{
+   ushort color[4];      // Half floats, w: reflection
+   ushort specular[4];   // Half floats, x: value, y: power, w: coef, z:inner illumination
+   ushort refraction;    // Half float
+   ushort transparency;  // Half float
+   short  textureId;
+   ushort flags;         // Bit 0: textured
+} MaterialRecord;
+
+#define MATERIAL_TEXTURED 1
+
+typedef struct
+{
+   float4 min;
+   float4 max;
+   int    left;         // Interior: left child, Leaf: first entry in the index array
+   int    right;        // Interior: right child
+   int    nbPrimitives; // 0 for interior nodes
+   int    parent;
+} BoundingVolume;
+
+typedef struct
+{
+   float4 transform;  // x,y,z: translation, w: uniform scale
+   int    geometryId;
+   int    materialId; // Overrides the material of the geometry unless NO_MATERIAL
+   int    rootNode;   // Root of the geometry in the bottom level hierarchy
+   int    reserved;
+} Instance;
+
+// State of a path in the wavefront pipeline, one per pixel
+typedef struct
+{
+   float4    origin;       // Current segment of the path
+   float4    target;
+   float4    color;        // Color accumulated along the path
+   float4    intersection; // Last intersection with a primitive
+   float4    normal;       // Normal at the last intersection
+   float4    lamps;        // x,y,z: color of the lamps, w: intensity (shadow stage)
+   Primitive object;       // Primitive hit by the current segment
+   float     throughput;   // Weight of the current segment in the final color
+   float     refraction;   // Refraction index of the current medium
+   float     blinn;        // Specular term of the first intersection
+   int       iteration;
+} Ray;
+
+// Primary intersection and color of a pixel, reprojected into the next view
+typedef struct
+{
+   float4 intersection; // w: distance to the eye, negative when the pixel has to be traced
+   float4 normal;       // 0 when the ray missed every primitive
+   float4 color;
+} HistorySample;
+
+// ________________________________________________________________________________
+Primitive loadPrimitive( 
+   __global PrimitiveRecord* primitives,
+   int                       index )
+{
+   PrimitiveRecord record = primitives[index];
+   Primitive primitive;
+   primitive.center.x = record.x;
+   primitive.center.y = record.y;
+   primitive.center.z = record.z;
+   primitive.center.w = record.width;
+   primitive.size.x   = record.width;
+   primitive.size.y   = record.height;
+   primitive.size.z   = 0.f;
+   primitive.size.w   = 0.f;
+   primitive.type           = record.type;
+   primitive.materialId     = record.materialId;
+   primitive.materialRatioX = (gTextureWidth/record.width/2)*record.padding;
+   primitive.materialRatioY = (gTextureHeight/record.height/2)*record.padding;
+   return primitive;
+}
+
+// ________________________________________________________________________________
+Material loadMaterial( 
+   __global MaterialRecord* materials,
+   int                      index )
+{
+   __global MaterialRecord* record = &materials[index];
+   Material material;
+   material.color        = vload_half4( 0, (__global half*)record->color );
+   material.specular     = vload_half4( 0, (__global half*)record->specular );
+   material.refraction   = vload_half( 0, (__global half*)&record->refraction );
+   material.transparency = vload_half( 0, (__global half*)&record->transparency );
+   material.textureId    = record->textureId;
+   material.textured     = record->flags & MATERIAL_TEXTURED;
+   return material;
+}
+
+// ________________________________________________________________________________
+void makeDelphiColor( 
+   float4         color, 
+   __global char* bitmap, 
+   int            index)
+{
+   int mdc_index = index*3; 
+   color.x = (color.x>1.f) ? 1.f : color.x;
+   color.y = (color.y>1.f) ? 1.f : color.y; 
+   color.z = (color.z>1.f) ? 1.f : color.z;
+   bitmap[mdc_index  ] = (char)(color.z*255.f);
+   bitmap[mdc_index+1] = (char)(color.y*255.f);
+   bitmap[mdc_index+2] = (char)(color.x*255.f);
+}
+
+// ________________________________________________________________________________
+void makeOpenGLColor( 
+   float4         color, 
+   __global char* bitmap, 
+   int            index)
+{
+   int mdc_index = index*4; 
+   color.x = (color.x>1.f) ? 1.f : color.x;
+   color.y = (color.y>1.f) ? 1.f : color.y; 
+   color.z = (color.z>1.f) ? 1.f : color.z;
+   color.w = (color.w>1.f) ? 1.f : color.w;
+   bitmap[mdc_index  ] = (char)(color.x*255.f); // Red
+   bitmap[mdc_index+1] = (char)(color.y*255.f); // Green
+   bitmap[mdc_index+2] = (char)(color.z*255.f); // Blue
+   bitmap[mdc_index+3] = (char)(color.w*255.f); // Alpha
+}
+
+// Middle of the range truncated by makeOpenGLColor, colors read and written
+// back are unchanged
+float4 readOpenGLColor( 
+   __global char* bitmap, 
+   int            index)
+{
+   int mdc_index = index*4; 
+   float4 color;
+   color.x = ((float)((uchar)bitmap[mdc_index  ])+0.5f)/255.f;
+   color.y = ((float)((uchar)bitmap[mdc_index+1])+0.5f)/255.f;
+   color.z = ((float)((uchar)bitmap[mdc_index+2])+0.5f)/255.f;
+   color.w = ((float)((uchar)bitmap[mdc_index+3])+0.5f)/255.f;
+   return color;
+}
+
+// ________________________________________________________________________________
+#if 1
+#define vectorLength( vector ) \
+   (half_sqrt( (vector).x*(vector).x + (vector).y*(vector).y + (vector).z*(vector).z ))
+#else
+#define vectorLength( vector ) \
+   fast_length(vector)
+#endif
+
+// ________________________________________________________________________________
+#define normalizeVector( v ) \
+   v /= vectorLength( v );
+
+// ________________________________________________________________________________
+#if 1
+float dotProduct( float4 v1, float4 v2 ) 
+{
+   return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
+}
+#else
+#define dotProduct( v1, v2 )\
+   dot(v1,v2)
+#endif // 0
+
+/*
+________________________________________________________________________________
+incident  : le vecteur normal inverse a la direction d'incidence de la source 
+lumineuse
+normal    : la normale a l'interface orientee dans le materiau ou se propage le 
+rayon incident
+reflected : le vecteur normal reflechi
+________________________________________________________________________________
+*/
+#define vectorReflection( __r, __i, __n ) \
+   __r = __i-2.f*dotProduct(__i,__n)*__n;
+
+/*
+________________________________________________________________________________
+incident: le vecteur norm? inverse ? la direction d?incidence de la source 
+lumineuse
+n1      : index of refraction of original medium
+n2      : index of refraction of new medium
+________________________________________________________________________________
+*/
+void vectorRefraction( float4* refracted, float4 incident, float n1, float4 normal, float n2 )
+{
+	(*refracted) = incident;
+	if(n1!=n2 && n2!=0.f) 
+	{
+		float r = n1/n2;
+		float cosI = dotProduct( incident, normal );
+		float cosT2 = 1.f - r*r*(1.f - cosI*cosI);
+		(*refracted) = r*incident + (r*cosI-sqrt( fabs(cosT2) ))*normal;
+	}
+}
+
+/*
+________________________________________________________________________________
+__v : Vector to rotate
+__c : Center of rotations
+__a : Angles
+________________________________________________________________________________
+*/
+#define vectorRotation( __v, __c, __a ) \
+{ \
+   float4 __r = __v; \
+   /* X axis */ \
+   __r.y = __v.y*half_cos(angles.x) - __v.z*half_sin(__a.x); \
+   __r.z = __v.y*half_sin(angles.x) + __v.z*half_cos(__a.x); \
+   __v = __r; \
+   __r = __v; \
+   /* Y axis */ \
+   __r.z = __v.z*half_cos(__a.y) - __v.x*half_sin(__a.y); \
+   __r.x = __v.z*half_sin(__a.y) + __v.x*half_cos(__a.y); \
+   __v = __r; \
+}
+
+/*
+________________________________________________________________________________
+Inverse of vectorRotation (center of rotations at the origin)
+__v : Vector to rotate
+__a : Angles
+________________________________________________________________________________
+*/
+#define vectorInverseRotation( __v, __a ) \
+{ \
+   float4 __r = __v; \
+   /* Y axis */ \
+   __r.z =  __v.z*half_cos(__a.y) + __v.x*half_sin(__a.y); \
+   __r.x = -__v.z*half_sin(__a.y) + __v.x*half_cos(__a.y); \
+   __v = __r; \
+   __r = __v; \
+   /* X axis */ \
+   __r.y =  __v.y*half_cos(__a.x) + __v.z*half_sin(__a.x); \
+   __r.z = -__v.y*half_sin(__a.x) + __v.z*half_cos(__a.x); \
+   __v = __r; \
+}
+
+/**
+* ________________________________________________________________________________
+* sphereMapping
+* ________________________________________________________________________________
+*/
+float4 sphereMapping( 
+   Primitive                primitive,
+   float4                   intersection,
+   __global MaterialRecord* materials,
+   __global char*           textures )
+{
+   Material material = loadMaterial( materials, primitive.materialId );
+   float4 result = material.color;
+   int x = gTextureOffset+(intersection.x-primitive.center.x+primitive.size.x)*primitive.materialRatioX;
+   int y = gTextureOffset+(intersection.y-primitive.center.y+primitive.size.y)*primitive.materialRatioY;
+
+   x = x % gTextureWidth;
+   y = y % gTextureHeight;
+
+   if( x>=0 && x<gTextureWidth&& y>=0 && y<gTextureHeight )
+   {
+      int index = (material.textureId*gTextureWidth*gTextureHeight + y*gTextureWidth+x)*gTextureDepth;
+      unsigned char r = textures[index  ];
+      unsigned char g = textures[index+1];
+      unsigned char b = textures[index+2];
+      result.x = r/256.f;
+      result.y = g/256.f;
+      result.z = b/256.f;
+   }
+   return result; 
+}
+
+/**
+* ________________________________________________________________________________
+* cubeMapping
+* ________________________________________________________________________________
+*/
+float4 cubeMapping( 
+   Primitive                primitive,
+   float4                   intersection,
+   __global MaterialRecord* materials,
+   __global char*           textures)
+{
+   Material material = loadMaterial( materials, primitive.materialId );
+   float4 result = material.color;
+   int x = ((primitive.type == ptCheckboard) ||
+            (primitive.type == ptXZPlane)    ||
+            (primitive.type == ptXYPlane))  ? 
+        gTextureOffset+(intersection.x-primitive.center.x+primitive.size.x)*primitive.materialRatioX:
+        gTextureOffset+(intersection.z-primitive.center.z+primitive.size.x)*primitive.materialRatioX;
+
+   int y = ((primitive.type == ptCheckboard)  ||
+            (primitive.type == ptXZPlane)) ? 
+        gTextureOffset+(intersection.z-primitive.center.z+primitive.size.y)*primitive.materialRatioY:
+        gTextureOffset+(intersection.y-primitive.center.y+primitive.size.y)*primitive.materialRatioY;
+   x = x % gTextureWidth;
+   y = y % gTextureHeight;
+
+   if( x>=0 && x<gTextureWidth&& y>=0 && y<gTextureHeight )
+   {
+      int index = (material.textureId*gTextureWidth*gTextureHeight + y*gTextureWidth+x)*gTextureDepth;
+      unsigned char r = textures[index];
+      unsigned char g = textures[index+1];
+      unsigned char b = textures[index+2];
+      result.x = r/256.f;
+      result.y = g/256.f;
+      result.z = b/256.f;
+   }
+   return result;
+}
+
+/**
+* ________________________________________________________________________________
+* Colors
+* ________________________________________________________________________________
+*/
+float4 objectColorAtIntersection( 
+   Primitive                primitive,
+   float4                   intersection,
+   __global char*           video,
+   __global char*           depth,
+   __global MaterialRecord* materials,
+   __global char*           textures,
+   float                    timer,
+   bool                     back )
+{
+   Material material = loadMaterial( materials, primitive.materialId );
+   float4 colorAtIntersection = material.color;
+   switch( primitive.type ) 
+   {
+   case ptSphere:
+   case ptCylinder:
+      {
+         colorAtIntersection = 
+            (isTextured(material) && (intersection.w==0.f)) ? 
+            sphereMapping(primitive, intersection, materials, textures) : 
+            colorAtIntersection;
+         break;
+      }
+   case ptTriangle:
+   case ptCheckboard :
+      {
+         if( isTextured(material) ) 
+         {
+            colorAtIntersection = cubeMapping( primitive, intersection, materials, textures );
+         }
+         else 
+         {
+            int x = gMaxViewDistance + (intersection.x - primitive.center.x)/50.f;
+            int z = gMaxViewDistance + (intersection.z - primitive.center.z)/50.f;
+            if(x%2==0) 
+            {
+               if (z%2==0) 
+               {
+                  colorAtIntersection.x = 1.0f;
+                  colorAtIntersection.y = 1.0f;
+                  colorAtIntersection.z = 1.0f;
+               }
+            }
+            else 
+            {
+               if (z%2!=0) 
+               {
+                  colorAtIntersection.x = 1.0f;
+                  colorAtIntersection.y = 1.0f;
+                  colorAtIntersection.z = 1.0f;
+               }
+            }
+         }
+         break;
+      }
+   case ptXYPlane:
+   case ptYZPlane:
+   case ptXZPlane:
+      {
+         colorAtIntersection = 
+            isTextured(material) ? 
+            cubeMapping( primitive, intersection, materials, textures ) : 
+            colorAtIntersection;
+         break;
+      }
+#if FEATURE_CAMERA
+   case ptCamera:
+      {
+         colorAtIntersection = material.color;
+         int x = (primitive.center.x + intersection.x)+gVideoWidth/2;
+         int y = gVideoHeight/2 - (intersection.y - primitive.center.y);
+         if( x>=0 && x<gVideoWidth && y>=0 && y<gVideoHeight ) 
+         {
+            int index = (y*gVideoWidth+x)*4;
+            unsigned char r = video[index+2];
+            unsigned char g = video[index+1];
+            unsigned char b = video[index+0];
+            colorAtIntersection.x = r/256.f;
+            colorAtIntersection.y = g/256.f;
+            colorAtIntersection.z = b/256.f;
+         }
+#if 0
+         int x = 2.f*(primitive.center.x + intersection.x)+gDepthWidth/2;
+         int y = gDepthHeight/2 - 2.f*(intersection.y - primitive.center.y);
+         if( x>=0 && x<gDepthWidth && y>=0 && y<gDepthHeight ) {
+            int index = (y*gDepthWidth+x)*2;
+            char s = depth[index] & 0x07;
+            //if( s != 0 ) 
+            {
+               char a = depth[index] & 0x1F;
+               int realDepth = (depth[index+1]<<5)|(a>>3);
+               float intensity = 1.f - realDepth/4000.f;
+               colorAtIntersection.x = intensity;
+               colorAtIntersection.y = intensity;
+               colorAtIntersection.z = intensity;
+            }
+         }
+#endif // 0
+         break;
+      }
+#endif // FEATURE_CAMERA
+   }
+   return colorAtIntersection;
+}
+
+/**
+________________________________________________________________________________
+Lamp Intersection
+Lamp         : Object on which we want to find the intersection
+origin       : Origin of the ray
+orientation  : Orientation of the ray
+intersection : Resulting intersection
+invert       : true if we want to check the front of the sphere, false for the 
+back
+returns true if there is an intersection, false otherwise
+________________________________________________________________________________
+*/
+bool lampIntersection( 
+   Lamp    lamp, 
+   float4  origin, 
+   float4  ray, 
+   float4  O_C,
+   float4* intersection)
+{
+   float si_A = 2.f*(ray.x*ray.x + ray.y*ray.y + ray.z*ray.z);
+   if ( si_A == 0.f ) return false;
+
+   bool  si_b1 = false; 
+   float si_B = 2.f*(O_C.x*ray.x + O_C.y*ray.y + O_C.z*ray.z);
+   float si_C = O_C.x*O_C.x+O_C.y*O_C.y+O_C.z*O_C.z-lamp.center.w*lamp.center.w;
+   float si_radius = si_B*si_B-2.f*si_A*si_C;
+   float si_t1 = (-si_B-half_sqrt(si_radius))/si_A;
+
+   if( si_t1>0.f ) 
+   {
+      *intersection = origin+si_t1*ray;
+      si_b1 = true;
+   }
+   return si_b1;
+}
+
+
+/**
+________________________________________________________________________________
+Sphere Intersection
+primitive    : Object on which we want to find the intersection
+origin       : Origin of the ray
+orientation  : Orientation of the ray
+intersection : Resulting intersection
+invert       : true if we want to check the front of the sphere, false for the 
+back
+returns true if there is an intersection, false otherwise
+________________________________________________________________________________
+*/
+bool sphereRecordIntersection( 
+   float4             sphere, 
+   float4             origin, 
+   float4             ray, 
+   float4*            intersection,
+   float4*            normal,
+   bool*              back
+   ) 
+{
+	// solve the equation sphere-ray to find the intersections
+	float4 O_C = origin-sphere;
+	float4 dir = ray;
+	normalizeVector( dir );
+
+	float a = 2.f*dotProduct(dir,dir);
+	float b = 2.f*dotProduct(O_C,dir);
+	float c = dotProduct(O_C,O_C) - sphere.w;
+	float d = b*b-2.f*a*c;
+
+	if( d<=0.f || a == 0.f) return false;
+	float r = sqrt(d);
+	float t1 = (-b-r)/a;
+	float t2 = (-b+r)/a;
+
+	if( t1<=EPSILON && t2<=EPSILON ) return false; // both intersections are behind the ray origin
+	*back = (t1<=EPSILON || t2<=EPSILON); // If only one intersection (t>0) then we are inside the sphere and the intersection is at the back of the sphere
+
+	float t=0.f;
+	if( t1<=EPSILON ) 
+		t = t2;
+	else 
+		if( t2<=EPSILON )
+			t = t1;
+		else
+			t=(t1<t2) ? t1 : t2;
+
+	if( t<EPSILON ) return false; // Too close to intersection
+	*intersection = origin+t*dir;
+
+	// Compute normal vector
+	(*normal) = *intersection-sphere;
+	(*normal).w = 0.f;
+	(*normal) *= (back) ? -1.f : 1.f;
+	normalizeVector(*normal);
+
+	return true;
+}
+
+bool sphereIntersection( 
+   Primitive                sphere,
+   float4                   origin,
+   float4                   ray,
+   float                    timer,
+   float4*                  intersection,
+   float4*                  normal,
+   bool                     computingShadows,
+   float*                   shadowIntensity,
+   __global char*           video,
+   __global char*           depth,
+   __global MaterialRecord* materials,
+   __global char*           textures,
+   float                    transparentColor,
+   bool*                    back
+   ) 
+{
+   float4 center = sphere.center;
+   center.w = sphere.size.x*sphere.size.x;
+   return sphereRecordIntersection( center, origin, ray, intersection, normal, back );
+}
+
+/**
+________________________________________________________________________________
+Cylinder Intersection
+primitive    : Object on which we want to find the intersection
+origin       : Origin of the ray
+orientation  : Orientation of the ray
+intersection : Resulting intersection
+invert       : true if we want to check the front of the sphere, false for the 
+back
+returns true if there is an intersection, false otherwise
+________________________________________________________________________________
+*/
+bool cylinderIntersection( 
+   Primitive                cylinder,
+   float4                   origin,
+   float4                   ray,
+   float                    timer,
+   float4*                  intersection,
+   float4*                  normal,
+   bool                     computingShadows,
+   float*                   shadowIntensity,
+   __global char*           video,
+   __global char*           depth,
+   __global MaterialRecord* materials,
+   __global char*           textures,
+   float                    transparentColor
+   ) 
+{
+   // solve the equation sphere-ray to find the intersections
+   Material material = loadMaterial( materials, cylinder.materialId );
+   bool result = false;
+   //bool reverseNormal = false;
+
+   // Top
+   if(!result && ray.y<0.f && origin.y>(cylinder.center.y+cylinder.size.y)) 
+   {
+      (*intersection).y = cylinder.center.y+cylinder.size.y;
+      float y = origin.y-cylinder.center.y-cylinder.size.y;
+      (*intersection).x = origin.x+y*ray.x/-ray.y;
+      (*intersection).z = origin.z+y*ray.z/-ray.y;
+      (*intersection).w = 1.f; // 1 for top, -1 for bottom
+
+      float4 v=(*intersection)-cylinder.center;
+      v.y = 0.f;
+      result = (vectorLength(v)<cylinder.size.x);
+
+      (*normal).x =  0.f;
+      (*normal).y =  1.f;
+      (*normal).z =  0.f;
+   }
+
+   // Bottom
+   if( !result && ray.y>0.f && origin.y<(cylinder.center.y - cylinder.size.y) ) 
+   {
+      (*intersection).y = cylinder.center.y - cylinder.size.y;
+      float y = origin.y - cylinder.center.y + cylinder.size.y;
+      (*intersection).x = origin.x+y*ray.x/-ray.y;
+      (*intersection).z = origin.z+y*ray.z/-ray.y;
+      (*intersection).w = -1.f; // 1 for top, -1 for bottom
+
+      float4 v=(*intersection)-cylinder.center;
+      v.y = 0.f;
+      result = (vectorLength(v)<cylinder.size.x);
+
+      (*normal).x =  0.f;
+      (*normal).y = -1.f;
+      (*normal).z =  0.f;
+   }
+
+   if( !result ) 
+   {
+      float4 O_C = origin - cylinder.center;
+      O_C.y = 0.f;
+      if(( dotProduct( O_C, ray ) > 0.f ) && (vectorLength(O_C) > cylinder.center.w)) return false;
+
+      float a = 2.f * ( ray.x*ray.x + ray.z*ray.z );
+      float b = 2.f*((origin.x-cylinder.center.x)*ray.x + (origin.z-cylinder.center.z)*ray.z);
+      float c = O_C.x*O_C.x + O_C.z*O_C.z - cylinder.center.w*cylinder.center.w;
+
+      float r = half_sqrt(b*b-2.f*a*c);
+
+      // Cylinder
+      if ( r < 0.f ) return false;
+   
+      a = ( a==0.f ) ? 0.0001f : a;
+      float t1 = (-b-r)/a;
+      float t2 = (-b+r)/a;
+      float ta = (t1<t2) ? t1 : t2;
+      float tb = (t2<t1) ? t1 : t2;
+   
+      if( ta >  0.001f ) 
+      {
+         *intersection = origin+ta*ray;
+         (*intersection).w = 0.f;
+
+         result = ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y );
+         if( result && isTransparent(material) ) 
+         {
+            float4 color = objectColorAtIntersection( cylinder, *intersection, video, depth, materials, textures, timer, false );
+            result = 
+               ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y ) &&
+               ( (color.x+color.y+color.z) >= transparentColor ); 
+         }
+      }
+
+      if( !result && tb > 0.001f ) 
+      {
+         *intersection = origin+tb*ray;
+         (*intersection).w = 0.f;
+
+         result = ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y );
+         //reverseNormal = true;
+         if( result && isTransparent(material) ) 
+         {
+            float4 color = objectColorAtIntersection( cylinder, *intersection, video, depth, materials, textures, timer, false );
+            result = 
+               ( fabs((*intersection).y - cylinder.center.y) <= cylinder.size.y ) &&
+               ( (color.x+color.y+color.z) >= transparentColor ); 
+         }
+      }
+
+      if( result )
+      {
+         (*normal) = (*intersection)-cylinder.center;
+         (*normal).y = 0.f;
+      }
+   }
+
+   // Normal to surface
+   if( result && !computingShadows ) 
+   {
+      if( material.textured ) 
+      {
+         float4 newCenter;
+         newCenter.x = cylinder.center.x + 5.f*half_cos(timer*0.58f+(*intersection).x);
+         newCenter.y = cylinder.center.y + 5.f*half_sin(timer*0.85f+(*intersection).y) + (*intersection).y;
+         newCenter.z = cylinder.center.z + 5.f*half_sin(half_cos(timer*1.24f+(*intersection).z));
+         *normal = *intersection-newCenter;
+      }
+      //*normal *= reverseNormal ? -1.f : 1.f; 
+      normalizeVector( *normal );
+   }
+
+#if 0
+   if( result && computingShadows ) 
+   {
+      float4 normal = normalToSurface( cylinder, *intersection, depth, materials, timer ); // Normal is computed twice!!!
+      normalizeVector(ray );
+      normalizeVector(normal);
+      *shadowIntensity = 5.f*fabs(dotProduct(-ray ,normal));
+      *shadowIntensity = (*shadowIntensity>1.f) ? 1.f : *shadowIntensity;
+   } 
+#else
+   *shadowIntensity = 1.f;
+#endif // 0
+   return result;
+}
+
+/**
+________________________________________________________________________________
+Checkboard Intersection
+primitive    : Object on which we want to find the intersection
+origin       : Origin of the ray
+orientation  : Orientation of the ray
+intersection : Resulting intersection
+invert       : true if we want to check the front of the sphere, false for the 
+back
+returns true if there is an intersection, false otherwise
+________________________________________________________________________________
+*/
+bool planeIntersection( 
+   Primitive                primitive,
+   float4                   origin,
+   float4                   ray,
+   bool                     reverse,
+   float*                   shadowIntensity,
+   __global char*           depth,
+   __global MaterialRecord* materials,
+   __global char*           textures,
+   float4*                  intersection,
+   float4*                  normal,
+   float                    transparentColor)
+{ 
+   //vectorRotation( &origin, primitive.center, primitive.rotation );
+   //vectorRotation( &ray,    primitive.center, primitive.rotation );
+   float reverted = reverse ? -1.f : 1.f;
+   bool collision = false;
+   switch( primitive.type ) 
+   {
+      case ptCheckboard:
+         {
+            (*intersection).y = primitive.center.y;
+            float y = origin.y-primitive.center.y;
+            if( reverted*ray.y<0.f && reverted*origin.y>reverted*primitive.center.y) 
+            {
+               (*intersection).x = origin.x+y*ray.x/-ray.y;
+               (*intersection).z = origin.z+y*ray.z/-ray.y;
+               collision = 
+                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
+                  fabs((*intersection).z - primitive.center.z) < primitive.size.y;
+               (*normal).x =  0.f;
+               (*normal).y =  1.f;
+               (*normal).z =  0.f;
+            }
+            break;
+         }
+      case ptXZPlane:
+         {
+            float y = origin.y-primitive.center.y;
+            if( reverted*ray.y<0.f && reverted*origin.y>reverted*primitive.center.y) 
+            {
+               (*normal).x =  0.f;
+               (*normal).y =  1.f;
+               (*normal).z =  0.f;
+               (*intersection).y = primitive.center.y;
+               (*intersection).x = origin.x+y*ray.x/-ray.y;
+               (*intersection).z = origin.z+y*ray.z/-ray.y;
+               collision = 
+                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
+                  fabs((*intersection).z - primitive.center.z) < primitive.size.y;
+            }
+            if( !collision && reverted*ray.y>0.f && reverted*origin.y<reverted*primitive.center.y) 
+            {
+               (*intersection).x = origin.x+y*ray.x/-ray.y;
+               (*intersection).z = origin.z+y*ray.z/-ray.y;
+               collision = 
+                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
+                  fabs((*intersection).z - primitive.center.z) < primitive.size.y;
+               (*normal).x =  0.f;
+               (*normal).y =  -1.f;
+               (*normal).z =  0.f;
+            }
+            break;
+         }
+      case ptYZPlane:
+         {
+            float x = origin.x-primitive.center.x;
+            if( reverted*ray.x<0.f && reverted*origin.x>reverted*primitive.center.x ) 
+            {
+               (*intersection).x = primitive.center.x;
+               (*intersection).y = origin.y+x*ray.y/-ray.x;
+               (*intersection).z = origin.z+x*ray.z/-ray.x;
+               collision = 
+                  fabs((*intersection).y - primitive.center.y) < primitive.size.y &&
+                  fabs((*intersection).z - primitive.center.z) < primitive.size.x;
+               (*normal).x =  1.f;
+               (*normal).y =  0.f;
+               (*normal).z =  0.f;
+            }
+            if( !collision && reverted*ray.x>0.f && reverted*origin.x<reverted*primitive.center.x ) 
+            {
+               (*intersection).x = primitive.center.x;
+               (*intersection).y = origin.y+x*ray.y/-ray.x;
+               (*intersection).z = origin.z+x*ray.z/-ray.x;
+               collision = 
+                  fabs((*intersection).y - primitive.center.y) < primitive.size.y &&
+                  fabs((*intersection).z - primitive.center.z) < primitive.size.x;
+               (*normal).x = -1.f;
+               (*normal).y =  0.f;
+               (*normal).z =  0.f;
+            }
+            break;
+         }
+      case ptXYPlane:
+         {
+            float z = origin.z-primitive.center.z;
+            if( reverted*ray.z<0.f && reverted*origin.z>reverted*primitive.center.z) 
+            {
+               (*intersection).z = primitive.center.z;
+               (*intersection).x = origin.x+z*ray.x/-ray.z;
+               (*intersection).y = origin.y+z*ray.y/-ray.z;
+               collision = 
+                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
+                  fabs((*intersection).y - primitive.center.y) < primitive.size.y;
+               (*normal).x =  0.f;
+               (*normal).y =  0.f;
+               (*normal).z =  1.f;
+            }
+            if( !collision && reverted*ray.z>0.f && reverted*origin.z<reverted*primitive.center.z )
+            {
+               (*intersection).z = primitive.center.z;
+               (*intersection).x = origin.x+z*ray.x/-ray.z;
+               (*intersection).y = origin.y+z*ray.y/-ray.z;
+               collision = 
+                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
+                  fabs((*intersection).y - primitive.center.y) < primitive.size.y;
+               (*normal).x =  0.f;
+               (*normal).y =  0.f;
+               (*normal).z = -1.f;
+            }
+            break;
+         }
+#if FEATURE_CAMERA
+      case ptCamera:
+         {
+            if( reverted*ray.z>0.f && reverted*origin.z<reverted*primitive.center.z )
+            {
+               (*intersection).z = primitive.center.z;
+               float z = origin.z-primitive.center.z;
+               (*intersection).x = origin.x+z*ray.x/-ray.z;
+               (*intersection).y = origin.y+z*ray.y/-ray.z;
+               collision =
+                  fabs((*intersection).x - primitive.center.x) < primitive.size.x &&
+                  fabs((*intersection).y - primitive.center.y) < primitive.size.y;
+               (*normal).x =  0.f;
+               (*normal).y =  0.f;
+               (*normal).z = -1.f;
+            }
+            break;
+         }
+#endif // FEATURE_CAMERA
+      }
+
+   if( collision ) 
+   {
+      Material material = loadMaterial( materials, primitive.materialId );
+      if( /*material.color.w != 0.f &&*/
+         isTransparent(material) && 
+         isTextured(material) ) 
+      {
+         float4 color = cubeMapping(primitive, *intersection, materials, textures );
+         *shadowIntensity = (color.x+color.y+color.z)/3.f;
+         collision = ( *shadowIntensity >= transparentColor );
+      }
+      else 
+      {
+         *shadowIntensity = 1.f;
+      }
+   }
+   //vectorRotation( intersection, primitive.center, -primitive.rotation );
+   return collision;
+}
+
+/*
+Shadows computation
+We do not consider the object from which the ray is launched...
+This object cannot shadow itself !
+
+We now have to find the intersection between the considered object and the ray which origin is the considered 3D float4
+and which direction is defined by the light source center.
+
+* Lamp                     Ray = Origin -> Light Source Center
+\
+\##
+#### object
+##
+\
+\  Origin
+--------O-------
+*/
+float shadow( 
+   __global PrimitiveRecord* primitives,
+   int                       nbPrimitives,
+   float4                    lampCenter,
+   float4                    origin,
+   float                     timer,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float                     transparentColor)
+{
+   float result = 0.f;
+   float4 O_L = lampCenter - origin;
+   int cptPrimitives = 0;
+   int collision = 0;
+   while( result<1.f && (collision<gNbMaxShadowCollisions) && (cptPrimitives<nbPrimitives) ) 
+   {
+      float4 intersection = 0;
+      float4 normal = 0;
+      float shadowIntensity = 0.f;
+      bool hit = false;
+      bool back;
+      Primitive primitive = loadPrimitive( primitives, cptPrimitives );
+
+      switch(primitive.type)
+      {
+      case ptSphere  : hit = sphereIntersection( primitive, origin, O_L, timer, &intersection, &normal, true, &shadowIntensity, video, depth, materials, textures, transparentColor, &back ); break;
+#if FEATURE_CYLINDERS
+      case ptCylinder: hit = cylinderIntersection( primitive, origin, O_L, timer, &intersection, &normal, true, &shadowIntensity, video, depth, materials, textures, transparentColor ); break;
+#endif // FEATURE_CYLINDERS
+      default        : 
+         hit = planeIntersection( primitive, origin, O_L, true, &shadowIntensity, depth, materials, textures, &intersection, &normal, transparentColor ); 
+         if( hit ) 
+         {
+            float4 O_I = intersection-origin;
+            hit = ( vectorLength(O_I)<vectorLength(O_L) );
+         }
+         break;
+      }
+
+      if( hit ) 
+      {
+         collision++;
+         if( collision == gNbMaxShadowCollisions ) 
+         {
+            result = 1.f;
+         }
+         else
+         {
+            Material material = loadMaterial( materials, primitive.materialId );
+            shadowIntensity *= 
+               isTransparent(material) ?
+               1.f - material.transparency :  // Shadow intensity of a transparent object
+               1.f;
+
+            if( primitive.type == ptSphere || primitive.type == ptCylinder )
+            {
+               float4 O_I = intersection-origin;
+               // Shadow exists only if object is between origin and lamp
+               shadowIntensity = (vectorLength(O_I) < vectorLength(O_L)) ? shadowIntensity : 0.f;
+            }
+            result += shadowIntensity;
+         }
+      }
+      cptPrimitives++; 
+   }
+
+   return (result>1.f) ? 1.f : result;
+}
+
+
+/*
+* lampsAtIntersection
+* Light received by the intersection: x,y,z hold the color of the lamps that 
+* are not in the shades, w the total intensity
+*/
+float4 lampsAtIntersection(
+   __global PrimitiveRecord* primitives,
+   int                       nbPrimitives,
+   __global Lamp*            lamps,
+   int                       NbLamps,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float4                    origin,
+   float4                    normal,
+   Primitive                 primitive,
+   float4                    intersection,
+   float                     timer,
+   float*                    shadowIntensity,
+   float*                    totalBlinn,
+   float                     transparentColor,
+   float4                    lampJitter)
+{
+   Material material = loadMaterial( materials, primitive.materialId );
+   float4 lampsColor = 0;
+
+   // Lamp Impact
+   float lambert = 0.f;
+   float totalIntensity = 0.f;
+   *totalBlinn = 0.f;
+
+   for( int cptLamps=0; cptLamps<NbLamps; cptLamps++ ) 
+   {
+#if FEATURE_SHADOWS
+      // Jittered samples spread the shadow rays over the lamp for soft shadows
+      float4 lampCenter = lamps[cptLamps].center + lampJitter*lamps[cptLamps].center.w;
+      *shadowIntensity = shadow( primitives, nbPrimitives, lampCenter, intersection, timer, video, depth, materials, textures, transparentColor );
+#else
+      *shadowIntensity = 0.f;
+#endif // FEATURE_SHADOWS
+
+      // Lighted object, not in the shades
+      if( (*shadowIntensity) != 1.0f )
+      {
+         float4 lightRay = lamps[cptLamps].center - intersection;
+         lampsColor += lamps[cptLamps].color;
+
+         // Lambert
+         normalizeVector(lightRay);
+         lambert = dotProduct(lightRay, normal);
+         lambert = (lambert<0.f) ? 0.f : lambert;
+         lambert *= (material.refraction == 0.f) ? lamps[cptLamps].color.w : 1.f;
+         lambert *= (1.f-*shadowIntensity);
+
+         totalIntensity += lambert; // + material.specular.z; // Lambert + inner illumination
+
+         // --------------------------------------------------------------------------------
+         // Blinn - Phong
+         // --------------------------------------------------------------------------------
+         float4 viewRay = intersection - origin;
+         normalizeVector(viewRay);
+
+         float4 blinnDir = lightRay - viewRay;
+         float temp = half_sqrt(dotProduct(blinnDir,blinnDir));
+         if (temp != 0.f ) 
+         {
+            // Specular reflection
+            blinnDir = (1.f / temp) * blinnDir;
+
+            float blinnTerm = dotProduct(blinnDir,normal);
+            blinnTerm = ( blinnTerm < 0.f) ? 0.f : blinnTerm;
+
+            blinnTerm = 
+               material.specular.x * 
+               pow(blinnTerm , material.specular.y) * 
+               material.specular.w;
+
+            *totalBlinn += lamps[cptLamps].color.w * blinnTerm;
+         }
+      }
+   }
+
+   lampsColor.w = totalIntensity;
+   *totalBlinn = (*totalBlinn>1.f) ? 1.f : *totalBlinn;
+
+   return lampsColor;
+}
+
+/*
+* colorFromObject 
+*/
+float4 colorFromObject(
+   __global PrimitiveRecord* primitives,
+   int                       nbPrimitives,
+   __global Lamp*            lamps,
+   int                       NbLamps,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float4                    origin,
+   float4                    normal,
+   Primitive                 primitive,
+   float4                    intersection,
+   float                     timer,
+   float4*                   refractionFromColor,
+   float*                    shadowIntensity,
+   float*                    totalBlinn,
+   float                     transparentColor,
+   float4                    lampJitter)
+{
+   float4 lampsColor = lampsAtIntersection( 
+      primitives, nbPrimitives, lamps, NbLamps, 
+      video, depth, materials, textures, 
+      origin, normal, primitive, intersection, 
+      timer, shadowIntensity, totalBlinn, transparentColor, lampJitter );
+
+   // Final color
+   float4 intersectionColor = objectColorAtIntersection( primitive, intersection, video, depth, materials, textures, timer, false );
+
+   float4 color = intersectionColor*lampsColor;
+   color.w = lampsColor.w;
+   
+   *refractionFromColor = intersectionColor; // Refraction depending on color;
+
+   return color;
+}
+
+/**
+________________________________________________________________________________
+Plan Intersection
+returns true if there is an intersection, false otherwise
+________________________________________________________________________________
+*/
+bool planIntersection( 
+   Primitive                plan,
+   float4                   origin,
+   float4                   ray,
+   __global MaterialRecord* materials,
+   __global char*           depth,
+   float                    timer,
+   float4*                  intersection )
+{
+   bool collision  = false;
+#if 0
+   float4 normal = normalToSurface( plan, plan.center, depth, materials, timer  );
+   normalizeVector(normal);
+   float B = dotProduct( normal, ray );
+   if(B < 0.f) 
+   {
+      origin = origin + plan.center;
+      float t = -dotProduct( normal, origin )/B;
+      *intersection = origin + t*ray;
+      collision  = true;
+   } 
+#endif // 0
+   return collision;
+}
+
+/**
+* ________________________________________________________________________________
+* Intersections with Objects
+* ________________________________________________________________________________
+*/
+bool intersectionWithLamps( 
+   __global Lamp*      lamps, 
+   int                 nbLamps, 
+   float4              origin, 
+   float4              target, 
+   float4*             lampColor)
+{
+   bool intersections = false; 
+
+   for( int cptLamps = 0; cptLamps<nbLamps && !intersections; cptLamps++ ) 
+   {
+      float4 O_C = origin - lamps[cptLamps].center; 
+      float4 ray = target - origin;
+      float4 intersection;
+      intersections = lampIntersection( lamps[cptLamps], origin, ray, O_C, &intersection );
+      if( intersections ) 
+      {
+         float4 I_C = intersection - lamps[cptLamps].center;
+         normalizeVector( O_C );
+         normalizeVector( I_C );
+         float d = dotProduct( O_C, I_C ) * lamps[cptLamps].color.w;
+         d = (d<0.f) ? 0.f : d;
+         (*lampColor) = lamps[cptLamps].color*d;
+      }
+   }
+   return intersections;
+}
+
+/**
+________________________________________________________________________________
+Bounding box Intersection
+Slab test, invDir being the inverse of the normalized ray direction. tNear
+receives the distance to the entry point of the box
+________________________________________________________________________________
+*/
+bool boxIntersection(
+   float4 boxMin,
+   float4 boxMax,
+   float4 origin,
+   float4 invDir,
+   float  maxDistance,
+   float* tNear )
+{
+   float4 t0 = (boxMin-origin)*invDir;
+   float4 t1 = (boxMax-origin)*invDir;
+   float tmin = fmax( fmax( fmin(t0.x,t1.x), fmin(t0.y,t1.y) ), fmin(t0.z,t1.z) );
+   float tmax = fmin( fmin( fmax(t0.x,t1.x), fmax(t0.y,t1.y) ), fmax(t0.z,t1.z) );
+   *tNear = tmin;
+   return ( tmax>=0.f && tmin<=tmax && tmin<maxDistance );
+}
+
+/**
+* ________________________________________________________________________________
+* Intersection with a single primitive, keeps it if it is the closest one so far
+* ________________________________________________________________________________
+*/
+bool closestIntersectionWithPrimitive( 
+   Primitive                primitive,
+   float4                   origin,
+   float4                   ray,
+   float                    timer,
+   float*                   minDistance,
+   Primitive*               closestObject,
+   float4*                  closestIntersection,
+   float4*                  closestNormal,
+   __global char*           video,
+   __global char*           depth,
+   __global MaterialRecord* materials,
+   __global char*           textures,
+   float                    transparentColor,
+   bool*                    back)
+{
+   bool   i = false; 
+   float  shadowIntensity;
+   float4 intersection = 0;
+   float4 normal = 0;
+
+   switch( primitive.type )
+   {
+   case ptSphere  : i = sphereIntersection( primitive, origin, ray, timer, &intersection, &normal, false, &shadowIntensity, video, depth, materials, textures,transparentColor, back ); break;
+#if FEATURE_CYLINDERS
+   case ptCylinder: i = cylinderIntersection( primitive, origin, ray, timer, &intersection, &normal, false, &shadowIntensity, video, depth, materials, textures, transparentColor); break;
+#endif // FEATURE_CYLINDERS
+   case ptTriangle: i = planIntersection( primitive, origin, ray, materials, depth, timer, &intersection ); break;
+   default        : i = planeIntersection( primitive, origin, ray, false, &shadowIntensity, depth, materials, textures, &intersection, &normal, transparentColor); break;
+   }
+
+   if( i ) 
+   {
+      float distance = vectorLength( origin - intersection );
+
+      if(distance>0.01f && distance<*minDistance) 
+      {
+         *minDistance         = distance;
+         *closestObject       = primitive;
+         *closestIntersection = intersection;
+         *closestNormal       = normal;
+         return true;
+      } 
+   }
+   return false;
+}
+
+/**
+* ________________________________________________________________________________
+* Instances
+* Instances only translate and uniformly scale their geometry, which keeps
+* every primitive axis aligned. The instanced primitive is therefore a regular
+* primitive in world space.
+* ________________________________________________________________________________
+*/
+Primitive instancePrimitive( 
+   Primitive primitive, 
+   float4    transform,
+   int       materialId )
+{
+   float scale = transform.w;
+   primitive.center.x = primitive.center.x*scale + transform.x;
+   primitive.center.y = primitive.center.y*scale + transform.y;
+   primitive.center.z = primitive.center.z*scale + transform.z;
+   primitive.center.w *= scale;
+   primitive.size     *= scale;
+   primitive.materialRatioX /= scale;
+   primitive.materialRatioY /= scale;
+   primitive.materialId = (materialId == NO_MATERIAL) ? primitive.materialId : materialId;
+   return primitive;
+}
+
+bool nodeIntersection(
+   __global BoundingVolume* boundingVolumes,
+   int                      node,
+   float4                   transform,
+   float4                   origin,
+   float4                   invDir,
+   float                    maxDistance,
+   float*                   tNear )
+{
+   return boxIntersection( 
+      boundingVolumes[node].min*transform.w + transform, 
+      boundingVolumes[node].max*transform.w + transform, 
+      origin, invDir, maxDistance, tNear );
+}
+
+/*
+* Pushes the children of an interior node that are hit by the ray, the
+* closest one ending on top of the stack
+*/
+void pushChildren(
+   __global BoundingVolume* boundingVolumes,
+   BoundingVolume           node,
+   float4                   transform,
+   float4                   origin,
+   float4                   invDir,
+   float                    maxDistance,
+   int*                     stack,
+   float*                   stackDistance,
+   int*                     stackSize )
+{
+   float tLeft;
+   float tRight;
+   bool hitLeft  = nodeIntersection( boundingVolumes, node.left,  transform, origin, invDir, maxDistance, &tLeft );
+   bool hitRight = nodeIntersection( boundingVolumes, node.right, transform, origin, invDir, maxDistance, &tRight );
+   if( hitLeft && hitRight )
+   {
+      bool leftFirst = (tLeft<=tRight);
+      stack[*stackSize]         = leftFirst ? node.right : node.left;
+      stackDistance[*stackSize] = leftFirst ? tRight : tLeft;
+      (*stackSize)++;
+      stack[*stackSize]         = leftFirst ? node.left : node.right;
+      stackDistance[*stackSize] = leftFirst ? tLeft : tRight;
+      (*stackSize)++;
+   }
+   else if( hitLeft )
+   {
+      stack[*stackSize]         = node.left;
+      stackDistance[*stackSize] = tLeft;
+      (*stackSize)++;
+   }
+   else if( hitRight )
+   {
+      stack[*stackSize]         = node.right;
+      stackDistance[*stackSize] = tRight;
+      (*stackSize)++;
+   }
+}
+
+float4 inverseDirection( float4 ray )
+{
+   float4 dir = ray;
+   normalizeVector( dir );
+   float4 invDir;
+   invDir.x = (dir.x==0.f) ? 1e30f : 1.f/dir.x;
+   invDir.y = (dir.y==0.f) ? 1e30f : 1.f/dir.y;
+   invDir.z = (dir.z==0.f) ? 1e30f : 1.f/dir.z;
+   invDir.w = 0.f;
+   return invDir;
+}
+
+/**
+* ________________________________________________________________________________
+* Walks a bounding volume hierarchy front to back, starting from the root node.
+* The hierarchy and its primitives are placed in the world by transform.
+* ________________________________________________________________________________
+*/
+bool intersectionWithHierarchy( 
+   __global PrimitiveRecord* primitives,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       root,
+   float4                    transform,
+   int                       materialId,
+   float4                    origin,
+   float4                    ray,
+   float4                    invDir,
+   float                     timer,
+   float*                    minDistance,
+   Primitive*                closestObject,
+   float4*                   closestIntersection,
+   float4*                   closestNormal,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float                     transparentColor,
+   bool*                     back)
+{
+   bool  intersections = false; 
+   int   stack[gBVHStackSize];
+   float stackDistance[gBVHStackSize];
+   int   stackSize = 0;
+   float tNear;
+   if( nodeIntersection( boundingVolumes, root, transform, origin, invDir, *minDistance, &tNear ) )
+   {
+      stack[0]         = root;
+      stackDistance[0] = tNear;
+      stackSize        = 1;
+   }
+
+   while( stackSize>0 )
+   {
+      stackSize--;
+
+      // Skip nodes that are now further away than the closest intersection
+      if( stackDistance[stackSize]>=*minDistance ) continue;
+
+      BoundingVolume node = boundingVolumes[stack[stackSize]];
+      if( node.nbPrimitives != 0 )
+      {
+         for( int i=0; i<node.nbPrimitives; i++ )
+         {
+            Primitive primitive = instancePrimitive( loadPrimitive( primitives, primitivesIndex[node.left+i] ), transform, materialId );
+            intersections |= closestIntersectionWithPrimitive( 
+               primitive, origin, ray, timer, 
+               minDistance, closestObject, closestIntersection, closestNormal,
+               video, depth, materials, textures, transparentColor, back );
+         }
+      }
+      else
+      {
+         pushChildren( boundingVolumes, node, transform, origin, invDir, *minDistance, stack, stackDistance, &stackSize );
+      }
+   }
+   return intersections;
+}
+
+/**
+* ________________________________________________________________________________
+* Intersections with instances
+* The top level hierarchy groups the instances, each of them then walks the
+* bottom level hierarchy of its geometry
+* ________________________________________________________________________________
+*/
+bool intersectionWithInstances( 
+   __global Instance*        instances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex,
+   float4                    origin,
+   float4                    ray,
+   float4                    invDir,
+   float                     timer,
+   float*                    minDistance,
+   Primitive*                closestObject,
+   float4*                   closestIntersection,
+   float4*                   closestNormal,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float                     transparentColor,
+   bool*                     back)
+{
+   bool   intersections = false; 
+   float4 identity = 0;
+   identity.w = 1.f;
+
+   int   stack[gBVHStackSize];
+   float stackDistance[gBVHStackSize];
+   int   stackSize = 0;
+   float tNear;
+   if( nodeIntersection( instanceBoundingVolumes, 0, identity, origin, invDir, *minDistance, &tNear ) )
+   {
+      stack[0]         = 0;
+      stackDistance[0] = tNear;
+      stackSize        = 1;
+   }
+
+   while( stackSize>0 )
+   {
+      stackSize--;
+      if( stackDistance[stackSize]>=*minDistance ) continue;
+
+      BoundingVolume node = instanceBoundingVolumes[stack[stackSize]];
+      if( node.nbPrimitives != 0 )
+      {
+         for( int i=0; i<node.nbPrimitives; i++ )
+         {
+            Instance instance = instances[instancesIndex[node.left+i]];
+            if( instance.rootNode == -1 ) continue; // Empty geometry
+            intersections |= intersectionWithHierarchy( 
+               geometryPrimitives, geometryBoundingVolumes, geometryIndex, 
+               instance.rootNode, instance.transform, instance.materialId,
+               origin, ray, invDir, timer, 
+               minDistance, closestObject, closestIntersection, closestNormal,
+               video, depth, materials, textures, transparentColor, back );
+         }
+      }
+      else
+      {
+         pushChildren( instanceBoundingVolumes, node, identity, origin, invDir, *minDistance, stack, stackDistance, &stackSize );
+      }
+   }
+   return intersections;
+}
+
+/**
+* ________________________________________________________________________________
+* Typed primitive arrays
+* Primitives are grouped by type, each group being tested by its own loop so 
+* that neighbour work-items run the same test on contiguous memory. Spheres 
+* are a single float4 (center, square of the radius), cylinders and planes 
+* two (center, size), the material being stored in size.w along with the
+* SHAPE_TRANSPARENT bit. primitivesIndex
+* gives the original primitive, only fetched for the closest intersection.
+* ranges holds the first record of each type, gNbPrimitiveRanges-1 types.
+* ________________________________________________________________________________
+*/
+Primitive primitiveFromRecord(
+   __global PrimitiveRecord* primitives,
+   __global float4*          shapes,
+   __global int*             primitivesIndex,
+   int                       record,
+   int                       shape,
+   int                       type )
+{
+   Primitive primitive;
+   primitive.center     = shapes[shape*2];
+   primitive.size       = shapes[shape*2+1];
+   int material         = as_int(primitive.size.w);
+   primitive.materialId = material & ~SHAPE_TRANSPARENT;
+   primitive.size.w     = 0.f;
+   primitive.type       = type;
+   primitive.materialRatioX = 0.f;
+   primitive.materialRatioY = 0.f;
+
+   // Transparent materials look at the texture of the primitive
+   if( FEATURE_TRANSPARENCY && (material & SHAPE_TRANSPARENT) ) 
+   {
+      primitive = loadPrimitive( primitives, primitivesIndex[record] );
+   }
+   return primitive;
+}
+
+bool intersectionWithPrimitiveArrays( 
+   __global PrimitiveRecord* primitives,
+   __global float4*          spheres,
+   __global float4*          shapes,
+   __global int*             primitivesIndex,
+   __global int*             ranges,
+   float4                    origin,
+   float4                    ray,
+   float                     timer,
+   float*                    minDistance,
+   Primitive*                closestObject,
+   float4*                   closestIntersection,
+   float4*                   closestNormal,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float                     transparentColor,
+   bool*                     back)
+{
+   int closest = -1;
+   float4 intersection = 0;
+   float4 normal = 0;
+
+   // Spheres
+   for( int r=ranges[0]; r<ranges[1]; r++ )
+   {
+      if( sphereRecordIntersection( spheres[r], origin, ray, &intersection, &normal, back ) )
+      {
+         float distance = vectorLength( origin - intersection );
+         if( distance>0.01f && distance<*minDistance ) 
+         {
+            *minDistance         = distance;
+            *closestIntersection = intersection;
+            *closestNormal       = normal;
+            closest              = r;
+         }
+      }
+   }
+
+   // Cylinders and planes, the type is the same for the whole range
+   int types[gNbPrimitiveRanges-2] = { ptCylinder, ptXYPlane, ptYZPlane, ptXZPlane, ptCheckboard, ptCamera };
+   for( int range=1; range<gNbPrimitiveRanges-1; range++ )
+   {
+      int type = types[range-1];
+      for( int r=ranges[range]; r<ranges[range+1]; r++ )
+      {
+         Primitive primitive = primitiveFromRecord( primitives, shapes, primitivesIndex, r, r-ranges[1], type );
+         if( closestIntersectionWithPrimitive( 
+            primitive, origin, ray, timer, 
+            minDistance, closestObject, closestIntersection, closestNormal,
+            video, depth, materials, textures, transparentColor, back ) )
+         {
+            closest = r;
+         }
+      }
+   }
+
+   if( closest != -1 ) *closestObject = loadPrimitive( primitives, primitivesIndex[closest] );
+   return (closest != -1);
+}
+
+/**
+* ________________________________________________________________________________
+* Intersections with Objects
+* Walks the bounding volume hierarchy front to back, falls back to testing every 
+* primitive when no hierarchy has been uploaded. Instances come next.
+* ________________________________________________________________________________
+*/
+bool intersectionWithPrimitives( 
+   __global PrimitiveRecord* primitives,
+   int                       nbPrimitives,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       nbBoundingVolumes,
+   __global float4*          typedSpheres,
+   __global float4*          typedShapes,
+   __global int*             typedIndex,
+   __global int*             typedRanges,
+   int                       nbTypedPrimitives,
+   __global Instance*        instances,
+   int                       nbInstances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex,
+   float4                    origin,
+   float4                    target,
+   float                     timer,
+   Primitive*                closestObject,
+   float4*                   closestIntersection,
+   float4*                   closestNormal,
+   __global char*            video,
+   __global char*            depth,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   float                     transparentColor,
+   bool*                     back)
+{
+   bool intersections = false; 
+   float minDistance  = gMaxViewDistance; 
+   float4 ray = target - origin; 
+   float4 invDir = inverseDirection( ray );
+
+   if( nbTypedPrimitives != 0 )
+   {
+      intersections |= intersectionWithPrimitiveArrays( 
+         primitives, typedSpheres, typedShapes, typedIndex, typedRanges,
+         origin, ray, timer, 
+         &minDistance, closestObject, closestIntersection, closestNormal,
+         video, depth, materials, textures, transparentColor, back );
+   }
+   else if( nbBoundingVolumes == 0 )
+   {
+      for( int cptObjects = 0; cptObjects<nbPrimitives; cptObjects++ )
+      { 
+         intersections |= closestIntersectionWithPrimitive( 
+            loadPrimitive( primitives, cptObjects ), origin, ray, timer, 
+            &minDistance, closestObject, closestIntersection, closestNormal,
+            video, depth, materials, textures, transparentColor, back );
+      }
+   }
+   else
+   {
+      float4 identity = 0;
+      identity.w = 1.f;
+      intersections |= intersectionWithHierarchy( 
+         primitives, boundingVolumes, primitivesIndex, 
+         0, identity, NO_MATERIAL,
+         origin, ray, invDir, timer, 
+         &minDistance, closestObject, closestIntersection, closestNormal,
+         video, depth, materials, textures, transparentColor, back );
+   }
+
+   if( nbInstances != 0 )
+   {
+      intersections |= intersectionWithInstances( 
+         instances, instanceBoundingVolumes, instancesIndex,
+         geometryPrimitives, geometryBoundingVolumes, geometryIndex,
+         origin, ray, invDir, timer, 
+         &minDistance, closestObject, closestIntersection, closestNormal,
+         video, depth, materials, textures, transparentColor, back );
+   }
+   return intersections;
+}
+
+/*
+* Random number in [0,1) (integer hash of the seed)
+*/
+float randomNumber( uint seed )
+{
+   seed = (seed ^ 61) ^ (seed >> 16);
+   seed *= 9;
+   seed = seed ^ (seed >> 4);
+   seed *= 0x27d4eb2d;
+   seed = seed ^ (seed >> 15);
+   return (float)(seed & 0xffffff)/16777216.f;
+}
+
+/**
+*  ------------------------------------------------------------------------------ 
+* Ray Intersections
+*  ============================================================================== 
+*  Calculate the reflected vector                   
+*                                                  
+*                  ^ Normal to object surface (N)  
+* Reflection (O_R)  |                              
+*                 \ |  Eye (O_E)                    
+*                  \| /                             
+*   ----------------O--------------- Object surface 
+*          closestIntersection                      
+*                                                   
+*  ============================================================================== 
+*  colours                                                                                    
+*  ------------------------------------------------------------------------------ 
+*  We now have to know the colour of this intersection                                        
+*  Color_from_object will compute the amount of light received by the
+*  intersection float4 and  will also compute the shadows. 
+*  The resulted color is stored in result.                     
+*  The first parameter is the closest object to the intersection (following 
+*  the ray). It can  be considered as a light source if its inner light rate 
+*  is > 0.                            
+*  ------------------------------------------------------------------------------ 
+*/
+float4 launchRay( 
+   __global PrimitiveRecord* primitives,
+   int                       nbPrimitives,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       nbBoundingVolumes,
+   __global float4*          typedSpheres,
+   __global float4*          typedShapes,
+   __global int*             typedIndex,
+   __global int*             typedRanges,
+   int                       nbTypedPrimitives,
+   __global Instance*        instances,
+   int                       nbInstances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex,
+   __global Lamp*            lamps,
+   int                       nbLamps,
+   float4                    origin,
+   float4                    target,
+   float                     timer,
+   __global MaterialRecord*  materials,
+   __global char*            textures,
+   __global char*            video,
+   __global char*            depth,
+   float                     transparentColor,
+   float4                    lampJitter,
+   int                       seed,
+   float4*                   intersection,
+   float4*                   primaryIntersection,
+   float4*                   primaryNormal)
+{
+   float4 intersectionColor = 0;
+   Primitive closestObject;
+   float4 closestIntersection = 0;
+   bool   carryon           = true;
+   float4 rayOrigin         = origin;
+   float4 rayTarget         = target;
+   float  initialRefraction = 1.0f;
+   int    iteration         = 0;
+   float  throughput        = 1.f;
+   float4 O_R;
+   float4 O_E;
+   float4 recursiveColor[gNbIterations+1];
+   float4 recursiveRatio[gNbIterations+1];
+
+   for( int i=0; i<=gNbIterations; i++ ) 
+   {
+      recursiveColor[i] = 0.f;
+      recursiveRatio[i] = 0.f;
+   }
+
+   // Variable declarations
+   float  shadowIntensity = 0.f;
+   float4 refractionFromColor;
+   float4 reflectedTarget;
+   float4 normal = 0;
+   float  blinn = 0.f;
+   int inters=0;
+   bool back;
+
+   // Rays missing every primitive are seen at the far end of the view
+   float4 direction = target - origin;
+   normalizeVector( direction );
+   *primaryIntersection = origin + direction*gMaxViewDistance;
+   *primaryNormal       = 0;
+
+   while( iteration<gNbIterations && carryon ) 
+   {
+
+      // Compute intesection with lamps
+      carryon = !intersectionWithLamps( lamps, nbLamps, rayOrigin, rayTarget, &intersectionColor);
+
+      // If no intersection with lamps detected. Now compute intersection with Primitives
+      if( carryon ) 
+      {
+         carryon = intersectionWithPrimitives(
+            primitives, nbPrimitives,
+            boundingVolumes, primitivesIndex, nbBoundingVolumes,
+            typedSpheres, typedShapes, typedIndex, typedRanges, nbTypedPrimitives,
+            instances, nbInstances, instanceBoundingVolumes, instancesIndex,
+            geometryPrimitives, geometryBoundingVolumes, geometryIndex,
+            rayOrigin, rayTarget,
+            timer, 
+            &closestObject, &closestIntersection, &normal,
+            video, depth, materials, textures, transparentColor,
+            &back);
+      }
+
+      if( carryon ) 
+      {
+         if( iteration == 0 ) 
+         {
+            *primaryIntersection = closestIntersection;
+            *primaryNormal       = normal;
+         }
+         inters += (back) ? -1 : 1;
+
+         // Get object color
+         recursiveColor[iteration] = colorFromObject( 
+            primitives, nbPrimitives, lamps, nbLamps, 
+            video, depth, materials, textures, 
+            origin, normal, closestObject, closestIntersection, 
+            timer, &refractionFromColor, &shadowIntensity, &blinn, transparentColor, lampJitter );
+
+         recursiveRatio[iteration].y = blinn;
+         recursiveRatio[iteration].w = 1.f;
+
+         Material material = loadMaterial( materials, closestObject.materialId );
+
+         if( isTransparent(material) ) 
+         {
+            // ----------
+            // Refraction
+            // ----------
+            // Replace the normal using the intersection color
+            // r,g,b become x,y,z... What the fuck!!
+            if( isTextured(material) ) 
+            {
+               refractionFromColor -= 0.5f;
+               normal *= refractionFromColor;
+            }
+             
+            O_E = rayOrigin - closestIntersection;
+            normalizeVector(O_E);
+            float refraction = material.refraction;
+            refraction = (refraction == initialRefraction) ? 1.0f : refraction;
+            vectorRefraction( &O_R, O_E, refraction, normal, initialRefraction );
+            reflectedTarget = closestIntersection - O_R;
+               
+            initialRefraction = refraction;
+
+            recursiveRatio[iteration].x = material.transparency;
+            recursiveRatio[iteration].z = 1.f;
+         }
+         else 
+         {
+            // ----------
+            // Reflection
+            // ----------
+            if( material.color.w != 0.f ) 
+            {
+               O_E = rayOrigin - closestIntersection;
+               vectorReflection( O_R, O_E, normal );
+               reflectedTarget = closestIntersection - O_R;
+
+               recursiveRatio[iteration].x = material.color.w;
+               //carryon &= (shadowIntensity!=1.f);
+            }
+            else 
+            {
+               carryon = false;
+            }
+         }
+
+         // Weight of the next bounce in the pixel, as in the recursion below
+         float w = recursiveColor[iteration].w;
+         if( recursiveRatio[iteration].z == 1.f ) {
+            w = recursiveColor[iteration].x + w*(1.f-recursiveColor[iteration].x);
+         }
+         throughput *= w*recursiveRatio[iteration].x;
+         if( carryon && throughput<gContributionThreshold ) 
+         {
+            // Russian roulette when a seed is given, the survivors make up for
+            // the paths stopped here. Otherwise the path is cut.
+            float survival = throughput/gContributionThreshold;
+            if( seed>=0 && randomNumber( (uint)seed*(gNbIterations+1)+(uint)iteration ) < survival ) 
+            {
+               recursiveRatio[iteration].w = 1.f/survival;
+               throughput = gContributionThreshold;
+            }
+            else 
+            {
+               carryon = false;
+            }
+         }
+
+         rayOrigin = closestIntersection; 
+         rayTarget = reflectedTarget;
+         iteration++; 
+      }
+   }
+
+   for( int i=iteration-1; i>=0; --i ) 
+   {
+      float w = recursiveColor[i].w;
+      if( recursiveRatio[i].z == 1.f ) {
+         w = recursiveColor[i].x + w*(1.f-recursiveColor[i].x);
+      }
+      recursiveColor[i] = (recursiveColor[i+1]*w*recursiveRatio[i].x*recursiveRatio[i].w + recursiveColor[i]*w*(1.f-recursiveRatio[i].x));
+   }
+   intersectionColor = recursiveColor[0];
+   
+   // Specular reflection
+   intersectionColor += recursiveRatio[0].y;
+
+   intersectionColor.x = (intersectionColor.x>1.f) ? 1.f : intersectionColor.x;
+   intersectionColor.y = (intersectionColor.y>1.f) ? 1.f : intersectionColor.y;
+   intersectionColor.z = (intersectionColor.z>1.f) ? 1.f : intersectionColor.z;
+   *intersection = closestIntersection;
+
+#if 0
+   // --------------------------------------------------
+   // Attenation effect (Fog)
+   // --------------------------------------------------
+   float4 O_I = closestIntersection - origin;
+   float len = 1.f-(vectorLength(O_I)/gMaxViewDistance);
+   len = (len>0.f) ? len : 0.f; 
+   intersectionColor *= len;
+#endif // 0
+
+   return intersectionColor;
+}
+
+
+/*
+* Radical inverse of n in the given base, successive values of n spread
+* evenly over [0,1) (Halton sequence)
+*/
+float radicalInverse( 
+   int n, 
+   int base )
+{
+   float inverse = 1.f/base;
+   float factor  = inverse;
+   float result  = 0.f;
+   while( n>0 ) 
+   {
+      result += (n%base)*factor;
+      n      /= base;
+      factor *= inverse;
+   }
+   return result;
+}
+
+/**
+* ________________________________________________________________________________
+* Color of a pixel
+* sample is the index of the frame accumulated since the view last changed,
+* -1 when frames are not accumulated. Accumulated samples are jittered within
+* the pixel and over the lamps, and faint bounces play russian roulette
+* instead of being cut. Their average goes to the bitmap.
+* ________________________________________________________________________________
+*/
+void renderPixel( 
+   int                       x,
+   int                       y,
+   float4                    origin,
+   float4                    target,
+   float4                    angles,
+   int                       width,
+   int                       height,
+   __global PrimitiveRecord* primitives,
+   __global Lamp*            lamps,
+   __global MaterialRecord*  materials,
+   int                       nbPrimitives,
+   int                       nbLamps,
+   __global char*            bitmap,
+   __global char*            video,
+   __global char*            depth,
+   __global char*            textures,
+   float                     timer,
+   int2                      refinement,
+   float                     transparentColor,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       nbBoundingVolumes,
+   __global float4*          typedSpheres,
+   __global float4*          typedShapes,
+   __global int*             typedIndex,
+   __global int*             typedRanges,
+   int                       nbTypedPrimitives,
+   __global Instance*        instances,
+   int                       nbInstances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex,
+   __global float4*          accumulation,
+   int                       sample,
+   __global HistorySample*   history,
+   int                       storeHistory)
+{
+   int index = y*width+x;
+
+   target.x = target.x + (float)(x - (width/2));
+   target.y = target.y + (float)(y - (height/2));
+
+   // The first sample goes through the center of the pixel
+   float4 lampJitter = 0;
+   if( sample>0 ) 
+   {
+      target.x += radicalInverse( sample, 2 ) - 0.5f;
+      target.y += radicalInverse( sample, 3 ) - 0.5f;
+      lampJitter.x = 2.f*radicalInverse( sample, 5 ) - 1.f;
+      lampJitter.y = 2.f*radicalInverse( sample, 7 ) - 1.f;
+      lampJitter.z = 2.f*radicalInverse( sample, 11 ) - 1.f;
+   }
+
+   float4 rotationCenter = 0;
+
+   vectorRotation( origin, rotationCenter, angles );
+   vectorRotation( target, rotationCenter, angles );
+
+   float4 intersection;
+   float4 primaryIntersection;
+   float4 primaryNormal;
+   float4 color = launchRay( 
+      primitives, nbPrimitives, 
+      boundingVolumes, primitivesIndex, nbBoundingVolumes,
+      typedSpheres, typedShapes, typedIndex, typedRanges, nbTypedPrimitives,
+      instances, nbInstances, instanceBoundingVolumes, instancesIndex,
+      geometryPrimitives, geometryBoundingVolumes, geometryIndex,
+      lamps, nbLamps, 
+      origin, target, timer, 
+      materials, textures,
+      video, depth, transparentColor,
+      lampJitter, (sample>=0) ? sample*width*height+index : -1,
+      &intersection, &primaryIntersection, &primaryNormal);
+
+   color.w = gMaxViewDistance/intersection.z;
+
+   if( sample>=0 ) 
+   {
+      float4 sum = (sample==0) ? color : accumulation[index] + color;
+      accumulation[index] = sum;
+      color = sum/(float)(sample+1);
+   }
+
+   // Kept for the reprojection of the next views
+   if( storeHistory ) 
+   {
+      primaryIntersection.w = vectorLength( primaryIntersection - origin );
+      history[index].intersection = primaryIntersection;
+      history[index].normal       = primaryNormal;
+      history[index].color        = color;
+   }
+
+   // The pixel fills the gap up to the next traced pixel
+   int step = refinement.x;
+   for( int j=0; j<step && y+j<height; j++ ) 
+   {
+      for( int i=0; i<step && x+i<width; i++ ) 
+      {
+         makeOpenGLColor( color, bitmap, index+j*width+i ); 
+      }
+   }
+}
+
+/*
+* Progressive refinement: one pixel out of step is traced on both axes. When 
+* the bitmap already holds the coarser level (refinement.y), its pixels are 
+* not traced again. After a reprojection (refinement.y is 2), only the pixels 
+* flagged in the history are traced.
+*/
+bool isRefinedPixel( 
+   int                     x, 
+   int                     y, 
+   int                     width,
+   int2                    refinement,
+   __global HistorySample* history )
+{
+   if( refinement.y == 2 ) return history[y*width+x].intersection.w < 0.f;
+   int coarser = refinement.x*2;
+   return !( refinement.y && (x%coarser)==0 && (y%coarser)==0 );
+}
+
+/**
+* ________________________________________________________________________________
+* Main Kernel!!!
+* ________________________________________________________________________________
+*/
+__kernel void render_kernel( 
+   float4                    origin,
+   float4                    target,
+   float4                    angles,
+   int                       width,
+   int                       height,
+   __global PrimitiveRecord* primitives,
+   __global Lamp*            lamps,
+   __global MaterialRecord*  materials,
+   int                       nbPrimitives,
+   int                       nbLamps,
+   int                       nbMaterials,
+   __global char*            bitmap,
+   __global char*            video,
+   __global char*            depth,
+   __global char*            textures,
+   float                     timer,
+   int2                      refinement,
+   float                     transparentColor,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       nbBoundingVolumes,
+   __global float4*          typedSpheres,
+   __global float4*          typedShapes,
+   __global int*             typedIndex,
+   __global int*             typedRanges,
+   int                       nbTypedPrimitives,
+   __global Instance*        instances,
+   int                       nbInstances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex,
+   __global float4*          accumulation,
+   int                       sample,
+   __global HistorySample*   history,
+   int                       storeHistory)
+{
+   // One work-item per traced pixel
+   int x = get_global_id(0)*refinement.x;
+   int y = get_global_id(1)*refinement.x;
+   if( x>=width || y>=height || !isRefinedPixel( x, y, width, refinement, history ) ) return;
+
+   renderPixel( 
+      x, y,
+      origin, target, angles, width, height,
+      primitives, lamps, materials, nbPrimitives, nbLamps, 
+      bitmap, video, depth, textures, timer, refinement, transparentColor,
+      boundingVolumes, primitivesIndex, nbBoundingVolumes,
+      typedSpheres, typedShapes, typedIndex, typedRanges, nbTypedPrimitives,
+      instances, nbInstances, instanceBoundingVolumes, instancesIndex,
+      geometryPrimitives, geometryBoundingVolumes, geometryIndex,
+      accumulation, sample, history, storeHistory );
+}
+
+/**
+* ________________________________________________________________________________
+* Persistent threads
+* Same as render_kernel, but launched with just enough work-groups to fill the
+* device. Each work-group keeps fetching the next batch of pixels from a global
+* counter until the frame is done, so that groups finishing early are given 
+* more work instead of waiting for their slowest work-item. The counter must
+* be 0 when the kernel starts.
+* ________________________________________________________________________________
+*/
+__kernel void render_persistent_kernel( 
+   float4                    origin,
+   float4                    target,
+   float4                    angles,
+   int                       width,
+   int                       height,
+   __global PrimitiveRecord* primitives,
+   __global Lamp*            lamps,
+   __global MaterialRecord*  materials,
+   int                       nbPrimitives,
+   int                       nbLamps,
+   int                       nbMaterials,
+   __global char*            bitmap,
+   __global char*            video,
+   __global char*            depth,
+   __global char*            textures,
+   float                     timer,
+   int2                      refinement,
+   float                     transparentColor,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       nbBoundingVolumes,
+   __global float4*          typedSpheres,
+   __global float4*          typedShapes,
+   __global int*             typedIndex,
+   __global int*             typedRanges,
+   int                       nbTypedPrimitives,
+   __global Instance*        instances,
+   int                       nbInstances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex,
+   __global float4*          accumulation,
+   int                       sample,
+   __global HistorySample*   history,
+   int                       storeHistory,
+   __global int*             workCounter)
+{
+   __local int batch;
+   int step = refinement.x;
+   int tracedWidth = (width+step-1)/step;
+   int nbPixels = tracedWidth*((height+step-1)/step);
+   int lid = get_local_id(0);
+   int batchSize = get_local_size(0);
+
+   while( true )
+   {
+      // One fetch per work-group, neighbour pixels stay in the same group
+      if( lid == 0 ) batch = atomic_add( workCounter, batchSize );
+      barrier( CLK_LOCAL_MEM_FENCE );
+      int first = batch;
+      barrier( CLK_LOCAL_MEM_FENCE );
+      if( first>=nbPixels ) break;
+
+      int index = first + lid;
+      int x = (index%tracedWidth)*step;
+      int y = (index/tracedWidth)*step;
+      if( index<nbPixels && isRefinedPixel( x, y, width, refinement, history ) )
+      {
+         renderPixel( 
+            x, y,
+            origin, target, angles, width, height,
+            primitives, lamps, materials, nbPrimitives, nbLamps, 
+            bitmap, video, depth, textures, timer, refinement, transparentColor,
+            boundingVolumes, primitivesIndex, nbBoundingVolumes,
+            typedSpheres, typedShapes, typedIndex, typedRanges, nbTypedPrimitives,
+            instances, nbInstances, instanceBoundingVolumes, instancesIndex,
+            geometryPrimitives, geometryBoundingVolumes, geometryIndex,
+            accumulation, sample, history, storeHistory );
+      }
+   }
+}
+
+/**
+* ________________________________________________________________________________
+* Temporal reprojection
+* The primary intersections of the previous frame are projected into the new
+* view. When several of them land on the same pixel the closest one wins 
+* (depth pass) and brings its color along (color pass). Pixels left empty, or
+* seen through a gap of a closer surface, are flagged in the history for 
+* render_kernel (refinement.y is 2).
+* ________________________________________________________________________________
+*/
+
+/*
+* Pixel through which a point is seen, inverse of the ray generation of 
+* renderPixel. False when the point is behind the eye or out of the view.
+*/
+bool projectPoint( 
+   float4 point,
+   float4 origin,
+   float4 target,
+   float4 angles,
+   int    width,
+   int    height,
+   int*   index,
+   float* distance )
+{
+   float4 eye = origin;
+   vectorRotation( eye, 0, angles );
+   *distance = vectorLength( point - eye );
+
+   // Back to the camera before its rotation, the view plane is at target.z
+   vectorInverseRotation( point, angles );
+   float4 ray = point - origin;
+   float  depth = target.z - origin.z;
+   if( ray.z*depth <= 0.f ) return false;
+
+   float ratio = depth/ray.z;
+   int x = (int)floor( origin.x + ratio*ray.x - target.x + (float)(width/2)  + 0.5f );
+   int y = (int)floor( origin.y + ratio*ray.y - target.y + (float)(height/2) + 0.5f );
+   *index = y*width+x;
+   return ( x>=0 && x<width && y>=0 && y<height );
+}
+
+__kernel void reprojection_clear_kernel(
+   __global HistorySample* history,
+   __global int*           depthBuffer )
+{
+   int index = get_global_id(0);
+   history[index].intersection.w = -1.f;
+   depthBuffer[index] = INT_MAX;
+}
+
+// Distances are positive, their bits compare as integers
+__kernel void reprojection_depth_kernel(
+   float4                  origin,
+   float4                  target,
+   float4                  angles,
+   int                     width,
+   int                     height,
+   __global HistorySample* previousHistory,
+   __global int*           depthBuffer )
+{
+   HistorySample sample = previousHistory[get_global_id(0)];
+   int   index;
+   float distance;
+   if( sample.intersection.w >= 0.f && 
+       projectPoint( sample.intersection, origin, target, angles, width, height, &index, &distance ) )
+   {
+      atomic_min( &depthBuffer[index], as_int(distance) );
+   }
+}
+
+__kernel void reprojection_color_kernel(
+   float4                  origin,
+   float4                  target,
+   float4                  angles,
+   int                     width,
+   int                     height,
+   __global HistorySample* previousHistory,
+   __global HistorySample* history,
+   __global int*           depthBuffer,
+   __global char*          bitmap )
+{
+   HistorySample sample = previousHistory[get_global_id(0)];
+   int   index;
+   float distance;
+   if( sample.intersection.w >= 0.f && 
+       projectPoint( sample.intersection, origin, target, angles, width, height, &index, &distance ) &&
+       depthBuffer[index] == as_int(distance) )
+   {
+      sample.intersection.w = distance;
+      history[index] = sample;
+      makeOpenGLColor( sample.color, bitmap, index );
+   }
+}
+
+/*
+* A pixel much further than at least two of its neighbours is likely to show
+* the background through the reprojected points of a closer surface. A pixel
+* whose normal disagrees with three of its neighbours or more is a stray 
+* sample of another surface, edges only disagree with two at most. The depth
+* buffer and the normals are only read, so that flagged pixels do not affect
+* the others.
+*/
+// Empty neighbours agree with any normal
+bool isDisagreeingNormal( 
+   float4                  normal,
+   int                     neighbour,
+   __global HistorySample* history,
+   __global int*           depthBuffer )
+{
+   if( depthBuffer[neighbour] == INT_MAX ) return false;
+   float4 delta = history[neighbour].normal - normal;
+   return vectorLength( delta ) > gReprojectionNormalTolerance;
+}
+
+__kernel void reprojection_holes_kernel(
+   int                     width,
+   int                     height,
+   __global HistorySample* history,
+   __global int*           depthBuffer )
+{
+   int x = get_global_id(0);
+   int y = get_global_id(1);
+   if( x>=width || y>=height ) return;
+
+   int index = y*width+x;
+   if( depthBuffer[index] == INT_MAX ) return;
+
+   float limit = as_float(depthBuffer[index])*(1.f-gReprojectionTolerance);
+   int closer = 0;
+   if( x>0        && as_float(depthBuffer[index-1])     < limit ) closer++;
+   if( x<width-1  && as_float(depthBuffer[index+1])     < limit ) closer++;
+   if( y>0        && as_float(depthBuffer[index-width]) < limit ) closer++;
+   if( y<height-1 && as_float(depthBuffer[index+width]) < limit ) closer++;
+
+   float4 normal = history[index].normal;
+   int disagree = 0;
+   if( x>0        && isDisagreeingNormal( normal, index-1,     history, depthBuffer ) ) disagree++;
+   if( x<width-1  && isDisagreeingNormal( normal, index+1,     history, depthBuffer ) ) disagree++;
+   if( y>0        && isDisagreeingNormal( normal, index-width, history, depthBuffer ) ) disagree++;
+   if( y<height-1 && isDisagreeingNormal( normal, index+width, history, depthBuffer ) ) disagree++;
+
+   if( closer>=2 || disagree>=3 ) history[index].intersection.w = -1.f;
+}
+
+/**
+* ________________________________________________________________________________
+* Post-processing
+* One pass per launch, from the source to the destination bitmap:
+* - PP_UPSCALE     : bilinear interpolation between the pixels traced by a 
+*                    coarse refinement level (one out of step on both axes)
+* - PP_DENOISE     : cross bilateral filter, the weights fall with the distance,
+*                    the difference of color and the difference of depth 
+*                    (alpha). parameters: radius, color sigma, depth sigma
+* - PP_TONE_MAPPING: exposure and gamma. parameters: exposure, gamma
+* ________________________________________________________________________________
+*/
+__kernel void post_processing_kernel(
+   __global char* source,
+   __global char* destination,
+   int            width,
+   int            height,
+   int            pass,
+   int            step,
+   float4         parameters)
+{
+   int x = get_global_id(0);
+   int y = get_global_id(1);
+   if( x>=width || y>=height ) return;
+
+   int index = y*width+x;
+   float4 color = readOpenGLColor( source, index );
+
+   if( pass == PP_UPSCALE ) 
+   {
+      int x0 = (x/step)*step;
+      int y0 = (y/step)*step;
+      int x1 = (x0+step<width)  ? x0+step : x0;
+      int y1 = (y0+step<height) ? y0+step : y0;
+      float fx = (float)(x-x0)/step;
+      float fy = (float)(y-y0)/step;
+      float4 top    = readOpenGLColor( source, y0*width+x0 )*(1.f-fx) + readOpenGLColor( source, y0*width+x1 )*fx;
+      float4 bottom = readOpenGLColor( source, y1*width+x0 )*(1.f-fx) + readOpenGLColor( source, y1*width+x1 )*fx;
+      color = top*(1.f-fy) + bottom*fy;
+   }
+   else if( pass == PP_DENOISE ) 
+   {
+      int   radius        = (int)parameters.x;
+      float spatialFactor = -0.5f/(float)(radius*radius);
+      float colorFactor   = -0.5f/(parameters.y*parameters.y);
+      float depthFactor   = -0.5f/(parameters.z*parameters.z);
+      float4 sum    = 0.f;
+      float  weights = 0.f;
+      for( int j=-radius; j<=radius; j++ ) 
+      {
+         if( y+j<0 || y+j>=height ) continue;
+         for( int i=-radius; i<=radius; i++ ) 
+         {
+            if( x+i<0 || x+i>=width ) continue;
+            float4 neighbour = readOpenGLColor( source, index+j*width+i );
+            float4 d = neighbour - color;
+            float weight = exp( 
+               (float)(i*i+j*j)*spatialFactor + 
+               (d.x*d.x+d.y*d.y+d.z*d.z)*colorFactor + 
+               d.w*d.w*depthFactor );
+            sum     += neighbour*weight;
+            weights += weight;
+         }
+      }
+      float depth = color.w;
+      color   = sum/weights;
+      color.w = depth;
+   }
+   else if( pass == PP_TONE_MAPPING ) 
+   {
+      float inverseGamma = 1.f/parameters.y;
+      color.x = pow( min( color.x*parameters.x, 1.f ), inverseGamma );
+      color.y = pow( min( color.y*parameters.x, 1.f ), inverseGamma );
+      color.z = pow( min( color.z*parameters.x, 1.f ), inverseGamma );
+   }
+
+   makeOpenGLColor( color, destination, index );
+}
+
+/**
+* ________________________________________________________________________________
+* Wavefront pipeline
+* launchRay split into stages communicating through the ray buffer. Each stage
+* only processes the rays listed in a queue, counters holding the size of the
+* queues. The extend stage keeps the rays that hit a primitive, the shade 
+* stage the ones that are reflected or refracted, so that every bounce only
+* works on rays that are still alive.
+* ________________________________________________________________________________
+*/
+__kernel void wavefront_generate_kernel( 
+   float4        origin,
+   float4        target,
+   float4        angles,
+   int           width,
+   int           height,
+   __global Ray* rays,
+   __global int* queue)
+{
+   int x = get_global_id(0);
+   int y = get_global_id(1);
+   int index = y*width+x;
+
+   target.x = target.x + (float)(x - (width/2));
+   target.y = target.y + (float)(y - (height/2));
+
+   float4 rotationCenter = 0;
+
+   vectorRotation( origin, rotationCenter, angles );
+   vectorRotation( target, rotationCenter, angles );
+
+   rays[index].origin       = origin;
+   rays[index].target       = target;
+   rays[index].color        = 0;
+   rays[index].intersection = 0;
+   rays[index].throughput   = 1.f;
+   rays[index].refraction   = 1.f;
+   rays[index].blinn        = 0.f;
+   rays[index].iteration    = 0;
+   queue[index] = index;
+}
+
+/*
+* Closest intersection of the rays of the queue, rays hitting a lamp or 
+* nothing are done
+*/
+__kernel void wavefront_extend_kernel( 
+   __global Ray*             rays,
+   __global int*             queue,
+   __global int*             hits,
+   __global int*             counters,
+   int                       queueCounter,
+   int                       hitsCounter,
+   __global PrimitiveRecord* primitives,
+   __global Lamp*            lamps,
+   __global MaterialRecord*  materials,
+   int                       nbPrimitives,
+   int                       nbLamps,
+   __global char*            video,
+   __global char*            depth,
+   __global char*            textures,
+   float                     timer,
+   float                     transparentColor,
+   __global BoundingVolume*  boundingVolumes,
+   __global int*             primitivesIndex,
+   int                       nbBoundingVolumes,
+   __global float4*          typedSpheres,
+   __global float4*          typedShapes,
+   __global int*             typedIndex,
+   __global int*             typedRanges,
+   int                       nbTypedPrimitives,
+   __global Instance*        instances,
+   int                       nbInstances,
+   __global BoundingVolume*  instanceBoundingVolumes,
+   __global int*             instancesIndex,
+   __global PrimitiveRecord* geometryPrimitives,
+   __global BoundingVolume*  geometryBoundingVolumes,
+   __global int*             geometryIndex)
+{
+   int i = get_global_id(0);
+   if( i>=counters[queueCounter] ) return;
+
+   int    index  = queue[i];
+   float4 origin = rays[index].origin;
+   float4 target = rays[index].target;
+
+   float4 lampColor;
+   if( intersectionWithLamps( lamps, nbLamps, origin, target, &lampColor ) ) return;
+
+   Primitive closestObject;
+   float4    closestIntersection = 0;
+   float4    normal = 0;
+   bool      back;
+   if( intersectionWithPrimitives(
+      primitives, nbPrimitives,
+      boundingVolumes, primitivesIndex, nbBoundingVolumes,
+      typedSpheres, typedShapes, typedIndex, typedRanges, nbTypedPrimitives,
+      instances, nbInstances, instanceBoundingVolumes, instancesIndex,
+      geometryPrimitives, geometryBoundingVolumes, geometryIndex,
+      origin, target,
+      timer, 
+      &closestObject, &closestIntersection, &normal,
+      video, depth, materials, textures, transparentColor,
+      &back) )
+   {
+      rays[index].object       = closestObject;
+      rays[index].intersection = closestIntersection;
+      rays[index].normal       = normal;
+      hits[atomic_inc(&counters[hitsCounter])] = index;
+   }
+}
+
+/*
+* Light received by the intersections, shadow rays being cast towards the lamps
+*/
+__kernel void wavefront_shadow_kernel( 
+   __global Ray*             rays,
+   __global int*             hits,
+   __global int*             counters,
+   int                       hitsCounter,
+   float4                    origin,
+   float4                    angles,
+   __global PrimitiveRecord* primitives,
+   __global Lamp*            lamps,
+   __global MaterialRecord*  materials,
+   int                       nbPrimitives,
+   int                       nbLamps,
+   __global char*            video,
+   __global char*            depth,
+   __global char*            textures,
+   float                     timer,
+   float                     transparentColor)
+{
+   int i = get_global_id(0);
+   if( i>=counters[hitsCounter] ) return;
+
+   int index = hits[i];
+
+   float4 rotationCenter = 0;
+   vectorRotation( origin, rotationCenter, angles );
+
+   float shadowIntensity;
+   float blinn;
+   rays[index].lamps = lampsAtIntersection( 
+      primitives, nbPrimitives, lamps, nbLamps, 
+      video, depth, materials, textures, 
+      origin, rays[index].normal, rays[index].object, rays[index].intersection, 
+      timer, &shadowIntensity, &blinn, transparentColor, 0 );
+
+   if( rays[index].iteration == 0 ) rays[index].blinn = blinn;
+}
+
+/*
+* Color of the intersections. The color is accumulated front to back, which 
+* gives the same result as the recursion of launchRay. Reflected and 
+* refracted rays are queued for the next bounce.
+*/
+__kernel void wavefront_shade_kernel( 
+   __global Ray*            rays,
+   __global int*            hits,
+   __global int*            queue,
+   __global int*            counters,
+   int                      hitsCounter,
+   int                      queueCounter,
+   __global MaterialRecord* materials,
+   __global char*           video,
+   __global char*           depth,
+   __global char*           textures,
+   float                    timer)
+{
+   int i = get_global_id(0);
+   if( i>=counters[hitsCounter] ) return;
+
+   int       index = hits[i];
+   Ray       ray = rays[index];
+   Material  material = loadMaterial( materials, ray.object.materialId );
+   float4    O_R;
+   float4    O_E;
+   float4    reflectedTarget = ray.target;
+   bool      carryon = true;
+
+   float4 intersectionColor = objectColorAtIntersection( ray.object, ray.intersection, video, depth, materials, textures, timer, false );
+   float4 color = intersectionColor*ray.lamps;
+   color.w = ray.lamps.w;
+
+   float weight = color.w;
+   float ratio  = 0.f;
+   if( isTransparent(material) ) 
+   {
+      // ----------
+      // Refraction
+      // ----------
+      if( isTextured(material) ) 
+      {
+         intersectionColor -= 0.5f;
+         ray.normal *= intersectionColor;
+      }
+
+      O_E = ray.origin - ray.intersection;
+      normalizeVector(O_E);
+      float refraction = material.refraction;
+      refraction = (refraction == ray.refraction) ? 1.0f : refraction;
+      vectorRefraction( &O_R, O_E, refraction, ray.normal, ray.refraction );
+      reflectedTarget = ray.intersection - O_R;
+
+      ray.refraction = refraction;
+
+      weight = color.x + weight*(1.f-color.x);
+      ratio  = material.transparency;
+   }
+   else 
+   {
+      // ----------
+      // Reflection
+      // ----------
+      if( material.color.w != 0.f ) 
+      {
+         O_E = ray.origin - ray.intersection;
+         vectorReflection( O_R, O_E, ray.normal );
+         reflectedTarget = ray.intersection - O_R;
+
+         ratio = material.color.w;
+      }
+      else 
+      {
+         carryon = false;
+      }
+   }
+
+   ray.color      += color*(ray.throughput*weight*(1.f-ratio));
+   ray.throughput *= weight*ratio;
+   ray.origin      = ray.intersection; 
+   ray.target      = reflectedTarget;
+   ray.iteration++;
+
+   rays[index].color      = ray.color;
+   rays[index].throughput = ray.throughput;
+   rays[index].refraction = ray.refraction;
+   rays[index].origin     = ray.origin;
+   rays[index].target     = ray.target;
+   rays[index].iteration  = ray.iteration;
+
+   // Paths weighing less than the contribution threshold are cut, frames of the
+   // wavefront pipeline are not accumulated so there is no Russian roulette
+   if( carryon && ray.iteration<gNbIterations && ray.throughput>=gContributionThreshold )
+   {
+      queue[atomic_inc(&counters[queueCounter])] = index;
+   }
+}
+
+/*
+* Final color of the paths
+*/
+__kernel void wavefront_output_kernel( 
+   __global Ray*  rays,
+   int            width,
+   __global char* bitmap)
+{
+   int x = get_global_id(0);
+   int y = get_global_id(1);
+   int index = y*width+x;
+
+   // Specular reflection
+   float4 color = rays[index].color;
+   color += rays[index].blinn;
+
+   color.x = (color.x>1.f) ? 1.f : color.x;
+   color.y = (color.y>1.f) ? 1.f : color.y;
+   color.z = (color.z>1.f) ? 1.f : color.z;
+   color.w = gMaxViewDistance/rays[index].intersection.z;
+   makeOpenGLColor( color, bitmap, index ); 
+}
+
+/**
+* ________________________________________________________________________________
+* Bounding volume hierarchy built on the device
+* Linear BVH: primitives are sorted along a Morton curve and the tree is derived
+* from the sorted codes. Internal nodes are stored first ([0,n-2]), leaves
+* follow ([n-1,2n-2]), leaf j holding the j-th sorted primitive.
+* ________________________________________________________________________________
+*/
+void primitiveBounds( 
+   Primitive primitive,
+   float4*   boxMin,
+   float4*   boxMax )
+{
+   // Planes have no thickness, give them some so that the slab test is stable
+   float thickness = 0.5f;
+   float4 extent = thickness;
+   switch( primitive.type )
+   {
+   case ptSphere:
+      extent.x = primitive.size.x;
+      extent.y = primitive.size.x;
+      extent.z = primitive.size.x;
+      break;
+   case ptCylinder:
+      extent.x = primitive.size.x;
+      extent.y = primitive.size.y;
+      extent.z = primitive.size.x;
+      break;
+   case ptCheckboard:
+   case ptXZPlane:
+      extent.x = primitive.size.x;
+      extent.z = primitive.size.y;
+      break;
+   case ptYZPlane:
+      extent.y = primitive.size.y;
+      extent.z = primitive.size.x;
+      break;
+   case ptXYPlane:
+   case ptCamera:
+      extent.x = primitive.size.x;
+      extent.y = primitive.size.y;
+      break;
+   }
+   extent.w = 0.f;
+   float4 center = primitive.center;
+   center.w = 0.f;
+   *boxMin = center - extent;
+   *boxMax = center + extent;
+}
+
+/*
+* Spreads the 10 lower bits of v so that there are two zeros between each of them
+*/
+uint expandBits( uint v )
+{
+   v = (v * 0x00010001u) & 0xFF0000FFu;
+   v = (v * 0x00000101u) & 0x0F00F00Fu;
+   v = (v * 0x00000011u) & 0xC30C30C3u;
+   v = (v * 0x00000005u) & 0x49249249u;
+   return v;
+}
+
+/*
+* 30 bits Morton code of a point within the unit cube
+*/
+uint mortonCode( float4 position )
+{
+   float x = fmin( fmax( position.x*1024.f, 0.f ), 1023.f );
+   float y = fmin( fmax( position.y*1024.f, 0.f ), 1023.f );
+   float z = fmin( fmax( position.z*1024.f, 0.f ), 1023.f );
+   return expandBits((uint)x)*4 + expandBits((uint)y)*2 + expandBits((uint)z);
+}
+
+/*
+* Length of the common prefix of the keys i and j. Identical keys are told
+* apart by their index so that all keys are unique.
+*/
+int commonPrefix( 
+   __global uint* keys,
+   int            nbPrimitives,
+   int            i,
+   int            j )
+{
+   if( j<0 || j>=nbPrimitives ) return -1;
+   uint ki = keys[i];
+   uint kj = keys[j];
+   if( ki == kj ) return 32 + clz( (uint)(i^j) );
+   return clz( ki^kj );
+}
+
+/*
+* Stage 1: Bounding box of every primitive, stored as min/max pairs
+*/
+__kernel void bvh_bounds_kernel(
+   __global PrimitiveRecord* primitives,
+   int                       nbPrimitives,
+   __global float4*          boxes )
+{
+   int i = get_global_id(0);
+   if( i>=nbPrimitives ) return;
+
+   float4 boxMin;
+   float4 boxMax;
+   primitiveBounds( loadPrimitive( primitives, i ), &boxMin, &boxMax );
+   boxes[2*i  ] = boxMin;
+   boxes[2*i+1] = boxMax;
+}
+
+/*
+* Stage 2: Bounds of the centroids, each work-group reducing a strided part of
+* the primitives into sceneBounds. There are at most as many work-groups as
+* work-items in a group so that stage 3 can reduce the partial bounds.
+*/
+__kernel void bvh_centroids_kernel(
+   __global float4* boxes,
+   int              nbPrimitives,
+   __global float4* sceneBounds )
+{
+   __local float4 sceneMin[gBVHSortGroupSize];
+   __local float4 sceneMax[gBVHSortGroupSize];
+
+   int id   = get_local_id(0);
+   int size = get_local_size(0);
+
+   float4 centroidMin = MAXFLOAT;
+   float4 centroidMax = -MAXFLOAT;
+   for( int i=get_global_id(0); i<nbPrimitives; i+=get_global_size(0) )
+   {
+      float4 centroid = (boxes[2*i]+boxes[2*i+1])*0.5f;
+      centroidMin = fmin( centroidMin, centroid );
+      centroidMax = fmax( centroidMax, centroid );
+   }
+   sceneMin[id] = centroidMin;
+   sceneMax[id] = centroidMax;
+   barrier( CLK_LOCAL_MEM_FENCE );
+
+   for( int s=size/2; s>0; s>>=1 )
+   {
+      if( id<s )
+      {
+         sceneMin[id] = fmin( sceneMin[id], sceneMin[id+s] );
+         sceneMax[id] = fmax( sceneMax[id], sceneMax[id+s] );
+      }
+      barrier( CLK_LOCAL_MEM_FENCE );
+   }
+
+   if( id == 0 )
+   {
+      sceneBounds[2*get_group_id(0)  ] = sceneMin[0];
+      sceneBounds[2*get_group_id(0)+1] = sceneMax[0];
+   }
+}
+
+/*
+* Stage 3: Morton code of every primitive centroid, relatively to the bounds
+* of all centroids. Every work-group reduces the partial bounds of stage 2.
+*/
+__kernel void bvh_morton_kernel(
+   __global float4* boxes,
+   int              nbPrimitives,
+   __global float4* sceneBounds,
+   int              nbBounds,
+   __global uint*   keys,
+   __global int*    values )
+{
+   __local float4 sceneMin[gBVHSortGroupSize];
+   __local float4 sceneMax[gBVHSortGroupSize];
+
+   int id   = get_local_id(0);
+   int size = get_local_size(0);
+
+   sceneMin[id] = (id<nbBounds) ? sceneBounds[2*id]   : MAXFLOAT;
+   sceneMax[id] = (id<nbBounds) ? sceneBounds[2*id+1] : -MAXFLOAT;
+   barrier( CLK_LOCAL_MEM_FENCE );
+
+   for( int s=size/2; s>0; s>>=1 )
+   {
+      if( id<s )
+      {
+         sceneMin[id] = fmin( sceneMin[id], sceneMin[id+s] );
+         sceneMax[id] = fmax( sceneMax[id], sceneMax[id+s] );
+      }
+      barrier( CLK_LOCAL_MEM_FENCE );
+   }
+
+   int i = get_global_id(0);
+   if( i>=nbPrimitives ) return;
+
+   float4 origin = sceneMin[0];
+   float4 extent = sceneMax[0] - sceneMin[0];
+   float4 scale;
+   scale.x = (extent.x>0.f) ? 1.f/extent.x : 0.f;
+   scale.y = (extent.y>0.f) ? 1.f/extent.y : 0.f;
+   scale.z = (extent.z>0.f) ? 1.f/extent.z : 0.f;
+   scale.w = 0.f;
+
+   float4 centroid = (boxes[2*i]+boxes[2*i+1])*0.5f;
+   keys[i]   = mortonCode( (centroid-origin)*scale );
+   values[i] = i;
+}
+
+/*
+* Digit counters of the keys of a work-group for one pass of the radix sort.
+* Each work-item owns gBVHSortChunk consecutive keys of the block of the
+* group, counters are digit-major: counters[digit*size+id].
+*/
+void radixCounters( 
+   __global uint* keys,
+   int            nbPrimitives,
+   int            pass,
+   __local int*   counters )
+{
+   int  id     = get_local_id(0);
+   int  size   = get_local_size(0);
+   int  source = (pass%2==0) ? 0 : nbPrimitives;
+   uint shift  = pass*gBVHRadixBits;
+   int  begin  = min( (int)get_global_id(0)*gBVHSortChunk, nbPrimitives );
+   int  end    = min( begin+gBVHSortChunk, nbPrimitives );
+
+   for( int d=0; d<gBVHRadixSize; d++ ) 
+   {
+      counters[d*size+id] = 0;
+   }
+   for( int i=begin; i<end; i++ )
+   {
+      uint digit = (keys[source+i]>>shift) & (gBVHRadixSize-1);
+      counters[digit*size+id]++;
+   }
+   barrier( CLK_LOCAL_MEM_FENCE );
+}
+
+/*
+* Stage 4: Stable least significant digit radix sort of the Morton codes, one
+* pass at a time. keys and values hold twice nbPrimitives elements and are 
+* used as ping-pong buffers, an even number of passes leaves the result in
+* the first half. Each pass runs three kernels:
+* - bvh_histogram_kernel counts the digits of every work-group, digit-major
+*   so that the scan orders the groups within each digit,
+* - bvh_scan_kernel turns the counts into the position of the first key of
+*   each digit and group,
+* - bvh_scatter_kernel moves the keys to their position.
+*/
+__kernel void bvh_histogram_kernel(
+   __global uint* keys,
+   int            nbPrimitives,
+   int            pass,
+   __global int*  histogram )
+{
+   __local int counters[gBVHRadixSize*gBVHSortGroupSize];
+
+   int id   = get_local_id(0);
+   int size = get_local_size(0);
+   radixCounters( keys, nbPrimitives, pass, counters );
+
+   if( id<gBVHRadixSize )
+   {
+      int count = 0;
+      for( int k=0; k<size; k++ )
+      {
+         count += counters[id*size+k];
+      }
+      histogram[id*get_num_groups(0)+get_group_id(0)] = count;
+   }
+}
+
+/*
+* Exclusive scan of the histogram as a single work-group, each work-item
+* scanning a contiguous chunk before the partial sums are combined
+*/
+__kernel void bvh_scan_kernel(
+   __global int* histogram,
+   int           count )
+{
+   __local int sums[gBVHSortGroupSize];
+
+   int id    = get_local_id(0);
+   int size  = get_local_size(0);
+   int chunk = (count+size-1)/size;
+   int begin = min( id*chunk, count );
+   int end   = min( begin+chunk, count );
+
+   int sum = 0;
+   for( int k=begin; k<end; k++ )
+   {
+      sum += histogram[k];
+   }
+   sums[id] = sum;
+   barrier( CLK_LOCAL_MEM_FENCE );
+
+   for( int offset=1; offset<size; offset<<=1 )
+   {
+      int value = (id>=offset) ? sums[id-offset] : 0;
+      barrier( CLK_LOCAL_MEM_FENCE );
+      sums[id] += value;
+      barrier( CLK_LOCAL_MEM_FENCE );
+   }
+
+   int running = sums[id] - sum;
+   for( int k=begin; k<end; k++ )
+   {
+      int value = histogram[k];
+      histogram[k] = running;
+      running += value;
+   }
+}
+
+__kernel void bvh_scatter_kernel(
+   __global uint* keys,
+   __global int*  values,
+   int            nbPrimitives,
+   int            pass,
+   __global int*  histogram )
+{
+   __local int counters[gBVHRadixSize*gBVHSortGroupSize];
+   __local int sums[gBVHSortGroupSize];
+   __local int digitStart[gBVHRadixSize];
+
+   int id   = get_local_id(0);
+   int size = get_local_size(0);
+   radixCounters( keys, nbPrimitives, pass, counters );
+
+   // Exclusive scan of the counters, each work-item scanning gBVHRadixSize
+   // consecutive entries before the partial sums are combined
+   int sum = 0;
+   for( int k=0; k<gBVHRadixSize; k++ )
+   {
+      sum += counters[id*gBVHRadixSize+k];
+   }
+   sums[id] = sum;
+   barrier( CLK_LOCAL_MEM_FENCE );
+
+   for( int offset=1; offset<size; offset<<=1 )
+   {
+      int value = (id>=offset) ? sums[id-offset] : 0;
+      barrier( CLK_LOCAL_MEM_FENCE );
+      sums[id] += value;
+      barrier( CLK_LOCAL_MEM_FENCE );
+   }
+
+   int running = sums[id] - sum;
+   for( int k=0; k<gBVHRadixSize; k++ )
+   {
+      int count = counters[id*gBVHRadixSize+k];
+      counters[id*gBVHRadixSize+k] = running;
+      running += count;
+   }
+   barrier( CLK_LOCAL_MEM_FENCE );
+
+   // Keys of the group with a lower digit come first in the scan, the global
+   // position of each digit replaces them
+   if( id<gBVHRadixSize )
+   {
+      digitStart[id] = histogram[id*get_num_groups(0)+get_group_id(0)] - counters[id*size];
+   }
+   barrier( CLK_LOCAL_MEM_FENCE );
+
+   int  source      = (pass%2==0) ? 0 : nbPrimitives;
+   int  destination = nbPrimitives - source;
+   uint shift       = pass*gBVHRadixBits;
+   int  begin       = min( (int)get_global_id(0)*gBVHSortChunk, nbPrimitives );
+   int  end         = min( begin+gBVHSortChunk, nbPrimitives );
+   for( int i=begin; i<end; i++ )
+   {
+      uint key      = keys[source+i];
+      uint digit    = (key>>shift) & (gBVHRadixSize-1);
+      int  position = digitStart[digit] + counters[digit*size+id]++;
+      keys[destination+position]   = key;
+      values[destination+position] = values[source+i];
+   }
+}
+
+/*
+* Stage 5: Hierarchy emission from the sorted codes, one work-item per
+* primitive. Work-item i writes leaf i and, except for the last one, internal
+* node i whose range and split are found by binary search over the common
+* prefixes of the sorted codes.
+*/
+__kernel void bvh_emit_kernel(
+   __global uint*           keys,
+   __global int*            values,
+   __global float4*         boxes,
+   int                      nbPrimitives,
+   __global BoundingVolume* boundingVolumes,
+   __global int*            primitivesIndex,
+   __global int*            flags )
+{
+   int i = get_global_id(0);
+   if( i>=nbPrimitives ) return;
+
+   // Leaf
+   int primitive = values[i];
+   int leaf      = nbPrimitives-1+i;
+   primitivesIndex[i] = primitive;
+   boundingVolumes[leaf].min          = boxes[2*primitive];
+   boundingVolumes[leaf].max          = boxes[2*primitive+1];
+   boundingVolumes[leaf].left         = i;
+   boundingVolumes[leaf].right        = -1;
+   boundingVolumes[leaf].nbPrimitives = 1;
+   if( nbPrimitives == 1 ) boundingVolumes[leaf].parent = -1;
+
+   if( i>=nbPrimitives-1 ) return;
+
+   // Direction of the range
+   int direction = ( commonPrefix( keys, nbPrimitives, i, i+1 ) - commonPrefix( keys, nbPrimitives, i, i-1 ) >= 0 ) ? 1 : -1;
+
+   // Upper bound of the range length
+   int minPrefix = commonPrefix( keys, nbPrimitives, i, i-direction );
+   int maxLength = 2;
+   while( commonPrefix( keys, nbPrimitives, i, i+maxLength*direction ) > minPrefix ) 
+   {
+      maxLength *= 2;
+   }
+
+   // Exact range length
+   int length = 0;
+   for( int t=maxLength/2; t>=1; t/=2 )
+   {
+      if( commonPrefix( keys, nbPrimitives, i, i+(length+t)*direction ) > minPrefix ) 
+      {
+         length += t;
+      }
+   }
+   int j = i+length*direction;
+
+   // Split position
+   int nodePrefix = commonPrefix( keys, nbPrimitives, i, j );
+   int split = 0;
+   int t = length;
+   do
+   {
+      t = (t+1)/2;
+      if( commonPrefix( keys, nbPrimitives, i, i+(split+t)*direction ) > nodePrefix ) 
+      {
+         split += t;
+      }
+   }
+   while( t>1 );
+   split = i + split*direction + min( direction, 0 );
+
+   int first = min( i, j );
+   int last  = max( i, j );
+   int left  = ( first == split )   ? nbPrimitives-1+split   : split;
+   int right = ( last  == split+1 ) ? nbPrimitives-1+split+1 : split+1;
+
+   boundingVolumes[i].left         = left;
+   boundingVolumes[i].right        = right;
+   boundingVolumes[i].nbPrimitives = 0;
+   boundingVolumes[left].parent    = i;
+   boundingVolumes[right].parent   = i;
+   if( i == 0 ) boundingVolumes[0].parent = -1;
+   flags[i] = 0;
+}
+
+/*
+* Stage 6: Bottom-up computation of the internal node bounds, one work-item
+* per leaf. The first child to reach a node stops there, the second one
+* merges both children and carries on towards the root.
+*/
+__kernel void bvh_refit_kernel(
+   __global BoundingVolume* boundingVolumes,
+   __global int*            flags,
+   int                      nbPrimitives )
+{
+   int i = get_global_id(0);
+   if( i>=nbPrimitives ) return;
+
+   int node = boundingVolumes[nbPrimitives-1+i].parent;
+   while( node != -1 )
+   {
+      mem_fence( CLK_GLOBAL_MEM_FENCE );
+      if( atomic_inc( &flags[node] ) == 0 ) return;
+
+      int left  = boundingVolumes[node].left;
+      int right = boundingVolumes[node].right;
+      boundingVolumes[node].min = fmin( boundingVolumes[left].min, boundingVolumes[right].min );
+      boundingVolumes[node].max = fmax( boundingVolumes[left].max, boundingVolumes[right].max );
+      node = boundingVolumes[node].parent;
+   }
+}
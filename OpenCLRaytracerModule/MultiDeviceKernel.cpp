@@ -0,0 +1,450 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+
+#define LOG_INFO( msg ) std::cout << msg << std::endl;
+#define LOG_ERROR( msg ) std::cerr << msg << std::endl;
+
+#include "MultiDeviceKernel.h"
+
+const long MAX_DEVICES = 10;
+
+/*
+* MultiDeviceKernel constructor
+* One kernel, with its own context, per device of the platform
+*/
+MultiDeviceKernel::MultiDeviceKernel( int platformId, int nbWorkingItems, int coarsestStep )
+ : m_coarsestStep(1),
+   m_stopping(false),
+   m_width(0),
+   m_height(0),
+   m_bitmap(0),
+   m_timer(0.f),
+   m_transparentColor(0.f)
+{
+   // Same step as the kernels, largest power of 2 up to the requested one
+   while( m_coarsestStep*2<=coarsestStep ) m_coarsestStep *= 2;
+
+   cl_platform_id platforms[MAX_DEVICES];
+   cl_uint        nbPlatforms(0);
+   cl_uint        nbDevices(0);
+   if( clGetPlatformIDs( MAX_DEVICES, platforms, &nbPlatforms ) != CL_SUCCESS ||
+       platformId<0 || platformId>=static_cast<int>(nbPlatforms) ||
+       clGetDeviceIDs( platforms[platformId], CL_DEVICE_TYPE_ALL, 0, NULL, &nbDevices ) != CL_SUCCESS )
+   {
+      LOG_ERROR( "Split-frame rendering: no device found\n" );
+      nbDevices = 0;
+   }
+   if( nbDevices>MAX_DEVICES ) nbDevices = MAX_DEVICES;
+
+   for( cl_uint d(0); d<nbDevices; ++d )
+   {
+      DeviceBand band;
+      band.owner  = this;
+      band.kernel = new OpenCLKernel( platformId, d, nbWorkingItems, coarsestStep );
+      band.top    = 0;
+      band.bottom = 0;
+      band.time   = 0.0;
+      band.thread = 0;
+      band.start  = CreateEvent( NULL, FALSE, FALSE, NULL );
+      band.done   = CreateEvent( NULL, FALSE, FALSE, NULL );
+      m_bands.push_back( band );
+   }
+
+   // Threads live as long as the renderer, they wait for the frames on their
+   // start event. The bands are all in place, they do not move any more.
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].thread = CreateThread( NULL, 0, renderThread, &m_bands[i], 0, NULL );
+   }
+
+   std::stringstream s;
+   s << "Split-frame rendering on " << nbDevices << " devices\n";
+   LOG_INFO( s.str() );
+}
+
+MultiDeviceKernel::~MultiDeviceKernel()
+{
+   m_stopping = true;
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      if( m_bands[i].thread ) SetEvent( m_bands[i].start );
+   }
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      if( m_bands[i].thread )
+      {
+         WaitForSingleObject( m_bands[i].thread, INFINITE );
+         CloseHandle( m_bands[i].thread );
+      }
+      CloseHandle( m_bands[i].start );
+      CloseHandle( m_bands[i].done );
+      delete m_bands[i].kernel;
+   }
+}
+
+/*
+* initializeDevice
+* Frames are read back by each device into bitmap, the kernels keep their
+* output buffers in device memory.
+*/
+void MultiDeviceKernel::initializeDevice(
+   int        width,
+   int        height,
+   int        nbPrimitives,
+   int        nbLamps,
+   int        nbMaterials,
+   int        nbTextures,
+   BYTE*      bitmap)
+{
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].kernel->initializeDevice( width, height, nbPrimitives, nbLamps, nbMaterials, nbTextures, 0 );
+   }
+
+   // Nothing measured yet, devices start with the same number of rows
+   std::vector<double> speeds( m_bands.size(), 1.0 );
+   splitFrame( height, speeds );
+   m_width  = width;
+   m_height = height;
+}
+
+void MultiDeviceKernel::compileKernels(
+   const KernelSourceType sourceType,
+   const std::string& source,
+   const std::string& ptxFileName,
+   const std::string& options)
+{
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].kernel->compileKernels( sourceType, source, ptxFileName, options );
+   }
+}
+
+void MultiDeviceKernel::setBackgroundCompilation( bool enabled )
+{
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].kernel->setBackgroundCompilation( enabled );
+   }
+}
+
+/*
+* render
+* Devices render their band at the same time, each on a thread of its own
+* waiting for its queue. The threads are woken by their start event and 
+* signal their done event.
+*/
+void MultiDeviceKernel::render(
+   int   width,
+   int   height,
+   BYTE* bitmap,
+   float timer,
+   float transparentColor )
+{
+   if( height != m_height )
+   {
+      std::vector<double> speeds( m_bands.size(), 1.0 );
+      splitFrame( height, speeds );
+   }
+   else
+   {
+      balanceBands( height );
+   }
+
+   m_width            = width;
+   m_height           = height;
+   m_bitmap           = bitmap;
+   m_timer            = timer;
+   m_transparentColor = transparentColor;
+
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      if( m_bands[i].thread ) SetEvent( m_bands[i].start );
+   }
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      // Devices whose thread could not be created render on the caller
+      if( m_bands[i].thread ) 
+      {
+         WaitForSingleObject( m_bands[i].done, INFINITE );
+      }
+      else
+      {
+         renderBand( m_bands[i] );
+      }
+   }
+}
+
+DWORD WINAPI MultiDeviceKernel::renderThread( LPVOID parameter )
+{
+   DeviceBand*        band  = static_cast<DeviceBand*>(parameter);
+   MultiDeviceKernel* owner = band->owner;
+   while( true )
+   {
+      WaitForSingleObject( band->start, INFINITE );
+      if( owner->m_stopping ) break;
+      owner->renderBand( *band );
+      SetEvent( band->done );
+   }
+   return 0;
+}
+
+void MultiDeviceKernel::renderBand( DeviceBand& band )
+{
+   LARGE_INTEGER frequency, start, end;
+   QueryPerformanceFrequency( &frequency );
+   QueryPerformanceCounter( &start );
+   band.kernel->render( m_width, m_height, m_bitmap, m_timer, m_transparentColor );
+   QueryPerformanceCounter( &end );
+   band.time = static_cast<double>(end.QuadPart-start.QuadPart)/frequency.QuadPart;
+}
+
+/*
+* balanceBands
+* Rows are dealt again in proportion to the rows per second of each device
+* on the last frame. Moved rows are traced again in full by their new
+* device, bands are left alone while the devices take about the same time.
+*/
+void MultiDeviceKernel::balanceBands( int height )
+{
+   double fastest(0.0), slowest(0.0);
+   std::vector<double> speeds( m_bands.size(), 0.0 );
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      const DeviceBand& band = m_bands[i];
+      if( band.time<=0.0 || band.bottom<=band.top ) return;
+      speeds[i] = (band.bottom-band.top)/band.time;
+      if( i==0 || band.time<fastest ) fastest = band.time;
+      if( i==0 || band.time>slowest ) slowest = band.time;
+   }
+   if( slowest-fastest > gSplitFrameTolerance*slowest ) splitFrame( height, speeds );
+}
+
+/*
+* splitFrame
+* Bands start on a multiple of the coarsest refinement step, so that the
+* pixels traced by a coarse level only fill rows of their own band. Every
+* device keeps at least one step of rows to be measured on.
+*/
+void MultiDeviceKernel::splitFrame( int height, const std::vector<double>& speeds )
+{
+   int nbDevices = getNbDevices();
+   double totalSpeed(0.0);
+   for( int i(0); i<nbDevices; ++i ) totalSpeed += speeds[i];
+
+   int top(0);
+   double speed(0.0);
+   for( int i(0); i<nbDevices; ++i )
+   {
+      speed += speeds[i];
+      int bottom = height;
+      if( i<nbDevices-1 )
+      {
+         bottom = static_cast<int>(height*speed/totalSpeed/m_coarsestStep+0.5)*m_coarsestStep;
+         int first = top+m_coarsestStep;
+         int last  = height-(nbDevices-1-i)*m_coarsestStep;
+         if( bottom<first ) bottom = first;
+         if( bottom>last )  bottom = last;
+         if( bottom<top )   bottom = top;
+      }
+      m_bands[i].top    = top;
+      m_bands[i].bottom = bottom;
+      m_bands[i].kernel->setBand( top, bottom );
+      top = bottom;
+   }
+}
+
+void MultiDeviceKernel::setShadows( bool enabled )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setShadows( enabled );
+}
+
+void MultiDeviceKernel::setMaxIterations( int iterations )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setMaxIterations( iterations );
+}
+
+void MultiDeviceKernel::setContributionThreshold( float threshold )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setContributionThreshold( threshold );
+}
+
+/*
+* Scene edits
+* Every device holds a copy of the scene. The kernels number the elements
+* alike, the index returned by the last one is the index on all of them.
+*/
+long MultiDeviceKernel::addPrimitive( int type )
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addPrimitive( type );
+   return index;
+}
+
+void MultiDeviceKernel::setPrimitive(
+   int   index,
+   float x,
+   float y,
+   float z,
+   float width,
+   float height,
+   int   materialId,
+   int   materialPadding )
+{
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].kernel->setPrimitive( index, x, y, z, width, height, materialId, materialPadding );
+   }
+}
+
+void MultiDeviceKernel::rotatePrimitive(
+   int   index,
+   float x,
+   float y,
+   float z )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->rotatePrimitive( index, x, y, z );
+}
+
+void MultiDeviceKernel::setPrimitiveMaterial(
+   int   index,
+   int   materialId )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setPrimitiveMaterial( index, materialId );
+}
+
+long MultiDeviceKernel::addGeometry()
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addGeometry();
+   return index;
+}
+
+long MultiDeviceKernel::addGeometryPrimitive(
+   int geometry,
+   int type )
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addGeometryPrimitive( geometry, type );
+   return index;
+}
+
+void MultiDeviceKernel::setGeometryPrimitive(
+   int   geometry,
+   int   index,
+   float x,
+   float y,
+   float z,
+   float width,
+   float height,
+   int   materialId,
+   int   materialPadding )
+{
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].kernel->setGeometryPrimitive( geometry, index, x, y, z, width, height, materialId, materialPadding );
+   }
+}
+
+long MultiDeviceKernel::addInstance( int geometry )
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addInstance( geometry );
+   return index;
+}
+
+void MultiDeviceKernel::setInstance(
+   int   index,
+   float x,
+   float y,
+   float z,
+   float scale,
+   int   materialId )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setInstance( index, x, y, z, scale, materialId );
+}
+
+long MultiDeviceKernel::addLamp()
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addLamp();
+   return index;
+}
+
+void MultiDeviceKernel::setLamp(
+   int index,
+   float x, float y, float z,
+   float intensity,
+   float r, float g, float b )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setLamp( index, x, y, z, intensity, r, g, b );
+}
+
+long MultiDeviceKernel::addMaterial()
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addMaterial();
+   return index;
+}
+
+void MultiDeviceKernel::setMaterial(
+   int   index,
+   float r, float g, float b,
+   float reflection,
+   float refraction,
+   int   textured,
+   float transparency,
+   int   textureId,
+   float specValue, float specPower, float specCoef,
+   float innerIllumination )
+{
+   for( size_t i(0); i<m_bands.size(); ++i )
+   {
+      m_bands[i].kernel->setMaterial(
+         index, r, g, b, reflection, refraction, textured, transparency, textureId,
+         specValue, specPower, specCoef, innerIllumination );
+   }
+}
+
+void MultiDeviceKernel::setCamera(
+   Float4 eye, Float4 dir, Float4 angles )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setCamera( eye, dir, angles );
+}
+
+void MultiDeviceKernel::setTexture(
+   int   index,
+   BYTE* texture )
+{
+   for( size_t i(0); i<m_bands.size(); ++i ) m_bands[i].kernel->setTexture( index, texture );
+}
+
+long MultiDeviceKernel::addTexture( const std::string& filename )
+{
+   long index(-1);
+   for( size_t i(0); i<m_bands.size(); ++i ) index = m_bands[i].kernel->addTexture( filename );
+   return index;
+}
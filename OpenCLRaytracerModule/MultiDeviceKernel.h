@@ -0,0 +1,194 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include "OpenCLKernel.h"
+#include <vector>
+
+const int   gAllDevices          = -1;    // Device id of the split-frame rendering
+const float gSplitFrameTolerance = 0.1f;  // Bands move once devices differ by more than 10% of the frame
+
+class MultiDeviceKernel;
+
+// Rows of the frame traced by a device
+struct DeviceBand
+{
+   MultiDeviceKernel* owner;
+   OpenCLKernel*      kernel;
+   int                top;
+   int                bottom;
+   double             time;   // Seconds of the last frame, uploads and read back included
+   HANDLE             thread;
+   HANDLE             start;  // Set by render when a frame is ready
+   HANDLE             done;   // Set by the thread once its band is read back
+};
+
+/*
+* Split-frame renderer: the scene is replicated on every device of a
+* platform, each device traces a band of rows of the frame. Bands follow
+* the speed of the devices measured on the last frame. Each device has a
+* thread, started with the renderer and woken for each frame.
+*/
+class OPENCLRAYTRACERMODULE_API MultiDeviceKernel : public Renderer
+{
+public:
+   MultiDeviceKernel( int platformId, int nbWorkingItems, int coarsestStep );
+   ~MultiDeviceKernel();
+
+public:
+   // ---------- Devices ----------
+   void initializeDevice(
+      int        width,
+      int        height,
+      int        nbPrimitives,
+      int        nbLamps,
+      int        nbMaterials,
+      int        nbTextures,
+      BYTE*      bitmap);
+
+   void compileKernels(
+      const KernelSourceType sourceType,
+      const std::string& source,
+      const std::string& ptxFileName,
+      const std::string& options);
+   void setBackgroundCompilation( bool enabled );
+
+   int           getNbDevices() { return static_cast<int>(m_bands.size()); };
+   OpenCLKernel* getDevice( int device ) { return m_bands[device].kernel; };
+   DeviceBand    getBand( int device ) { return m_bands[device]; };
+
+public:
+   // ---------- Rendering ----------
+   void render(
+      int   imageW,
+      int   imageH,
+      BYTE* bitmap,
+      float time,
+      float transparentColor );
+
+   void setShadows( bool enabled );
+   void setMaxIterations( int iterations );
+   void setContributionThreshold( float threshold );
+
+public:
+   // ---------- Primitives ----------
+   long addPrimitive( int type );
+   void setPrimitive(
+      int   index,
+      float x,
+      float y,
+      float z,
+      float width,
+      float height,
+      int   materialId,
+      int   materialPadding );
+   void rotatePrimitive(
+      int   index,
+      float x,
+      float y,
+      float z );
+   void setPrimitiveMaterial(
+      int   index,
+      int   materialId );
+
+public:
+   // ---------- Instances ----------
+   long addGeometry();
+   long addGeometryPrimitive(
+      int geometry,
+      int type );
+   void setGeometryPrimitive(
+      int   geometry,
+      int   index,
+      float x,
+      float y,
+      float z,
+      float width,
+      float height,
+      int   materialId,
+      int   materialPadding );
+   long addInstance( int geometry );
+   void setInstance(
+      int   index,
+      float x,
+      float y,
+      float z,
+      float scale,
+      int   materialId );
+
+public:
+   // ---------- Lamps ----------
+   long addLamp();
+   void setLamp(
+      int index,
+      float x, float y, float z,
+      float intensity,
+      float r, float g, float b );
+
+public:
+   // ---------- Materials ----------
+   long addMaterial();
+   void setMaterial(
+      int   index,
+      float r, float g, float b,
+      float reflection,
+      float refraction,
+      int   textured,
+      float transparency,
+      int   textureId,
+      float specValue, float specPower, float specCoef,
+      float innerIllumination );
+
+public:
+   // ---------- Camera ----------
+   void setCamera(
+      Float4 eye, Float4 dir, Float4 angles );
+
+public:
+   // ---------- Textures ----------
+   void setTexture(
+      int   index,
+      BYTE* texture );
+   long addTexture(
+      const std::string& filename );
+
+private:
+   static DWORD WINAPI renderThread( LPVOID parameter );
+   void   renderBand( DeviceBand& band );
+   void   balanceBands( int height );
+   void   splitFrame( int height, const std::vector<double>& speeds );
+
+private:
+   std::vector<DeviceBand> m_bands;
+   int                     m_coarsestStep; // Bands start on a multiple of it
+   volatile bool           m_stopping;     // Threads leave at their next start
+
+private:
+   // Frame being rendered
+   int         m_width;
+   int         m_height;
+   BYTE*       m_bitmap;
+   float       m_timer;
+   float       m_transparentColor;
+};
@@ -1,1018 +1,3069 @@
-/* 
- * OpenCL Raytracer
- * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- * This library is free software; you can redistribute it and/or
- * modify it under the terms of the GNU Library General Public
- * License as published by the Free Software Foundation; either
- * version 2 of the License, or (at your option) any later version.
- *
- * This library is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- * Library General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
- */
-
-/*
- * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- */
-
-#include <math.h>
-#include <iostream>
-#include <fstream>
-#include <time.h>
-#include <sstream>
-
-#define LOG_INFO( msg ) std::cout << msg << std::endl;
-#define LOG_ERROR( msg ) std::cerr << msg << std::endl;
-
-#include "OpenCLKernel.h"
-
-const long MAX_SOURCE_SIZE = 65535;
-const long MAX_DEVICES = 10;
-
-/*
-* getErrorDesc
-*/
-std::string getErrorDesc(int err)
-{
-   switch (err)
-   {
-   case CL_SUCCESS                        : return "CL_SUCCESS";
-   case CL_DEVICE_NOT_FOUND               : return "CL_DEVICE_NOT_FOUND";
-   case CL_COMPILER_NOT_AVAILABLE         : return "CL_COMPILER_NOT_AVAILABLE";
-   case CL_MEM_OBJECT_ALLOCATION_FAILURE  : return "CL_MEM_OBJECT_ALLOCATION_FAILURE";
-   case CL_OUT_OF_RESOURCES               : return "CL_OUT_OF_RESOURCES";
-   case CL_OUT_OF_HOST_MEMORY             : return "CL_OUT_OF_HOST_MEMORY";
-   case CL_PROFILING_INFO_NOT_AVAILABLE   : return "CL_PROFILING_INFO_NOT_AVAILABLE";
-   case CL_MEM_COPY_OVERLAP               : return "CL_MEM_COPY_OVERLAP";
-   case CL_IMAGE_FORMAT_MISMATCH          : return "CL_IMAGE_FORMAT_MISMATCH";
-   case CL_IMAGE_FORMAT_NOT_SUPPORTED     : return "CL_IMAGE_FORMAT_NOT_SUPPORTED";
-   case CL_BUILD_PROGRAM_FAILURE          : return "CL_BUILD_PROGRAM_FAILURE";
-   case CL_MAP_FAILURE                    : return "CL_MAP_FAILURE";
-
-   case CL_INVALID_VALUE                  : return "CL_INVALID_VALUE";
-   case CL_INVALID_DEVICE_TYPE            : return "CL_INVALID_DEVICE_TYPE";
-   case CL_INVALID_PLATFORM               : return "CL_INVALID_PLATFORM";
-   case CL_INVALID_DEVICE                 : return "CL_INVALID_DEVICE";
-   case CL_INVALID_CONTEXT                : return "CL_INVALID_CONTEXT";
-   case CL_INVALID_QUEUE_PROPERTIES       : return "CL_INVALID_QUEUE_PROPERTIES";
-   case CL_INVALID_COMMAND_QUEUE          : return "CL_INVALID_COMMAND_QUEUE";
-   case CL_INVALID_HOST_PTR               : return "CL_INVALID_HOST_PTR";
-   case CL_INVALID_MEM_OBJECT             : return "CL_INVALID_MEM_OBJECT";
-   case CL_INVALID_IMAGE_FORMAT_DESCRIPTOR: return "CL_INVALID_IMAGE_FORMAT_DESCRIPTOR";
-   case CL_INVALID_IMAGE_SIZE             : return "CL_INVALID_IMAGE_SIZE";
-   case CL_INVALID_SAMPLER                : return "CL_INVALID_SAMPLER";
-   case CL_INVALID_BINARY                 : return "CL_INVALID_BINARY";
-   case CL_INVALID_BUILD_OPTIONS          : return "CL_INVALID_BUILD_OPTIONS";
-   case CL_INVALID_PROGRAM                : return "CL_INVALID_PROGRAM";
-   case CL_INVALID_PROGRAM_EXECUTABLE     : return "CL_INVALID_PROGRAM_EXECUTABLE";
-   case CL_INVALID_KERNEL_NAME            : return "CL_INVALID_KERNEL_NAME";
-   case CL_INVALID_KERNEL_DEFINITION      : return "CL_INVALID_KERNEL_DEFINITION";
-   case CL_INVALID_KERNEL                 : return "CL_INVALID_KERNEL";
-   case CL_INVALID_ARG_INDEX              : return "CL_INVALID_ARG_INDEX";
-   case CL_INVALID_ARG_VALUE              : return "CL_INVALID_ARG_VALUE";
-   case CL_INVALID_ARG_SIZE               : return "CL_INVALID_ARG_SIZE";
-   case CL_INVALID_KERNEL_ARGS            : return "CL_INVALID_KERNEL_ARGS";
-   case CL_INVALID_WORK_DIMENSION         : return "CL_INVALID_WORK_DIMENSION";
-   case CL_INVALID_WORK_GROUP_SIZE        : return "CL_INVALID_WORK_GROUP_SIZE";
-   case CL_INVALID_WORK_ITEM_SIZE         : return "CL_INVALID_WORK_ITEM_SIZE";
-   case CL_INVALID_GLOBAL_OFFSET          : return "CL_INVALID_GLOBAL_OFFSET";
-   case CL_INVALID_EVENT_WAIT_LIST        : return "CL_INVALID_EVENT_WAIT_LIST";
-   case CL_INVALID_OPERATION              : return "CL_INVALID_OPERATION";
-   case CL_INVALID_GL_OBJECT              : return "CL_INVALID_GL_OBJECT";
-   case CL_INVALID_BUFFER_SIZE            : return "CL_INVALID_BUFFER_SIZE";
-   case CL_INVALID_MIP_LEVEL              : return "CL_INVALID_MIP_LEVEL";
-   default: return "UNKNOWN";
-   }
-}
-
-/*
-* Callback function for clBuildProgram notifications
-*/
-void pfn_notify(cl_program, void *user_data)
-{
-   std::stringstream s;
-   s << "OpenCL Error (via pfn_notify): " << user_data;
-   std::cerr << s.str() << std::endl;
-}
-
-/*
-* CHECKSTATUS
-*/
-
-#define CHECKSTATUS( stmt ) \
-{ \
-   int __status = stmt; \
-   if( __status != CL_SUCCESS ) { \
-   std::stringstream __s; \
-   __s << "==> " #stmt "\n"; \
-   __s << "ERROR : " << getErrorDesc(__status) << "\n" ; \
-   __s << "<== " #stmt "\n"; \
-   LOG_ERROR( __s.str() ); \
-   } \
-}
-
-/*
-* OpenCLKernel constructor
-*/
-OpenCLKernel::OpenCLKernel( int platformId, int deviceId, int nbWorkingItems, int draft )
- : m_hContext(0),m_hQueue(0),
-   m_hBitmap(0), m_hVideo(0), m_hDepth(0), m_hTextures(0),
-   m_hPrimitives(0), m_hLamps(0), m_primitives(0), m_lamps(0), m_materials(0),m_textures(0),
-   m_nbActivePrimitives(0), m_nbActiveLamps(0),m_nbActiveMaterials(0),m_nbActiveTextures(0),
-#if USE_KINECT
-   m_skeletons(0), m_hNextDepthFrameEvent(0), m_hNextVideoFrameEvent(0), m_hNextSkeletonEvent(0),
-   m_pVideoStreamHandle(0), m_pDepthStreamHandle(0),
-   m_skeletonsBody(-1), m_skeletonsLamp(-1),
-#endif // USE_KINECT
-   m_computeUnits( nbWorkingItems ), m_preferredWorkGroupSize(0), m_initialDraft(draft), m_draft(1),
-   m_texturedTransfered(false)
-{
-   int  status(0);
-   cl_platform_id   platforms[MAX_DEVICES];
-   cl_uint          ret_num_devices;
-   cl_uint          ret_num_platforms;
-   char buffer[MAX_SOURCE_SIZE];
-   size_t len;
-
-#if USE_KINECT
-   // Initialize Kinect
-   status = NuiInitialize( NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON | NUI_INITIALIZE_FLAG_USES_COLOR);
-
-   m_hNextDepthFrameEvent = CreateEvent( NULL, TRUE, FALSE, NULL ); 
-   m_hNextVideoFrameEvent = CreateEvent( NULL, TRUE, FALSE, NULL ); 
-   m_hNextSkeletonEvent   = CreateEvent( NULL, TRUE, FALSE, NULL );
-
-   m_skeletons = CreateEvent( NULL, TRUE, FALSE, NULL );			 
-   status = NuiSkeletonTrackingEnable( m_skeletons, 0 );
-
-   status = NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR,                  NUI_IMAGE_RESOLUTION_640x480, 0, 2, m_hNextVideoFrameEvent, &m_pVideoStreamHandle );
-   status = NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, NUI_IMAGE_RESOLUTION_320x240, 0, 2, m_hNextDepthFrameEvent, &m_pDepthStreamHandle );
-
-   status = NuiCameraElevationSetAngle( 0 );
-#endif // USE_KINECT
-
-
-   LOG_INFO("clGetPlatformIDs\n");
-   CHECKSTATUS(clGetPlatformIDs(MAX_DEVICES, platforms, &ret_num_platforms));
-   //CHECKSTATUS(clGetPlatformIDs(0, NULL, &ret_num_platforms));
-
-   std::stringstream s;
-   //for( int p(0); p<ret_num_platforms; p++) 
-   int p = platformId;
-   {
-      // Platform details
-      s << "Platform " << p << ":\n";
-      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_PROFILE, MAX_SOURCE_SIZE, buffer, &len ));
-      buffer[len] = 0; s << "  Profile    : " << buffer << "\n";
-      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_VERSION, MAX_SOURCE_SIZE, buffer, &len ));
-      buffer[len] = 0; s << "  Version    : " << buffer << "\n";
-      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_NAME, MAX_SOURCE_SIZE, buffer, &len ));
-      buffer[len] = 0; s << "  Name       : " << buffer << "\n";
-      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_VENDOR, MAX_SOURCE_SIZE, buffer, &len ));
-      buffer[len] = 0; s << "  Vendor     : " << buffer << "\n";
-      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_VENDOR, MAX_SOURCE_SIZE, buffer, &len ));
-      buffer[len] = 0; s << "  Extensions : " << buffer << "\n";
-
-      CHECKSTATUS(clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 1, m_hDevices, &ret_num_devices));
-
-      // Devices
-      int d = deviceId;
-      //for( cl_uint d(0); d<ret_num_devices; d++ ) 
-      {
-         s << "  Device " << d << ":\n";
-
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_NAME, sizeof(buffer), buffer, NULL));
-         s << "    DEVICE_NAME                        : " << buffer << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_VENDOR, sizeof(buffer), buffer, NULL));
-         s << "    DEVICE_VENDOR                      : " << buffer << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_VERSION, sizeof(buffer), buffer, NULL));
-         s << "    DEVICE_VERSION                     : " << buffer << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DRIVER_VERSION, sizeof(buffer), buffer, NULL));
-         s << "    DRIVER_VERSION                     : " << buffer << "\n";
-
-         cl_uint value;
-         cl_uint values[10];
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(value), &value, NULL));
-         s << "    DEVICE_MAX_COMPUTE_UNITS           : " << value << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(value), &value, NULL));
-         s << "    CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS : " << value << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(value), &value, NULL));
-         s << "    CL_DEVICE_MAX_WORK_GROUP_SIZE      : " << value << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(values), &values, NULL));
-         s << "    CL_DEVICE_MAX_WORK_ITEM_SIZES      : " << values[0] << ", " << values[1] << ", " << values[2] << "\n";
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(value), &value, NULL));
-         s << "    CL_DEVICE_MAX_CLOCK_FREQUENCY      : " << value << "\n";
-
-
-         cl_device_type infoType;
-         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_TYPE, sizeof(infoType), &infoType, NULL));
-         s << "    DEVICE_TYPE                        : ";
-         if (infoType & CL_DEVICE_TYPE_DEFAULT) {
-            infoType &= ~CL_DEVICE_TYPE_DEFAULT;
-            s << "Default";
-         }
-         if (infoType & CL_DEVICE_TYPE_CPU) {
-            infoType &= ~CL_DEVICE_TYPE_CPU;
-            s << "CPU";
-         }
-         if (infoType & CL_DEVICE_TYPE_GPU) {
-            infoType &= ~CL_DEVICE_TYPE_GPU;
-            s << "GPU";
-         }
-         if (infoType & CL_DEVICE_TYPE_ACCELERATOR) {
-            infoType &= ~CL_DEVICE_TYPE_ACCELERATOR;
-            s << "Accelerator";
-         }
-         if (infoType != 0) {
-            s << "Unknown ";
-            s << infoType;
-         }
-      }
-      s << "\n";
-   }
-   std::cout << s.str() << std::endl;
-   LOG_INFO( s.str() );
-
-    m_hContext = clCreateContext(NULL, ret_num_devices, &m_hDevices[0], NULL, NULL, &status );
-
-   m_hQueue = clCreateCommandQueue(m_hContext, m_hDevices[0], CL_QUEUE_PROFILING_ENABLE, &status);
-
-   // Eye position
-   m_viewPos.s[0] =   0.0f;
-   m_viewPos.s[1] =   0.0f;
-   m_viewPos.s[2] = -40.0f;
-
-   // Rotation angles
-   m_angles.s[0] = 0.0f;
-   m_angles.s[1] = 0.0f;
-   m_angles.s[2] = 0.0f;
-}
-
-/*
-* compileKernels
-*/
-void OpenCLKernel::compileKernels( 
-   const KernelSourceType sourceType,
-   const std::string& source, 
-   const std::string& ptxFileName,
-   const std::string& options)
-{
-   try 
-   {
-      int status(0);
-      cl_program hProgram(0);
-      clUnloadCompiler();
-
-      const char* source_str; 
-      size_t len(0);
-      switch( sourceType ) 
-      {
-      case kst_file:
-         if( source.length() != 0 ) 
-         {
-            source_str = loadFromFile(source, len);
-         }
-         break;
-      case kst_string:
-         {
-            source_str = source.c_str();
-            len = source.length();
-         }
-         break;
-      }
-
-
-      LOG_INFO("clCreateProgramWithSource\n");
-      hProgram = clCreateProgramWithSource( m_hContext, 1, (const char **)&source_str, (const size_t*)&len, &status );
-      CHECKSTATUS(status);
-
-      LOG_INFO("clCreateProgramWithSource\n");
-      hProgram = clCreateProgramWithSource( m_hContext, 1, (const char **)&source_str, (const size_t*)&len, &status );
-      CHECKSTATUS(status);
-
-      LOG_INFO("clBuildProgram\n");
-      CHECKSTATUS( clBuildProgram( hProgram, 0, NULL, options.c_str(), NULL, NULL) );
-      
-      if( sourceType == kst_file)
-      {
-         delete [] source_str;
-         source_str = NULL;
-      }
-
-      clUnloadCompiler();
-
-      LOG_INFO("clCreateKernel(render_kernel)\n");
-      m_hKernel = clCreateKernel( hProgram, "render_kernel", &status );
-      CHECKSTATUS(status);
-
-      //if( m_computeUnits == 0 ) 
-      {
-         clGetKernelWorkGroupInfo( m_hKernel, m_hDevices[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(m_computeUnits), &m_computeUnits , NULL);
-         std::cout << "CL_KERNEL_WORK_GROUP_SIZE=" << m_computeUnits << std::endl;
-      }
-
-      clGetKernelWorkGroupInfo( m_hKernel, m_hDevices[0], CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(m_preferredWorkGroupSize), &m_preferredWorkGroupSize , NULL);
-      std::cout << "CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE=" << m_preferredWorkGroupSize << std::endl;
-
-      char buffer[MAX_SOURCE_SIZE];
-      LOG_INFO("clGetProgramBuildInfo\n");
-      CHECKSTATUS( clGetProgramBuildInfo( hProgram, m_hDevices[0], CL_PROGRAM_BUILD_LOG, MAX_SOURCE_SIZE*sizeof(char), &buffer, &len ) );
-
-      if( buffer[0] != 0 ) 
-      {
-         buffer[len] = 0;
-         std::stringstream s;
-         s << buffer;
-         LOG_INFO( s.str() );
-         std::cout << s.str() << std::endl;
-      }
-#if 0
-         // Generate Binaries!!!
-         // Obtain the length of the binary data that will be queried, for each device
-         size_t ret_num_devices = 1;
-         size_t binaries_sizes[MAX_DEVICES];
-         CHECKSTATUS( clGetProgramInfo(
-            hProgram, 
-            CL_PROGRAM_BINARY_SIZES, 
-            ret_num_devices*sizeof(size_t), 
-            binaries_sizes, 
-            0 ));
-
-         char **binaries = new char*[MAX_DEVICES];
-         for (size_t i = 0; i < ret_num_devices; i++)
-            binaries[i] = new char[binaries_sizes[i]+1];
-
-         CHECKSTATUS( clGetProgramInfo(
-            hProgram, 
-            CL_PROGRAM_BINARIES, 
-            MAX_DEVICES*sizeof(size_t), 
-            binaries, 
-            NULL));                        
-
-         for (size_t i = 0; i < ret_num_devices; i++) {
-            binaries[i][binaries_sizes[i]] = '\0';
-            char name[255];
-            sprintf_s(name, 255, "kernel%d.ptx", i );
-            FILE* fp = NULL;
-            fopen_s(&fp, name, "w");
-            fwrite(binaries[i], 1, binaries_sizes[i], fp);
-            fclose(fp);
-         }
-
-         for (size_t i = 0; i < ret_num_devices; i++)                                
-            delete [] binaries[i];                        
-         delete [] binaries;
-#endif // 0
-
-      if( ptxFileName.length() != 0 ) 
-      {
-         // Open the ptx file and load it   
-         // into a char* buffer   
-         std::ifstream myReadFile;
-         std::string str;
-         std::string line;
-         std::ifstream myfile( ptxFileName.c_str() );
-         if (myfile.is_open()) {
-            while ( myfile.good() ) {
-               std::getline(myfile,line);
-               str += '\n' + line;
-            }
-            myfile.close();
-         }
-
-         size_t lSize = str.length();
-         char* buffer = new char[lSize+1];
-         strcpy_s( buffer, lSize, str.c_str() );
-
-         // Build the rendering kernel
-         int errcode(0);
-         hProgram = clCreateProgramWithBinary(
-            m_hContext,
-            1, 
-            &m_hDevices[0],
-            &lSize, 
-            (const unsigned char**)&buffer,                 
-            &status, 
-            &errcode);   
-         CHECKSTATUS(errcode);
-
-         CHECKSTATUS( clBuildProgram( hProgram, 0, NULL, "", NULL, NULL) );
-
-         m_hKernel = clCreateKernel(
-            hProgram, "render_kernel", &status );
-         CHECKSTATUS(status);
-
-         delete [] buffer;
-      }
-
-      LOG_INFO("clReleaseProgram\n");
-      CHECKSTATUS(clReleaseProgram(hProgram));
-      hProgram = 0;
-   }
-   catch( ... ) 
-   {
-      LOG_ERROR("Unexpected exception\n");
-   }
-}
-
-void OpenCLKernel::initializeDevice(
-   int        width, 
-   int        height, 
-   int        nbPrimitives,
-   int        nbLamps,
-   int        nbMaterials,
-   int        nbTextures,
-   BYTE*      bitmap)
-{
-   int status(0);
-   // Setup device memory
-   LOG_INFO("Setup device memory\n");
-   m_hBitmap     = clCreateBuffer( m_hContext, CL_MEM_WRITE_ONLY, width*height*sizeof(BYTE)*gColorDepth,            0, NULL);
-
-   m_hPrimitives = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , sizeof(Primitive)*nbPrimitives,                   0, NULL);
-   m_hLamps      = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , sizeof(Lamp)*nbLamps,                             0, NULL);
-   m_hMaterials  = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , sizeof(Material)*nbMaterials,                     0, NULL);
-
-   m_hTextures   = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , gTextureWidth*gTextureHeight*gTextureDepth*sizeof(BYTE)*nbTextures, 0, NULL);
-
-   m_hVideo      = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , gVideoWidth*gVideoHeight*gKinectColorVideo, 0, NULL);
-   m_hDepth      = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , gDepthWidth*gDepthHeight*gKinectColorDepth, 0, NULL);
-
-   // Setup World
-   m_primitives = new Primitive[nbPrimitives];
-   memset( m_primitives, 0, nbPrimitives*sizeof(Primitive) ); 
-   m_lamps      = new Lamp[nbLamps];
-   memset( m_lamps, 0, nbLamps*sizeof(Lamp) ); 
-   m_materials  = new Material[nbMaterials];
-   memset( m_materials, 0, nbMaterials*sizeof(Material) ); 
-   m_textures   = new BYTE[gTextureWidth*gTextureHeight*gColorDepth*nbTextures];
-
-   // NVAPI
-   /*
-   StereoHandle * m_pStereoHandle = NULL;
-   IUnknown *m_pDx = NULL;
-   NvAPI_Stereo_CreateHandleFromIUnknown( m_pDx, m_pStereoHandle );
-   NvAPI_Stereo_Activate( m_pStereoHandle );
-   */
-}
-
-void OpenCLKernel::releaseDevice()
-{
-   LOG_INFO("Release device memory\n");
-   if( m_hPrimitives ) CHECKSTATUS(clReleaseMemObject(m_hPrimitives));
-   if( m_hLamps )      CHECKSTATUS(clReleaseMemObject(m_hLamps));
-   if( m_hMaterials )  CHECKSTATUS(clReleaseMemObject(m_hMaterials));
-   if( m_hTextures )   CHECKSTATUS(clReleaseMemObject(m_hTextures));
-
-   if( m_hBitmap )     CHECKSTATUS(clReleaseMemObject(m_hBitmap));
-   if( m_hVideo )      CHECKSTATUS(clReleaseMemObject(m_hVideo));
-   if( m_hDepth )      CHECKSTATUS(clReleaseMemObject(m_hDepth));
-
-   if( m_hKernel )     CHECKSTATUS(clReleaseKernel(m_hKernel));
-
-   if( m_hQueue )      CHECKSTATUS(clReleaseCommandQueue(m_hQueue));
-   if( m_hContext )    CHECKSTATUS(clReleaseContext(m_hContext));
-
-   delete m_primitives;
-   delete m_lamps;
-   delete m_materials;
-   delete m_textures;
-
-   m_hContext=0;
-   m_hQueue=0;
-   m_hBitmap=0;
-   m_hVideo=0;
-   m_hDepth=0;
-   m_hTextures=0;
-   m_hPrimitives=0;
-   m_hLamps=0;
-   m_primitives=0;
-   m_lamps=0;
-   m_materials=0;
-   m_textures=0;
-   m_nbActivePrimitives=0;
-   m_nbActiveLamps=0;
-   m_nbActiveMaterials=0;
-   m_nbActiveTextures=0;
-#if USE_KINECT
-   m_skeletons=0, 
-   m_hNextDepthFrameEvent=0;
-   m_hNextVideoFrameEvent=0;
-   m_hNextSkeletonEvent=0;
-   m_pVideoStreamHandle=0;
-   m_pDepthStreamHandle=0;
-   m_skeletonsBody = -1;
-   m_skeletonsLamp = -1;
-#endif // USE_KINECT
-}
-
-/*
-* runKernel
-*/
-void OpenCLKernel::render( 
-   int   width, 
-   int   height, 
-   BYTE* bitmap,
-   float timer,
-   float transparentColor)
-{
-   int status(0);
-
-   BYTE* video(0);
-   BYTE* depth(0);
-#if USE_KINECT
-   // Video
-   const NUI_IMAGE_FRAME* pImageFrame = 0;
-   WaitForSingleObject (m_hNextVideoFrameEvent,INFINITE); 
-   status = NuiImageStreamGetNextFrame( m_pVideoStreamHandle, 0, &pImageFrame ); 
-   if(( status == S_OK) && pImageFrame ) 
-   {
-      INuiFrameTexture* pTexture = pImageFrame->pFrameTexture;
-      NUI_LOCKED_RECT LockedRect;
-      pTexture->LockRect( 0, &LockedRect, NULL, 0 ) ; 
-      if( LockedRect.Pitch != 0 ) 
-      {
-         video = (BYTE*) LockedRect.pBits;
-      }
-   }
-
-   // Depth
-   const NUI_IMAGE_FRAME* pDepthFrame = 0;
-   WaitForSingleObject (m_hNextDepthFrameEvent,INFINITE); 
-   status = NuiImageStreamGetNextFrame( m_pDepthStreamHandle, 0, &pDepthFrame ); 
-   if(( status == S_OK) && pDepthFrame ) 
-   {
-      INuiFrameTexture* pTexture = pDepthFrame->pFrameTexture;
-      if( pTexture ) 
-      {
-         NUI_LOCKED_RECT LockedRectDepth;
-         pTexture->LockRect( 0, &LockedRectDepth, NULL, 0 ) ; 
-         if( LockedRectDepth.Pitch != 0 ) 
-         {
-            depth = (BYTE*) LockedRectDepth.pBits;
-         }
-      }
-   }
-   NuiImageStreamReleaseFrame( m_pVideoStreamHandle, pImageFrame ); 
-   NuiImageStreamReleaseFrame( m_pDepthStreamHandle, pDepthFrame ); 
-#endif // USE_KINECT
-
-
-   // Initialise Input arrays
-   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hPrimitives, CL_FALSE, 0, m_nbActivePrimitives*sizeof(Primitive),                       m_primitives, 0, NULL, NULL));
-   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hLamps,      CL_FALSE, 0, m_nbActiveLamps*sizeof(Lamp),                                 m_lamps,      0, NULL, NULL));
-   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hMaterials,  CL_FALSE, 0, m_nbActiveMaterials*sizeof(Material),                         m_materials,  0, NULL, NULL));
-   if( !m_texturedTransfered )
-   {
-      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hTextures,   CL_FALSE, 0, gTextureDepth*gTextureWidth*gTextureHeight*m_nbActiveTextures,m_textures,   0, NULL, NULL));
-      m_texturedTransfered = true;
-   }
-
-   if( video ) CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hVideo, CL_FALSE, 0, gKinectColorVideo*gVideoWidth*gVideoHeight, video, 0, NULL, NULL));
-   if( depth ) CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hDepth, CL_FALSE, 0, gKinectColorDepth*gDepthWidth*gDepthHeight, depth, 0, NULL, NULL));
-
-   // Setting kernel arguments
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 0, sizeof(cl_float4),(void*)&m_viewPos ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 1, sizeof(cl_float4),(void*)&m_viewDir ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 2, sizeof(cl_float4),(void*)&m_angles ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 3, sizeof(cl_int),   (void*)&width ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 4, sizeof(cl_int),   (void*)&height ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 5, sizeof(cl_mem),   (void*)&m_hPrimitives ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 6, sizeof(cl_mem),   (void*)&m_hLamps ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 7, sizeof(cl_mem),   (void*)&m_hMaterials ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 8, sizeof(cl_int),   (void*)&m_nbActivePrimitives ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel, 9, sizeof(cl_int),   (void*)&m_nbActiveLamps ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,10, sizeof(cl_int),   (void*)&m_nbActiveMaterials ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,11, sizeof(cl_mem),   (void*)&m_hBitmap ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,12, sizeof(cl_mem),   (void*)&m_hVideo ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,13, sizeof(cl_mem),   (void*)&m_hDepth ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,14, sizeof(cl_mem),   (void*)&m_hTextures ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,15, sizeof(cl_float), (void*)&timer ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,16, sizeof(cl_int),   (void*)&m_draft ));
-   CHECKSTATUS(clSetKernelArg( m_hKernel,17, sizeof(cl_int),   (void*)&transparentColor ));
-
-   // Run the kernel!!
-   size_t szGlobalWorkSize[] = {width,height};
-   size_t szLocalWorkSize  = 0;
-
-   CHECKSTATUS(clEnqueueNDRangeKernel(
-      m_hQueue, m_hKernel, 2, NULL, szGlobalWorkSize, 0, 0, 0, 0));
-
-   // ------------------------------------------------------------
-   // Read back the results
-   // ------------------------------------------------------------
-
-   // Bitmap
-   if( bitmap != 0 ) {
-      CHECKSTATUS( clEnqueueReadBuffer( m_hQueue, m_hBitmap, CL_FALSE, 0, width*height*sizeof(BYTE)*gColorDepth, bitmap, 0, NULL, NULL) );
-   }
-
-   CHECKSTATUS(clFlush(m_hQueue));
-   CHECKSTATUS(clFinish(m_hQueue));
-
-   m_draft--;
-   m_draft = (m_draft < 1) ? 1 : m_draft;
-}
-
-void OpenCLKernel::setCamera( 
-   cl_float4 eye, cl_float4 dir, cl_float4 angles )
-{
-   m_viewPos   = eye;
-   m_viewDir   = dir;
-   m_angles.s[0]  += angles.s[0];
-   m_angles.s[1]  += angles.s[1];
-   m_angles.s[2]  += angles.s[2];
-   m_draft     = m_initialDraft;
-}
-
-/*
-*
-*/
-OpenCLKernel::~OpenCLKernel()
-{
-   // Clean up
-   releaseDevice();
-
-#if USE_KINECT
-   CloseHandle(m_skeletons);
-   CloseHandle(m_hNextDepthFrameEvent); 
-   CloseHandle(m_hNextVideoFrameEvent); 
-   CloseHandle(m_hNextSkeletonEvent);
-   NuiShutdown();
-#endif // USE_KINECT
-}
-
-long OpenCLKernel::addPrimitive( int type )
-{
-   long result = m_nbActivePrimitives;
-   m_primitives[m_nbActivePrimitives].type = type;
-   m_primitives[m_nbActivePrimitives].materialId = NO_MATERIAL;
-   m_nbActivePrimitives++;
-   return result;
-}
-
-void OpenCLKernel::setPrimitive( 
-   int index, 
-   float x, 
-   float y, 
-   float z, 
-   float width, 
-   float height, 
-   int   martialId, 
-   int   materialPadding )
-{
-   if( index>= 0 && index < m_nbActivePrimitives) 
-   {
-      m_primitives[index].center.s[0]   = x;
-      m_primitives[index].center.s[1]   = y;
-      m_primitives[index].center.s[2]   = z;
-      m_primitives[index].center.s[3]   = width; // Deprecated
-      /*
-      m_primitives[index].rotation.s[0] = 0.f;
-      m_primitives[index].rotation.s[1] = 0.f;
-      m_primitives[index].rotation.s[2] = 0.f;
-      m_primitives[index].rotation.s[3] = 0.f; // Not used
-      */
-      m_primitives[index].size.s[0] = width;
-      m_primitives[index].size.s[1] = height;
-      m_primitives[index].size.s[2] = 0.f;
-      m_primitives[index].size.s[3] = 0.f; // Not used
-      m_primitives[index].materialId    = martialId;
-      m_primitives[index].materialRatioX = (gTextureWidth/width/2)*materialPadding;
-      m_primitives[index].materialRatioY = (gTextureHeight/height/2)*materialPadding;
-   }
-}
-
-void OpenCLKernel::rotatePrimitive( 
-   int   index, 
-   float x, 
-   float y, 
-   float z )
-{
-   /*
-   if( index>= 0 && index < m_nbActivePrimitives) 
-   {
-      m_primitives[index].rotation.s[0]   = x;
-      m_primitives[index].rotation.s[1]   = y;
-      m_primitives[index].rotation.s[2]   = z;
-      m_primitives[index].rotation.s[3]   = 0.f; // Not used
-   }
-   */
-}
-
-long OpenCLKernel::addCube( 
-   float x, 
-   float y, 
-   float z, 
-   float radius, 
-   int   martialId, 
-   int   materialPadding )
-{
-   long returnValue;
-   // Back
-   returnValue = addPrimitive( ptXYPlane );
-   setPrimitive( returnValue, x, y, z+radius, radius, radius, martialId, materialPadding ); 
-
-   // Front
-   returnValue = addPrimitive( ptXYPlane );
-   setPrimitive( returnValue, x, y, z-radius, radius, radius, martialId, materialPadding ); 
-
-   // Left
-   returnValue = addPrimitive( ptYZPlane );
-   setPrimitive( returnValue, x-radius, y, z, radius, radius, martialId, materialPadding ); 
-
-   // Right
-   returnValue = addPrimitive( ptYZPlane );
-   setPrimitive( returnValue, x+radius, y, z, radius, radius, martialId, materialPadding ); 
-
-   // Top
-   returnValue = addPrimitive( ptXZPlane );
-   setPrimitive( returnValue, x, y+radius, z, radius, radius, martialId, materialPadding ); 
-
-   // Bottom
-   returnValue = addPrimitive( ptXZPlane );
-   setPrimitive( returnValue, x, y-radius, z, radius, radius, martialId, materialPadding ); 
-   return returnValue;
-}
-
-void OpenCLKernel::setPrimitiveMaterial( 
-   int   index, 
-   int   materialId )
-{
-   if( index>= 0 && index < m_nbActivePrimitives) {
-      m_primitives[index].materialId = materialId;
-   }
-}
-
-long OpenCLKernel::addLamp()
-{
-   long result = m_nbActiveLamps;
-   m_nbActiveLamps++;
-   return result;
-}
-
-void OpenCLKernel::setLamp( 
-   int index,
-   float x, float y, float z, 
-   float intensity, 
-   float r, float g, float b )
-{
-   if( index>= 0 && index < m_nbActiveLamps ) {
-      m_lamps[index].center.s[0]   = x;
-      m_lamps[index].center.s[1]   = y;
-      m_lamps[index].center.s[2]   = z;
-      m_lamps[index].center.s[3]   = 0.5f; // radius
-      m_lamps[index].color.s[0]    = r;
-      m_lamps[index].color.s[1]    = g;
-      m_lamps[index].color.s[2]    = b;
-      m_lamps[index].color.s[3]    = intensity;
-   }
-}
-
-// ---------- Materials ----------
-long OpenCLKernel::addMaterial()
-{
-   long result = m_nbActiveMaterials;
-   m_materials[m_nbActiveMaterials].textureId = NO_MATERIAL;
-   m_nbActiveMaterials++;
-   return result;
-}
-
-void OpenCLKernel::setMaterial( 
-   int   index,
-   float r, float g, float b, 
-   float reflection, 
-   float refraction, 
-   int   textured,
-   float transparency,
-   int   textureId,
-   float specValue, float specPower, float specCoef, float innerIllumination )
-{
-   if( index>= 0 && index < m_nbActiveMaterials ) {
-      m_materials[index].color.s[0]  = r;
-      m_materials[index].color.s[1]  = g;
-      m_materials[index].color.s[2]  = b;
-      m_materials[index].color.s[3]  = reflection;
-      m_materials[index].refraction  = refraction;
-      m_materials[index].textured    = textured;
-      m_materials[index].textureId   = textureId;
-      m_materials[index].transparency= transparency;
-      m_materials[index].specular.s[0]  = specValue;
-      m_materials[index].specular.s[1]  = specPower;
-      m_materials[index].specular.s[2]  = innerIllumination;
-      m_materials[index].specular.s[3]  = specCoef;
-   }
-}
-
-// ---------- Textures ----------
-void OpenCLKernel::setTexture(
-   int   index,
-   BYTE* texture )
-{
-   BYTE* idx = m_textures+index*gTextureWidth*gTextureHeight*gTextureDepth;
-   int j(0);
-   for( int i(0); i<gTextureWidth*gTextureHeight*gColorDepth; i += gColorDepth ) {
-      idx[j]   = texture[i+2];
-      idx[j+1] = texture[i+1];
-      idx[j+2] = texture[i];
-      j+=gTextureDepth;
-   }
-}
-
-/*
-*
-*/
-char* OpenCLKernel::loadFromFile( const std::string& filename, size_t& length )
-{
-   // Load the kernel source code into the array source_str
-   FILE *fp = 0;
-   char *source_str = 0;
-
-   fopen_s( &fp, filename.c_str(), "r");
-   if( fp == 0 ) 
-   {
-      std::cout << "Failed to load kernel " << filename.c_str() << std::endl;
-   }
-   else 
-   {
-      source_str = (char*)malloc(MAX_SOURCE_SIZE);
-      length = fread( source_str, 1, MAX_SOURCE_SIZE, fp);
-      fclose( fp );
-   }
-   return source_str;
-}
-
-// ---------- Kinect ----------
-long OpenCLKernel::addTexture( const std::string& filename )
-{
-   FILE *filePtr(0); //our file pointer
-   BITMAPFILEHEADER bitmapFileHeader; //our bitmap file header
-   unsigned char *bitmapImage;  //store image data
-   BITMAPINFOHEADER bitmapInfoHeader;
-   DWORD imageIdx=0;  //image index counter
-   unsigned char tempRGB;  //our swap variable
-
-   //open filename in read binary mode
-   fopen_s(&filePtr, filename.c_str(), "rb");
-   if (filePtr == NULL) {
-      return 1;
-   }
-
-   //read the bitmap file header
-   fread(&bitmapFileHeader, sizeof(BITMAPFILEHEADER), 1, filePtr);
-
-   //verify that this is a bmp file by check bitmap id
-   if (bitmapFileHeader.bfType !=0x4D42) {
-      fclose(filePtr);
-      return 1;
-   }
-
-   //read the bitmap info header
-   fread(&bitmapInfoHeader, sizeof(BITMAPINFOHEADER),1,filePtr);
-
-   //move file point to the begging of bitmap data
-   fseek(filePtr, bitmapFileHeader.bfOffBits, SEEK_SET);
-
-   //allocate enough memory for the bitmap image data
-   bitmapImage = (unsigned char*)malloc(bitmapInfoHeader.biSizeImage);
-
-   //verify memory allocation
-   if (!bitmapImage)
-   {
-      free(bitmapImage);
-      fclose(filePtr);
-      return 1;
-   }
-
-   //read in the bitmap image data
-   fread( bitmapImage, bitmapInfoHeader.biSizeImage, 1, filePtr);
-
-   //make sure bitmap image data was read
-   if (bitmapImage == NULL)
-   {
-      fclose(filePtr);
-      return NULL;
-   }
-
-   //swap the r and b values to get RGB (bitmap is BGR)
-   for (imageIdx = 0; imageIdx < bitmapInfoHeader.biSizeImage; imageIdx += 3)
-   {
-      tempRGB = bitmapImage[imageIdx];
-      bitmapImage[imageIdx] = bitmapImage[imageIdx + 2];
-      bitmapImage[imageIdx + 2] = tempRGB;
-   }
-
-   //close file and return bitmap iamge data
-   fclose(filePtr);
-
-   BYTE* index = m_textures + (m_nbActiveTextures*bitmapInfoHeader.biSizeImage*sizeof(BYTE));
-   memcpy( index, bitmapImage, bitmapInfoHeader.biSizeImage );
-   m_nbActiveTextures++;
-
-   free( bitmapImage );
-   return m_nbActiveTextures-1;
-}
-
-#ifdef USE_KINECT
-long OpenCLKernel::updateSkeletons( 
-   double center_x, double  center_y, double  center_z, 
-   double size,
-   double radius,       int materialId,
-   double head_radius,  int head_materialId,
-   double hands_radius, int hands_materialId,
-   double feet_radius,  int feet_materialId)
-{
-   bool found = false;
-   HRESULT hr = NuiSkeletonGetNextFrame( 0, &m_skeletonFrame );
-   int i=0;
-   while( i<NUI_SKELETON_COUNT && !found ) 
-   {
-      if( m_skeletonFrame.SkeletonData[i].eTrackingState == NUI_SKELETON_TRACKED ) 
-      {
-         found = true;
-         if( m_skeletonsBody == -1 ) 
-         {
-            // Create Skeleton
-            m_skeletonsBody = m_nbActivePrimitives;
-            m_skeletonsLamp = m_nbActiveLamps;
-            for( int j=0; j<20; j++ ) 
-            {
-               addPrimitive( ptSphere );
-            }
-         }
-         else 
-         {
-            for( int j=0; j<20; j++ ) 
-            {
-               double r = radius;
-               int   m = materialId;
-               bool createSphere(true);
-               switch (j) {
-                  case NUI_SKELETON_POSITION_FOOT_LEFT:
-                  case NUI_SKELETON_POSITION_FOOT_RIGHT:
-                     r = feet_radius;
-                     m = feet_materialId;
-                     createSphere = true;
-                     break;
-                  case NUI_SKELETON_POSITION_HAND_LEFT:
-                  case NUI_SKELETON_POSITION_HAND_RIGHT:
-                     r = hands_radius;
-                     m = hands_materialId;
-                     createSphere = true;
-                     /*
-                     if( j == NUI_SKELETON_POSITION_HAND_RIGHT )
-                     {
-                        m_viewDir.s[0] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].x;
-                        m_viewDir.s[1] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].y;
-                        m_viewDir.s[2] = m_viewPos.s[2] + size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].z;
-                     }
-                     */
-                     break;
-                  case NUI_SKELETON_POSITION_HEAD:
-                     r = head_radius;
-                     m = head_materialId;
-                     createSphere = true;
-                     /*
-                     m_viewPos.s[0] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].x;
-                     m_viewPos.s[1] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].y;
-                     m_viewPos.s[2] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].z - 400.f;
-                     m_viewDir = m_viewPos;
-                     */
-                     break;
-               }
-               if( createSphere ) setPrimitive(
-                  m_skeletonsBody+j,
-                  static_cast<float>(m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].x * size + center_x),
-                  static_cast<float>(m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].y * size + center_y),
-                  static_cast<float>(m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].z * size + center_z),
-                  static_cast<float>(r), 
-                  static_cast<float>(r), 
-                  m,
-                  1 );
-            }
-#if 0
-            m_angles.s[1] += 0.1f*asin( 
-               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_RIGHT].x - 
-               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_ELBOW_RIGHT].x );
-            m_angles.s[0] += 0.1f*asin( 
-               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_LEFT].y - 
-               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_ELBOW_LEFT].y );
-#endif // 0
-            /*
-            m_viewDir.s[2] += 200.f + 100.f*( 
-               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_RIGHT].z - 
-               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_LEFT].z );
-               */
-         }
-      }
-      i++;
-   }
-   return 0;
-}
-#endif // USE_KINECT
+/* 
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <math.h>
+#include <iostream>
+#include <fstream>
+#include <time.h>
+#include <sstream>
+#include <algorithm>
+
+#define LOG_INFO( msg ) std::cout << msg << std::endl;
+#define LOG_ERROR( msg ) std::cerr << msg << std::endl;
+
+#include "OpenCLKernel.h"
+
+const long MAX_SOURCE_SIZE = 65535;
+const long MAX_DEVICES = 10;
+
+// Source of the counter resets, non blocking writes need it to outlive the call
+const cl_int gZeroCounter = 0;
+
+// Renders the frames queued before the first build completes
+const char* gFallbackKernelSource =
+   "__kernel void clear_kernel( __global char* bitmap )\n"
+   "{\n"
+   "   bitmap[get_global_id(0)] = 0;\n"
+   "}\n";
+
+/*
+* hashBytes
+* 64 bits FNV-1a
+*/
+cl_ulong hashBytes( const char* bytes, size_t length )
+{
+   cl_ulong hash = 14695981039346656037ULL;
+   for( size_t i(0); i<length; ++i )
+   {
+      hash ^= static_cast<unsigned char>(bytes[i]);
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+/*
+* defaultProgramCacheDirectory
+* Programs are cached per user, in the local application data. The cache is
+* disabled when that folder cannot be found or created.
+*/
+std::string defaultProgramCacheDirectory()
+{
+   char localAppData[MAX_PATH];
+   DWORD length = GetEnvironmentVariableA( "LOCALAPPDATA", localAppData, MAX_PATH );
+   if( length == 0 || length >= MAX_PATH ) return "";
+
+   std::string directory = std::string(localAppData) + "\\OpenCLRaytracer";
+   if( !CreateDirectoryA( directory.c_str(), NULL ) && GetLastError() != ERROR_ALREADY_EXISTS ) return "";
+   return directory;
+}
+
+/*
+* getErrorDesc
+*/
+std::string getErrorDesc(int err)
+{
+   switch (err)
+   {
+   case CL_SUCCESS                        : return "CL_SUCCESS";
+   case CL_DEVICE_NOT_FOUND               : return "CL_DEVICE_NOT_FOUND";
+   case CL_COMPILER_NOT_AVAILABLE         : return "CL_COMPILER_NOT_AVAILABLE";
+   case CL_MEM_OBJECT_ALLOCATION_FAILURE  : return "CL_MEM_OBJECT_ALLOCATION_FAILURE";
+   case CL_OUT_OF_RESOURCES               : return "CL_OUT_OF_RESOURCES";
+   case CL_OUT_OF_HOST_MEMORY             : return "CL_OUT_OF_HOST_MEMORY";
+   case CL_PROFILING_INFO_NOT_AVAILABLE   : return "CL_PROFILING_INFO_NOT_AVAILABLE";
+   case CL_MEM_COPY_OVERLAP               : return "CL_MEM_COPY_OVERLAP";
+   case CL_IMAGE_FORMAT_MISMATCH          : return "CL_IMAGE_FORMAT_MISMATCH";
+   case CL_IMAGE_FORMAT_NOT_SUPPORTED     : return "CL_IMAGE_FORMAT_NOT_SUPPORTED";
+   case CL_BUILD_PROGRAM_FAILURE          : return "CL_BUILD_PROGRAM_FAILURE";
+   case CL_MAP_FAILURE                    : return "CL_MAP_FAILURE";
+
+   case CL_INVALID_VALUE                  : return "CL_INVALID_VALUE";
+   case CL_INVALID_DEVICE_TYPE            : return "CL_INVALID_DEVICE_TYPE";
+   case CL_INVALID_PLATFORM               : return "CL_INVALID_PLATFORM";
+   case CL_INVALID_DEVICE                 : return "CL_INVALID_DEVICE";
+   case CL_INVALID_CONTEXT                : return "CL_INVALID_CONTEXT";
+   case CL_INVALID_QUEUE_PROPERTIES       : return "CL_INVALID_QUEUE_PROPERTIES";
+   case CL_INVALID_COMMAND_QUEUE          : return "CL_INVALID_COMMAND_QUEUE";
+   case CL_INVALID_HOST_PTR               : return "CL_INVALID_HOST_PTR";
+   case CL_INVALID_MEM_OBJECT             : return "CL_INVALID_MEM_OBJECT";
+   case CL_INVALID_IMAGE_FORMAT_DESCRIPTOR: return "CL_INVALID_IMAGE_FORMAT_DESCRIPTOR";
+   case CL_INVALID_IMAGE_SIZE             : return "CL_INVALID_IMAGE_SIZE";
+   case CL_INVALID_SAMPLER                : return "CL_INVALID_SAMPLER";
+   case CL_INVALID_BINARY                 : return "CL_INVALID_BINARY";
+   case CL_INVALID_BUILD_OPTIONS          : return "CL_INVALID_BUILD_OPTIONS";
+   case CL_INVALID_PROGRAM                : return "CL_INVALID_PROGRAM";
+   case CL_INVALID_PROGRAM_EXECUTABLE     : return "CL_INVALID_PROGRAM_EXECUTABLE";
+   case CL_INVALID_KERNEL_NAME            : return "CL_INVALID_KERNEL_NAME";
+   case CL_INVALID_KERNEL_DEFINITION      : return "CL_INVALID_KERNEL_DEFINITION";
+   case CL_INVALID_KERNEL                 : return "CL_INVALID_KERNEL";
+   case CL_INVALID_ARG_INDEX              : return "CL_INVALID_ARG_INDEX";
+   case CL_INVALID_ARG_VALUE              : return "CL_INVALID_ARG_VALUE";
+   case CL_INVALID_ARG_SIZE               : return "CL_INVALID_ARG_SIZE";
+   case CL_INVALID_KERNEL_ARGS            : return "CL_INVALID_KERNEL_ARGS";
+   case CL_INVALID_WORK_DIMENSION         : return "CL_INVALID_WORK_DIMENSION";
+   case CL_INVALID_WORK_GROUP_SIZE        : return "CL_INVALID_WORK_GROUP_SIZE";
+   case CL_INVALID_WORK_ITEM_SIZE         : return "CL_INVALID_WORK_ITEM_SIZE";
+   case CL_INVALID_GLOBAL_OFFSET          : return "CL_INVALID_GLOBAL_OFFSET";
+   case CL_INVALID_EVENT_WAIT_LIST        : return "CL_INVALID_EVENT_WAIT_LIST";
+   case CL_INVALID_OPERATION              : return "CL_INVALID_OPERATION";
+   case CL_INVALID_GL_OBJECT              : return "CL_INVALID_GL_OBJECT";
+   case CL_INVALID_BUFFER_SIZE            : return "CL_INVALID_BUFFER_SIZE";
+   case CL_INVALID_MIP_LEVEL              : return "CL_INVALID_MIP_LEVEL";
+   default: return "UNKNOWN";
+   }
+}
+
+/*
+* Callback function for clBuildProgram notifications
+*/
+void pfn_notify(cl_program, void *user_data)
+{
+   std::stringstream s;
+   s << "OpenCL Error (via pfn_notify): " << user_data;
+   std::cerr << s.str() << std::endl;
+}
+
+/*
+* CHECKSTATUS
+*/
+
+#define CHECKSTATUS( stmt ) \
+{ \
+   int __status = stmt; \
+   if( __status != CL_SUCCESS ) { \
+   std::stringstream __s; \
+   __s << "==> " #stmt "\n"; \
+   __s << "ERROR : " << getErrorDesc(__status) << "\n" ; \
+   __s << "<== " #stmt "\n"; \
+   LOG_ERROR( __s.str() ); \
+   } \
+}
+
+/*
+* OpenCLKernel constructor
+*/
+OpenCLKernel::OpenCLKernel( int platformId, int deviceId, int nbWorkingItems, int coarsestStep )
+ : m_hContext(0),m_hQueue(0),m_hTransferQueue(0),m_hKernel(0),m_hKernelPostProcessing(0),
+   m_hBitmap(0), m_hVideo(0), m_hDepth(0), m_hTextures(0),
+   m_hPrimitives(0), m_hLamps(0),
+   m_hBoundingVolumes(0), m_hPrimitivesIndex(0), m_nbBoundingVolumes(0), m_bvhDirty(true),
+   m_hBVHBoxes(0), m_hBVHKeys(0), m_hBVHValues(0), m_hBVHFlags(0), m_hBVHSceneBounds(0), m_hBVHHistogram(0), m_bvhBuilder(bvb_host),
+   m_hKernelBVHBounds(0), m_hKernelBVHCentroids(0), m_hKernelBVHMorton(0), 
+   m_hKernelBVHHistogram(0), m_hKernelBVHScan(0), m_hKernelBVHScatter(0), m_hKernelBVHEmit(0), m_hKernelBVHRefit(0),
+   m_bvhSortGroupSize(0),
+   m_hKernelWavefrontGenerate(0), m_hKernelWavefrontExtend(0), m_hKernelWavefrontShadow(0), 
+   m_hKernelWavefrontShade(0), m_hKernelWavefrontOutput(0),
+   m_hKernelPersistent(0), m_persistentGroupSize(0), m_persistentWorkItems(0), m_hWorkCounter(0),
+   m_hRays(0), m_hRayHits(0), m_hRayCounters(0), m_renderMode(rm_standard),
+   m_hTypedSpheres(0), m_hTypedShapes(0), m_hTypedIndex(0), m_hTypedRanges(0), 
+   m_primitiveStorage(ps_hierarchy), m_nbTypedPrimitives(0),
+   m_hInstances(0), m_hInstanceBoundingVolumes(0), m_hInstancesIndex(0), 
+   m_hGeometryPrimitives(0), m_hGeometryBoundingVolumes(0), m_hGeometryIndex(0),
+   m_geometriesDirty(false), m_instancesDirty(false),
+#if USE_KINECT
+   m_skeletons(0), m_hNextDepthFrameEvent(0), m_hNextVideoFrameEvent(0), m_hNextSkeletonEvent(0),
+   m_pVideoStreamHandle(0), m_pDepthStreamHandle(0),
+   m_skeletonsBody(-1), m_skeletonsLamp(-1),
+#endif // USE_KINECT
+   m_computeUnits( nbWorkingItems ), m_preferredWorkGroupSize(0), m_programCacheDirectory(defaultProgramCacheDirectory()),
+   m_kernelSpecialization(true),
+   m_backgroundCompilation(false), m_hKernelFallback(0), m_hProgramFallback(0),
+   m_coarsestStep(1), m_refinementStep(1), m_previousStep(0), m_previousOutput(0),
+   m_hAccumulation(0), m_accumulation(true), m_nbSamples(0), m_accumulationTimer(0.f), m_animatedScene(false),
+   m_hKernelReprojectionClear(0), m_hKernelReprojectionDepth(0), m_hKernelReprojectionColor(0), m_hKernelReprojectionHoles(0),
+   m_hReprojectionDepth(0), m_reprojection(false), m_reprojectFrame(false), m_historyValid(false), 
+   m_historyIndex(0), m_nbReprojectedFrames(0), m_postProcessing(0),
+   m_texturedTransfered(false),
+   m_pipelineDepth(2), m_nbQueuedFrames(0),
+   m_outputMode(om_copy), m_outputBitmap(0), m_outputSize(0), m_mappedBitmap(0),
+   m_nextTicket(0), m_pendingCallbacks(0), m_bandTop(0), m_bandBottom(0),
+   m_profileFrame(false), m_nbFrameTimings(0), m_frameTimingsIndex(0)
+{
+   int  status(0);
+   cl_platform_id   platforms[MAX_DEVICES];
+   cl_uint          ret_num_devices;
+   cl_uint          ret_num_platforms;
+   char buffer[MAX_SOURCE_SIZE];
+   size_t len;
+
+   // Largest power of 2 up to the requested step
+   while( m_coarsestStep*2<=coarsestStep ) m_coarsestStep *= 2;
+   m_refinementStep = m_coarsestStep;
+
+   InitializeCriticalSection( &m_renderLock );
+   m_callbacksDone = CreateEvent( NULL, TRUE, TRUE, NULL );
+   m_hRayQueues[0] = 0;
+   m_hRayQueues[1] = 0;
+   m_hHistory[0]   = 0;
+   m_hHistory[1]   = 0;
+   m_hPostProcessingFrames[0] = 0;
+   m_hPostProcessingFrames[1] = 0;
+   setDenoiser( 2, 0.1f, 0.05f );
+   setToneMapping( 1.f, 1.f );
+   for( int i(0); i<gMaxFramesInFlight; ++i )
+   {
+      m_hFrames[i]   = 0;
+      m_frames[i]    = 0;
+      m_frameRead[i] = 0;
+   }
+
+#if USE_KINECT
+   // Initialize Kinect
+   status = NuiInitialize( NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX | NUI_INITIALIZE_FLAG_USES_SKELETON | NUI_INITIALIZE_FLAG_USES_COLOR);
+
+   m_hNextDepthFrameEvent = CreateEvent( NULL, TRUE, FALSE, NULL ); 
+   m_hNextVideoFrameEvent = CreateEvent( NULL, TRUE, FALSE, NULL ); 
+   m_hNextSkeletonEvent   = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+   m_skeletons = CreateEvent( NULL, TRUE, FALSE, NULL );			 
+   status = NuiSkeletonTrackingEnable( m_skeletons, 0 );
+
+   status = NuiImageStreamOpen( NUI_IMAGE_TYPE_COLOR,                  NUI_IMAGE_RESOLUTION_640x480, 0, 2, m_hNextVideoFrameEvent, &m_pVideoStreamHandle );
+   status = NuiImageStreamOpen( NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, NUI_IMAGE_RESOLUTION_320x240, 0, 2, m_hNextDepthFrameEvent, &m_pDepthStreamHandle );
+
+   status = NuiCameraElevationSetAngle( 0 );
+#endif // USE_KINECT
+
+   LOG_INFO("clGetPlatformIDs\n");
+   CHECKSTATUS(clGetPlatformIDs(MAX_DEVICES, platforms, &ret_num_platforms));
+   //CHECKSTATUS(clGetPlatformIDs(0, NULL, &ret_num_platforms));
+
+   std::stringstream s;
+   //for( int p(0); p<ret_num_platforms; p++) 
+   int p = platformId;
+   {
+      // Platform details
+      s << "Platform " << p << ":\n";
+      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_PROFILE, MAX_SOURCE_SIZE, buffer, &len ));
+      buffer[len] = 0; s << "  Profile    : " << buffer << "\n";
+      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_VERSION, MAX_SOURCE_SIZE, buffer, &len ));
+      buffer[len] = 0; s << "  Version    : " << buffer << "\n";
+      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_NAME, MAX_SOURCE_SIZE, buffer, &len ));
+      buffer[len] = 0; s << "  Name       : " << buffer << "\n";
+      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_VENDOR, MAX_SOURCE_SIZE, buffer, &len ));
+      buffer[len] = 0; s << "  Vendor     : " << buffer << "\n";
+      CHECKSTATUS(clGetPlatformInfo( platforms[p], CL_PLATFORM_VENDOR, MAX_SOURCE_SIZE, buffer, &len ));
+      buffer[len] = 0; s << "  Extensions : " << buffer << "\n";
+
+      CHECKSTATUS(clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, MAX_DEVICES, m_hDevices, &ret_num_devices));
+
+      // Devices
+      int d = deviceId;
+      //for( cl_uint d(0); d<ret_num_devices; d++ ) 
+      {
+         s << "  Device " << d << ":\n";
+
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_NAME, sizeof(buffer), buffer, NULL));
+         s << "    DEVICE_NAME                        : " << buffer << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_VENDOR, sizeof(buffer), buffer, NULL));
+         s << "    DEVICE_VENDOR                      : " << buffer << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_VERSION, sizeof(buffer), buffer, NULL));
+         s << "    DEVICE_VERSION                     : " << buffer << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DRIVER_VERSION, sizeof(buffer), buffer, NULL));
+         s << "    DRIVER_VERSION                     : " << buffer << "\n";
+
+         cl_uint value;
+         cl_uint values[10];
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(value), &value, NULL));
+         s << "    DEVICE_MAX_COMPUTE_UNITS           : " << value << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(value), &value, NULL));
+         s << "    CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS : " << value << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(value), &value, NULL));
+         s << "    CL_DEVICE_MAX_WORK_GROUP_SIZE      : " << value << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(values), &values, NULL));
+         s << "    CL_DEVICE_MAX_WORK_ITEM_SIZES      : " << values[0] << ", " << values[1] << ", " << values[2] << "\n";
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(value), &value, NULL));
+         s << "    CL_DEVICE_MAX_CLOCK_FREQUENCY      : " << value << "\n";
+
+
+         cl_device_type infoType;
+         CHECKSTATUS(clGetDeviceInfo(m_hDevices[d], CL_DEVICE_TYPE, sizeof(infoType), &infoType, NULL));
+         s << "    DEVICE_TYPE                        : ";
+         if (infoType & CL_DEVICE_TYPE_DEFAULT) {
+            infoType &= ~CL_DEVICE_TYPE_DEFAULT;
+            s << "Default";
+         }
+         if (infoType & CL_DEVICE_TYPE_CPU) {
+            infoType &= ~CL_DEVICE_TYPE_CPU;
+            s << "CPU";
+         }
+         if (infoType & CL_DEVICE_TYPE_GPU) {
+            infoType &= ~CL_DEVICE_TYPE_GPU;
+            s << "GPU";
+         }
+         if (infoType & CL_DEVICE_TYPE_ACCELERATOR) {
+            infoType &= ~CL_DEVICE_TYPE_ACCELERATOR;
+            s << "Accelerator";
+         }
+         if (infoType != 0) {
+            s << "Unknown ";
+            s << infoType;
+         }
+      }
+      s << "\n";
+   }
+   std::cout << s.str() << std::endl;
+   LOG_INFO( s.str() );
+
+   // The context only holds the requested device, moved first
+   m_hDevices[0] = m_hDevices[deviceId];
+   m_hContext = clCreateContext(NULL, 1, &m_hDevices[0], NULL, NULL, &status );
+
+   m_hQueue = clCreateCommandQueue(m_hContext, m_hDevices[0], CL_QUEUE_PROFILING_ENABLE, &status);
+   m_hTransferQueue = clCreateCommandQueue(m_hContext, m_hDevices[0], 0, &status);
+}
+
+/*
+* compileKernels
+* In background mode, the program is built on a worker thread and frames 
+* are cleared until its kernels are swapped in.
+*/
+void OpenCLKernel::compileKernels( 
+   const KernelSourceType sourceType,
+   const std::string& source, 
+   const std::string& ptxFileName,
+   const std::string& options)
+{
+   try 
+   {
+      int status(0);
+      cl_program hProgram(0);
+      waitForBuilds();
+      clUnloadCompiler();
+      releaseKernelVariants();
+
+      const char* source_str; 
+      size_t len(0);
+      switch( sourceType ) 
+      {
+      case kst_file:
+         if( source.length() != 0 ) 
+         {
+            source_str = loadFromFile(source, len);
+         }
+         break;
+      case kst_string:
+         {
+            source_str = source.c_str();
+            len = source.length();
+         }
+         break;
+      }
+
+      // Kept to build the scene-specialized variants
+      m_kernelSource.assign( source_str, len );
+      m_kernelOptions   = options;
+      m_genericSettings = renderSettings( m_maxIterations );
+      m_featuresDirty   = true;
+      
+      if( sourceType == kst_file)
+      {
+         delete [] source_str;
+         source_str = NULL;
+      }
+
+      if( m_backgroundCompilation && ptxFileName.length() == 0 )
+      {
+         createFallbackKernel();
+         startBuild( "" );
+         return;
+      }
+
+      hProgram = buildProgram( m_kernelSource.c_str(), m_kernelSource.length(), options + m_genericSettings );
+
+      clUnloadCompiler();
+
+      if( hProgram ) createKernels( hProgram );
+
+      if( ptxFileName.length() != 0 ) 
+      {
+         // Open the ptx file and load it   
+         // into a char* buffer   
+         std::ifstream myReadFile;
+         std::string str;
+         std::string line;
+         std::ifstream myfile( ptxFileName.c_str() );
+         if (myfile.is_open()) {
+            while ( myfile.good() ) {
+               std::getline(myfile,line);
+               str += '\n' + line;
+            }
+            myfile.close();
+         }
+
+         size_t lSize = str.length();
+         char* buffer = new char[lSize+1];
+         strcpy_s( buffer, lSize, str.c_str() );
+
+         // Build the rendering kernel
+         int errcode(0);
+         hProgram = clCreateProgramWithBinary(
+            m_hContext,
+            1, 
+            &m_hDevices[0],
+            &lSize, 
+            (const unsigned char**)&buffer,                 
+            &status, 
+            &errcode);   
+         CHECKSTATUS(errcode);
+
+         CHECKSTATUS( clBuildProgram( hProgram, 0, NULL, "", NULL, NULL) );
+
+         m_hKernel = clCreateKernel(
+            hProgram, "render_kernel", &status );
+         CHECKSTATUS(status);
+
+         // There is no source left to specialize
+         m_kernelSource.clear();
+
+         delete [] buffer;
+      }
+
+      LOG_INFO("clReleaseProgram\n");
+      if( hProgram ) CHECKSTATUS(clReleaseProgram(hProgram));
+      hProgram = 0;
+   }
+   catch( ... ) 
+   {
+      LOG_ERROR("Unexpected exception\n");
+   }
+}
+
+
+/*
+* createKernels
+* Kernels of a program built from the generic source, the kernels in use 
+* are released first.
+*/
+void OpenCLKernel::createKernels( cl_program hProgram )
+{
+   int status(0);
+   size_t len(0);
+   releaseKernels();
+
+   LOG_INFO("clCreateKernel(render_kernel)\n");
+   m_hKernel = clCreateKernel( hProgram, "render_kernel", &status );
+   CHECKSTATUS(status);
+
+   //if( m_computeUnits == 0 ) 
+   {
+      clGetKernelWorkGroupInfo( m_hKernel, m_hDevices[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(m_computeUnits), &m_computeUnits , NULL);
+      std::cout << "CL_KERNEL_WORK_GROUP_SIZE=" << m_computeUnits << std::endl;
+   }
+
+   clGetKernelWorkGroupInfo( m_hKernel, m_hDevices[0], CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(m_preferredWorkGroupSize), &m_preferredWorkGroupSize , NULL);
+   std::cout << "CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE=" << m_preferredWorkGroupSize << std::endl;
+
+   // Bounding volume hierarchy construction
+   LOG_INFO("clCreateKernel(bvh_bounds_kernel)\n");
+   m_hKernelBVHBounds = clCreateKernel( hProgram, "bvh_bounds_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_centroids_kernel)\n");
+   m_hKernelBVHCentroids = clCreateKernel( hProgram, "bvh_centroids_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_morton_kernel)\n");
+   m_hKernelBVHMorton = clCreateKernel( hProgram, "bvh_morton_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_histogram_kernel)\n");
+   m_hKernelBVHHistogram = clCreateKernel( hProgram, "bvh_histogram_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_scan_kernel)\n");
+   m_hKernelBVHScan = clCreateKernel( hProgram, "bvh_scan_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_scatter_kernel)\n");
+   m_hKernelBVHScatter = clCreateKernel( hProgram, "bvh_scatter_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_emit_kernel)\n");
+   m_hKernelBVHEmit = clCreateKernel( hProgram, "bvh_emit_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(bvh_refit_kernel)\n");
+   m_hKernelBVHRefit = clCreateKernel( hProgram, "bvh_refit_kernel", &status );
+   CHECKSTATUS(status);
+
+   // Persistent threads: a few work-groups per compute unit
+   LOG_INFO("clCreateKernel(render_persistent_kernel)\n");
+   m_hKernelPersistent = clCreateKernel( hProgram, "render_persistent_kernel", &status );
+   CHECKSTATUS(status);
+   if( m_hKernelPersistent )
+   {
+      cl_uint deviceUnits(0);
+      CHECKSTATUS(clGetDeviceInfo( m_hDevices[0], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(deviceUnits), &deviceUnits, NULL ));
+      clGetKernelWorkGroupInfo( m_hKernelPersistent, m_hDevices[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(m_persistentGroupSize), &m_persistentGroupSize, NULL);
+      m_persistentGroupSize = (m_persistentGroupSize>gPersistentGroupSize || m_persistentGroupSize==0) ? gPersistentGroupSize : m_persistentGroupSize;
+      m_persistentWorkItems = deviceUnits*gPersistentGroupsPerUnit*m_persistentGroupSize;
+      LOG_INFO("Persistent threads=" << m_persistentWorkItems << " (work-group size=" << m_persistentGroupSize << ")");
+   }
+
+   // Wavefront pipeline
+   LOG_INFO("clCreateKernel(wavefront_generate_kernel)\n");
+   m_hKernelWavefrontGenerate = clCreateKernel( hProgram, "wavefront_generate_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(wavefront_extend_kernel)\n");
+   m_hKernelWavefrontExtend = clCreateKernel( hProgram, "wavefront_extend_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(wavefront_shadow_kernel)\n");
+   m_hKernelWavefrontShadow = clCreateKernel( hProgram, "wavefront_shadow_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(wavefront_shade_kernel)\n");
+   m_hKernelWavefrontShade = clCreateKernel( hProgram, "wavefront_shade_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(wavefront_output_kernel)\n");
+   m_hKernelWavefrontOutput = clCreateKernel( hProgram, "wavefront_output_kernel", &status );
+   CHECKSTATUS(status);
+
+   // Post-processing passes
+   LOG_INFO("clCreateKernel(post_processing_kernel)\n");
+   m_hKernelPostProcessing = clCreateKernel( hProgram, "post_processing_kernel", &status );
+   CHECKSTATUS(status);
+
+   // Temporal reprojection
+   LOG_INFO("clCreateKernel(reprojection_clear_kernel)\n");
+   m_hKernelReprojectionClear = clCreateKernel( hProgram, "reprojection_clear_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(reprojection_depth_kernel)\n");
+   m_hKernelReprojectionDepth = clCreateKernel( hProgram, "reprojection_depth_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(reprojection_color_kernel)\n");
+   m_hKernelReprojectionColor = clCreateKernel( hProgram, "reprojection_color_kernel", &status );
+   CHECKSTATUS(status);
+   LOG_INFO("clCreateKernel(reprojection_holes_kernel)\n");
+   m_hKernelReprojectionHoles = clCreateKernel( hProgram, "reprojection_holes_kernel", &status );
+   CHECKSTATUS(status);
+
+   // Morton codes and sort share a work-group size, a power of 2 that every kernel accepts
+   cl_kernel sortKernels[] = { m_hKernelBVHCentroids, m_hKernelBVHMorton, m_hKernelBVHHistogram, m_hKernelBVHScan, m_hKernelBVHScatter };
+   const size_t nbSortKernels = sizeof(sortKernels)/sizeof(cl_kernel);
+   if( std::find( sortKernels, sortKernels+nbSortKernels, (cl_kernel)0 ) == sortKernels+nbSortKernels )
+   {
+      m_bvhSortGroupSize = gBVHSortGroupSize;
+      for( size_t k(0); k<nbSortKernels; ++k )
+      {
+         size_t groupSize(0);
+         clGetKernelWorkGroupInfo( sortKernels[k], m_hDevices[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(groupSize), &groupSize, NULL);
+         while( m_bvhSortGroupSize>1 && m_bvhSortGroupSize>groupSize )
+         {
+            m_bvhSortGroupSize /= 2;
+         }
+      }
+      LOG_INFO("BVH sort work-group size=" << m_bvhSortGroupSize);
+   }
+
+   char buffer[MAX_SOURCE_SIZE];
+   LOG_INFO("clGetProgramBuildInfo\n");
+   CHECKSTATUS( clGetProgramBuildInfo( hProgram, m_hDevices[0], CL_PROGRAM_BUILD_LOG, MAX_SOURCE_SIZE*sizeof(char), &buffer, &len ) );
+
+   if( buffer[0] != 0 ) 
+   {
+      buffer[len] = 0;
+      std::stringstream s;
+      s << buffer;
+      LOG_INFO( s.str() );
+      std::cout << s.str() << std::endl;
+   }
+}
+
+void OpenCLKernel::releaseKernels()
+{
+   if( m_hKernel )     CHECKSTATUS(clReleaseKernel(m_hKernel));
+   if( m_hKernelPostProcessing ) CHECKSTATUS(clReleaseKernel(m_hKernelPostProcessing));
+   if( m_hKernelBVHBounds ) CHECKSTATUS(clReleaseKernel(m_hKernelBVHBounds));
+   if( m_hKernelBVHCentroids ) CHECKSTATUS(clReleaseKernel(m_hKernelBVHCentroids));
+   if( m_hKernelBVHMorton )    CHECKSTATUS(clReleaseKernel(m_hKernelBVHMorton));
+   if( m_hKernelBVHHistogram ) CHECKSTATUS(clReleaseKernel(m_hKernelBVHHistogram));
+   if( m_hKernelBVHScan )      CHECKSTATUS(clReleaseKernel(m_hKernelBVHScan));
+   if( m_hKernelBVHScatter )   CHECKSTATUS(clReleaseKernel(m_hKernelBVHScatter));
+   if( m_hKernelBVHEmit )   CHECKSTATUS(clReleaseKernel(m_hKernelBVHEmit));
+   if( m_hKernelBVHRefit )  CHECKSTATUS(clReleaseKernel(m_hKernelBVHRefit));
+   if( m_hKernelWavefrontGenerate ) CHECKSTATUS(clReleaseKernel(m_hKernelWavefrontGenerate));
+   if( m_hKernelWavefrontExtend )   CHECKSTATUS(clReleaseKernel(m_hKernelWavefrontExtend));
+   if( m_hKernelWavefrontShadow )   CHECKSTATUS(clReleaseKernel(m_hKernelWavefrontShadow));
+   if( m_hKernelWavefrontShade )    CHECKSTATUS(clReleaseKernel(m_hKernelWavefrontShade));
+   if( m_hKernelWavefrontOutput )   CHECKSTATUS(clReleaseKernel(m_hKernelWavefrontOutput));
+   if( m_hKernelPersistent )        CHECKSTATUS(clReleaseKernel(m_hKernelPersistent));
+   if( m_hKernelReprojectionClear ) CHECKSTATUS(clReleaseKernel(m_hKernelReprojectionClear));
+   if( m_hKernelReprojectionDepth ) CHECKSTATUS(clReleaseKernel(m_hKernelReprojectionDepth));
+   if( m_hKernelReprojectionColor ) CHECKSTATUS(clReleaseKernel(m_hKernelReprojectionColor));
+   if( m_hKernelReprojectionHoles ) CHECKSTATUS(clReleaseKernel(m_hKernelReprojectionHoles));
+
+   m_hKernel=0;
+   m_hKernelPostProcessing=0;
+   m_hKernelBVHBounds=0;
+   m_hKernelBVHCentroids=0;
+   m_hKernelBVHMorton=0;
+   m_hKernelBVHHistogram=0;
+   m_hKernelBVHScan=0;
+   m_hKernelBVHScatter=0;
+   m_hKernelBVHEmit=0;
+   m_hKernelBVHRefit=0;
+   m_hKernelWavefrontGenerate=0;
+   m_hKernelWavefrontExtend=0;
+   m_hKernelWavefrontShadow=0;
+   m_hKernelWavefrontShade=0;
+   m_hKernelWavefrontOutput=0;
+   m_hKernelPersistent=0;
+   m_hKernelReprojectionClear=0;
+   m_hKernelReprojectionDepth=0;
+   m_hKernelReprojectionColor=0;
+   m_hKernelReprojectionHoles=0;
+}
+
+void OpenCLKernel::setProgramCacheDirectory( const std::string& directory )
+{
+   m_programCacheDirectory = directory;
+}
+
+/*
+* buildProgram
+* Programs are looked for in the cache first. Any mismatch or failure 
+* falls back to a build from source, whose binary then replaces the 
+* cached one. Returns 0 when the program fails to build, the caller keeps
+* the kernels it has.
+*/
+cl_program OpenCLKernel::buildProgram( 
+   const char*        source, 
+   size_t             length, 
+   const std::string& options )
+{
+   std::string key;
+   if( m_programCacheDirectory.length() != 0 ) 
+   {
+      key = programCacheKey( source, length, options );
+      cl_program hProgram = loadProgramBinary( key, options );
+      if( hProgram ) return hProgram;
+   }
+
+   int status(0);
+   LOG_INFO("clCreateProgramWithSource\n");
+   cl_program hProgram = clCreateProgramWithSource( m_hContext, 1, &source, &length, &status );
+   CHECKSTATUS(status);
+
+   if( status != CL_SUCCESS ) return 0;
+
+   LOG_INFO("clBuildProgram\n");
+   status = clBuildProgram( hProgram, 0, NULL, options.c_str(), NULL, NULL);
+   CHECKSTATUS(status);
+   if( status != CL_SUCCESS ) 
+   {
+      size_t len(0);
+      clGetProgramBuildInfo( hProgram, m_hDevices[0], CL_PROGRAM_BUILD_LOG, 0, NULL, &len );
+      std::string buildLog( len, 0 );
+      if( len != 0 ) clGetProgramBuildInfo( hProgram, m_hDevices[0], CL_PROGRAM_BUILD_LOG, len, &buildLog[0], NULL );
+      LOG_ERROR("Program failed to build:" << options << "\n" << buildLog.c_str());
+      CHECKSTATUS(clReleaseProgram(hProgram));
+      return 0;
+   }
+
+   if( key.length() != 0 ) saveProgramBinary( hProgram, key );
+   return hProgram;
+}
+
+/*
+* programCacheKey
+* Everything a binary depends on: the device, its driver, the build options 
+* and the source itself, through its hash.
+*/
+std::string OpenCLKernel::programCacheKey( 
+   const char*        source, 
+   size_t             length, 
+   const std::string& options )
+{
+   char deviceName[256];
+   char driverVersion[256];
+   deviceName[0]    = 0;
+   driverVersion[0] = 0;
+   clGetDeviceInfo( m_hDevices[0], CL_DEVICE_NAME,    sizeof(deviceName),    deviceName,    NULL );
+   clGetDeviceInfo( m_hDevices[0], CL_DRIVER_VERSION, sizeof(driverVersion), driverVersion, NULL );
+   deviceName[sizeof(deviceName)-1]       = 0;
+   driverVersion[sizeof(driverVersion)-1] = 0;
+
+   std::stringstream key;
+   key << deviceName << "\n" << driverVersion << "\n" << options << "\n" 
+       << std::hex << hashBytes( source, length ) << "\n" << std::dec << length;
+   return key.str();
+}
+
+std::string OpenCLKernel::programCacheFile( const std::string& key )
+{
+   std::stringstream filename;
+   filename << m_programCacheDirectory << "/kernel_" << std::hex << hashBytes( key.c_str(), key.length() ) << ".bin";
+   return filename.str();
+}
+
+/*
+* loadProgramBinary
+* Cache files start with the full key, a file whose name matches by 
+* accident is ignored.
+*/
+cl_program OpenCLKernel::loadProgramBinary( 
+   const std::string& key, 
+   const std::string& options )
+{
+   std::ifstream file( programCacheFile(key).c_str(), std::ios::in | std::ios::binary );
+   if( !file.is_open() ) return 0;
+
+   cl_uint keyLength(0);
+   file.read( reinterpret_cast<char*>(&keyLength), sizeof(keyLength) );
+   if( !file.good() || keyLength != key.length() ) return 0;
+   std::string fileKey( keyLength, 0 );
+   file.read( &fileKey[0], keyLength );
+   if( !file.good() || fileKey != key ) return 0;
+
+   cl_ulong binarySize(0);
+   file.read( reinterpret_cast<char*>(&binarySize), sizeof(binarySize) );
+   if( !file.good() || binarySize == 0 ) return 0;
+   std::vector<unsigned char> binary( static_cast<size_t>(binarySize) );
+   file.read( reinterpret_cast<char*>(&binary[0]), binary.size() );
+   if( !file.good() ) return 0;
+
+   LOG_INFO("clCreateProgramWithBinary\n");
+   size_t size = binary.size();
+   const unsigned char* binaries = &binary[0];
+   cl_int binaryStatus(0);
+   cl_int status(0);
+   cl_program hProgram = clCreateProgramWithBinary( m_hContext, 1, &m_hDevices[0], &size, &binaries, &binaryStatus, &status );
+   if( status != CL_SUCCESS || binaryStatus != CL_SUCCESS ) 
+   {
+      LOG_INFO("Cached program rejected by the driver, building from source\n");
+      if( hProgram ) clReleaseProgram( hProgram );
+      return 0;
+   }
+
+   if( clBuildProgram( hProgram, 0, NULL, options.c_str(), NULL, NULL) != CL_SUCCESS ) 
+   {
+      LOG_INFO("Cached program failed to build, building from source\n");
+      clReleaseProgram( hProgram );
+      return 0;
+   }
+   LOG_INFO("Program loaded from the cache\n");
+   return hProgram;
+}
+
+void OpenCLKernel::saveProgramBinary( 
+   cl_program         hProgram, 
+   const std::string& key )
+{
+   size_t binarySize(0);
+   CHECKSTATUS( clGetProgramInfo( hProgram, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, NULL ));
+   if( binarySize == 0 ) return;
+
+   std::vector<unsigned char> binary( binarySize );
+   unsigned char* binaries = &binary[0];
+   CHECKSTATUS( clGetProgramInfo( hProgram, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binaries, NULL ));
+
+   // Written aside then moved in place, so that another process never
+   // reads a partial file
+   std::string filename = programCacheFile(key);
+   std::stringstream temporary;
+   temporary << filename << "." << GetCurrentProcessId() << "." << GetCurrentThreadId() << ".tmp";
+   {
+      std::ofstream file( temporary.str().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+      if( !file.is_open() ) 
+      {
+         LOG_INFO("Program cache is not writable\n");
+         return;
+      }
+      cl_uint  keyLength  = static_cast<cl_uint>(key.length());
+      cl_ulong size       = binarySize;
+      file.write( reinterpret_cast<const char*>(&keyLength), sizeof(keyLength) );
+      file.write( key.c_str(), keyLength );
+      file.write( reinterpret_cast<const char*>(&size), sizeof(size) );
+      file.write( reinterpret_cast<const char*>(&binary[0]), binary.size() );
+      if( !file.good() )
+      {
+         file.close();
+         DeleteFileA( temporary.str().c_str() );
+         return;
+      }
+   }
+   if( !MoveFileExA( temporary.str().c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+   {
+      LOG_INFO("Program cache could not be updated\n");
+      DeleteFileA( temporary.str().c_str() );
+   }
+}
+
+/*
+* renderSettings
+* -D options of the settings given through the RayTracer_* functions. The
+* generic kernels are built with them too, wavefront and persistent modes
+* included.
+*/
+std::string OpenCLKernel::renderSettings( int iterations )
+{
+   std::stringstream settings;
+   if( m_shadows ) settings << " -DFEATURE_SHADOWS=1";
+   if( iterations != gNbIterations ) settings << " -DgNbIterations=" << iterations;
+   if( iterations > 1 && m_contributionThreshold > 0.f ) 
+   {
+      settings << " -DgContributionThreshold=" << std::fixed << m_contributionThreshold << "f";
+   }
+   return settings.str();
+}
+
+/*
+* sceneFeatures
+* -D options of the features the scene does without, followed by the 
+* settings. Options match the defaults of Kernel.cl for the generic kernels.
+*/
+std::string OpenCLKernel::sceneFeatures()
+{
+   bool cylinders(false);
+   bool cameras(false);
+   for( int i(0); i<m_nbActivePrimitives; ++i )
+   {
+      cylinders |= (m_primitives[i].type == ptCylinder);
+      cameras   |= (m_primitives[i].type == ptCamera);
+   }
+   for( size_t g(0); g<m_geometries.size(); ++g )
+   {
+      for( size_t i(0); i<m_geometries[g].size(); ++i )
+      {
+         cylinders |= (m_geometries[g][i].type == ptCylinder);
+         cameras   |= (m_geometries[g][i].type == ptCamera);
+      }
+   }
+
+   bool textures(false);
+   bool transparency(false);
+   bool reflections(false);
+   for( int i(0); i<m_nbActiveMaterials; ++i )
+   {
+      textures     |= (m_materials[i].textureId != NO_MATERIAL);
+      transparency |= (m_materials[i].transparency != 0.f);
+      reflections  |= (m_materials[i].color.s[3] != 0.f);
+   }
+
+   // Cylinder normals move with the timer
+   m_animatedScene = cylinders;
+
+   // Rays stop at the first hit when nothing reflects or refracts
+   int iterations = (reflections || transparency) ? m_maxIterations : 1;
+
+   std::stringstream features;
+   if( !cylinders )    features << " -DFEATURE_CYLINDERS=0";
+   if( !cameras )      features << " -DFEATURE_CAMERA=0";
+   if( !textures )     features << " -DFEATURE_TEXTURES=0";
+   if( !transparency ) features << " -DFEATURE_TRANSPARENCY=0";
+   features << renderSettings( iterations );
+   return features.str();
+}
+
+/*
+* selectKernelVariant
+* Variants are built the first time their features are met, the program 
+* cache usually spares the compilation. Variants that fail to build fall 
+* back to the generic kernels.
+*/
+void OpenCLKernel::selectKernelVariant()
+{
+   m_featuresDirty = false;
+   m_kernelVariant.clear();
+
+   // The generic kernels follow the settings whether a variant is used or not
+   std::string settings = renderSettings( m_maxIterations );
+   if( settings != m_genericSettings && m_kernelSource.length() != 0 )
+   {
+      m_genericSettings = settings;
+      if( m_backgroundCompilation )
+      {
+         startBuild( "" );
+      }
+      else
+      {
+         LOG_INFO("Rebuilding generic kernels\n");
+         cl_program program = buildProgram( m_kernelSource.c_str(), m_kernelSource.length(), m_kernelOptions + m_genericSettings );
+         if( program )
+         {
+            createKernels( program );
+            CHECKSTATUS(clReleaseProgram(program));
+         }
+      }
+   }
+
+   std::string features = sceneFeatures();
+   if( !m_kernelSpecialization || m_kernelSource.length() == 0 || features.length() == 0 ) return;
+
+   std::map<std::string, KernelVariant>::iterator it = m_kernelVariants.find( features );
+   if( it == m_kernelVariants.end() )
+   {
+      if( m_backgroundCompilation )
+      {
+         // The generic kernels render the scene until the variant is swapped in
+         bool building(false);
+         for( size_t i(0); i<m_builds.size(); ++i ) building |= (m_builds[i]->features == features);
+         if( !building ) startBuild( features );
+         return;
+      }
+
+      LOG_INFO("Building kernel variant:" << features);
+      addKernelVariant( features, buildProgram( m_kernelSource.c_str(), m_kernelSource.length(), m_kernelOptions + features ) );
+      it = m_kernelVariants.find( features );
+   }
+
+   if( it->second.kernel && it->second.persistentKernel ) m_kernelVariant = features;
+}
+
+void OpenCLKernel::addKernelVariant( const std::string& features, cl_program program )
+{
+   int status(0);
+   KernelVariant variant = { program, 0, 0 };
+   if( program )
+   {
+      variant.kernel = clCreateKernel( program, "render_kernel", &status );
+      CHECKSTATUS(status);
+      variant.persistentKernel = clCreateKernel( program, "render_persistent_kernel", &status );
+      CHECKSTATUS(status);
+   }
+   m_kernelVariants[features] = variant;
+}
+
+void OpenCLKernel::releaseKernelVariants()
+{
+   std::map<std::string, KernelVariant>::iterator it = m_kernelVariants.begin();
+   while( it != m_kernelVariants.end() )
+   {
+      if( it->second.kernel )           CHECKSTATUS(clReleaseKernel(it->second.kernel));
+      if( it->second.persistentKernel ) CHECKSTATUS(clReleaseKernel(it->second.persistentKernel));
+      if( it->second.program )          CHECKSTATUS(clReleaseProgram(it->second.program));
+      ++it;
+   }
+   m_kernelVariants.clear();
+   m_kernelVariant.clear();
+}
+
+void OpenCLKernel::setBackgroundCompilation( bool enabled )
+{
+   m_backgroundCompilation = enabled;
+}
+
+/*
+* createFallbackKernel
+* Clears the frames rendered before the first build completes. The kernel 
+* is small enough to be built on the calling thread.
+*/
+void OpenCLKernel::createFallbackKernel()
+{
+   if( m_hKernelFallback ) return;
+
+   int status(0);
+   const char* source = gFallbackKernelSource;
+   size_t length = strlen( source );
+   LOG_INFO("clCreateKernel(clear_kernel)\n");
+   m_hProgramFallback = clCreateProgramWithSource( m_hContext, 1, &source, &length, &status );
+   CHECKSTATUS(status);
+   CHECKSTATUS(clBuildProgram( m_hProgramFallback, 0, NULL, NULL, NULL, NULL ));
+   m_hKernelFallback = clCreateKernel( m_hProgramFallback, "clear_kernel", &status );
+   CHECKSTATUS(status);
+}
+
+/*
+* startBuild
+* Builds the generic program (no features) or a variant on a worker thread.
+* The build is picked up by swapKernels once the thread has completed.
+*/
+void OpenCLKernel::startBuild( const std::string& features )
+{
+   LOG_INFO("Starting background build:" << features);
+
+   ProgramBuild* build = new ProgramBuild;
+   build->owner    = this;
+   build->options  = m_kernelOptions + ((features.length() == 0) ? m_genericSettings : features);
+   build->features = features;
+   build->program  = 0;
+   build->thread   = CreateThread( NULL, 0, buildThread, build, 0, NULL );
+   if( !build->thread ) 
+   {
+      // No worker, the build happens right away
+      LOG_ERROR("CreateThread failed\n");
+      build->program = buildProgram( m_kernelSource.c_str(), m_kernelSource.length(), build->options );
+   }
+   m_builds.push_back( build );
+}
+
+DWORD WINAPI OpenCLKernel::buildThread( LPVOID parameter )
+{
+   // The source and the context are left alone until the build is collected
+   ProgramBuild* build = static_cast<ProgramBuild*>(parameter);
+   OpenCLKernel* owner = build->owner;
+   build->program = owner->buildProgram( owner->m_kernelSource.c_str(), owner->m_kernelSource.length(), build->options );
+   return 0;
+}
+
+/*
+* swapKernels
+* Called at frame boundaries: the completed builds replace the kernels in 
+* use. Frames already queued keep the kernels they were enqueued with.
+*/
+void OpenCLKernel::swapKernels()
+{
+   std::vector<ProgramBuild*>::iterator it = m_builds.begin();
+   while( it != m_builds.end() )
+   {
+      ProgramBuild* build = *it;
+      if( build->thread && WaitForSingleObject( build->thread, 0 ) != WAIT_OBJECT_0 )
+      {
+         ++it;
+         continue;
+      }
+
+      if( build->features.length() == 0 )
+      {
+         // Generic builds overtaken by a change of settings are dropped, 
+         // failed ones leave the kernels in use
+         if( build->program == 0 )
+         {
+            LOG_ERROR("Background build failed, keeping the current kernels\n");
+         }
+         else if( build->options == m_kernelOptions + m_genericSettings )
+         {
+            LOG_INFO("Swapping generic kernels\n");
+            createKernels( build->program );
+         }
+         if( build->program ) CHECKSTATUS(clReleaseProgram(build->program));
+      }
+      else
+      {
+         LOG_INFO("Swapping kernel variant\n");
+         addKernelVariant( build->features, build->program );
+      }
+      m_featuresDirty = true;
+
+      if( build->thread ) CloseHandle( build->thread );
+      delete build;
+      it = m_builds.erase( it );
+   }
+}
+
+/*
+* waitForBuilds
+* Builds in flight are completed and dropped, their source is about to change
+* or the device to be released.
+*/
+void OpenCLKernel::waitForBuilds()
+{
+   for( size_t i(0); i<m_builds.size(); ++i )
+   {
+      ProgramBuild* build = m_builds[i];
+      if( build->thread )
+      {
+         WaitForSingleObject( build->thread, INFINITE );
+         CloseHandle( build->thread );
+      }
+      if( build->program ) CHECKSTATUS(clReleaseProgram(build->program));
+      delete build;
+   }
+   m_builds.clear();
+}
+
+void OpenCLKernel::initializeDevice(
+   int        width, 
+   int        height, 
+   int        nbPrimitives,
+   int        nbLamps,
+   int        nbMaterials,
+   int        nbTextures,
+   BYTE*      bitmap)
+{
+   int status(0);
+   // Setup device memory
+   LOG_INFO("Setup device memory\n");
+   m_outputBitmap = bitmap;
+   m_outputSize   = width*height*sizeof(BYTE)*gColorDepth;
+   createOutputBuffer();
+
+   m_hPrimitives = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , sizeof(PrimitiveRecord)*nbPrimitives,             0, NULL);
+   m_hLamps      = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , sizeof(Lamp)*nbLamps,                             0, NULL);
+   m_hMaterials  = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , sizeof(MaterialRecord)*nbMaterials,               0, NULL);
+
+   m_hTextures   = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , gTextureWidth*gTextureHeight*gTextureDepth*sizeof(BYTE)*nbTextures, 0, NULL);
+
+   m_hVideo      = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , gVideoWidth*gVideoHeight*gKinectColorVideo, 0, NULL);
+   m_hDepth      = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY , gDepthWidth*gDepthHeight*gKinectColorDepth, 0, NULL);
+
+   // Bounding volume hierarchy (a binary tree has at most 2n-1 nodes), written
+   // by the device when it builds or refits the hierarchy
+   m_hBoundingVolumes = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(BoundingVolume)*2*nbPrimitives, 0, NULL);
+   m_hPrimitivesIndex = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*nbPrimitives,           0, NULL);
+
+   // Device side construction (keys and values are ping-pong buffers for the sort)
+   m_hBVHBoxes  = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_float4)*2*nbPrimitives, 0, NULL);
+   m_hBVHKeys   = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_uint)*2*nbPrimitives,   0, NULL);
+   m_hBVHValues = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*2*nbPrimitives,    0, NULL);
+   m_hBVHFlags  = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*nbPrimitives,      0, NULL);
+   m_hBVHSceneBounds = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_float4)*2*gBVHSortGroupSize, 0, NULL);
+   m_hBVHHistogram   = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*gBVHRadixSize*((nbPrimitives+gBVHSortChunk-1)/gBVHSortChunk), 0, NULL);
+
+   // Wavefront pipeline, one path per pixel
+   m_hRays         = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(Ray)*width*height,       0, NULL);
+   m_hRayQueues[0] = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*width*height,    0, NULL);
+   m_hRayQueues[1] = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*width*height,    0, NULL);
+   m_hRayHits      = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*width*height,    0, NULL);
+   m_hRayCounters  = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*gNbRayCounters, 0, NULL);
+
+   // Pixels already taken by the persistent threads
+   m_hWorkCounter = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int), 0, NULL);
+
+   // Sum of the samples of each pixel
+   m_hAccumulation = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_float4)*width*height, 0, NULL);
+
+   // Primary intersections of the last two frames, and depth of the reprojected pixels
+   m_hHistory[0]        = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(HistorySample)*width*height, 0, NULL);
+   m_hHistory[1]        = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(HistorySample)*width*height, 0, NULL);
+   m_hReprojectionDepth = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, sizeof(cl_int)*width*height,        0, NULL);
+   m_historyValid = false;
+
+   // Post-processing reads the frame from its own buffer
+   m_hPostProcessingFrames[0] = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, m_outputSize, 0, NULL);
+   m_hPostProcessingFrames[1] = clCreateBuffer( m_hContext, CL_MEM_READ_WRITE, m_outputSize, 0, NULL);
+
+   allocateScene( nbPrimitives, nbLamps, nbMaterials, nbTextures );
+
+   // NVAPI
+   /*
+   StereoHandle * m_pStereoHandle = NULL;
+   IUnknown *m_pDx = NULL;
+   NvAPI_Stereo_CreateHandleFromIUnknown( m_pDx, m_pStereoHandle );
+   NvAPI_Stereo_Activate( m_pStereoHandle );
+   */
+}
+
+void OpenCLKernel::releaseDevice()
+{
+   LOG_INFO("Release device memory\n");
+   if( m_hPrimitives ) CHECKSTATUS(clReleaseMemObject(m_hPrimitives));
+   if( m_hLamps )      CHECKSTATUS(clReleaseMemObject(m_hLamps));
+   if( m_hMaterials )  CHECKSTATUS(clReleaseMemObject(m_hMaterials));
+   if( m_hTextures )   CHECKSTATUS(clReleaseMemObject(m_hTextures));
+
+   if( m_mappedBitmap ) CHECKSTATUS(clEnqueueUnmapMemObject( m_hQueue, m_hBitmap, m_mappedBitmap, 0, NULL, NULL ));
+   if( m_hQueue )      CHECKSTATUS(clFinish(m_hQueue));
+   if( m_hBitmap )     CHECKSTATUS(clReleaseMemObject(m_hBitmap));
+   if( m_hVideo )      CHECKSTATUS(clReleaseMemObject(m_hVideo));
+   if( m_hDepth )      CHECKSTATUS(clReleaseMemObject(m_hDepth));
+
+   if( m_hBoundingVolumes ) CHECKSTATUS(clReleaseMemObject(m_hBoundingVolumes));
+   if( m_hPrimitivesIndex ) CHECKSTATUS(clReleaseMemObject(m_hPrimitivesIndex));
+   if( m_hBVHBoxes )        CHECKSTATUS(clReleaseMemObject(m_hBVHBoxes));
+   if( m_hBVHKeys )         CHECKSTATUS(clReleaseMemObject(m_hBVHKeys));
+   if( m_hBVHValues )       CHECKSTATUS(clReleaseMemObject(m_hBVHValues));
+   if( m_hBVHFlags )        CHECKSTATUS(clReleaseMemObject(m_hBVHFlags));
+   if( m_hBVHSceneBounds )  CHECKSTATUS(clReleaseMemObject(m_hBVHSceneBounds));
+   if( m_hBVHHistogram )    CHECKSTATUS(clReleaseMemObject(m_hBVHHistogram));
+
+   if( m_hInstances )               CHECKSTATUS(clReleaseMemObject(m_hInstances));
+   if( m_hInstanceBoundingVolumes ) CHECKSTATUS(clReleaseMemObject(m_hInstanceBoundingVolumes));
+   if( m_hInstancesIndex )          CHECKSTATUS(clReleaseMemObject(m_hInstancesIndex));
+   if( m_hGeometryPrimitives )      CHECKSTATUS(clReleaseMemObject(m_hGeometryPrimitives));
+   if( m_hGeometryBoundingVolumes ) CHECKSTATUS(clReleaseMemObject(m_hGeometryBoundingVolumes));
+   if( m_hGeometryIndex )           CHECKSTATUS(clReleaseMemObject(m_hGeometryIndex));
+   if( m_hTypedSpheres )            CHECKSTATUS(clReleaseMemObject(m_hTypedSpheres));
+   if( m_hTypedShapes )             CHECKSTATUS(clReleaseMemObject(m_hTypedShapes));
+   if( m_hTypedIndex )              CHECKSTATUS(clReleaseMemObject(m_hTypedIndex));
+   if( m_hTypedRanges )             CHECKSTATUS(clReleaseMemObject(m_hTypedRanges));
+
+   if( m_hRays )         CHECKSTATUS(clReleaseMemObject(m_hRays));
+   if( m_hRayQueues[0] ) CHECKSTATUS(clReleaseMemObject(m_hRayQueues[0]));
+   if( m_hRayQueues[1] ) CHECKSTATUS(clReleaseMemObject(m_hRayQueues[1]));
+   if( m_hRayHits )      CHECKSTATUS(clReleaseMemObject(m_hRayHits));
+   if( m_hRayCounters )  CHECKSTATUS(clReleaseMemObject(m_hRayCounters));
+   if( m_hWorkCounter )  CHECKSTATUS(clReleaseMemObject(m_hWorkCounter));
+   if( m_hAccumulation ) CHECKSTATUS(clReleaseMemObject(m_hAccumulation));
+   if( m_hHistory[0] )   CHECKSTATUS(clReleaseMemObject(m_hHistory[0]));
+   if( m_hHistory[1] )   CHECKSTATUS(clReleaseMemObject(m_hHistory[1]));
+   if( m_hReprojectionDepth ) CHECKSTATUS(clReleaseMemObject(m_hReprojectionDepth));
+   if( m_hPostProcessingFrames[0] ) CHECKSTATUS(clReleaseMemObject(m_hPostProcessingFrames[0]));
+   if( m_hPostProcessingFrames[1] ) CHECKSTATUS(clReleaseMemObject(m_hPostProcessingFrames[1]));
+
+   waitForBuilds();
+   releaseKernels();
+   releaseKernelVariants();
+   if( m_hKernelFallback )  CHECKSTATUS(clReleaseKernel(m_hKernelFallback));
+   if( m_hProgramFallback ) CHECKSTATUS(clReleaseProgram(m_hProgramFallback));
+   m_hKernelFallback=0;
+   m_hProgramFallback=0;
+
+   releaseFrames();
+   releaseRenders();
+
+   if( m_hTransferQueue ) CHECKSTATUS(clReleaseCommandQueue(m_hTransferQueue));
+   if( m_hQueue )      CHECKSTATUS(clReleaseCommandQueue(m_hQueue));
+   if( m_hContext )    CHECKSTATUS(clReleaseContext(m_hContext));
+
+   releaseScene();
+
+   m_hContext=0;
+   m_hQueue=0;
+   m_hTransferQueue=0;
+   m_hBitmap=0;
+   m_mappedBitmap=0;
+   m_outputBitmap=0;
+   m_outputSize=0;
+   m_hVideo=0;
+   m_hDepth=0;
+   m_hTextures=0;
+   m_hPrimitives=0;
+   m_hLamps=0;
+   m_hBoundingVolumes=0;
+   m_hPrimitivesIndex=0;
+   m_hBVHBoxes=0;
+   m_hBVHKeys=0;
+   m_hBVHValues=0;
+   m_hBVHFlags=0;
+   m_hBVHSceneBounds=0;
+   m_hBVHHistogram=0;
+   m_hInstances=0;
+   m_hInstanceBoundingVolumes=0;
+   m_hInstancesIndex=0;
+   m_hGeometryPrimitives=0;
+   m_hGeometryBoundingVolumes=0;
+   m_hGeometryIndex=0;
+   m_hTypedSpheres=0;
+   m_hTypedShapes=0;
+   m_hTypedIndex=0;
+   m_hTypedRanges=0;
+   m_hRays=0;
+   m_hRayQueues[0]=0;
+   m_hRayQueues[1]=0;
+   m_hRayHits=0;
+   m_hRayCounters=0;
+   m_hWorkCounter=0;
+   m_hAccumulation=0;
+   m_hHistory[0]=0;
+   m_hHistory[1]=0;
+   m_hReprojectionDepth=0;
+   m_hPostProcessingFrames[0]=0;
+   m_hPostProcessingFrames[1]=0;
+   m_nbBoundingVolumes=0;
+   m_bvhDirty=true;
+   m_modifiedPrimitives.clear();
+   m_bvh.clear();
+   m_geometries.clear();
+   m_geometryBounds.clear();
+   m_geometryRoots.clear();
+   m_geometriesDirty=false;
+   m_instances.clear();
+   m_instancesBvh.clear();
+   m_instancesDirty=false;
+   m_modifiedInstances.clear();
+   m_typedSpheres.clear();
+   m_typedShapes.clear();
+   m_typedIndex.clear();
+   m_nbTypedPrimitives=0;
+#if USE_KINECT
+   m_skeletons=0, 
+   m_hNextDepthFrameEvent=0;
+   m_hNextVideoFrameEvent=0;
+   m_hNextSkeletonEvent=0;
+   m_pVideoStreamHandle=0;
+   m_pDepthStreamHandle=0;
+   m_skeletonsBody = -1;
+   m_skeletonsLamp = -1;
+#endif // USE_KINECT
+}
+
+/*
+* runKernel
+*/
+void OpenCLKernel::render( 
+   int   width, 
+   int   height, 
+   BYTE* bitmap,
+   float timer,
+   float transparentColor)
+{
+   size_t size = width*height*sizeof(BYTE)*gColorDepth;
+   m_profileFrame = true;
+   enqueueRendering( m_hBitmap, width, height, timer, transparentColor, true, 0 );
+   if( m_bandBottom != 0 && m_outputMode == om_copy && bitmap != 0 )
+   {
+      // Only the band was traced
+      size_t rowSize = width*sizeof(BYTE)*gColorDepth;
+      size_t offset  = m_bandTop*rowSize;
+      size_t length  = ((std::min)(m_bandBottom,height)-m_bandTop)*rowSize;
+      CHECKSTATUS( clEnqueueReadBuffer( m_hQueue, m_hBitmap, CL_FALSE, offset, length, bitmap+offset, 0, NULL, profilingEvent( fs_readBack )) );
+   }
+   else
+   {
+      enqueueReadBack( bitmap, size, 0 );
+   }
+
+   CHECKSTATUS(clFlush(m_hQueue));
+   CHECKSTATUS(clFinish(m_hQueue));
+   m_profileFrame = false;
+   collectTimings();
+
+   // The bitmap given to initializeDevice is the mapped one, others need a copy
+   if( m_mappedBitmap && bitmap != 0 && bitmap != m_mappedBitmap ) {
+      memcpy( bitmap, m_mappedBitmap, size );
+   }
+}
+
+/*
+* enqueueReadBack
+* Queues the read back of the output buffer, or its mapping in mapped 
+* output mode. done is signaled once the frame is available to the host.
+*/
+void OpenCLKernel::enqueueReadBack( 
+   BYTE*     bitmap, 
+   size_t    size, 
+   cl_event* done )
+{
+   if( m_outputMode == om_mapped ) {
+      int status(0);
+      m_mappedBitmap = static_cast<BYTE*>(clEnqueueMapBuffer( m_hQueue, m_hBitmap, CL_FALSE, CL_MAP_READ, 0, size, 0, NULL, (done) ? done : profilingEvent( fs_readBack ), &status ));
+      CHECKSTATUS(status);
+   }
+   else if( bitmap != 0 ) {
+      CHECKSTATUS( clEnqueueReadBuffer( m_hQueue, m_hBitmap, CL_FALSE, 0, size, bitmap, 0, NULL, (done) ? done : profilingEvent( fs_readBack )) );
+   }
+   else if( done ) {
+      CHECKSTATUS(clEnqueueMarker( m_hQueue, done ));
+   }
+}
+
+/*
+* profilingEvent
+* Event of a command queued for the frame being rendered, NULL for the
+* other frames. Events are kept by stage until the frame is done.
+*/
+cl_event* OpenCLKernel::profilingEvent( FrameStage stage )
+{
+   if( !m_profileFrame ) return NULL;
+   m_profilingEvents[stage].push_back( 0 );
+   return &m_profilingEvents[stage].back();
+}
+
+/*
+* collectTimings
+* The queue is in order, commands of a stage do not overlap and their 
+* times add up.
+*/
+void OpenCLKernel::collectTimings()
+{
+   FrameTimings& timings = m_frameTimings[m_frameTimingsIndex];
+   for( int stage(0); stage<gNbFrameStages; ++stage )
+   {
+      cl_ulong total(0);
+      std::deque<cl_event>& events = m_profilingEvents[stage];
+      for( size_t i(0); i<events.size(); ++i )
+      {
+         if( events[i] == 0 ) continue;
+         cl_ulong start(0), end(0);
+         if( clGetEventProfilingInfo( events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL ) == CL_SUCCESS &&
+             clGetEventProfilingInfo( events[i], CL_PROFILING_COMMAND_END,   sizeof(cl_ulong), &end,   NULL ) == CL_SUCCESS &&
+             end>start )
+         {
+            total += end-start;
+         }
+         CHECKSTATUS(clReleaseEvent( events[i] ));
+      }
+      events.clear();
+      timings.stages[stage] = total*1e-6; // Nanoseconds to milliseconds
+   }
+   m_frameTimingsIndex = (m_frameTimingsIndex+1)%gProfilingWindow;
+   if( m_nbFrameTimings<gProfilingWindow ) m_nbFrameTimings++;
+}
+
+void OpenCLKernel::getStageTimings( FrameStage stage, double& frame, double& average )
+{
+   frame   = 0.0;
+   average = 0.0;
+   if( m_nbFrameTimings == 0 ) return;
+   frame = m_frameTimings[(m_frameTimingsIndex+gProfilingWindow-1)%gProfilingWindow].stages[stage];
+   for( int i(0); i<m_nbFrameTimings; ++i )
+   {
+      average += m_frameTimings[i].stages[stage];
+   }
+   average /= m_nbFrameTimings;
+}
+
+// Parameters of the completion callback of an asynchronous frame
+struct RenderCompletion
+{
+   OpenCLKernel*  owner;
+   long           ticket;
+   RenderCallback callback;
+   BYTE*          bitmap;
+   void*          userData;
+};
+
+/*
+* renderCompleted
+* Runs on a thread of the OpenCL runtime. The caller has been told the 
+* status of the frame, its event is released and the status is kept for
+* getRenderStatus.
+*/
+void CL_CALLBACK OpenCLKernel::renderCompleted( cl_event event, cl_int status, void* data )
+{
+   RenderCompletion* completion = static_cast<RenderCompletion*>(data);
+   OpenCLKernel* owner  = completion->owner;
+   long          ticket = completion->ticket;
+   RenderStatus  result = (status == CL_COMPLETE) ? rs_complete : rs_failed;
+   completion->callback( ticket, result, completion->bitmap, completion->userData );
+   delete completion;
+
+   EnterCriticalSection( &owner->m_renderLock );
+   std::map<long, cl_event>::iterator it = owner->m_pendingRenders.find(ticket);
+   if( it != owner->m_pendingRenders.end() )
+   {
+      CHECKSTATUS(clReleaseEvent(it->second));
+      owner->m_pendingRenders.erase(it);
+      owner->m_finishedRenders[ticket] = result;
+   }
+   if( --owner->m_pendingCallbacks == 0 ) SetEvent( owner->m_callbacksDone );
+   LeaveCriticalSection( &owner->m_renderLock );
+}
+
+/*
+* renderAsync
+* Same commands as render, but the host only waits for the uploads of the
+* scene. Frames queued one after the other share the output buffer, the 
+* queue being in order each one is read back before the next one is 
+* rendered.
+*/
+long OpenCLKernel::renderAsync( 
+   int            width, 
+   int            height, 
+   BYTE*          bitmap,
+   float          timer,
+   float          transparentColor,
+   RenderCallback callback,
+   void*          userData )
+{
+   size_t size = width*height*sizeof(BYTE)*gColorDepth;
+   cl_event uploaded(0);
+   cl_event done(0);
+   enqueueRendering( m_hBitmap, width, height, timer, transparentColor, true, &uploaded );
+   enqueueReadBack( bitmap, size, &done );
+
+   long ticket = m_nextTicket++;
+   EnterCriticalSection( &m_renderLock );
+   m_pendingRenders[ticket] = done;
+   LeaveCriticalSection( &m_renderLock );
+   if( callback )
+   {
+      // The callback may fire right away, the ticket has to be known by then
+      RenderCompletion* completion = new RenderCompletion;
+      completion->owner    = this;
+      completion->ticket   = ticket;
+      completion->callback = callback;
+      completion->bitmap   = (m_outputMode == om_mapped) ? m_mappedBitmap : bitmap;
+      completion->userData = userData;
+      EnterCriticalSection( &m_renderLock );
+      if( m_pendingCallbacks++ == 0 ) ResetEvent( m_callbacksDone );
+      LeaveCriticalSection( &m_renderLock );
+      CHECKSTATUS(clSetEventCallback( done, CL_COMPLETE, renderCompleted, completion ));
+   }
+   CHECKSTATUS(clFlush(m_hQueue));
+
+   CHECKSTATUS(clWaitForEvents( 1, &uploaded ));
+   CHECKSTATUS(clReleaseEvent(uploaded));
+   return ticket;
+}
+
+RenderStatus OpenCLKernel::getRenderStatus( long ticket )
+{
+   EnterCriticalSection( &m_renderLock );
+   std::map<long, cl_event>::iterator it = m_pendingRenders.find(ticket);
+   if( it == m_pendingRenders.end() ) 
+   {
+      // Completed tickets are forgotten once their status has been returned,
+      // unknown ones are reported as failed
+      RenderStatus result(rs_failed);
+      std::map<long, RenderStatus>::iterator finished = m_finishedRenders.find(ticket);
+      if( finished != m_finishedRenders.end() )
+      {
+         result = finished->second;
+         m_finishedRenders.erase(finished);
+      }
+      LeaveCriticalSection( &m_renderLock );
+      return result;
+   }
+
+   cl_int status(CL_QUEUED);
+   CHECKSTATUS(clGetEventInfo( it->second, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL ));
+   if( status <= CL_COMPLETE ) 
+   {
+      CHECKSTATUS(clReleaseEvent(it->second));
+      m_pendingRenders.erase(it);
+   }
+   LeaveCriticalSection( &m_renderLock );
+
+   if( status > CL_COMPLETE ) return rs_pending;
+   return (status == CL_COMPLETE) ? rs_complete : rs_failed;
+}
+
+RenderStatus OpenCLKernel::waitForRender( long ticket )
+{
+   // The completion callback may release the event while the host waits
+   cl_event done(0);
+   EnterCriticalSection( &m_renderLock );
+   std::map<long, cl_event>::iterator it = m_pendingRenders.find(ticket);
+   if( it != m_pendingRenders.end() ) 
+   {
+      done = it->second;
+      CHECKSTATUS(clRetainEvent(done));
+   }
+   LeaveCriticalSection( &m_renderLock );
+
+   if( done )
+   {
+      CHECKSTATUS(clWaitForEvents( 1, &done ));
+      CHECKSTATUS(clReleaseEvent(done));
+   }
+   return getRenderStatus( ticket );
+}
+
+void OpenCLKernel::releaseRenders()
+{
+   if( m_hQueue ) CHECKSTATUS(clFinish(m_hQueue));
+
+   // Callbacks still running reference the tickets
+   WaitForSingleObject( m_callbacksDone, INFINITE );
+
+   EnterCriticalSection( &m_renderLock );
+   std::map<long, cl_event>::iterator it = m_pendingRenders.begin();
+   while( it != m_pendingRenders.end() )
+   {
+      CHECKSTATUS(clReleaseEvent(it->second));
+      ++it;
+   }
+   m_pendingRenders.clear();
+   m_finishedRenders.clear();
+   LeaveCriticalSection( &m_renderLock );
+}
+
+/*
+* renderPipelined
+* Frame N is rendered in its own slot while frame N-1 is read back on the 
+* transfer queue and consumed by the caller. Only the uploads of frame N 
+* are waited for, the host memory they read from being left to the caller
+* again.
+*/
+BYTE* OpenCLKernel::renderPipelined( 
+   int   width, 
+   int   height, 
+   float timer,
+   float transparentColor)
+{
+   size_t size = width*height*sizeof(BYTE)*gColorDepth;
+   int slot = m_nbQueuedFrames % m_pipelineDepth;
+   int status(0);
+   if( !m_hFrames[slot] )
+   {
+      if( m_outputMode == om_mapped )
+      {
+         m_hFrames[slot] = clCreateBuffer( m_hContext, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, size, 0, &status );
+      }
+      else
+      {
+         m_hFrames[slot] = clCreateBuffer( m_hContext, CL_MEM_WRITE_ONLY, size, 0, &status );
+         m_frames[slot]  = new BYTE[size];
+      }
+      CHECKSTATUS(status);
+   }
+
+   // The caller is done with the frame previously held by the slot
+   if( m_frameRead[slot] ) CHECKSTATUS(clReleaseEvent(m_frameRead[slot]));
+   m_frameRead[slot] = 0;
+   if( m_outputMode == om_mapped && m_frames[slot] )
+   {
+      CHECKSTATUS(clEnqueueUnmapMemObject( m_hQueue, m_hFrames[slot], m_frames[slot], 0, NULL, NULL ));
+      m_frames[slot] = 0;
+   }
+
+   cl_event uploaded(0);
+   // Slots never hold the previous frame, accumulated samples would never
+   // converge
+   enqueueRendering( m_hFrames[slot], width, height, timer, transparentColor, false, &uploaded );
+
+   cl_event rendered(0);
+   CHECKSTATUS(clEnqueueMarker( m_hQueue, &rendered ));
+   CHECKSTATUS(clFlush(m_hQueue));
+   if( m_outputMode == om_mapped )
+   {
+      m_frames[slot] = static_cast<BYTE*>(clEnqueueMapBuffer( m_hTransferQueue, m_hFrames[slot], CL_FALSE, CL_MAP_READ, 0, size, 1, &rendered, &m_frameRead[slot], &status ));
+      CHECKSTATUS(status);
+   }
+   else
+   {
+      CHECKSTATUS(clEnqueueReadBuffer( m_hTransferQueue, m_hFrames[slot], CL_FALSE, 0, size, m_frames[slot], 1, &rendered, &m_frameRead[slot] ));
+   }
+   CHECKSTATUS(clFlush(m_hTransferQueue));
+   CHECKSTATUS(clReleaseEvent(rendered));
+   m_nbQueuedFrames++;
+
+   CHECKSTATUS(clWaitForEvents( 1, &uploaded ));
+   CHECKSTATUS(clReleaseEvent(uploaded));
+
+   // Oldest frame of the pipeline
+   if( m_nbQueuedFrames < m_pipelineDepth ) return 0;
+   int oldest = (m_nbQueuedFrames-m_pipelineDepth) % m_pipelineDepth;
+   CHECKSTATUS(clWaitForEvents( 1, &m_frameRead[oldest] ));
+   return m_frames[oldest];
+}
+
+void OpenCLKernel::setPipelineDepth( int depth )
+{
+   flushPipeline();
+   m_pipelineDepth = (depth<1) ? 1 : (depth>gMaxFramesInFlight) ? gMaxFramesInFlight : depth;
+}
+
+/*
+* flushPipeline
+* Waits for the frames in flight, the next pipelined frame starts from 
+* the first slot.
+*/
+void OpenCLKernel::flushPipeline()
+{
+   if( m_hQueue )         CHECKSTATUS(clFinish(m_hQueue));
+   if( m_hTransferQueue ) CHECKSTATUS(clFinish(m_hTransferQueue));
+   for( int i(0); i<gMaxFramesInFlight; ++i )
+   {
+      if( m_frameRead[i] ) CHECKSTATUS(clReleaseEvent(m_frameRead[i]));
+      m_frameRead[i] = 0;
+   }
+   m_nbQueuedFrames = 0;
+}
+
+/*
+* releaseFrames
+* Frames of the pipeline are allocated on first use, following the output 
+* mode at that time.
+*/
+void OpenCLKernel::releaseFrames()
+{
+   flushPipeline();
+   for( int i(0); i<gMaxFramesInFlight; ++i )
+   {
+      if( m_outputMode == om_mapped )
+      {
+         if( m_frames[i] ) CHECKSTATUS(clEnqueueUnmapMemObject( m_hQueue, m_hFrames[i], m_frames[i], 0, NULL, NULL ));
+      }
+      else
+      {
+         delete [] m_frames[i];
+      }
+      m_frames[i] = 0;
+   }
+   if( m_hQueue ) CHECKSTATUS(clFinish(m_hQueue));
+   for( int i(0); i<gMaxFramesInFlight; ++i )
+   {
+      if( m_hFrames[i] ) CHECKSTATUS(clReleaseMemObject(m_hFrames[i]));
+      m_hFrames[i] = 0;
+   }
+}
+
+void OpenCLKernel::setOutputMode( OutputMode mode )
+{
+   releaseFrames();
+   m_outputMode = mode;
+   if( m_hContext && m_outputSize != 0 ) createOutputBuffer();
+}
+
+/*
+* createOutputBuffer
+* In mapped mode, a bitmap from the caller is used in place as the storage 
+* of the buffer. Page aligned, CPU devices and integrated GPUs render 
+* straight into it and mapping costs nothing. Discrete GPUs copy it at map
+* time, as they would on a read.
+*/
+void OpenCLKernel::createOutputBuffer()
+{
+   if( m_mappedBitmap )
+   {
+      CHECKSTATUS(clEnqueueUnmapMemObject( m_hQueue, m_hBitmap, m_mappedBitmap, 0, NULL, NULL ));
+      CHECKSTATUS(clFinish(m_hQueue));
+      m_mappedBitmap = 0;
+   }
+   if( m_hBitmap ) CHECKSTATUS(clReleaseMemObject(m_hBitmap));
+
+   int status(0);
+   cl_mem_flags flags = CL_MEM_WRITE_ONLY;
+   void* hostPtr(0);
+   if( m_outputMode == om_mapped )
+   {
+      flags  |= (m_outputBitmap) ? CL_MEM_USE_HOST_PTR : CL_MEM_ALLOC_HOST_PTR;
+      hostPtr = m_outputBitmap;
+   }
+   m_hBitmap = clCreateBuffer( m_hContext, flags, m_outputSize, hostPtr, &status );
+   CHECKSTATUS(status);
+}
+
+/*
+* enqueueRendering
+* Uploads the changes of the scene and queues the rendering into output. 
+* When requested, uploaded is signaled once the host memory read by the 
+* uploads can be modified again. Without accumulate, every pixel is traced
+* once, whatever the number of samples.
+*/
+void OpenCLKernel::enqueueRendering( 
+   cl_mem    output,
+   int       width, 
+   int       height, 
+   float     timer,
+   float     transparentColor,
+   bool      accumulate,
+   cl_event* uploaded )
+{
+   int status(0);
+
+   // The kernel cannot write into a mapped buffer
+   if( output == m_hBitmap && m_mappedBitmap )
+   {
+      CHECKSTATUS(clEnqueueUnmapMemObject( m_hQueue, m_hBitmap, m_mappedBitmap, 0, NULL, profilingEvent( fs_readBack ) ));
+      m_mappedBitmap = 0;
+   }
+
+   BYTE* video(0);
+   BYTE* depth(0);
+#if USE_KINECT
+   // Video
+   const NUI_IMAGE_FRAME* pImageFrame = 0;
+   WaitForSingleObject (m_hNextVideoFrameEvent,INFINITE); 
+   status = NuiImageStreamGetNextFrame( m_pVideoStreamHandle, 0, &pImageFrame ); 
+   if(( status == S_OK) && pImageFrame ) 
+   {
+      INuiFrameTexture* pTexture = pImageFrame->pFrameTexture;
+      NUI_LOCKED_RECT LockedRect;
+      pTexture->LockRect( 0, &LockedRect, NULL, 0 ) ; 
+      if( LockedRect.Pitch != 0 ) 
+      {
+         video = (BYTE*) LockedRect.pBits;
+      }
+   }
+
+   // Depth
+   const NUI_IMAGE_FRAME* pDepthFrame = 0;
+   WaitForSingleObject (m_hNextDepthFrameEvent,INFINITE); 
+   status = NuiImageStreamGetNextFrame( m_pDepthStreamHandle, 0, &pDepthFrame ); 
+   if(( status == S_OK) && pDepthFrame ) 
+   {
+      INuiFrameTexture* pTexture = pDepthFrame->pFrameTexture;
+      if( pTexture ) 
+      {
+         NUI_LOCKED_RECT LockedRectDepth;
+         pTexture->LockRect( 0, &LockedRectDepth, NULL, 0 ) ; 
+         if( LockedRectDepth.Pitch != 0 ) 
+         {
+            depth = (BYTE*) LockedRectDepth.pBits;
+         }
+      }
+   }
+   NuiImageStreamReleaseFrame( m_pVideoStreamHandle, pImageFrame ); 
+   NuiImageStreamReleaseFrame( m_pDepthStreamHandle, pDepthFrame ); 
+#endif // USE_KINECT
+
+
+   // Frame boundary, builds completed in the background are swapped in
+   if( !m_builds.empty() ) swapKernels();
+
+   // Scene edits restart the accumulation
+   if( !m_dirtyPrimitives.empty() || !m_dirtyLamps.empty() || !m_dirtyMaterials.empty() || 
+       m_geometriesDirty || m_instancesDirty || !m_modifiedInstances.empty() || 
+       m_featuresDirty || !m_texturedTransfered || video || depth || 
+       (m_animatedScene && timer != m_accumulationTimer) )
+   {
+      m_nbSamples    = 0;
+      m_historyValid = false;
+   }
+   m_accumulationTimer = timer;
+
+   // Leanest kernels for the scene, geometries are only built with the instances
+   if( m_featuresDirty || m_geometriesDirty ) selectKernelVariant();
+
+   // Initialise Input arrays, static frames upload nothing
+   uploadDirtyRanges( m_hPrimitives, m_dirtyPrimitives, sizeof(PrimitiveRecord), m_primitiveRecords );
+   uploadDirtyRanges( m_hLamps,      m_dirtyLamps,      sizeof(Lamp),            m_lamps );
+   uploadDirtyRanges( m_hMaterials,  m_dirtyMaterials,  sizeof(MaterialRecord),  m_materialRecords );
+   if( !m_texturedTransfered )
+   {
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hTextures,   CL_FALSE, 0, gTextureDepth*gTextureWidth*gTextureHeight*m_nbActiveTextures,m_textures,   0, NULL, profilingEvent( fs_upload )));
+      m_texturedTransfered = true;
+   }
+
+   if( video ) CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hVideo, CL_FALSE, 0, gKinectColorVideo*gVideoWidth*gVideoHeight, video, 0, NULL, profilingEvent( fs_upload )));
+   if( depth ) CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hDepth, CL_FALSE, 0, gKinectColorDepth*gDepthWidth*gDepthHeight, depth, 0, NULL, profilingEvent( fs_upload )));
+
+   // Acceleration structure
+   if( m_primitiveStorage == ps_typed )
+   {
+      // The packed arrays replace the hierarchy
+      if( m_bvhDirty || !m_modifiedPrimitives.empty() ) buildPrimitiveArrays();
+   }
+   else if( m_bvhBuilder == bvb_device && m_hKernelBVHEmit )
+   {
+      // Only the primitives are uploaded, the device takes care of the rest
+      if( m_bvhDirty || !m_modifiedPrimitives.empty() ) buildBoundingVolumesOnDevice();
+   }
+   else if( !m_bvhDirty && !m_modifiedPrimitives.empty() )
+   {
+      refitBoundingVolumes();
+      if( m_nbBoundingVolumes != 0 && !m_bvhDirty )
+      {
+         // Only the bounds of the refitted nodes have changed
+         uploadDirtyRanges( m_hBoundingVolumes, m_refittedNodes, sizeof(BoundingVolume), m_bvh.getNodes(), fs_build );
+      }
+      m_refittedNodes.clear();
+   }
+   if( m_bvhDirty && m_primitiveStorage == ps_hierarchy )
+   {
+      buildBoundingVolumes();
+      if( m_nbBoundingVolumes != 0 )
+      {
+         CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hBoundingVolumes, CL_FALSE, 0, m_nbBoundingVolumes*sizeof(BoundingVolume), m_bvh.getNodes(),   0, NULL, profilingEvent( fs_build )));
+         CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hPrimitivesIndex, CL_FALSE, 0, m_bvh.getNbIndices()*sizeof(cl_int),      m_bvh.getIndices(), 0, NULL, profilingEvent( fs_build )));
+      }
+   }
+
+   // Instances
+   updateInstances();
+
+   if( uploaded ) CHECKSTATUS(clEnqueueMarker( m_hQueue, uploaded ));
+
+   // With post-processing, the frame is rendered into a buffer of its own and
+   // the passes write the output
+   bool   postProcessing = (m_postProcessing != 0 && m_hKernelPostProcessing != 0);
+   cl_mem frame = postProcessing ? m_hPostProcessingFrames[0] : output;
+
+   // Temporal reprojection, the scene must not have changed since the history
+   // was traced. Otherwise the move is refined like any other.
+   bool reprojected(false);
+   if( m_reprojectFrame )
+   {
+      m_reprojectFrame = false;
+      reprojected = 
+         m_historyValid && m_hKernelReprojectionHoles && m_renderMode != rm_wavefront &&
+         ( m_hKernel || m_kernelVariant.length() != 0 );
+      if( reprojected ) 
+      {
+         enqueueReprojection( frame, width, height );
+      }
+      else
+      {
+         m_refinementStep      = m_coarsestStep;
+         m_nbReprojectedFrames = 0;
+      }
+   }
+
+   // Progressive refinement, the coarser level can only be skipped when it 
+   // was rendered into the same buffer
+   cl_int2 refinement;
+   refinement.s[0] = m_refinementStep;
+   refinement.s[1] = (m_previousStep == 2*m_refinementStep && m_previousOutput == frame) ? 1 : 0;
+   if( reprojected ) refinement.s[1] = 2;
+
+   // Frames are accumulated once every pixel is traced. A converged frame 
+   // already in the output is not traced again.
+   cl_int sample = (m_accumulation && accumulate && m_refinementStep == 1 && refinement.s[1] == 0) ? m_nbSamples : -1;
+   bool converged = (sample >= gMaxAccumulatedSamples && m_previousOutput == frame);
+
+   if( !m_hKernel && m_kernelVariant.length() == 0 )
+   {
+      // Still building, the frame is cleared
+      refinement.s[0] = 0;
+      size_t szGlobalWorkSize = width*height*gColorDepth;
+      if( m_hKernelFallback )
+      {
+         CHECKSTATUS(clSetKernelArg( m_hKernelFallback, 0, sizeof(cl_mem), (void*)&output ));
+         CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelFallback, 1, NULL, &szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_render )));
+      }
+   }
+   else if( converged )
+   {
+      refinement.s[0] = 1;
+   }
+   else if( m_renderMode == rm_wavefront && m_hKernelWavefrontOutput )
+   {
+      // Every pixel is traced, the history is left behind
+      refinement.s[0] = 1;
+      renderWavefront( frame, width, height, timer, transparentColor );
+      m_historyValid = false;
+   }
+   else
+   {
+      // Persistent threads share the arguments of the standard kernel
+      bool persistent = (m_renderMode == rm_persistent && m_hKernelPersistent);
+      cl_kernel kernel = persistent ? m_hKernelPersistent : m_hKernel;
+      if( m_kernelVariant.length() != 0 )
+      {
+         const KernelVariant& variant = m_kernelVariants[m_kernelVariant];
+         kernel = persistent ? variant.persistentKernel : variant.kernel;
+      }
+
+      // The history is only written for the reprojection
+      cl_int storeHistory = m_reprojection ? 1 : 0;
+
+      // Setting kernel arguments
+      CHECKSTATUS(clSetKernelArg( kernel, 0, sizeof(cl_float4),(void*)&m_viewPos ));
+      CHECKSTATUS(clSetKernelArg( kernel, 1, sizeof(cl_float4),(void*)&m_viewDir ));
+      CHECKSTATUS(clSetKernelArg( kernel, 2, sizeof(cl_float4),(void*)&m_angles ));
+      CHECKSTATUS(clSetKernelArg( kernel, 3, sizeof(cl_int),   (void*)&width ));
+      CHECKSTATUS(clSetKernelArg( kernel, 4, sizeof(cl_int),   (void*)&height ));
+      CHECKSTATUS(clSetKernelArg( kernel, 5, sizeof(cl_mem),   (void*)&m_hPrimitives ));
+      CHECKSTATUS(clSetKernelArg( kernel, 6, sizeof(cl_mem),   (void*)&m_hLamps ));
+      CHECKSTATUS(clSetKernelArg( kernel, 7, sizeof(cl_mem),   (void*)&m_hMaterials ));
+      CHECKSTATUS(clSetKernelArg( kernel, 8, sizeof(cl_int),   (void*)&m_nbActivePrimitives ));
+      CHECKSTATUS(clSetKernelArg( kernel, 9, sizeof(cl_int),   (void*)&m_nbActiveLamps ));
+      CHECKSTATUS(clSetKernelArg( kernel,10, sizeof(cl_int),   (void*)&m_nbActiveMaterials ));
+      CHECKSTATUS(clSetKernelArg( kernel,11, sizeof(cl_mem),   (void*)&frame ));
+      CHECKSTATUS(clSetKernelArg( kernel,12, sizeof(cl_mem),   (void*)&m_hVideo ));
+      CHECKSTATUS(clSetKernelArg( kernel,13, sizeof(cl_mem),   (void*)&m_hDepth ));
+      CHECKSTATUS(clSetKernelArg( kernel,14, sizeof(cl_mem),   (void*)&m_hTextures ));
+      CHECKSTATUS(clSetKernelArg( kernel,15, sizeof(cl_float), (void*)&timer ));
+      CHECKSTATUS(clSetKernelArg( kernel,16, sizeof(cl_int2),  (void*)&refinement ));
+      CHECKSTATUS(clSetKernelArg( kernel,17, sizeof(cl_int),   (void*)&transparentColor ));
+      CHECKSTATUS(clSetKernelArg( kernel,18, sizeof(cl_mem),   (void*)&m_hBoundingVolumes ));
+      CHECKSTATUS(clSetKernelArg( kernel,19, sizeof(cl_mem),   (void*)&m_hPrimitivesIndex ));
+      CHECKSTATUS(clSetKernelArg( kernel,20, sizeof(cl_int),   (void*)&m_nbBoundingVolumes ));
+      CHECKSTATUS(clSetKernelArg( kernel,21, sizeof(cl_mem),   (void*)&m_hTypedSpheres ));
+      CHECKSTATUS(clSetKernelArg( kernel,22, sizeof(cl_mem),   (void*)&m_hTypedShapes ));
+      CHECKSTATUS(clSetKernelArg( kernel,23, sizeof(cl_mem),   (void*)&m_hTypedIndex ));
+      CHECKSTATUS(clSetKernelArg( kernel,24, sizeof(cl_mem),   (void*)&m_hTypedRanges ));
+      CHECKSTATUS(clSetKernelArg( kernel,25, sizeof(cl_int),   (void*)&m_nbTypedPrimitives ));
+      cl_int nbInstances = getNbInstances();
+      CHECKSTATUS(clSetKernelArg( kernel,26, sizeof(cl_mem),   (void*)&m_hInstances ));
+      CHECKSTATUS(clSetKernelArg( kernel,27, sizeof(cl_int),   (void*)&nbInstances ));
+      CHECKSTATUS(clSetKernelArg( kernel,28, sizeof(cl_mem),   (void*)&m_hInstanceBoundingVolumes ));
+      CHECKSTATUS(clSetKernelArg( kernel,29, sizeof(cl_mem),   (void*)&m_hInstancesIndex ));
+      CHECKSTATUS(clSetKernelArg( kernel,30, sizeof(cl_mem),   (void*)&m_hGeometryPrimitives ));
+      CHECKSTATUS(clSetKernelArg( kernel,31, sizeof(cl_mem),   (void*)&m_hGeometryBoundingVolumes ));
+      CHECKSTATUS(clSetKernelArg( kernel,32, sizeof(cl_mem),   (void*)&m_hGeometryIndex ));
+      CHECKSTATUS(clSetKernelArg( kernel,33, sizeof(cl_mem),   (void*)&m_hAccumulation ));
+      CHECKSTATUS(clSetKernelArg( kernel,34, sizeof(cl_int),   (void*)&sample ));
+      CHECKSTATUS(clSetKernelArg( kernel,35, sizeof(cl_mem),   (void*)&m_hHistory[m_historyIndex] ));
+      CHECKSTATUS(clSetKernelArg( kernel,36, sizeof(cl_int),   (void*)&storeHistory ));
+
+      if( persistent )
+      {
+         CHECKSTATUS(clSetKernelArg( kernel,37, sizeof(cl_mem),   (void*)&m_hWorkCounter ));
+         CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hWorkCounter, CL_FALSE, 0, sizeof(cl_int), &gZeroCounter, 0, NULL, profilingEvent( fs_render )));
+         CHECKSTATUS(clEnqueueNDRangeKernel(
+            m_hQueue, kernel, 1, NULL, &m_persistentWorkItems, &m_persistentGroupSize, 0, 0, profilingEvent( fs_render )));
+      }
+      else
+      {
+         // Run the kernel!! The offset moves the rows to the band
+         int top    = m_bandTop;
+         int bottom = (m_bandBottom != 0) ? (std::min)(m_bandBottom,height) : height;
+         size_t szGlobalWorkOffset[] = {0,top/m_refinementStep};
+         size_t szGlobalWorkSize[]   = {(width+m_refinementStep-1)/m_refinementStep,(bottom-top+m_refinementStep-1)/m_refinementStep};
+         size_t szLocalWorkSize  = 0;
+
+         CHECKSTATUS(clEnqueueNDRangeKernel(
+            m_hQueue, kernel, 2, szGlobalWorkOffset, szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_render )));
+      }
+
+      // Each traced pixel has written its history
+      if( m_refinementStep == 1 && storeHistory ) m_historyValid = true;
+   }
+
+   // The fallback kernel has cleared the output already
+   if( postProcessing && refinement.s[0] != 0 ) enqueuePostProcessing( output, width, height, refinement.s[0] );
+
+   // Nothing is refined while the kernels are building
+   m_previousStep   = refinement.s[0];
+   m_previousOutput = frame;
+   if( m_previousStep != 0 ) m_refinementStep = (m_refinementStep>1) ? m_refinementStep/2 : 1;
+   if( m_previousStep != 0 && sample>=0 && !converged ) m_nbSamples++;
+}
+
+/*
+* setBand
+* Rows moving from one device to another were neither refined nor 
+* accumulated by this one, the next frame traces every pixel again.
+*/
+void OpenCLKernel::setBand( int top, int bottom )
+{
+   if( top == m_bandTop && bottom == m_bandBottom ) return;
+   m_bandTop        = top;
+   m_bandBottom     = bottom;
+   m_previousOutput = 0;
+   m_nbSamples      = 0;
+}
+
+void OpenCLKernel::setBoundingVolumeBuilder( BoundingVolumeBuilder builder )
+{
+   m_bvhBuilder = builder;
+   m_bvhDirty   = true;
+   m_modifiedPrimitives.clear();
+}
+
+void OpenCLKernel::setAccumulation( bool enabled )
+{
+   m_accumulation = enabled;
+   m_nbSamples    = 0;
+}
+
+void OpenCLKernel::setReprojection( bool enabled )
+{
+   m_reprojection   = enabled;
+   m_reprojectFrame = false;
+   m_historyValid   = false; // Not written while the reprojection was off
+}
+
+/*
+* enqueueReprojection
+* Warps the history of the last frame into the output. The pixels it cannot
+* fill are flagged in the new history, render_kernel traces them next.
+*/
+void OpenCLKernel::enqueueReprojection( cl_mem output, int width, int height )
+{
+   cl_mem previous = m_hHistory[m_historyIndex];
+   m_historyIndex  = 1-m_historyIndex;
+   cl_mem history  = m_hHistory[m_historyIndex];
+   size_t nbPixels = width*height;
+
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionClear, 0, sizeof(cl_mem), (void*)&history ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionClear, 1, sizeof(cl_mem), (void*)&m_hReprojectionDepth ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelReprojectionClear, 1, NULL, &nbPixels, 0, 0, 0, profilingEvent( fs_render )));
+
+   // Closest point of each pixel
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 0, sizeof(cl_float4),(void*)&m_viewPos ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 1, sizeof(cl_float4),(void*)&m_viewDir ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 2, sizeof(cl_float4),(void*)&m_angles ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 3, sizeof(cl_int),   (void*)&width ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 4, sizeof(cl_int),   (void*)&height ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 5, sizeof(cl_mem),   (void*)&previous ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionDepth, 6, sizeof(cl_mem),   (void*)&m_hReprojectionDepth ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelReprojectionDepth, 1, NULL, &nbPixels, 0, 0, 0, profilingEvent( fs_render )));
+
+   // Its color
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 0, sizeof(cl_float4),(void*)&m_viewPos ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 1, sizeof(cl_float4),(void*)&m_viewDir ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 2, sizeof(cl_float4),(void*)&m_angles ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 3, sizeof(cl_int),   (void*)&width ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 4, sizeof(cl_int),   (void*)&height ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 5, sizeof(cl_mem),   (void*)&previous ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 6, sizeof(cl_mem),   (void*)&history ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 7, sizeof(cl_mem),   (void*)&m_hReprojectionDepth ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionColor, 8, sizeof(cl_mem),   (void*)&output ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelReprojectionColor, 1, NULL, &nbPixels, 0, 0, 0, profilingEvent( fs_render )));
+
+   // Disocclusions
+   size_t szGlobalWorkSize[] = { width, height };
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionHoles, 0, sizeof(cl_int), (void*)&width ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionHoles, 1, sizeof(cl_int), (void*)&height ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionHoles, 2, sizeof(cl_mem), (void*)&history ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelReprojectionHoles, 3, sizeof(cl_mem), (void*)&m_hReprojectionDepth ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelReprojectionHoles, 2, NULL, szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_render )));
+}
+
+void OpenCLKernel::setPostProcessing( int passes )
+{
+   m_postProcessing = passes & (pp_denoise|pp_upscale|pp_toneMapping);
+}
+
+void OpenCLKernel::setDenoiser( int radius, float colorSigma, float depthSigma )
+{
+   m_denoiser.s[0] = static_cast<float>( (radius<1) ? 1 : (radius>gMaxDenoiserRadius) ? gMaxDenoiserRadius : radius );
+   m_denoiser.s[1] = (colorSigma>0.f) ? colorSigma : 0.1f;
+   m_denoiser.s[2] = (depthSigma>0.f) ? depthSigma : 0.05f;
+   m_denoiser.s[3] = 0.f;
+}
+
+void OpenCLKernel::setToneMapping( float exposure, float gamma )
+{
+   m_toneMapping.s[0] = (exposure>0.f) ? exposure : 1.f;
+   m_toneMapping.s[1] = (gamma>0.f) ? gamma : 1.f;
+   m_toneMapping.s[2] = 0.f;
+   m_toneMapping.s[3] = 0.f;
+}
+
+/*
+* enqueuePostProcessing
+* Runs the passes from the raw frame to the output. The passes alternate 
+* between the intermediate buffer and the output, so that the last one 
+* writes into the output. step is the refinement step of the frame, the 
+* upscaler has nothing to do with fully traced frames.
+*/
+void OpenCLKernel::enqueuePostProcessing( cl_mem output, int width, int height, int step )
+{
+   cl_float4 noParameters = { 0.f, 0.f, 0.f, 0.f };
+   std::vector<cl_int>    passes;
+   std::vector<cl_float4> parameters;
+   if( (m_postProcessing & pp_upscale) && step>1 ) 
+   {
+      passes.push_back( pp_upscale );
+      parameters.push_back( noParameters );
+   }
+   if( m_postProcessing & pp_denoise )
+   {
+      passes.push_back( pp_denoise );
+      parameters.push_back( m_denoiser );
+   }
+   if( m_postProcessing & pp_toneMapping )
+   {
+      passes.push_back( pp_toneMapping );
+      parameters.push_back( m_toneMapping );
+   }
+
+   cl_mem source = m_hPostProcessingFrames[0];
+   if( passes.empty() )
+   {
+      CHECKSTATUS(clEnqueueCopyBuffer( m_hQueue, source, output, 0, 0, m_outputSize, 0, NULL, profilingEvent( fs_postProcessing ) ));
+      return;
+   }
+
+   size_t szGlobalWorkSize[] = { width, height };
+   for( size_t i(0); i<passes.size(); ++i )
+   {
+      cl_mem destination = ((passes.size()-1-i)%2 == 0) ? output : m_hPostProcessingFrames[1];
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 0, sizeof(cl_mem),    (void*)&source ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 1, sizeof(cl_mem),    (void*)&destination ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 2, sizeof(cl_int),    (void*)&width ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 3, sizeof(cl_int),    (void*)&height ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 4, sizeof(cl_int),    (void*)&passes[i] ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 5, sizeof(cl_int),    (void*)&step ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelPostProcessing, 6, sizeof(cl_float4), (void*)&parameters[i] ));
+      CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelPostProcessing, 2, NULL, szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_postProcessing )));
+      source = destination;
+   }
+}
+
+void OpenCLKernel::setKernelSpecialization( bool enabled )
+{
+   m_kernelSpecialization = enabled;
+   m_featuresDirty = true;
+}
+
+void OpenCLKernel::setRenderMode( RenderMode mode )
+{
+   m_renderMode = mode;
+}
+
+void OpenCLKernel::setPrimitiveStorage( PrimitiveStorage storage )
+{
+   m_primitiveStorage  = storage;
+   m_nbTypedPrimitives = 0;
+   m_bvhDirty          = true;
+   m_modifiedPrimitives.clear();
+}
+
+/*
+* Wavefront rendering. Rays are generated for every pixel, then each bounce
+* runs the extend, shadow and shade stages over the rays still alive only.
+* The size of the queues stays on the device: every stage is launched over
+* the whole frame and the work-items past the end of their queue leave 
+* straight away, so the host never waits for the device within a frame.
+*/
+void OpenCLKernel::renderWavefront( 
+   cl_mem output,
+   int    width, 
+   int    height, 
+   float  timer,
+   float  transparentColor )
+{
+   cl_int nbRays = width*height;
+   size_t szGlobalWorkSize[] = {width,height};
+
+   // Generate
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 0, sizeof(cl_float4),(void*)&m_viewPos ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 1, sizeof(cl_float4),(void*)&m_viewDir ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 2, sizeof(cl_float4),(void*)&m_angles ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 3, sizeof(cl_int),   (void*)&width ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 4, sizeof(cl_int),   (void*)&height ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 5, sizeof(cl_mem),   (void*)&m_hRays ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontGenerate, 6, sizeof(cl_mem),   (void*)&m_hRayQueues[0] ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelWavefrontGenerate, 2, NULL, szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_render )));
+
+   cl_int counters[gNbRayCounters] = { nbRays, 0, 0 };
+   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hRayCounters, CL_FALSE, 0, sizeof(counters), counters, 0, NULL, profilingEvent( fs_render )));
+
+   // Arguments that do not change from one bounce to the next
+   cl_int hitsCounter = gRayHitsCounter;
+   cl_int nbInstances = getNbInstances();
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 0, sizeof(cl_mem),   (void*)&m_hRays ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 2, sizeof(cl_mem),   (void*)&m_hRayHits ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 3, sizeof(cl_mem),   (void*)&m_hRayCounters ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 5, sizeof(cl_int),   (void*)&hitsCounter ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 6, sizeof(cl_mem),   (void*)&m_hPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 7, sizeof(cl_mem),   (void*)&m_hLamps ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 8, sizeof(cl_mem),   (void*)&m_hMaterials ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 9, sizeof(cl_int),   (void*)&m_nbActivePrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,10, sizeof(cl_int),   (void*)&m_nbActiveLamps ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,11, sizeof(cl_mem),   (void*)&m_hVideo ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,12, sizeof(cl_mem),   (void*)&m_hDepth ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,13, sizeof(cl_mem),   (void*)&m_hTextures ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,14, sizeof(cl_float), (void*)&timer ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,15, sizeof(cl_float), (void*)&transparentColor ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,16, sizeof(cl_mem),   (void*)&m_hBoundingVolumes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,17, sizeof(cl_mem),   (void*)&m_hPrimitivesIndex ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,18, sizeof(cl_int),   (void*)&m_nbBoundingVolumes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,19, sizeof(cl_mem),   (void*)&m_hTypedSpheres ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,20, sizeof(cl_mem),   (void*)&m_hTypedShapes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,21, sizeof(cl_mem),   (void*)&m_hTypedIndex ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,22, sizeof(cl_mem),   (void*)&m_hTypedRanges ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,23, sizeof(cl_int),   (void*)&m_nbTypedPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,24, sizeof(cl_mem),   (void*)&m_hInstances ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,25, sizeof(cl_int),   (void*)&nbInstances ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,26, sizeof(cl_mem),   (void*)&m_hInstanceBoundingVolumes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,27, sizeof(cl_mem),   (void*)&m_hInstancesIndex ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,28, sizeof(cl_mem),   (void*)&m_hGeometryPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,29, sizeof(cl_mem),   (void*)&m_hGeometryBoundingVolumes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend,30, sizeof(cl_mem),   (void*)&m_hGeometryIndex ));
+
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 0, sizeof(cl_mem),   (void*)&m_hRays ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 1, sizeof(cl_mem),   (void*)&m_hRayHits ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 2, sizeof(cl_mem),   (void*)&m_hRayCounters ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 3, sizeof(cl_int),   (void*)&hitsCounter ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 4, sizeof(cl_float4),(void*)&m_viewPos ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 5, sizeof(cl_float4),(void*)&m_angles ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 6, sizeof(cl_mem),   (void*)&m_hPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 7, sizeof(cl_mem),   (void*)&m_hLamps ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 8, sizeof(cl_mem),   (void*)&m_hMaterials ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow, 9, sizeof(cl_int),   (void*)&m_nbActivePrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow,10, sizeof(cl_int),   (void*)&m_nbActiveLamps ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow,11, sizeof(cl_mem),   (void*)&m_hVideo ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow,12, sizeof(cl_mem),   (void*)&m_hDepth ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow,13, sizeof(cl_mem),   (void*)&m_hTextures ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow,14, sizeof(cl_float), (void*)&timer ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShadow,15, sizeof(cl_float), (void*)&transparentColor ));
+
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 0, sizeof(cl_mem),   (void*)&m_hRays ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 1, sizeof(cl_mem),   (void*)&m_hRayHits ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 3, sizeof(cl_mem),   (void*)&m_hRayCounters ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 4, sizeof(cl_int),   (void*)&hitsCounter ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 6, sizeof(cl_mem),   (void*)&m_hMaterials ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 7, sizeof(cl_mem),   (void*)&m_hVideo ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 8, sizeof(cl_mem),   (void*)&m_hDepth ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 9, sizeof(cl_mem),   (void*)&m_hTextures ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade,10, sizeof(cl_float), (void*)&timer ));
+
+   // Bounces
+   cl_int queueCounter = 0;
+   for( int iteration(0); iteration<m_maxIterations; ++iteration )
+   {
+      cl_int nextCounter = 1-queueCounter;
+
+      // Extend: closest intersections, surviving rays are listed in the hits
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hRayCounters, CL_FALSE, hitsCounter*sizeof(cl_int), sizeof(cl_int), &gZeroCounter, 0, NULL, profilingEvent( fs_render )));
+      CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 1, sizeof(cl_mem), (void*)&m_hRayQueues[queueCounter] ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontExtend, 4, sizeof(cl_int), (void*)&queueCounter ));
+      enqueueRays( m_hKernelWavefrontExtend, nbRays );
+
+      // Shadow: light received by the intersections
+      enqueueRays( m_hKernelWavefrontShadow, nbRays );
+
+      // Shade: color of the intersections, reflected and refracted rays 
+      // are queued for the next bounce
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hRayCounters, CL_FALSE, nextCounter*sizeof(cl_int), sizeof(cl_int), &gZeroCounter, 0, NULL, profilingEvent( fs_render )));
+      CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 2, sizeof(cl_mem), (void*)&m_hRayQueues[nextCounter] ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontShade, 5, sizeof(cl_int), (void*)&nextCounter ));
+      enqueueRays( m_hKernelWavefrontShade, nbRays );
+
+      queueCounter = nextCounter;
+   }
+
+   // Output
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontOutput, 0, sizeof(cl_mem), (void*)&m_hRays ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontOutput, 1, sizeof(cl_int), (void*)&width ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelWavefrontOutput, 2, sizeof(cl_mem), (void*)&output ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelWavefrontOutput, 2, NULL, szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_render )));
+}
+
+/*
+* Launches a stage over nbRays work-items, the capacity of the queues. The 
+* global size is rounded up to a multiple of the preferred work-group size,
+* the work-items past the end of the queue leave straight away.
+*/
+void OpenCLKernel::enqueueRays( cl_kernel kernel, cl_int nbRays )
+{
+   size_t groupSize = (m_preferredWorkGroupSize != 0) ? m_preferredWorkGroupSize : 64;
+   size_t szGlobalWorkSize = ((nbRays+groupSize-1)/groupSize)*groupSize;
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, kernel, 1, NULL, &szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_render )));
+}
+
+void OpenCLKernel::setCamera( 
+   Float4 eye, Float4 dir, Float4 angles )
+{
+   // Small moves are reprojected, a few frames in a row at most
+   float move(0.f);
+   for( int i(0); i<3; ++i )
+   {
+      move = (std::max)( move, fabs(eye.s[i]-m_viewPos.s[i]) );
+      move = (std::max)( move, fabs(dir.s[i]-m_viewDir.s[i]) );
+   }
+   float rotation = (std::max)( fabs(angles.s[0]), fabs(angles.s[1]) );
+   m_reprojectFrame = 
+      m_reprojection && m_historyValid && m_nbReprojectedFrames<gMaxReprojectedFrames &&
+      move <= gReprojectionMaxMove && rotation <= gReprojectionMaxAngle;
+   m_nbReprojectedFrames = m_reprojectFrame ? m_nbReprojectedFrames+1 : 0;
+
+   SceneRenderer::setCamera( eye, dir, angles );
+   m_refinementStep = m_reprojectFrame ? 1 : m_coarsestStep;
+   m_nbSamples      = 0;
+}
+
+/*
+*
+*/
+OpenCLKernel::~OpenCLKernel()
+{
+   // Clean up
+   releaseDevice();
+   DeleteCriticalSection( &m_renderLock );
+   CloseHandle( m_callbacksDone );
+
+#if USE_KINECT
+   CloseHandle(m_skeletons);
+   CloseHandle(m_hNextDepthFrameEvent); 
+   CloseHandle(m_hNextVideoFrameEvent); 
+   CloseHandle(m_hNextSkeletonEvent);
+   NuiShutdown();
+#endif // USE_KINECT
+}
+
+long OpenCLKernel::addPrimitive( int type )
+{
+   m_bvhDirty = true;
+   return SceneRenderer::addPrimitive( type );
+}
+
+void OpenCLKernel::setPrimitive( 
+   int index, 
+   float x, 
+   float y, 
+   float z, 
+   float width, 
+   float height, 
+   int   materialId, 
+   int   materialPadding )
+{
+   SceneRenderer::setPrimitive( index, x, y, z, width, height, materialId, materialPadding );
+   if( index>= 0 && index < m_nbActivePrimitives && !m_bvhDirty ) m_modifiedPrimitives.push_back(index);
+}
+
+long OpenCLKernel::addCube( 
+   float x, 
+   float y, 
+   float z, 
+   float radius, 
+   int   materialId, 
+   int   materialPadding )
+{
+   long returnValue;
+   // Back
+   returnValue = addPrimitive( ptXYPlane );
+   setPrimitive( returnValue, x, y, z+radius, radius, radius, materialId, materialPadding ); 
+
+   // Front
+   returnValue = addPrimitive( ptXYPlane );
+   setPrimitive( returnValue, x, y, z-radius, radius, radius, materialId, materialPadding ); 
+
+   // Left
+   returnValue = addPrimitive( ptYZPlane );
+   setPrimitive( returnValue, x-radius, y, z, radius, radius, materialId, materialPadding ); 
+
+   // Right
+   returnValue = addPrimitive( ptYZPlane );
+   setPrimitive( returnValue, x+radius, y, z, radius, radius, materialId, materialPadding ); 
+
+   // Top
+   returnValue = addPrimitive( ptXZPlane );
+   setPrimitive( returnValue, x, y+radius, z, radius, radius, materialId, materialPadding ); 
+
+   // Bottom
+   returnValue = addPrimitive( ptXZPlane );
+   setPrimitive( returnValue, x, y-radius, z, radius, radius, materialId, materialPadding ); 
+   return returnValue;
+}
+
+// ---------- Instances ----------
+long OpenCLKernel::addGeometry()
+{
+   m_geometries.push_back( std::vector<Primitive>() );
+   m_geometriesDirty = true;
+   return static_cast<long>(m_geometries.size())-1;
+}
+
+long OpenCLKernel::addGeometryPrimitive( 
+   int geometry,
+   int type )
+{
+   if( geometry<0 || geometry>=static_cast<int>(m_geometries.size()) ) return -1;
+
+   Primitive primitive;
+   memset( &primitive, 0, sizeof(Primitive) );
+   primitive.type = type;
+   primitive.materialId = NO_MATERIAL;
+   m_geometries[geometry].push_back( primitive );
+   m_geometriesDirty = true;
+   return static_cast<long>(m_geometries[geometry].size())-1;
+}
+
+void OpenCLKernel::setGeometryPrimitive( 
+   int   geometry,
+   int   index, 
+   float x, 
+   float y, 
+   float z, 
+   float width, 
+   float height, 
+   int   materialId, 
+   int   materialPadding )
+{
+   if( geometry>=0 && geometry<static_cast<int>(m_geometries.size()) &&
+       index>=0    && index<static_cast<int>(m_geometries[geometry].size()) )
+   {
+      fillPrimitive( m_geometries[geometry][index], x, y, z, width, height, materialId, materialPadding );
+      m_geometriesDirty = true;
+   }
+}
+
+long OpenCLKernel::addCubeGeometry( 
+   float radius, 
+   int   materialId, 
+   int   materialPadding )
+{
+   long geometry = addGeometry();
+   long index;
+   // Back
+   index = addGeometryPrimitive( geometry, ptXYPlane );
+   setGeometryPrimitive( geometry, index, 0.f, 0.f, radius, radius, radius, materialId, materialPadding ); 
+
+   // Front
+   index = addGeometryPrimitive( geometry, ptXYPlane );
+   setGeometryPrimitive( geometry, index, 0.f, 0.f, -radius, radius, radius, materialId, materialPadding ); 
+
+   // Left
+   index = addGeometryPrimitive( geometry, ptYZPlane );
+   setGeometryPrimitive( geometry, index, -radius, 0.f, 0.f, radius, radius, materialId, materialPadding ); 
+
+   // Right
+   index = addGeometryPrimitive( geometry, ptYZPlane );
+   setGeometryPrimitive( geometry, index, radius, 0.f, 0.f, radius, radius, materialId, materialPadding ); 
+
+   // Top
+   index = addGeometryPrimitive( geometry, ptXZPlane );
+   setGeometryPrimitive( geometry, index, 0.f, radius, 0.f, radius, radius, materialId, materialPadding ); 
+
+   // Bottom
+   index = addGeometryPrimitive( geometry, ptXZPlane );
+   setGeometryPrimitive( geometry, index, 0.f, -radius, 0.f, radius, radius, materialId, materialPadding ); 
+   return geometry;
+}
+
+long OpenCLKernel::addInstance( int geometry )
+{
+   if( geometry<0 || geometry>=static_cast<int>(m_geometries.size()) ) return -1;
+
+   Instance instance;
+   memset( &instance, 0, sizeof(Instance) );
+   instance.transform.s[3] = 1.f;
+   instance.geometryId     = geometry;
+   instance.materialId     = NO_MATERIAL;
+   instance.rootNode       = -1;
+   m_instances.push_back( instance );
+   m_instancesDirty = true;
+   return static_cast<long>(m_instances.size())-1;
+}
+
+void OpenCLKernel::setInstance( 
+   int   index,
+   float x, 
+   float y, 
+   float z, 
+   float scale, 
+   int   materialId )
+{
+   if( index>=0 && index<static_cast<int>(m_instances.size()) && scale>0.f )
+   {
+      m_instances[index].transform.s[0] = x;
+      m_instances[index].transform.s[1] = y;
+      m_instances[index].transform.s[2] = z;
+      m_instances[index].transform.s[3] = scale;
+      m_instances[index].materialId     = materialId;
+      if( !m_instancesDirty ) m_modifiedInstances.push_back(index);
+   }
+}
+
+void OpenCLKernel::setPrimitiveMaterial( 
+   int   index, 
+   int   materialId )
+{
+   SceneRenderer::setPrimitiveMaterial( index, materialId );
+   if( index>= 0 && index < m_nbActivePrimitives && !m_bvhDirty ) m_modifiedPrimitives.push_back(index);
+}
+
+// ---------- Materials ----------
+void OpenCLKernel::setMaterial( 
+   int   index,
+   float r, float g, float b, 
+   float reflection, 
+   float refraction, 
+   int   textured,
+   float transparency,
+   int   textureId,
+   float specValue, float specPower, float specCoef, float innerIllumination )
+{
+   // Packed arrays carry the transparency of their material
+   if( index>= 0 && index < m_nbActiveMaterials && m_primitiveStorage == ps_typed && 
+       (m_materials[index].transparency != 0.f) != (transparency != 0.f) ) m_bvhDirty = true;
+   SceneRenderer::setMaterial( index, r, g, b, reflection, refraction, textured, transparency, textureId, 
+      specValue, specPower, specCoef, innerIllumination );
+}
+
+// ---------- Scene uploads ----------
+/*
+* uploadDirtyRanges
+* Sorts the dirty indices and uploads them as contiguous ranges. Ranges 
+* separated by less than gMaxUploadGap clean elements are merged, a few 
+* extra bytes being cheaper than another transfer.
+*/
+void OpenCLKernel::uploadDirtyRanges( 
+   cl_mem               buffer, 
+   std::vector<cl_int>& indices, 
+   size_t               elementSize, 
+   const void*          data,
+   FrameStage           stage )
+{
+   if( indices.empty() ) return;
+
+   std::sort( indices.begin(), indices.end() );
+   const char* bytes = static_cast<const char*>(data);
+   size_t i(0);
+   while( i<indices.size() )
+   {
+      cl_int first = indices[i];
+      cl_int last  = first;
+      while( i<indices.size() && indices[i]-last<=gMaxUploadGap )
+      {
+         last = indices[i];
+         ++i;
+      }
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, buffer, CL_FALSE, first*elementSize, (last-first+1)*elementSize, bytes+first*elementSize, 0, NULL, profilingEvent( stage )));
+   }
+   indices.clear();
+}
+
+// ---------- Acceleration structure ----------
+void OpenCLKernel::getPrimitiveBounds( 
+   const Primitive& primitive, 
+   BoundingBox&     box )
+{
+   // Planes have no thickness, give them some so that the slab test is stable
+   const float thickness = 0.5f;
+   cl_float4 extent;
+   switch( primitive.type )
+   {
+   case ptSphere:
+      extent.s[0] = primitive.size.s[0];
+      extent.s[1] = primitive.size.s[0];
+      extent.s[2] = primitive.size.s[0];
+      break;
+   case ptCylinder:
+      extent.s[0] = primitive.size.s[0];
+      extent.s[1] = primitive.size.s[1];
+      extent.s[2] = primitive.size.s[0];
+      break;
+   case ptCheckboard:
+   case ptXZPlane:
+      extent.s[0] = primitive.size.s[0];
+      extent.s[1] = thickness;
+      extent.s[2] = primitive.size.s[1];
+      break;
+   case ptYZPlane:
+      extent.s[0] = thickness;
+      extent.s[1] = primitive.size.s[1];
+      extent.s[2] = primitive.size.s[0];
+      break;
+   case ptXYPlane:
+   case ptCamera:
+      extent.s[0] = primitive.size.s[0];
+      extent.s[1] = primitive.size.s[1];
+      extent.s[2] = thickness;
+      break;
+   default:
+      // Triangles are never hit by the kernel
+      extent.s[0] = thickness;
+      extent.s[1] = thickness;
+      extent.s[2] = thickness;
+      break;
+   }
+   for( int i(0); i<3; ++i )
+   {
+      box.min.s[i] = primitive.center.s[i] - extent.s[i];
+      box.max.s[i] = primitive.center.s[i] + extent.s[i];
+   }
+   box.min.s[3] = 0.f;
+   box.max.s[3] = 0.f;
+}
+
+void OpenCLKernel::buildBoundingVolumes()
+{
+   std::vector<BoundingBox> boxes(m_nbActivePrimitives);
+   for( int i(0); i<m_nbActivePrimitives; ++i )
+   {
+      getPrimitiveBounds( m_primitives[i], boxes[i] );
+   }
+   m_bvh.build( boxes );
+   m_nbBoundingVolumes = m_bvh.getNbNodes();
+   m_bvhDirty = false;
+   m_modifiedPrimitives.clear();
+}
+
+void OpenCLKernel::refitBoundingVolumes()
+{
+   // A material change leaves the bounds untouched and the refit stops at the leaf
+   std::sort( m_modifiedPrimitives.begin(), m_modifiedPrimitives.end() );
+   m_modifiedPrimitives.erase( std::unique( m_modifiedPrimitives.begin(), m_modifiedPrimitives.end() ), m_modifiedPrimitives.end() );
+   BoundingBox box;
+   for( size_t i(0); i<m_modifiedPrimitives.size(); ++i )
+   {
+      getPrimitiveBounds( m_primitives[m_modifiedPrimitives[i]], box );
+      m_bvh.refit( m_modifiedPrimitives[i], box, m_refittedNodes );
+   }
+   m_modifiedPrimitives.clear();
+
+   // Moving objects around eventually makes the hierarchy loose
+   if( m_bvh.isDegraded() )
+   {
+      LOG_INFO("Bounding volume hierarchy has degraded, rebuilding it");
+      m_bvhDirty = true;
+   }
+}
+
+void OpenCLKernel::buildBoundingVolumesOnDevice()
+{
+   cl_int nbPrimitives = m_nbActivePrimitives;
+   m_nbBoundingVolumes = (nbPrimitives>0) ? 2*nbPrimitives-1 : 0;
+   m_bvhDirty = false;
+   m_modifiedPrimitives.clear();
+   if( nbPrimitives == 0 ) return;
+
+   size_t szGlobalWorkSize = nbPrimitives;
+   size_t szGroupWorkSize  = m_bvhSortGroupSize;
+
+   // Bounding boxes
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHBounds, 0, sizeof(cl_mem), (void*)&m_hPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHBounds, 1, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHBounds, 2, sizeof(cl_mem), (void*)&m_hBVHBoxes ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHBounds, 1, NULL, &szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_build )));
+
+   // Bounds of the centroids, reduced by at most szGroupWorkSize work-groups
+   size_t nbGroups = std::min( (szGlobalWorkSize+szGroupWorkSize-1)/szGroupWorkSize, szGroupWorkSize );
+   size_t szBoundsWorkSize = nbGroups*szGroupWorkSize;
+   cl_int nbBounds = static_cast<cl_int>(nbGroups);
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHCentroids, 0, sizeof(cl_mem), (void*)&m_hBVHBoxes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHCentroids, 1, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHCentroids, 2, sizeof(cl_mem), (void*)&m_hBVHSceneBounds ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHCentroids, 1, NULL, &szBoundsWorkSize, &szGroupWorkSize, 0, 0, profilingEvent( fs_build )));
+
+   // Morton codes
+   size_t szCodesWorkSize = ((szGlobalWorkSize+szGroupWorkSize-1)/szGroupWorkSize)*szGroupWorkSize;
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHMorton, 0, sizeof(cl_mem), (void*)&m_hBVHBoxes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHMorton, 1, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHMorton, 2, sizeof(cl_mem), (void*)&m_hBVHSceneBounds ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHMorton, 3, sizeof(cl_int), (void*)&nbBounds ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHMorton, 4, sizeof(cl_mem), (void*)&m_hBVHKeys ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHMorton, 5, sizeof(cl_mem), (void*)&m_hBVHValues ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHMorton, 1, NULL, &szCodesWorkSize, &szGroupWorkSize, 0, 0, profilingEvent( fs_build )));
+
+   // Radix sort, each work-group owning szGroupWorkSize*gBVHSortChunk keys
+   size_t szBlockSize    = szGroupWorkSize*gBVHSortChunk;
+   size_t nbSortGroups   = (szGlobalWorkSize+szBlockSize-1)/szBlockSize;
+   size_t szSortWorkSize = nbSortGroups*szGroupWorkSize;
+   cl_int histogramSize  = static_cast<cl_int>(gBVHRadixSize*nbSortGroups);
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHHistogram, 0, sizeof(cl_mem), (void*)&m_hBVHKeys ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHHistogram, 1, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHHistogram, 3, sizeof(cl_mem), (void*)&m_hBVHHistogram ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHScan,      0, sizeof(cl_mem), (void*)&m_hBVHHistogram ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHScan,      1, sizeof(cl_int), (void*)&histogramSize ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHScatter,   0, sizeof(cl_mem), (void*)&m_hBVHKeys ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHScatter,   1, sizeof(cl_mem), (void*)&m_hBVHValues ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHScatter,   2, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHScatter,   4, sizeof(cl_mem), (void*)&m_hBVHHistogram ));
+   for( cl_int pass(0); pass<gBVHRadixPasses; ++pass )
+   {
+      CHECKSTATUS(clSetKernelArg( m_hKernelBVHHistogram, 2, sizeof(cl_int), (void*)&pass ));
+      CHECKSTATUS(clSetKernelArg( m_hKernelBVHScatter,   3, sizeof(cl_int), (void*)&pass ));
+      CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHHistogram, 1, NULL, &szSortWorkSize,  &szGroupWorkSize, 0, 0, profilingEvent( fs_build )));
+      CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHScan,      1, NULL, &szGroupWorkSize, &szGroupWorkSize, 0, 0, profilingEvent( fs_build )));
+      CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHScatter,   1, NULL, &szSortWorkSize,  &szGroupWorkSize, 0, 0, profilingEvent( fs_build )));
+   }
+
+   // Hierarchy
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 0, sizeof(cl_mem), (void*)&m_hBVHKeys ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 1, sizeof(cl_mem), (void*)&m_hBVHValues ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 2, sizeof(cl_mem), (void*)&m_hBVHBoxes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 3, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 4, sizeof(cl_mem), (void*)&m_hBoundingVolumes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 5, sizeof(cl_mem), (void*)&m_hPrimitivesIndex ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHEmit, 6, sizeof(cl_mem), (void*)&m_hBVHFlags ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHEmit, 1, NULL, &szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_build )));
+
+   // Bounds of the internal nodes
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHRefit, 0, sizeof(cl_mem), (void*)&m_hBoundingVolumes ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHRefit, 1, sizeof(cl_mem), (void*)&m_hBVHFlags ));
+   CHECKSTATUS(clSetKernelArg( m_hKernelBVHRefit, 2, sizeof(cl_int), (void*)&nbPrimitives ));
+   CHECKSTATUS(clEnqueueNDRangeKernel( m_hQueue, m_hKernelBVHRefit, 1, NULL, &szGlobalWorkSize, 0, 0, 0, profilingEvent( fs_build )));
+}
+
+/*
+* buildGeometries
+* One hierarchy per geometry, all of them being packed in the same arrays. 
+* Node and index references are offset to their position in those arrays.
+*/
+void OpenCLKernel::buildGeometries()
+{
+   std::vector<PrimitiveRecord> primitives;
+   std::vector<BoundingVolume>  nodes;
+   std::vector<cl_int>          indices;
+
+   size_t nbGeometries = m_geometries.size();
+   m_geometryRoots.resize(nbGeometries);
+   m_geometryBounds.resize(nbGeometries);
+   for( size_t g(0); g<nbGeometries; ++g )
+   {
+      const std::vector<Primitive>& geometry = m_geometries[g];
+      cl_int primitiveOffset = static_cast<cl_int>(primitives.size());
+      cl_int nodeOffset      = static_cast<cl_int>(nodes.size());
+      cl_int indexOffset     = static_cast<cl_int>(indices.size());
+
+      std::vector<BoundingBox> boxes(geometry.size());
+      for( size_t i(0); i<geometry.size(); ++i )
+      {
+         getPrimitiveBounds( geometry[i], boxes[i] );
+         PrimitiveRecord record;
+         packPrimitive( geometry[i], record );
+         primitives.push_back( record );
+      }
+
+      BoundingVolumeHierarchy bvh;
+      bvh.build( boxes );
+      for( cl_int n(0); n<bvh.getNbNodes(); ++n )
+      {
+         BoundingVolume node = bvh.getNodes()[n];
+         if( node.nbPrimitives != 0 )
+         {
+            node.left += indexOffset;
+         }
+         else
+         {
+            node.left  += nodeOffset;
+            node.right += nodeOffset;
+         }
+         node.parent = (node.parent == -1) ? -1 : node.parent+nodeOffset;
+         nodes.push_back( node );
+      }
+      for( cl_int i(0); i<bvh.getNbIndices(); ++i )
+      {
+         indices.push_back( bvh.getIndices()[i]+primitiveOffset );
+      }
+
+      // Empty geometries have no root and their instances are skipped
+      m_geometryRoots[g] = (bvh.getNbNodes() != 0) ? nodeOffset : -1;
+      memset( &m_geometryBounds[g], 0, sizeof(BoundingBox) );
+      if( bvh.getNbNodes() != 0 )
+      {
+         m_geometryBounds[g].min = bvh.getNodes()[0].min;
+         m_geometryBounds[g].max = bvh.getNodes()[0].max;
+      }
+   }
+
+   if( !primitives.empty() )
+   {
+      reserveBuffer( m_hGeometryPrimitives,      primitives.size()*sizeof(PrimitiveRecord) );
+      reserveBuffer( m_hGeometryBoundingVolumes, nodes.size()*sizeof(BoundingVolume) );
+      reserveBuffer( m_hGeometryIndex,           indices.size()*sizeof(cl_int) );
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hGeometryPrimitives,      CL_TRUE, 0, primitives.size()*sizeof(PrimitiveRecord), &primitives[0], 0, NULL, profilingEvent( fs_build )));
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hGeometryBoundingVolumes, CL_TRUE, 0, nodes.size()*sizeof(BoundingVolume),    &nodes[0],      0, NULL, profilingEvent( fs_build )));
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hGeometryIndex,           CL_TRUE, 0, indices.size()*sizeof(cl_int),          &indices[0],    0, NULL, profilingEvent( fs_build )));
+   }
+   m_geometriesDirty = false;
+
+   // Instances have to follow their geometry
+   m_instancesDirty = true;
+}
+
+void OpenCLKernel::getInstanceBounds( 
+   const Instance& instance, 
+   BoundingBox&    box )
+{
+   const BoundingBox& bounds = m_geometryBounds[instance.geometryId];
+   for( int i(0); i<3; ++i )
+   {
+      box.min.s[i] = bounds.min.s[i]*instance.transform.s[3] + instance.transform.s[i];
+      box.max.s[i] = bounds.max.s[i]*instance.transform.s[3] + instance.transform.s[i];
+   }
+   box.min.s[3] = 0.f;
+   box.max.s[3] = 0.f;
+}
+
+/*
+* updateInstances
+* Same policy as for primitives: the top level hierarchy is refitted when 
+* instances move and rebuilt when instances are added or once it has degraded
+*/
+void OpenCLKernel::updateInstances()
+{
+   if( m_geometriesDirty ) buildGeometries();
+
+   size_t nbInstances = m_instances.size();
+   if( nbInstances == 0 || (!m_instancesDirty && m_modifiedInstances.empty()) ) return;
+
+   BoundingBox box;
+   if( !m_instancesDirty )
+   {
+      std::sort( m_modifiedInstances.begin(), m_modifiedInstances.end() );
+      m_modifiedInstances.erase( std::unique( m_modifiedInstances.begin(), m_modifiedInstances.end() ), m_modifiedInstances.end() );
+      std::vector<cl_int> refittedNodes;
+      for( size_t i(0); i<m_modifiedInstances.size(); ++i )
+      {
+         getInstanceBounds( m_instances[m_modifiedInstances[i]], box );
+         m_instancesBvh.refit( m_modifiedInstances[i], box, refittedNodes );
+      }
+      m_instancesDirty = m_instancesBvh.isDegraded();
+      if( !m_instancesDirty )
+      {
+         // Only the moved instances and the bounds of the refitted nodes have changed
+         uploadDirtyRanges( m_hInstances,               m_modifiedInstances, sizeof(Instance),       &m_instances[0],           fs_build );
+         uploadDirtyRanges( m_hInstanceBoundingVolumes, refittedNodes,       sizeof(BoundingVolume), m_instancesBvh.getNodes(), fs_build );
+         return;
+      }
+   }
+   m_modifiedInstances.clear();
+
+   if( m_instancesDirty )
+   {
+      std::vector<BoundingBox> boxes(nbInstances);
+      for( size_t i(0); i<nbInstances; ++i )
+      {
+         m_instances[i].rootNode = m_geometryRoots[m_instances[i].geometryId];
+         getInstanceBounds( m_instances[i], boxes[i] );
+      }
+      m_instancesBvh.build( boxes );
+
+      reserveBuffer( m_hInstancesIndex, m_instancesBvh.getNbIndices()*sizeof(cl_int) );
+      CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hInstancesIndex, CL_TRUE, 0, m_instancesBvh.getNbIndices()*sizeof(cl_int), m_instancesBvh.getIndices(), 0, NULL, profilingEvent( fs_build )));
+      m_instancesDirty = false;
+   }
+
+   reserveBuffer( m_hInstances,               nbInstances*sizeof(Instance) );
+   reserveBuffer( m_hInstanceBoundingVolumes, m_instancesBvh.getNbNodes()*sizeof(BoundingVolume) );
+   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hInstances,               CL_TRUE, 0, nbInstances*sizeof(Instance),                             &m_instances[0],           0, NULL, profilingEvent( fs_build )));
+   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hInstanceBoundingVolumes, CL_TRUE, 0, m_instancesBvh.getNbNodes()*sizeof(BoundingVolume), m_instancesBvh.getNodes(), 0, NULL, profilingEvent( fs_build )));
+}
+
+/*
+* Groups the primitives by type. Spheres only keep their center and the square
+* of their radius, other primitives their center and size. Triangles are left
+* out, they cannot be intersected yet.
+*/
+void OpenCLKernel::buildPrimitiveArrays()
+{
+   const int types[gNbPrimitiveRanges-1] = { ptSphere, ptCylinder, ptXYPlane, ptYZPlane, ptXZPlane, ptCheckboard, ptCamera };
+
+   m_typedSpheres.clear();
+   m_typedShapes.clear();
+   m_typedIndex.clear();
+   for( int t(0); t<gNbPrimitiveRanges-1; ++t )
+   {
+      m_typedRanges[t] = static_cast<cl_int>(m_typedIndex.size());
+      for( cl_int i(0); i<m_nbActivePrimitives; ++i )
+      {
+         const Primitive& primitive = m_primitives[i];
+         if( primitive.type != types[t] ) continue;
+
+         if( primitive.type == ptSphere )
+         {
+            cl_float4 sphere = primitive.center;
+            sphere.s[3] = primitive.size.s[0]*primitive.size.s[0];
+            m_typedSpheres.push_back( sphere );
+         }
+         else
+         {
+            // The transparency bit spares the device a material fetch per candidate
+            cl_int material = primitive.materialId;
+            if( material>=0 && material<m_nbActiveMaterials && m_materials[material].transparency != 0.f ) material |= gTransparentShape;
+            cl_float4 size = primitive.size;
+            memcpy( &size.s[3], &material, sizeof(cl_int) );
+            m_typedShapes.push_back( primitive.center );
+            m_typedShapes.push_back( size );
+         }
+         m_typedIndex.push_back( i );
+      }
+   }
+   m_typedRanges[gNbPrimitiveRanges-1] = static_cast<cl_int>(m_typedIndex.size());
+   m_nbTypedPrimitives = m_typedRanges[gNbPrimitiveRanges-1];
+   m_nbBoundingVolumes = 0; // Stale, records are tested one by one when no array is built
+   m_bvhDirty = false;
+   m_modifiedPrimitives.clear();
+   if( m_nbTypedPrimitives == 0 ) return;
+
+   // Spheres and shapes may be empty, buffers still need to exist
+   reserveBuffer( m_hTypedSpheres, (m_typedSpheres.size()+1)*sizeof(cl_float4) );
+   reserveBuffer( m_hTypedShapes,  (m_typedShapes.size()+1)*sizeof(cl_float4) );
+   reserveBuffer( m_hTypedIndex,   m_typedIndex.size()*sizeof(cl_int) );
+   reserveBuffer( m_hTypedRanges,  gNbPrimitiveRanges*sizeof(cl_int) );
+   if( !m_typedSpheres.empty() ) CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hTypedSpheres, CL_FALSE, 0, m_typedSpheres.size()*sizeof(cl_float4), &m_typedSpheres[0], 0, NULL, profilingEvent( fs_build )));
+   if( !m_typedShapes.empty() )  CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hTypedShapes,  CL_FALSE, 0, m_typedShapes.size()*sizeof(cl_float4),  &m_typedShapes[0],  0, NULL, profilingEvent( fs_build )));
+   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hTypedIndex,  CL_FALSE, 0, m_typedIndex.size()*sizeof(cl_int), &m_typedIndex[0], 0, NULL, profilingEvent( fs_build )));
+   CHECKSTATUS(clEnqueueWriteBuffer( m_hQueue, m_hTypedRanges, CL_FALSE, 0, gNbPrimitiveRanges*sizeof(cl_int),  m_typedRanges,    0, NULL, profilingEvent( fs_build )));
+}
+
+/*
+*
+*/
+char* OpenCLKernel::loadFromFile( const std::string& filename, size_t& length )
+{
+   // Load the kernel source code into the array source_str
+   FILE *fp = 0;
+   char *source_str = 0;
+
+   fopen_s( &fp, filename.c_str(), "r");
+   if( fp == 0 ) 
+   {
+      std::cout << "Failed to load kernel " << filename.c_str() << std::endl;
+   }
+   else 
+   {
+      // The kernel has outgrown MAX_SOURCE_SIZE, read the whole file
+      fseek( fp, 0, SEEK_END );
+      size_t size = ftell( fp );
+      fseek( fp, 0, SEEK_SET );
+      source_str = new char[size+1];
+      length = fread( source_str, 1, size, fp);
+      source_str[length] = 0;
+      fclose( fp );
+   }
+   return source_str;
+}
+
+/*
+* reserveBuffer
+* (Re)allocates a device buffer that has become too small. The content is 
+* not preserved.
+*/
+void OpenCLKernel::reserveBuffer( cl_mem& buffer, size_t size )
+{
+   size_t capacity(0);
+   if( buffer ) CHECKSTATUS(clGetMemObjectInfo( buffer, CL_MEM_SIZE, sizeof(capacity), &capacity, NULL ));
+   if( capacity<size )
+   {
+      if( buffer ) CHECKSTATUS(clReleaseMemObject( buffer ));
+      int status(0);
+      buffer = clCreateBuffer( m_hContext, CL_MEM_READ_ONLY, size, 0, &status );
+      CHECKSTATUS(status);
+   }
+}
+
+// ---------- Kinect ----------
+#ifdef USE_KINECT
+long OpenCLKernel::updateSkeletons( 
+   double center_x, double  center_y, double  center_z, 
+   double size,
+   double radius,       int materialId,
+   double head_radius,  int head_materialId,
+   double hands_radius, int hands_materialId,
+   double feet_radius,  int feet_materialId)
+{
+   bool found = false;
+   HRESULT hr = NuiSkeletonGetNextFrame( 0, &m_skeletonFrame );
+   int i=0;
+   while( i<NUI_SKELETON_COUNT && !found ) 
+   {
+      if( m_skeletonFrame.SkeletonData[i].eTrackingState == NUI_SKELETON_TRACKED ) 
+      {
+         found = true;
+         if( m_skeletonsBody == -1 ) 
+         {
+            // Create Skeleton
+            m_skeletonsBody = m_nbActivePrimitives;
+            m_skeletonsLamp = m_nbActiveLamps;
+            for( int j=0; j<20; j++ ) 
+            {
+               addPrimitive( ptSphere );
+            }
+         }
+         else 
+         {
+            for( int j=0; j<20; j++ ) 
+            {
+               double r = radius;
+               int   m = materialId;
+               bool createSphere(true);
+               switch (j) {
+                  case NUI_SKELETON_POSITION_FOOT_LEFT:
+                  case NUI_SKELETON_POSITION_FOOT_RIGHT:
+                     r = feet_radius;
+                     m = feet_materialId;
+                     createSphere = true;
+                     break;
+                  case NUI_SKELETON_POSITION_HAND_LEFT:
+                  case NUI_SKELETON_POSITION_HAND_RIGHT:
+                     r = hands_radius;
+                     m = hands_materialId;
+                     createSphere = true;
+                     /*
+                     if( j == NUI_SKELETON_POSITION_HAND_RIGHT )
+                     {
+                        m_viewDir.s[0] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].x;
+                        m_viewDir.s[1] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].y;
+                        m_viewDir.s[2] = m_viewPos.s[2] + size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].z;
+                     }
+                     */
+                     break;
+                  case NUI_SKELETON_POSITION_HEAD:
+                     r = head_radius;
+                     m = head_materialId;
+                     createSphere = true;
+                     /*
+                     m_viewPos.s[0] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].x;
+                     m_viewPos.s[1] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].y;
+                     m_viewPos.s[2] = size*m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].z - 400.f;
+                     m_viewDir = m_viewPos;
+                     */
+                     break;
+               }
+               if( createSphere ) setPrimitive(
+                  m_skeletonsBody+j,
+                  static_cast<float>(m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].x * size + center_x),
+                  static_cast<float>(m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].y * size + center_y),
+                  static_cast<float>(m_skeletonFrame.SkeletonData[i].SkeletonPositions[j].z * size + center_z),
+                  static_cast<float>(r), 
+                  static_cast<float>(r), 
+                  m,
+                  1 );
+            }
+#if 0
+            m_angles.s[1] += 0.1f*asin( 
+               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_RIGHT].x - 
+               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_ELBOW_RIGHT].x );
+            m_angles.s[0] += 0.1f*asin( 
+               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_LEFT].y - 
+               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_ELBOW_LEFT].y );
+#endif // 0
+            /*
+            m_viewDir.s[2] += 200.f + 100.f*( 
+               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_RIGHT].z - 
+               m_skeletonFrame.SkeletonData[i].SkeletonPositions[NUI_SKELETON_POSITION_HAND_LEFT].z );
+               */
+         }
+      }
+      i++;
+   }
+   return 0;
+}
+#endif // USE_KINECT
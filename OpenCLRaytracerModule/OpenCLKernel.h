@@ -1,287 +1,714 @@
-/* 
- * OpenCL Raytracer
- * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- * This library is free software; you can redistribute it and/or
- * modify it under the terms of the GNU Library General Public
- * License as published by the Free Software Foundation; either
- * version 2 of the License, or (at your option) any later version.
- *
- * This library is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- * Library General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
- */
-
-/*
- * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- */
-
-#pragma once
-
-#include <CL/opencl.h>
-
-#include "DLL_API.h"
-#include <stdio.h>
-#include <string>
-#include <windows.h>
-#if USE_KINECT
-#include <nuiapi.h>
-#endif // USE_KINECT
-
-const int gTextureWidth  = 512;
-const int gTextureHeight = 512;
-const int gTextureDepth  = 3;
-const int gColorDepth    = 4;
-
-enum KernelSourceType
-{
-   kst_file,
-   kst_string
-};
-
-enum PrimitiveType 
-{
-   ptSphere = 0,
-   ptTriangle,
-   ptCheckboard,
-   ptCamera,
-   ptXYPlane,
-   ptYZPlane,
-   ptXZPlane,
-   ptCylinder
-};
-
-const int NO_MATERIAL = -1;
-
-const int gKinectColorVideo = 4;
-const int gVideoWidth       = 640;
-const int gVideoHeight      = 480;
-const int gKinectColorDepth = 2;
-const int gDepthWidth       = 320;
-const int gDepthHeight      = 240;
-
-struct Material
-{
-   cl_float4 color;
-   cl_float  refraction;
-   cl_int    textured;
-   cl_float  transparency;
-   cl_int    textureId;
-   cl_float4 specular;
-};
-
-struct Primitive
-{
-   cl_float4 center;
-   //cl_float4 rotation;
-   cl_float4 size;
-   cl_int    type;
-   cl_int    materialId;
-   cl_float  materialRatioX;
-   cl_float  materialRatioY;
-};
-
-struct Lamp
-{
-   cl_float4 center;
-   cl_float4 color;
-};
-
-class OPENCLRAYTRACERMODULE_API OpenCLKernel
-{
-public:
-   OpenCLKernel( int platformId, int device, int nbWorkingItems, int draft );
-   ~OpenCLKernel();
-
-public:
-   // ---------- Devices ----------
-   void initializeDevice(
-      int        width, 
-      int        height, 
-      int        nbPrimitives,
-      int        nbLamps,
-      int        nbMaterials,
-      int        nbTextures,
-      BYTE*      bitmap);
-   void releaseDevice();
-
-   void compileKernels(
-      const KernelSourceType sourceType,
-      const std::string& source, 
-      const std::string& ptxFileName,
-      const std::string& options);
-
-public:
-   // ---------- Rendering ----------
-   void render(
-      int   imageW, 
-      int   imageH, 
-      BYTE* bitmap,
-      float time,
-      float transparentColor );
-
-public:
-
-   // ---------- Primitives ----------
-   long addPrimitive( int type );
-   void setPrimitive( 
-      int   index, 
-      float x, 
-      float y, 
-      float z, 
-      float width, 
-      float height, 
-      int   martialId, 
-      int   materialPadding );
-   void rotatePrimitive( 
-      int   index, 
-      float x, 
-      float y, 
-      float z );
-   void setPrimitiveMaterial( 
-      int   index, 
-      int   materialId ); 
-
-public:
-
-   // ---------- Complex objects ----------
-   long addCube( 
-      float x, 
-      float y, 
-      float z, 
-      float radius, 
-      int   martialId, 
-      int   materialPadding );
-
-public:
-
-   // ---------- Lamps ----------
-   long addLamp();
-   void setLamp( 
-      int index,
-      float x, float y, float z, 
-      float intensity, 
-      float r, float g, float b );
-
-public:
-
-   // ---------- Materials ----------
-   long addMaterial();
-   void setMaterial( 
-      int   index,
-      float r, float g, float b, 
-      float reflection, 
-      float refraction,
-      int   textured,
-      float transparency,
-      int   textureId,
-      float specValue, float specPower, float specCoef,
-      float innerIllumination );
-
-public:
-
-   // ---------- Camera ----------
-   void setCamera( 
-      cl_float4 eye, cl_float4 dir, cl_float4 angles );
-
-public:
-
-   // ---------- Textures ----------
-   void setTexture(
-      int   index,
-      BYTE* texture );
-
-   long addTexture( 
-      const std::string& filename );
-
-#ifdef USE_KINECT
-public:
-
-   // ---------- Kinect ----------
-
-   long updateSkeletons( 
-      double center_x, double  center_y, double  center_z, 
-      double size,
-      double radius,       int materialId,
-      double head_radius,  int head_materialId,
-      double hands_radius, int hands_materialId,
-      double feet_radius,  int feet_materialId);
-#endif // USE_KINECT
-
-public:
-
-   cl_int getNbActivePrimitives() { return m_nbActivePrimitives; };
-   cl_int getNbActiveLamps()      { return m_nbActiveLamps; };
-   cl_int getNbActiveMaterials()  { return m_nbActiveMaterials; };
-
-public:
-
-   int              getCLPlatformId() { return m_hPlatformId; };
-   cl_context       getCLContext()    { return m_hContext; };
-   cl_command_queue getCLQueue()      { return m_hQueue; };
-
-private:
-
-   char* loadFromFile( const std::string&, size_t&);
-
-private:
-   // OpenCL Objects
-   cl_device_id     m_hDevices[100];
-   int              m_hPlatformId;
-   cl_context       m_hContext;
-   cl_command_queue m_hQueue;
-   cl_kernel        m_hKernel;
-   cl_kernel        m_hKernelPostProcessing;
-   cl_uint          m_computeUnits;
-   cl_uint          m_preferredWorkGroupSize;
-
-private:
-   // Host
-   cl_mem m_hBitmap;
-   cl_mem m_hPrimitives;
-   cl_mem m_hLamps;
-   cl_mem m_hMaterials;
-   cl_mem m_hVideo;
-   cl_mem m_hDepth;
-   cl_mem m_hTextures;
-   cl_mem m_hRays;
-
-   // Kinect declarations
-#ifdef USE_KINECT
-private:
-   HANDLE             m_skeletons;
-   HANDLE             m_hNextDepthFrameEvent; 
-   HANDLE             m_hNextVideoFrameEvent;
-   HANDLE             m_hNextSkeletonEvent;
-   HANDLE             m_pVideoStreamHandle;
-   HANDLE             m_pDepthStreamHandle;
-   NUI_SKELETON_FRAME m_skeletonFrame;
-
-   long               m_skeletonsBody;
-   long               m_skeletonsLamp;
-
-#endif // USE_KINECT
-
-private:
-   Primitive*  m_primitives;
-   Lamp*       m_lamps;
-   Material*   m_materials;
-   cl_int      m_nbActivePrimitives;
-   cl_int      m_nbActiveLamps;
-   cl_int      m_nbActiveMaterials;
-   cl_int      m_nbActiveTextures;
-   cl_float4   m_viewPos;
-   cl_float4   m_viewDir;
-   cl_float4   m_angles;
-   BYTE*       m_textures;
-   bool        m_texturedTransfered;
-
-private:
-   cl_int      m_initialDraft;
-   cl_int      m_draft;
-};
+/* 
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include <CL/opencl.h>
+
+#include "DLL_API.h"
+#include "BoundingVolumeHierarchy.h"
+#include "SceneRenderer.h"
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <windows.h>
+#if USE_KINECT
+#include <nuiapi.h>
+#endif // USE_KINECT
+
+const int gPersistentGroupSize     = 64; // Pixels fetched at once by a persistent work-group
+const int gPersistentGroupsPerUnit = 4;  // Resident work-groups per compute unit, hides memory latency
+
+const int gMaxUploadGap = 16; // Clean elements worth uploading to merge two dirty ranges in one transfer
+
+const int gMaxFramesInFlight = 3; // Frames queued at once by the pipelined rendering
+const int gOutputAlignment   = 4096; // Alignment of host bitmaps for zero copy output buffers
+
+const int gCoarsestRefinementStep = 4; // 1 pixel out of 16 is traced right after a camera move
+const int gMaxAccumulatedSamples  = 256; // Static views stop being traced once converged
+
+const int   gMaxDenoiserRadius    = 8;     // Window of the denoiser, (2*radius+1)^2 pixels
+
+const int   gMaxReprojectedFrames = 8;     // Reprojection errors add up, the view is traced again after that
+const float gReprojectionMaxAngle = 0.05f; // Largest camera rotation (radians) reprojected
+const float gReprojectionMaxMove  = 20.f;  // Largest camera move reprojected
+
+enum KernelSourceType
+{
+   kst_file,
+   kst_string
+};
+
+enum BoundingVolumeBuilder
+{
+   bvb_host,   // Binned SAH on the host, refitted when primitives move
+   bvb_device  // Linear BVH rebuilt by the device whenever primitives change
+};
+
+enum PrimitiveStorage
+{
+   ps_hierarchy, // Primitive records walked through the bounding volume hierarchy
+   ps_typed      // Packed arrays per type of primitive, each tested by its own loop
+};
+
+enum RenderMode
+{
+   rm_standard,  // One work-item follows the whole path of its pixel
+   rm_wavefront, // Paths are processed by stages, bounce after bounce
+   rm_persistent // Work-groups filling the device pull pixels until the frame is done
+};
+
+enum RenderStatus
+{
+   rs_pending,  // Queued or running on the device
+   rs_complete, // The bitmap holds the frame
+   rs_failed
+};
+
+// Called from a thread of the OpenCL runtime once an asynchronous frame is done
+typedef void (CALLBACK *RenderCallback)( long ticket, RenderStatus status, BYTE* bitmap, void* userData );
+
+// Post-processing passes, combined as flags. Must match Kernel.cl
+enum PostProcessingPass
+{
+   pp_denoise     = 1, // Edge aware, colors and depths of the neighbours are compared
+   pp_upscale     = 2, // Interpolates the pixels traced by the coarse refinement levels
+   pp_toneMapping = 4  // Exposure and gamma
+};
+
+enum OutputMode
+{
+   om_copy,  // Frames are read back into the bitmap of the caller
+   om_mapped // Frames are mapped, host accessible memory backs the output buffers
+};
+
+// Stages of the frames timed by render
+enum FrameStage
+{
+   fs_upload,         // Scene edits, textures and Kinect frames
+   fs_build,          // Acceleration structures and instances
+   fs_render,         // Rendering kernels, reprojection included
+   fs_postProcessing,
+   fs_readBack        // Read back or mapping of the output
+};
+const int gNbFrameStages   = 5;
+const int gProfilingWindow = 32; // Frames of the rolling averages
+
+// Milliseconds spent by the device on each stage of a frame
+struct FrameTimings
+{
+   double stages[gNbFrameStages];
+};
+
+const int gKinectColorVideo = 4;
+const int gVideoWidth       = 640;
+const int gVideoHeight      = 480;
+const int gKinectColorDepth = 2;
+const int gDepthWidth       = 320;
+const int gDepthHeight      = 240;
+
+struct Instance
+{
+   cl_float4 transform;  // x,y,z: translation, w: uniform scale
+   cl_int    geometryId;
+   cl_int    materialId; // Overrides the material of the geometry unless NO_MATERIAL
+   cl_int    rootNode;   // Root of the geometry in the bottom level hierarchy
+   cl_int    reserved;
+};
+
+// State of a path in the wavefront pipeline, must match Kernel.cl
+struct Ray
+{
+   cl_float4 origin;
+   cl_float4 target;
+   cl_float4 color;
+   cl_float4 intersection;
+   cl_float4 normal;
+   cl_float4 lamps;
+   Primitive object;
+   cl_float  throughput;
+   cl_float  refraction;
+   cl_float  blinn;
+   cl_int    iteration;
+};
+
+// Primary intersection, normal and color of a pixel, must match Kernel.cl
+struct HistorySample
+{
+   cl_float4 intersection;
+   cl_float4 normal;
+   cl_float4 color;
+};
+
+// Types of the packed primitive arrays: spheres, cylinders, XY, YZ, XZ planes, 
+// checkboards and cameras. Must match Kernel.cl
+const int gNbPrimitiveRanges = 8;
+
+// Set in the material id of a packed shape whose material is transparent. Must match Kernel.cl
+const cl_int gTransparentShape = 0x40000000;
+
+// Slots of the wavefront counters: the two ray queues, then the hits
+const int gNbRayCounters = 3;
+const int gRayHitsCounter = 2;
+
+// Rendering kernels built for a given set of scene features
+struct KernelVariant
+{
+   cl_program program;
+   cl_kernel  kernel;           // render_kernel
+   cl_kernel  persistentKernel; // render_persistent_kernel
+};
+
+class OpenCLKernel;
+
+// Program built on a worker thread
+struct ProgramBuild
+{
+   OpenCLKernel* owner;
+   std::string   options;
+   std::string   features; // Variant features, empty for the generic kernels
+   cl_program    program;
+   HANDLE        thread;
+};
+
+// Renderer running Kernel.cl on an OpenCL device
+class OPENCLRAYTRACERMODULE_API OpenCLKernel : public SceneRenderer
+{
+public:
+   // Progressive refinement: after setCamera, one pixel out of coarsestStep 
+   // (a power of 2) is traced on both axes and fills the gap up to the next. 
+   // Each following frame halves the step until every pixel is traced. 
+   // 1 disables the refinement.
+   OpenCLKernel( int platformId, int device, int nbWorkingItems, int coarsestStep );
+   virtual ~OpenCLKernel();
+
+public:
+   // ---------- Devices ----------
+   virtual void initializeDevice(
+      int        width, 
+      int        height, 
+      int        nbPrimitives,
+      int        nbLamps,
+      int        nbMaterials,
+      int        nbTextures,
+      BYTE*      bitmap);
+   void releaseDevice();
+
+   void compileKernels(
+      const KernelSourceType sourceType,
+      const std::string& source, 
+      const std::string& ptxFileName,
+      const std::string& options);
+
+   // Programs built from source are saved to the directory and reloaded by 
+   // later builds of the same source, options, device and driver. The cache
+   // defaults to %LOCALAPPDATA%\OpenCLRaytracer, an empty directory disables
+   // it.
+   void setProgramCacheDirectory( const std::string& directory );
+
+   // Background compilation: programs are built on worker threads and their
+   // kernels swapped in at the next frame. Frames are cleared until the 
+   // first build completes, variants render with the generic kernels.
+   void setBackgroundCompilation( bool enabled );
+
+public:
+   // ---------- Rendering ----------
+   virtual void render(
+      int   imageW, 
+      int   imageH, 
+      BYTE* bitmap,
+      float time,
+      float transparentColor );
+
+   // Pipelined rendering: queues a frame and returns the oldest completed 
+   // one, NULL while the pipeline fills up. The returned bitmap belongs to
+   // the kernel and remains valid until the next call. Pipelined frames are
+   // not accumulated.
+   BYTE* renderPipelined(
+      int   imageW, 
+      int   imageH, 
+      float time,
+      float transparentColor );
+   void  setPipelineDepth( int depth );
+
+   // Asynchronous rendering: returns a ticket as soon as the frame is 
+   // queued. The scene can be edited while the device renders. In mapped 
+   // output mode, the frame ends in getBitmap rather than in bitmap.
+   long  renderAsync(
+      int            imageW, 
+      int            imageH, 
+      BYTE*          bitmap,
+      float          time,
+      float          transparentColor,
+      RenderCallback callback = 0,
+      void*          userData = 0 );
+   RenderStatus getRenderStatus( long ticket );
+   RenderStatus waitForRender( long ticket );
+
+   // Mapped output: the bitmap given to initializeDevice becomes the backing
+   // store of the output buffer, or pinned memory is allocated without one.
+   // getBitmap returns the last frame until the next rendering.
+   void  setOutputMode( OutputMode mode );
+   BYTE* getBitmap() { return m_mappedBitmap; };
+
+   // Profiling: device time of each stage of the last frame given to render,
+   // and its average over the last gProfilingWindow frames. Pipelined and 
+   // asynchronous frames are not timed.
+   void  getStageTimings( FrameStage stage, double& frame, double& average );
+
+   // Scene-specialized kernels: the rendering kernels are built again without 
+   // the features the scene does not use (cylinders, camera planes, textures, 
+   // transparency, bounces) whenever the scene changes. Variants are kept 
+   // until the device is released. Paths stop bouncing once their weight in 
+   // the pixel is under the contribution threshold (0 to always bounce), 
+   // accumulated frames play russian roulette instead.
+   void setKernelSpecialization( bool enabled );
+
+   // Temporal accumulation: while neither the camera nor the scene changes, 
+   // jittered frames are averaged on the device, anti-aliasing the image and
+   // softening the shadows.
+   void setAccumulation( bool enabled );
+
+   // Temporal reprojection: after a small camera move, the previous frame is
+   // warped into the new view and only the pixels it did not see are traced.
+   void setReprojection( bool enabled );
+
+   // Post-processing: the passes (PostProcessingPass flags) run on the device
+   // between the rendering and the read back, the upscaler first, then the 
+   // denoiser and the tone mapping. The raw frame is kept for the refinement
+   // and the accumulation of the next frames.
+   void setPostProcessing( int passes );
+   void setDenoiser( int radius, float colorSigma, float depthSigma );
+   void setToneMapping( float exposure, float gamma );
+
+   // Split-frame rendering: the standard kernel only traces the rows from
+   // top to bottom-1 and only those are read back in copy mode. top must be 
+   // a multiple of the coarsest refinement step, bottom 0 for the whole 
+   // frame. Wavefront and persistent modes still trace every row.
+   void setBand( int top, int bottom );
+
+   void setBoundingVolumeBuilder( BoundingVolumeBuilder builder );
+   void setRenderMode( RenderMode mode );
+   void setPrimitiveStorage( PrimitiveStorage storage );
+
+public:
+
+   // ---------- Primitives ----------
+   long addPrimitive( int type );
+   void setPrimitive( 
+      int   index, 
+      float x, 
+      float y, 
+      float z, 
+      float width, 
+      float height, 
+      int   materialId, 
+      int   materialPadding );
+   void setPrimitiveMaterial( 
+      int   index, 
+      int   materialId ); 
+
+public:
+
+   // ---------- Complex objects ----------
+   long addCube( 
+      float x, 
+      float y, 
+      float z, 
+      float radius, 
+      int   materialId, 
+      int   materialPadding );
+
+public:
+
+   // ---------- Instances ----------
+   // A geometry is a group of primitives stored once, in object space. 
+   // Instances place it in the scene with a translation and a uniform scale.
+   long addGeometry();
+   long addGeometryPrimitive( 
+      int geometry,
+      int type );
+   void setGeometryPrimitive( 
+      int   geometry,
+      int   index, 
+      float x, 
+      float y, 
+      float z, 
+      float width, 
+      float height, 
+      int   materialId, 
+      int   materialPadding );
+   long addCubeGeometry( 
+      float radius, 
+      int   materialId, 
+      int   materialPadding );
+
+   long addInstance( int geometry );
+   void setInstance( 
+      int   index,
+      float x, 
+      float y, 
+      float z, 
+      float scale, 
+      int   materialId );
+
+public:
+
+   // ---------- Materials ----------
+   void setMaterial( 
+      int   index,
+      float r, float g, float b, 
+      float reflection, 
+      float refraction,
+      int   textured,
+      float transparency,
+      int   textureId,
+      float specValue, float specPower, float specCoef,
+      float innerIllumination );
+
+public:
+
+   // ---------- Camera ----------
+   void setCamera( 
+      Float4 eye, Float4 dir, Float4 angles );
+
+#ifdef USE_KINECT
+public:
+
+   // ---------- Kinect ----------
+
+   long updateSkeletons( 
+      double center_x, double  center_y, double  center_z, 
+      double size,
+      double radius,       int materialId,
+      double head_radius,  int head_materialId,
+      double hands_radius, int hands_materialId,
+      double feet_radius,  int feet_materialId);
+#endif // USE_KINECT
+
+public:
+
+   cl_int getNbInstances() { return static_cast<cl_int>(m_instances.size()); };
+
+public:
+
+   int              getCLPlatformId() { return m_hPlatformId; };
+   cl_context       getCLContext()    { return m_hContext; };
+   cl_command_queue getCLQueue()      { return m_hQueue; };
+
+private:
+
+   char* loadFromFile( const std::string&, size_t&);
+
+   // ---------- Program binary cache ----------
+   cl_program  buildProgram( const char* source, size_t length, const std::string& options );
+   std::string programCacheKey( const char* source, size_t length, const std::string& options );
+   std::string programCacheFile( const std::string& key );
+   cl_program  loadProgramBinary( const std::string& key, const std::string& options );
+   void        saveProgramBinary( cl_program program, const std::string& key );
+   void  reserveBuffer( cl_mem& buffer, size_t size );
+
+private:
+
+   // ---------- Kernel variants ----------
+   std::string renderSettings( int iterations );
+   std::string sceneFeatures();
+   void        selectKernelVariant();
+   void        addKernelVariant( const std::string& features, cl_program program );
+   void        releaseKernelVariants();
+
+private:
+
+   // ---------- Background compilation ----------
+   void  createKernels( cl_program program );
+   void  releaseKernels();
+   void  createFallbackKernel();
+   void  startBuild( const std::string& features );
+   void  swapKernels();
+   void  waitForBuilds();
+   static DWORD WINAPI buildThread( LPVOID parameter );
+
+private:
+
+   // ---------- Acceleration structure ----------
+   void getPrimitiveBounds( const Primitive& primitive, BoundingBox& box );
+   void buildBoundingVolumes();
+   void refitBoundingVolumes();
+   void buildBoundingVolumesOnDevice();
+   void buildGeometries();
+   void getInstanceBounds( const Instance& instance, BoundingBox& box );
+   void updateInstances();
+   void buildPrimitiveArrays();
+
+private:
+
+   // ---------- Scene uploads ----------
+   void uploadDirtyRanges( 
+      cl_mem               buffer, 
+      std::vector<cl_int>& indices, 
+      size_t               elementSize, 
+      const void*          data,
+      FrameStage           stage = fs_upload );
+
+private:
+
+   // ---------- Rendering ----------
+   void   enqueueRendering(
+      cl_mem    output,
+      int       width, 
+      int       height, 
+      float     timer,
+      float     transparentColor,
+      bool      accumulate,
+      cl_event* uploaded );
+   void   flushPipeline();
+   void   enqueueReadBack( BYTE* bitmap, size_t size, cl_event* done );
+   void   releaseRenders();
+   static void CL_CALLBACK renderCompleted( cl_event event, cl_int status, void* data );
+   void   releaseFrames();
+   void   createOutputBuffer();
+   void   enqueueReprojection( cl_mem output, int width, int height );
+   void   enqueuePostProcessing( cl_mem output, int width, int height, int step );
+
+private:
+   // ---------- Profiling ----------
+   cl_event* profilingEvent( FrameStage stage );
+   void      collectTimings();
+
+private:
+
+   // ---------- Wavefront ----------
+   void   renderWavefront(
+      cl_mem output,
+      int    width, 
+      int    height, 
+      float  timer,
+      float  transparentColor );
+   void   enqueueRays( cl_kernel kernel, cl_int nbRays );
+
+private:
+   // OpenCL Objects
+   cl_device_id     m_hDevices[100];
+   int              m_hPlatformId;
+   cl_context       m_hContext;
+   cl_command_queue m_hQueue;
+   cl_command_queue m_hTransferQueue; // Read backs of the pipelined frames
+   cl_kernel        m_hKernel;
+   cl_kernel        m_hKernelPostProcessing;
+   cl_kernel        m_hKernelBVHBounds;
+   cl_kernel        m_hKernelBVHCentroids;
+   cl_kernel        m_hKernelBVHMorton;
+   cl_kernel        m_hKernelBVHHistogram;
+   cl_kernel        m_hKernelBVHScan;
+   cl_kernel        m_hKernelBVHScatter;
+   cl_kernel        m_hKernelBVHEmit;
+   cl_kernel        m_hKernelBVHRefit;
+   size_t           m_bvhSortGroupSize;
+   cl_kernel        m_hKernelWavefrontGenerate;
+   cl_kernel        m_hKernelWavefrontExtend;
+   cl_kernel        m_hKernelWavefrontShadow;
+   cl_kernel        m_hKernelWavefrontShade;
+   cl_kernel        m_hKernelWavefrontOutput;
+   cl_kernel        m_hKernelPersistent;
+   cl_kernel        m_hKernelReprojectionClear;
+   cl_kernel        m_hKernelReprojectionDepth;
+   cl_kernel        m_hKernelReprojectionColor;
+   cl_kernel        m_hKernelReprojectionHoles;
+   size_t           m_persistentGroupSize;
+   size_t           m_persistentWorkItems;
+   cl_uint          m_computeUnits;
+   cl_uint          m_preferredWorkGroupSize;
+   std::string      m_programCacheDirectory;
+
+private:
+   // Scene-specialized kernels, keyed by the -D options of their features
+   std::string                          m_kernelSource;
+   std::string                          m_kernelOptions;
+   std::string                          m_genericSettings; // Settings the generic kernels are built with
+   std::map<std::string, KernelVariant> m_kernelVariants;
+   std::string                          m_kernelVariant;  // Variant in use, empty for the generic kernels
+   bool                                 m_kernelSpecialization;
+
+private:
+   // Background compilation
+   bool                        m_backgroundCompilation;
+   std::vector<ProgramBuild*>  m_builds;
+   cl_kernel                   m_hKernelFallback;
+   cl_program                  m_hProgramFallback;
+
+private:
+   // Host
+   cl_mem m_hBitmap;
+   cl_mem m_hPrimitives;
+   cl_mem m_hLamps;
+   cl_mem m_hMaterials;
+   cl_mem m_hVideo;
+   cl_mem m_hDepth;
+   cl_mem m_hTextures;
+   cl_mem m_hRays;
+   cl_mem m_hRayQueues[2];
+   cl_mem m_hRayHits;
+   cl_mem m_hRayCounters;
+   cl_mem m_hWorkCounter;
+   cl_mem m_hAccumulation;
+   cl_mem m_hHistory[2];
+   cl_mem m_hPostProcessingFrames[2]; // Raw frame and intermediate pass
+   cl_mem m_hReprojectionDepth;
+   cl_mem m_hBoundingVolumes;
+   cl_mem m_hPrimitivesIndex;
+   cl_mem m_hBVHBoxes;
+   cl_mem m_hBVHKeys;
+   cl_mem m_hBVHValues;
+   cl_mem m_hBVHFlags;
+   cl_mem m_hBVHSceneBounds;
+   cl_mem m_hBVHHistogram;
+   cl_mem m_hInstances;
+   cl_mem m_hInstanceBoundingVolumes;
+   cl_mem m_hInstancesIndex;
+   cl_mem m_hGeometryPrimitives;
+   cl_mem m_hGeometryBoundingVolumes;
+   cl_mem m_hGeometryIndex;
+   cl_mem m_hTypedSpheres;
+   cl_mem m_hTypedShapes;
+   cl_mem m_hTypedIndex;
+   cl_mem m_hTypedRanges;
+
+   // Kinect declarations
+#ifdef USE_KINECT
+private:
+   HANDLE             m_skeletons;
+   HANDLE             m_hNextDepthFrameEvent; 
+   HANDLE             m_hNextVideoFrameEvent;
+   HANDLE             m_hNextSkeletonEvent;
+   HANDLE             m_pVideoStreamHandle;
+   HANDLE             m_pDepthStreamHandle;
+   NUI_SKELETON_FRAME m_skeletonFrame;
+
+   long               m_skeletonsBody;
+   long               m_skeletonsLamp;
+
+#endif // USE_KINECT
+
+private:
+   bool        m_texturedTransfered;
+
+private:
+   // Bounding volume hierarchy over the active primitives
+   BoundingVolumeHierarchy m_bvh;
+   cl_int                  m_nbBoundingVolumes;
+   bool                    m_bvhDirty;            // Primitives were added, the hierarchy has to be built again
+   std::vector<cl_int>     m_modifiedPrimitives;  // Primitives changed since the last rendering
+   std::vector<cl_int>     m_refittedNodes;       // Nodes whose bounds changed with the last refit
+   BoundingVolumeBuilder   m_bvhBuilder;
+
+private:
+   // Instancing: bottom level hierarchies over the geometries and a top 
+   // level one over the instances
+   std::vector< std::vector<Primitive> > m_geometries;
+   std::vector<BoundingBox>              m_geometryBounds;
+   std::vector<cl_int>                   m_geometryRoots;
+   bool                                  m_geometriesDirty;
+   std::vector<Instance>                 m_instances;
+   BoundingVolumeHierarchy               m_instancesBvh;
+   bool                                  m_instancesDirty;
+   std::vector<cl_int>                   m_modifiedInstances;
+
+private:
+   // Packed arrays per type of primitive
+   PrimitiveStorage       m_primitiveStorage;
+   std::vector<cl_float4> m_typedSpheres; // x,y,z: center, w: square of the radius
+   std::vector<cl_float4> m_typedShapes;  // center then size, size.w holding the material
+   std::vector<cl_int>    m_typedIndex;   // Primitive of each record
+   cl_int                 m_typedRanges[gNbPrimitiveRanges];
+   cl_int                 m_nbTypedPrimitives;
+
+private:
+   RenderMode  m_renderMode;
+
+private:
+   // Pipelined frames, each slot holding a frame until the caller is done with it
+   int         m_pipelineDepth;
+   int         m_nbQueuedFrames;
+   cl_mem      m_hFrames[gMaxFramesInFlight];
+   BYTE*       m_frames[gMaxFramesInFlight];
+   cl_event    m_frameRead[gMaxFramesInFlight];
+
+private:
+   // Asynchronous frames still referenced by a ticket, also released by
+   // their completion callback. The status of the frames released by a 
+   // callback is kept until it is queried.
+   long                         m_nextTicket;
+   std::map<long, cl_event>     m_pendingRenders;
+   std::map<long, RenderStatus> m_finishedRenders;
+   CRITICAL_SECTION             m_renderLock;
+   LONG                         m_pendingCallbacks;
+   HANDLE                       m_callbacksDone; // Signalled when no callback is pending
+
+private:
+   OutputMode  m_outputMode;
+   BYTE*       m_outputBitmap; // Bitmap of the caller, backing store of the mapped output
+   size_t      m_outputSize;
+   BYTE*       m_mappedBitmap; // Output buffer while mapped, NULL otherwise
+
+private:
+   // Progressive refinement
+   cl_int      m_coarsestStep;
+   cl_int      m_refinementStep; // Step of the next frame
+   cl_int      m_previousStep;   // Step of the last frame, 0 when nothing was traced
+   cl_mem      m_previousOutput; // Buffer of the last frame, refined by the next one
+
+private:
+   // Split-frame rendering
+   int         m_bandTop;
+   int         m_bandBottom; // 0 for the whole frame
+
+private:
+   // Temporal accumulation
+   bool        m_accumulation;
+   cl_int      m_nbSamples; // Frames accumulated since the view last changed
+   cl_float    m_accumulationTimer;
+   bool        m_animatedScene; // The timer changes the image
+
+private:
+   // Temporal reprojection
+   bool        m_reprojection;
+   bool        m_reprojectFrame;      // The camera has moved little since the last frame
+   bool        m_historyValid;        // Every pixel of the history has been traced or reprojected
+   int         m_historyIndex;        // History of the last frame
+   int         m_nbReprojectedFrames; // Frames reprojected in a row
+
+private:
+   // Post-processing
+   int         m_postProcessing; // PostProcessingPass flags
+   cl_float4   m_denoiser;       // Radius, color sigma, depth sigma
+   cl_float4   m_toneMapping;    // Exposure, gamma
+
+private:
+   // Profiling
+   bool                 m_profileFrame; // Commands of the frame being enqueued get an event
+   std::deque<cl_event> m_profilingEvents[gNbFrameStages];
+   FrameTimings         m_frameTimings[gProfilingWindow];
+   int                  m_nbFrameTimings;
+   int                  m_frameTimingsIndex; // Slot of the next frame
+};
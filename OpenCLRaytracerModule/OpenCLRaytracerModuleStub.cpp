@@ -1,290 +1,682 @@
-/* 
- * OpenCL Raytracer
- * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- * This library is free software; you can redistribute it and/or
- * modify it under the terms of the GNU Library General Public
- * License as published by the Free Software Foundation; either
- * version 2 of the License, or (at your option) any later version.
- *
- * This library is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- * Library General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
- */
-
-/*
- * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- */
-
-#include <windows.h>
-#include "OpenCLRaytracerModuleStub.h"
-
-#include <fstream>
-
-#include "OpenCLKernel.h"
-OpenCLKernel* oclKernel = 0;
-
-// Global variables
-int    gImageWidth     =  0;
-int    gImageHeight    =  0;
-bool   gViewHasChanged =  true;
-BYTE*  gRenderBitmap   =  0;
-double gTime           =  0.0f;
-
-// Gesture
-cl_float gAngleX = 0.f;
-cl_float gAngleY = 0.f;
-cl_float gAngleZ = 0.f;
-cl_float gDistance = 0.f;
-
-// Textures
-cl_float4  gEye;
-cl_float4  gDir;
-
-// --------------------------------------------------------------------------------
-// Forward declarations
-// --------------------------------------------------------------------------------
-extern "C" void setTextureFilterMode(
-   bool bLinearFilter);
-
-// --------------------------------------------------------------------------------
-// Implementation
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_CreateScene(
-   int     platformId,
-   int     deviceId,
-   char*   kernelCode,
-   int     width,
-   int     height,
-   int     nbPrimitives,
-   int     nbLamps,
-   int     nbMaterials,
-   int     nbTextures,
-   int     nbWorkingItems,
-   HANDLE& display,
-   HANDLE& kinect)
-{
-   gImageWidth   = width;
-   gImageHeight  = height;
-   gRenderBitmap = new BYTE[width*height*gColorDepth];
-   gTime = 0.f;
-
-   oclKernel = new OpenCLKernel( platformId, deviceId, nbWorkingItems, 1 );
-   oclKernel->compileKernels( kst_string, kernelCode, "", "" );
-   oclKernel->initializeDevice( width, height, nbPrimitives, nbLamps, nbMaterials, nbTextures, gRenderBitmap );
-
-   gViewHasChanged = true;
-
-   display  = gRenderBitmap; // Returns the rended bitmap to the caller
-   return 0;
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_DeleteScene()
-{
-   // kernel_finalizeOPENCL();
-   if( gRenderBitmap ) delete [] gRenderBitmap;
-   if( oclKernel ) delete oclKernel;
-   return 0;   
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   void RayTracer_SetCamera( 
-   double eye_x,   double eye_y,   double eye_z,
-   double dir_x,   double dir_y,   double dir_z,
-   double angle_x, double angle_y, double angle_z )
-{
-   cl_float4 eye;
-   eye.s[0] = static_cast<cl_float>(eye_x);
-   eye.s[1] = static_cast<cl_float>(eye_y);
-   eye.s[2] = static_cast<cl_float>(eye_z + gDistance);
-
-   gDir.s[0] = static_cast<cl_float>(dir_x);
-   gDir.s[1] = static_cast<cl_float>(dir_y);
-   gDir.s[2] = static_cast<cl_float>(dir_z);
-
-   cl_float4 angles;
-   angles.s[0] = static_cast<cl_float>(angle_x + gAngleX);
-   angles.s[1] = static_cast<cl_float>(angle_y + gAngleY);
-   angles.s[2] = static_cast<cl_float>(angle_z + gAngleZ);
-
-   oclKernel->setCamera( eye, gDir, angles );
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_RunKernel( double timer, double transparentColor )
-{
-   oclKernel->render( 
-      gImageWidth, gImageHeight, 
-      gRenderBitmap,
-      static_cast<cl_float>(gTime),
-      static_cast<cl_float>(transparentColor) );
-   gTime += 0.1f;
-   return 0;
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_AddPrimitive( int type )
-{
-   return oclKernel->addPrimitive( type );
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_SetPrimitive( 
-   int    index,
-   double center_x, 
-   double center_y, 
-   double center_z, 
-   double width,
-   double height,
-   int    materialId, 
-   int    materialPadding )
-{
-   oclKernel->setPrimitive( 
-      index, 
-      static_cast<cl_float>(center_x), 
-      static_cast<cl_float>(center_y), 
-      static_cast<cl_float>(center_z), 
-      static_cast<cl_float>(width), 
-      static_cast<cl_float>(height), 
-      materialId, materialPadding );
-   return 0;
-}
-
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RotatePrimitive( 
-   int    index,
-   double center_x, 
-   double center_y, 
-   double center_z)
-{
-   oclKernel->rotatePrimitive( 
-      index, 
-      static_cast<cl_float>(center_x), 
-      static_cast<cl_float>(center_y), 
-      static_cast<cl_float>(center_z));
-   return 0;
-}
-
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitiveMaterial( 
-   int    index,
-   int    materialId)
-{
-   oclKernel->setPrimitiveMaterial( 
-      index, 
-      materialId);
-   return 0;
-}
-
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_AddLamp()
-{
-   return oclKernel->addLamp();
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API 
-   long RayTracer_SetLamp( 
-   int     index,
-   double  center_x,
-   double  center_y,
-   double  center_z,
-   double  intensity,
-   double  color_r,
-   double  color_g,
-   double  color_b )
-{
-   oclKernel->setLamp(
-      index,
-      static_cast<cl_float>(center_x), static_cast<cl_float>(center_y), static_cast<cl_float>(center_z), 
-      static_cast<cl_float>(intensity), 
-      static_cast<cl_float>(color_r), static_cast<cl_float>(color_g), static_cast<cl_float>(color_b) );
-   return 0;
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_UpdateSkeletons( 
-   double center_x, double  center_y, double center_z, 
-   double size,
-   double radius,       int materialId,
-   double head_radius,  int head_materialId,
-   double hands_radius, int hands_materialId,
-   double feet_radius,  int feet_materialId)
-{
-#if USE_KINECT
-   return oclKernel->updateSkeletons(
-      center_x, center_y, center_z, 
-      size,
-      radius,       materialId,
-      head_radius,  head_materialId,
-      hands_radius, hands_materialId,
-      feet_radius,  feet_materialId);
-#else
-   return 0;
-#endif // USE_KINECT
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddTexture( char* filename )
-{
-   return oclKernel->addTexture( filename );
-}
-
-// --------------------------------------------------------------------------------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetTexture( int index, HANDLE texture )
-{
-   oclKernel->setTexture( 
-      index, 
-      static_cast<BYTE*>(texture) );
-   return 0;
-}
-
-// ---------- Materials ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddMaterial()
-{
-   return oclKernel->addMaterial();
-}
-
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetMaterial(
-   int    index,
-   double color_r, 
-   double color_g, 
-   double color_b,
-   double reflection,
-   double refraction,
-   int    textured,
-   float  transparency,
-   int    textureId,
-   double specValue, 
-   double specPower, 
-   double specCoef,
-   double innerIllumination)
-{
-   oclKernel->setMaterial( 
-      index, 
-      static_cast<cl_float>(color_r), 
-      static_cast<cl_float>(color_g), 
-      static_cast<cl_float>(color_b), 
-      static_cast<cl_float>(reflection), 
-      static_cast<cl_float>(refraction),
-      textured, 
-      static_cast<cl_float>(transparency), 
-      textureId,
-      static_cast<cl_float>(specValue),
-      static_cast<cl_float>(specPower), 
-      static_cast<cl_float>(specCoef ),
-      static_cast<cl_float>(innerIllumination));
-   return 0;
-}
+/* 
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <windows.h>
+#include "OpenCLRaytracerModuleStub.h"
+
+#include <fstream>
+#include <malloc.h>
+
+#include "OpenCLKernel.h"
+#include "CPUKernel.h"
+#include "MultiDeviceKernel.h"
+Renderer*     renderer  = 0;
+OpenCLKernel* oclKernel = 0; // The renderer when it runs on an OpenCL device, 0 otherwise
+
+// Global variables
+int    gImageWidth     =  0;
+int    gImageHeight    =  0;
+bool   gViewHasChanged =  true;
+BYTE*  gRenderBitmap   =  0;
+double gTime           =  0.0f;
+
+// Program cache given by RayTracer_SetProgramCacheDirectory, kernels keep
+// their per-user default otherwise
+bool        gProgramCacheSet = false;
+std::string gProgramCacheDirectory;
+
+// Gesture
+cl_float gAngleX = 0.f;
+cl_float gAngleY = 0.f;
+cl_float gAngleZ = 0.f;
+cl_float gDistance = 0.f;
+
+// Textures
+Float4     gEye;
+Float4     gDir;
+
+// --------------------------------------------------------------------------------
+// Forward declarations
+// --------------------------------------------------------------------------------
+extern "C" void setTextureFilterMode(
+   bool bLinearFilter);
+
+// --------------------------------------------------------------------------------
+// Kernels of the device settings that split frames support: the OpenCL 
+// renderer, or every device of a split frame
+// --------------------------------------------------------------------------------
+std::vector<OpenCLKernel*> deviceKernels()
+{
+   std::vector<OpenCLKernel*> kernels;
+   MultiDeviceKernel* multiKernel = dynamic_cast<MultiDeviceKernel*>(renderer);
+   if( multiKernel )
+   {
+      for( int i(0); i<multiKernel->getNbDevices(); ++i ) kernels.push_back( multiKernel->getDevice(i) );
+   }
+   else if( oclKernel )
+   {
+      kernels.push_back( oclKernel );
+   }
+   return kernels;
+}
+
+// --------------------------------------------------------------------------------
+// Implementation
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_CreateScene(
+   int     platformId,
+   int     deviceId,
+   char*   kernelCode,
+   int     width,
+   int     height,
+   int     nbPrimitives,
+   int     nbLamps,
+   int     nbMaterials,
+   int     nbTextures,
+   int     nbWorkingItems,
+   HANDLE& display,
+   HANDLE& kinect)
+{
+   // OpenCL.dll is delay-loaded, only the OpenCL renderers need it
+   if( platformId != gNativePlatform )
+   {
+      HMODULE openCL = LoadLibraryA( "OpenCL.dll" );
+      if( !openCL ) return -1;
+      FreeLibrary( openCL );
+   }
+
+   gImageWidth   = width;
+   gImageHeight  = height;
+   // Page aligned so that mapped output buffers can use it in place
+   gRenderBitmap = static_cast<BYTE*>(_aligned_malloc( width*height*gColorDepth, gOutputAlignment ));
+   gTime = 0.f;
+
+   if( platformId == gNativePlatform )
+   {
+      // Traced by the host, nbWorkingItems threads
+      renderer  = new CPUKernel( nbWorkingItems );
+      oclKernel = 0;
+   }
+   else if( deviceId == gAllDevices )
+   {
+      // Split frame, every device of the platform traces a band
+      MultiDeviceKernel* multiKernel = new MultiDeviceKernel( platformId, nbWorkingItems, gCoarsestRefinementStep );
+      if( multiKernel->getNbDevices() == 0 )
+      {
+         delete multiKernel;
+         _aligned_free( gRenderBitmap );
+         gRenderBitmap = 0;
+         renderer      = 0;
+         oclKernel     = 0;
+         return -1;
+      }
+      for( int i(0); gProgramCacheSet && i<multiKernel->getNbDevices(); ++i ) 
+      {
+         multiKernel->getDevice(i)->setProgramCacheDirectory( gProgramCacheDirectory );
+      }
+      multiKernel->setBackgroundCompilation( true );
+      multiKernel->compileKernels( kst_string, kernelCode, "", "" );
+      renderer  = multiKernel;
+      oclKernel = 0;
+   }
+   else
+   {
+      // Kernels are built in the background, first frames come out cleared
+      oclKernel = new OpenCLKernel( platformId, deviceId, nbWorkingItems, gCoarsestRefinementStep );
+      if( gProgramCacheSet ) oclKernel->setProgramCacheDirectory( gProgramCacheDirectory );
+      oclKernel->setBackgroundCompilation( true );
+      oclKernel->compileKernels( kst_string, kernelCode, "", "" );
+      renderer = oclKernel;
+   }
+   renderer->initializeDevice( width, height, nbPrimitives, nbLamps, nbMaterials, nbTextures, gRenderBitmap );
+
+   gViewHasChanged = true;
+
+   display  = gRenderBitmap; // Returns the rended bitmap to the caller
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_DeleteScene()
+{
+   // kernel_finalizeOPENCL();
+   // The bitmap may back the output buffer, the kernel goes first
+   if( renderer ) delete renderer;
+   renderer  = 0;
+   oclKernel = 0;
+   if( gRenderBitmap ) _aligned_free( gRenderBitmap );
+   return 0;   
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   void RayTracer_SetCamera( 
+   double eye_x,   double eye_y,   double eye_z,
+   double dir_x,   double dir_y,   double dir_z,
+   double angle_x, double angle_y, double angle_z )
+{
+   Float4 eye;
+   eye.s[0] = static_cast<float>(eye_x);
+   eye.s[1] = static_cast<float>(eye_y);
+   eye.s[2] = static_cast<float>(eye_z + gDistance);
+
+   gDir.s[0] = static_cast<float>(dir_x);
+   gDir.s[1] = static_cast<float>(dir_y);
+   gDir.s[2] = static_cast<float>(dir_z);
+
+   Float4 angles;
+   angles.s[0] = static_cast<float>(angle_x + gAngleX);
+   angles.s[1] = static_cast<float>(angle_y + gAngleY);
+   angles.s[2] = static_cast<float>(angle_z + gAngleZ);
+
+   renderer->setCamera( eye, gDir, angles );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_RunKernel( double timer, double transparentColor )
+{
+   renderer->render( 
+      gImageWidth, gImageHeight, 
+      gRenderBitmap,
+      static_cast<cl_float>(gTime),
+      static_cast<cl_float>(transparentColor) );
+   gTime += 0.1f;
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_RunKernelPipelined( double timer, double transparentColor, HANDLE& frame )
+{
+   // The frame returned is one or more frames late, NULL until the pipeline is full
+   frame = NULL;
+   if( oclKernel == NULL ) return -1;
+   frame = oclKernel->renderPipelined( 
+      gImageWidth, gImageHeight, 
+      static_cast<cl_float>(gTime),
+      static_cast<cl_float>(transparentColor) );
+   gTime += 0.1f;
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_RunKernelAsync( double timer, double transparentColor, RenderCallback callback, void* userData )
+{
+   // Returns the ticket of the frame, the display bitmap is updated once it completes
+   if( oclKernel == NULL ) return -1;
+   long ticket = oclKernel->renderAsync( 
+      gImageWidth, gImageHeight, 
+      gRenderBitmap,
+      static_cast<cl_float>(gTime),
+      static_cast<cl_float>(transparentColor),
+      callback, userData );
+   gTime += 0.1f;
+   return ticket;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_GetRenderStatus( long ticket )
+{
+   if( oclKernel == NULL ) return -1;
+   return oclKernel->getRenderStatus( ticket );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_WaitForRender( long ticket )
+{
+   if( oclKernel == NULL ) return -1;
+   return oclKernel->waitForRender( ticket );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetPipelineDepth( int depth )
+{
+   if( oclKernel == NULL ) return -1;
+   oclKernel->setPipelineDepth( depth );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetOutputMode( int mode )
+{
+   // In mapped mode the display handle is the output buffer itself, frames 
+   // are no longer copied into it
+   if( oclKernel == NULL ) return -1;
+   oclKernel->setOutputMode( static_cast<OutputMode>(mode) );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetBoundingVolumeBuilder( int builder )
+{
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   if( kernels.empty() ) return -1;
+   for( size_t i(0); i<kernels.size(); ++i ) kernels[i]->setBoundingVolumeBuilder( static_cast<BoundingVolumeBuilder>(builder) );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetRenderMode( int mode )
+{
+   // Only the standard kernel traces a band of the frame
+   if( dynamic_cast<MultiDeviceKernel*>(renderer) && mode != rm_standard ) return -1;
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   if( kernels.empty() ) return -1;
+   for( size_t i(0); i<kernels.size(); ++i ) kernels[i]->setRenderMode( static_cast<RenderMode>(mode) );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetPrimitiveStorage( int storage )
+{
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   if( kernels.empty() ) return -1;
+   for( size_t i(0); i<kernels.size(); ++i ) kernels[i]->setPrimitiveStorage( static_cast<PrimitiveStorage>(storage) );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetAccumulation( int enabled )
+{
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   if( kernels.empty() ) return -1;
+   for( size_t i(0); i<kernels.size(); ++i ) kernels[i]->setAccumulation( enabled != 0 );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetReprojection( int enabled )
+{
+   if( oclKernel == NULL ) return -1;
+   oclKernel->setReprojection( enabled != 0 );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetPostProcessing( int passes )
+{
+   if( oclKernel == NULL ) return -1;
+   oclKernel->setPostProcessing( passes );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetDenoiser( int radius, float colorSigma, float depthSigma )
+{
+   if( oclKernel == NULL ) return -1;
+   oclKernel->setDenoiser( radius, colorSigma, depthSigma );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetToneMapping( float exposure, float gamma )
+{
+   if( oclKernel == NULL ) return -1;
+   oclKernel->setToneMapping( exposure, gamma );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetKernelSpecialization( int enabled )
+{
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   if( kernels.empty() ) return -1;
+   for( size_t i(0); i<kernels.size(); ++i ) kernels[i]->setKernelSpecialization( enabled != 0 );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetProgramCacheDirectory( char* directory )
+{
+   gProgramCacheSet       = true;
+   gProgramCacheDirectory = (directory != NULL) ? directory : "";
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   for( size_t i(0); i<kernels.size(); ++i ) kernels[i]->setProgramCacheDirectory( gProgramCacheDirectory );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetShadows( int enabled )
+{
+   renderer->setShadows( enabled != 0 );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetMaxIterations( int iterations )
+{
+   renderer->setMaxIterations( iterations );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetContributionThreshold( float threshold )
+{
+   renderer->setContributionThreshold( threshold );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetTileSize( int size )
+{
+   CPUKernel* cpuKernel = dynamic_cast<CPUKernel*>(renderer);
+   if( cpuKernel == NULL ) return -1;
+   cpuKernel->setTileSize( size );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_GetThreadStatistics( int thread, double& busy, double& idle, int& tiles, int& stolenTiles )
+{
+   // Only the native renderer has threads
+   CPUKernel* cpuKernel = dynamic_cast<CPUKernel*>(renderer);
+   if( cpuKernel == NULL || thread<0 || thread>=cpuKernel->getNbThreads() ) return -1;
+   ThreadStatistics statistics = cpuKernel->getThreadStatistics( thread );
+   busy        = statistics.busy;
+   idle        = statistics.idle;
+   tiles       = statistics.tiles;
+   stolenTiles = statistics.stolenTiles;
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_ResetThreadStatistics()
+{
+   CPUKernel* cpuKernel = dynamic_cast<CPUKernel*>(renderer);
+   if( cpuKernel == NULL ) return -1;
+   cpuKernel->resetThreadStatistics();
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_GetDeviceBand( int device, int& top, int& bottom, double& time )
+{
+   // Only split frames have bands
+   MultiDeviceKernel* multiKernel = dynamic_cast<MultiDeviceKernel*>(renderer);
+   if( multiKernel == NULL || device<0 || device>=multiKernel->getNbDevices() ) return -1;
+   DeviceBand band = multiKernel->getBand( device );
+   top    = band.top;
+   bottom = band.bottom;
+   time   = band.time;
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_GetStageTimings( int device, int stage, double& frame, double& average )
+{
+   // Devices are numbered as for the bands, 0 without split frame
+   std::vector<OpenCLKernel*> kernels = deviceKernels();
+   if( device<0 || device>=static_cast<int>(kernels.size()) || stage<0 || stage>=gNbFrameStages ) return -1;
+   kernels[device]->getStageTimings( static_cast<FrameStage>(stage), frame, average );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_AddPrimitive( int type )
+{
+   return renderer->addPrimitive( type );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetPrimitive( 
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z, 
+   double width,
+   double height,
+   int    materialId, 
+   int    materialPadding )
+{
+   renderer->setPrimitive( 
+      index, 
+      static_cast<cl_float>(center_x), 
+      static_cast<cl_float>(center_y), 
+      static_cast<cl_float>(center_z), 
+      static_cast<cl_float>(width), 
+      static_cast<cl_float>(height), 
+      materialId, materialPadding );
+   return 0;
+}
+
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RotatePrimitive( 
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z)
+{
+   renderer->rotatePrimitive( 
+      index, 
+      static_cast<cl_float>(center_x), 
+      static_cast<cl_float>(center_y), 
+      static_cast<cl_float>(center_z));
+   return 0;
+}
+
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitiveMaterial( 
+   int    index,
+   int    materialId)
+{
+   renderer->setPrimitiveMaterial( 
+      index, 
+      materialId);
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_AddGeometry()
+{
+   return renderer->addGeometry();
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_AddGeometryPrimitive( int geometry, int type )
+{
+   return renderer->addGeometryPrimitive( geometry, type );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetGeometryPrimitive( 
+   int    geometry,
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z, 
+   double width,
+   double height,
+   int    materialId, 
+   int    materialPadding )
+{
+   renderer->setGeometryPrimitive( 
+      geometry,
+      index, 
+      static_cast<cl_float>(center_x), 
+      static_cast<cl_float>(center_y), 
+      static_cast<cl_float>(center_z), 
+      static_cast<cl_float>(width), 
+      static_cast<cl_float>(height), 
+      materialId, materialPadding );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_AddInstance( int geometry )
+{
+   return renderer->addInstance( geometry );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetInstance( 
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z, 
+   double scale,
+   int    materialId )
+{
+   renderer->setInstance( 
+      index, 
+      static_cast<cl_float>(center_x), 
+      static_cast<cl_float>(center_y), 
+      static_cast<cl_float>(center_z), 
+      static_cast<cl_float>(scale), 
+      materialId );
+   return 0;
+}
+
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_AddLamp()
+{
+   return renderer->addLamp();
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API 
+   long RayTracer_SetLamp( 
+   int     index,
+   double  center_x,
+   double  center_y,
+   double  center_z,
+   double  intensity,
+   double  color_r,
+   double  color_g,
+   double  color_b )
+{
+   renderer->setLamp(
+      index,
+      static_cast<cl_float>(center_x), static_cast<cl_float>(center_y), static_cast<cl_float>(center_z), 
+      static_cast<cl_float>(intensity), 
+      static_cast<cl_float>(color_r), static_cast<cl_float>(color_g), static_cast<cl_float>(color_b) );
+   return 0;
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_UpdateSkeletons( 
+   double center_x, double  center_y, double center_z, 
+   double size,
+   double radius,       int materialId,
+   double head_radius,  int head_materialId,
+   double hands_radius, int hands_materialId,
+   double feet_radius,  int feet_materialId)
+{
+#if USE_KINECT
+   if( oclKernel == NULL ) return -1;
+   return oclKernel->updateSkeletons(
+      center_x, center_y, center_z, 
+      size,
+      radius,       materialId,
+      head_radius,  head_materialId,
+      hands_radius, hands_materialId,
+      feet_radius,  feet_materialId);
+#else
+   return 0;
+#endif // USE_KINECT
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddTexture( char* filename )
+{
+   return renderer->addTexture( filename );
+}
+
+// --------------------------------------------------------------------------------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetTexture( int index, HANDLE texture )
+{
+   renderer->setTexture( 
+      index, 
+      static_cast<BYTE*>(texture) );
+   return 0;
+}
+
+// ---------- Materials ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddMaterial()
+{
+   return renderer->addMaterial();
+}
+
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetMaterial(
+   int    index,
+   double color_r, 
+   double color_g, 
+   double color_b,
+   double reflection,
+   double refraction,
+   int    textured,
+   float  transparency,
+   int    textureId,
+   double specValue, 
+   double specPower, 
+   double specCoef,
+   double innerIllumination)
+{
+   renderer->setMaterial( 
+      index, 
+      static_cast<cl_float>(color_r), 
+      static_cast<cl_float>(color_g), 
+      static_cast<cl_float>(color_b), 
+      static_cast<cl_float>(reflection), 
+      static_cast<cl_float>(refraction),
+      textured, 
+      static_cast<cl_float>(transparency), 
+      textureId,
+      static_cast<cl_float>(specValue),
+      static_cast<cl_float>(specPower), 
+      static_cast<cl_float>(specCoef ),
+      static_cast<cl_float>(innerIllumination));
+   return 0;
+}
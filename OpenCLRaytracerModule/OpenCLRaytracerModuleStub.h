@@ -1,114 +1,187 @@
-/* 
- * OpenCL Raytracer
- * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- * This library is free software; you can redistribute it and/or
- * modify it under the terms of the GNU Library General Public
- * License as published by the Free Software Foundation; either
- * version 2 of the License, or (at your option) any later version.
- *
- * This library is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- * Library General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
- */
-
-/*
- * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
- *
- */
-
-#pragma once
-
-#include <windows.h>
-#include "OpenCLKernel.h"
-
-// ---------- Scene ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_CreateScene(
-   int     platformId,
-   int     deviceId,
-   char*   kernelCode,
-   int     width,
-   int     height,
-   int     nbPrimitives,
-   int     nbLamps,
-   int     nbMaterials,
-   int     nbTextures,
-   int     nbWorkingItems,
-   HANDLE& bitmap,
-   HANDLE& kinect);
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_DeleteScene();
-
-// ---------- Camera ----------
-extern "C" OPENCLRAYTRACERMODULE_API void RayTracer_SetCamera( 
-   double eye_x,   double eye_y,   double eye_z,
-   double dir_x,   double dir_y,   double dir_z,
-   double angle_x, double angle_y, double angle_z);
-
-// ---------- Rendering ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RunKernel( double timer, double transparentColor );
-
-// ---------- Primitives ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddPrimitive( int type );
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitive( 
-   int    index,
-   double center_x, 
-   double center_y, 
-   double center_z, 
-   double width,
-   double height,
-   int    materialId, 
-   int    materialPadding);
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RotatePrimitive( 
-   int    index,
-   double center_x, 
-   double center_y, 
-   double center_z);
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitiveMaterial( 
-   int    index,
-   int    materialId);
-
-// ---------- Lamps ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddLamp();
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetLamp( 
-   int     index,
-   double  center_x, 
-   double  center_y, 
-   double  center_z,
-   double  intensity,
-   double  color_r, 
-   double  color_g, 
-   double  color_b );
-
-// ---------- Materials ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddMaterial();
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetMaterial(
-   int    index,
-   double color_r, 
-   double color_g, 
-   double color_b,
-   double reflection,
-   double refraction,
-   int    textured,
-   float  transparency,
-   int    textureId,
-   double specValue, 
-   double specPower, 
-   double specCoef,
-   double innerIllumination);
-
-// ---------- Textures ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddTexture( char* filename );
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetTexture( int index, HANDLE texture );
-
-// ---------- Kinect ----------
-extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_UpdateSkeletons(
-   double center_x, double  center_y, double  center_z, 
-   double size,
-   double radius,       int materialId,
-   double head_radius,  int head_materialId,
-   double hands_radius, int hands_materialId,
-   double feet_radius,  int feet_materialId);
+/* 
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include <windows.h>
+#include "OpenCLKernel.h"
+
+// ---------- Scene ----------
+// platformId gNativePlatform (-1) renders on the host with nbWorkingItems 
+// threads, 0 for one per processor, and does not need OpenCL.dll. Other 
+// platforms fail when OpenCL.dll cannot be loaded.
+// deviceId gAllDevices (-1) splits the frame between every device of the
+// platform, and fails when the platform has no device
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_CreateScene(
+   int     platformId,
+   int     deviceId,
+   char*   kernelCode,
+   int     width,
+   int     height,
+   int     nbPrimitives,
+   int     nbLamps,
+   int     nbMaterials,
+   int     nbTextures,
+   int     nbWorkingItems,
+   HANDLE& bitmap,
+   HANDLE& kinect);
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_DeleteScene();
+
+// ---------- Camera ----------
+extern "C" OPENCLRAYTRACERMODULE_API void RayTracer_SetCamera( 
+   double eye_x,   double eye_y,   double eye_z,
+   double dir_x,   double dir_y,   double dir_z,
+   double angle_x, double angle_y, double angle_z);
+
+// ---------- Rendering ----------
+// Pipelined and asynchronous rendering, as well as the settings below down 
+// to SetKernelSpecialization, need an OpenCL device. They return -1 when 
+// the scene is rendered by another engine. Split frames only take the
+// bounding volume builder, render mode, primitive storage, accumulation 
+// and kernel specialization.
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RunKernel( double timer, double transparentColor );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RunKernelPipelined( double timer, double transparentColor, HANDLE& frame );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RunKernelAsync( double timer, double transparentColor, RenderCallback callback, void* userData );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_GetRenderStatus( long ticket );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_WaitForRender( long ticket );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPipelineDepth( int depth );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetOutputMode( int mode );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetBoundingVolumeBuilder( int builder );
+// Split frames only support the standard mode
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetRenderMode( int mode );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitiveStorage( int storage );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetAccumulation( int enabled );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetReprojection( int enabled );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPostProcessing( int passes );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetDenoiser( int radius, float colorSigma, float depthSigma );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetToneMapping( float exposure, float gamma );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetKernelSpecialization( int enabled );
+// Directory of the compiled programs, %LOCALAPPDATA%\OpenCLRaytracer by 
+// default and disabled when empty or NULL. Also applies to the scenes
+// created afterwards, call it before RayTracer_CreateScene to cover the
+// first build.
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetProgramCacheDirectory( char* directory );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetShadows( int enabled );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetMaxIterations( int iterations );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetContributionThreshold( float threshold );
+
+// ---------- Native renderer threads ----------
+// Return -1 when the scene is not rendered by the native renderer
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetTileSize( int size );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_GetThreadStatistics( int thread, double& busy, double& idle, int& tiles, int& stolenTiles );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_ResetThreadStatistics();
+
+// ---------- Split frame ----------
+// Rows top to bottom-1 of the frame, traced by the device in time seconds.
+// Returns -1 when the frame is not split.
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_GetDeviceBand( int device, int& top, int& bottom, double& time );
+
+// ---------- Profiling ----------
+// Milliseconds spent by the device on a stage (FrameStage) of the last frame
+// of RayTracer_RunKernel, and its rolling average. Returns -1 without an
+// OpenCL device.
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_GetStageTimings( int device, int stage, double& frame, double& average );
+
+// ---------- Primitives ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddPrimitive( int type );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitive( 
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z, 
+   double width,
+   double height,
+   int    materialId, 
+   int    materialPadding);
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_RotatePrimitive( 
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z);
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetPrimitiveMaterial( 
+   int    index,
+   int    materialId);
+
+// ---------- Instances ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddGeometry();
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddGeometryPrimitive( int geometry, int type );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetGeometryPrimitive( 
+   int    geometry,
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z, 
+   double width,
+   double height,
+   int    materialId, 
+   int    materialPadding);
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddInstance( int geometry );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetInstance( 
+   int    index,
+   double center_x, 
+   double center_y, 
+   double center_z, 
+   double scale,
+   int    materialId);
+
+// ---------- Lamps ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddLamp();
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetLamp( 
+   int     index,
+   double  center_x, 
+   double  center_y, 
+   double  center_z,
+   double  intensity,
+   double  color_r, 
+   double  color_g, 
+   double  color_b );
+
+// ---------- Materials ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddMaterial();
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetMaterial(
+   int    index,
+   double color_r, 
+   double color_g, 
+   double color_b,
+   double reflection,
+   double refraction,
+   int    textured,
+   float  transparency,
+   int    textureId,
+   double specValue, 
+   double specPower, 
+   double specCoef,
+   double innerIllumination);
+
+// ---------- Textures ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_AddTexture( char* filename );
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_SetTexture( int index, HANDLE texture );
+
+// ---------- Kinect ----------
+extern "C" OPENCLRAYTRACERMODULE_API long RayTracer_UpdateSkeletons(
+   double center_x, double  center_y, double  center_z, 
+   double size,
+   double radius,       int materialId,
+   double head_radius,  int head_materialId,
+   double hands_radius, int hands_materialId,
+   double feet_radius,  int feet_materialId);
@@ -0,0 +1,152 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include "DLL_API.h"
+#include <string>
+#include <windows.h>
+
+// Vector of the interface, laid out like cl_float4 without depending on the
+// OpenCL headers
+struct Float4
+{
+   float s[4];
+};
+
+/*
+* Rendering engine behind the RayTracer_* functions: the scene edits, the
+* camera and the rendering every engine supports. Settings of a given
+* engine are reached through its own class.
+*/
+class OPENCLRAYTRACERMODULE_API Renderer
+{
+public:
+   virtual ~Renderer() {};
+
+public:
+   // ---------- Devices ----------
+   virtual void initializeDevice(
+      int        width,
+      int        height,
+      int        nbPrimitives,
+      int        nbLamps,
+      int        nbMaterials,
+      int        nbTextures,
+      BYTE*      bitmap) = 0;
+
+public:
+   // ---------- Rendering ----------
+   virtual void render(
+      int   imageW,
+      int   imageH,
+      BYTE* bitmap,
+      float time,
+      float transparentColor ) = 0;
+
+   virtual void setShadows( bool enabled ) = 0;
+   virtual void setMaxIterations( int iterations ) = 0;
+   virtual void setContributionThreshold( float threshold ) = 0;
+
+public:
+   // ---------- Primitives ----------
+   virtual long addPrimitive( int type ) = 0;
+   virtual void setPrimitive(
+      int   index,
+      float x,
+      float y,
+      float z,
+      float width,
+      float height,
+      int   materialId,
+      int   materialPadding ) = 0;
+   virtual void rotatePrimitive(
+      int   index,
+      float x,
+      float y,
+      float z ) = 0;
+   virtual void setPrimitiveMaterial(
+      int   index,
+      int   materialId ) = 0;
+
+public:
+   // ---------- Instances ----------
+   virtual long addGeometry() = 0;
+   virtual long addGeometryPrimitive(
+      int geometry,
+      int type ) = 0;
+   virtual void setGeometryPrimitive(
+      int   geometry,
+      int   index,
+      float x,
+      float y,
+      float z,
+      float width,
+      float height,
+      int   materialId,
+      int   materialPadding ) = 0;
+   virtual long addInstance( int geometry ) = 0;
+   virtual void setInstance(
+      int   index,
+      float x,
+      float y,
+      float z,
+      float scale,
+      int   materialId ) = 0;
+
+public:
+   // ---------- Lamps ----------
+   virtual long addLamp() = 0;
+   virtual void setLamp(
+      int index,
+      float x, float y, float z,
+      float intensity,
+      float r, float g, float b ) = 0;
+
+public:
+   // ---------- Materials ----------
+   virtual long addMaterial() = 0;
+   virtual void setMaterial(
+      int   index,
+      float r, float g, float b,
+      float reflection,
+      float refraction,
+      int   textured,
+      float transparency,
+      int   textureId,
+      float specValue, float specPower, float specCoef,
+      float innerIllumination ) = 0;
+
+public:
+   // ---------- Camera ----------
+   virtual void setCamera(
+      Float4 eye, Float4 dir, Float4 angles ) = 0;
+
+public:
+   // ---------- Textures ----------
+   virtual void setTexture(
+      int   index,
+      BYTE* texture ) = 0;
+   virtual long addTexture(
+      const std::string& filename ) = 0;
+};
@@ -0,0 +1,446 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "SceneRenderer.h"
+
+/*
+* floatToHalf
+* IEEE 754 half precision, rounded to nearest. Values out of range become
+* infinities, values below the smallest denormal are flushed to zero.
+*/
+cl_ushort floatToHalf( float value )
+{
+   cl_uint bits;
+   memcpy( &bits, &value, sizeof(cl_uint) );
+   cl_ushort sign     = static_cast<cl_ushort>((bits>>16) & 0x8000);
+   cl_uint   mantissa = bits & 0x007fffff;
+   int       exponent = static_cast<int>((bits>>23) & 0xff);
+
+   if( exponent == 0xff ) return sign | 0x7c00 | (mantissa ? 0x0200 : 0); // Infinity, NaN
+
+   exponent = exponent - 127 + 15;
+   if( exponent >= 31 ) return sign | 0x7c00;
+   if( exponent <= 0 )
+   {
+      if( exponent < -10 ) return sign;
+      mantissa |= 0x00800000;
+      int shift = 14 - exponent;
+      cl_uint result = (mantissa >> shift) + ((mantissa >> (shift-1)) & 1);
+      return sign | static_cast<cl_ushort>(result);
+   }
+   // A carry out of the mantissa correctly bumps the exponent
+   cl_uint result = (static_cast<cl_uint>(exponent)<<10 | (mantissa>>13)) + ((mantissa>>12) & 1);
+   return sign | static_cast<cl_ushort>(result);
+}
+
+/*
+* SceneRenderer constructor
+*/
+SceneRenderer::SceneRenderer()
+ : m_featuresDirty(true), m_shadows(false), m_maxIterations(gNbIterations),
+   m_contributionThreshold(gContributionThreshold),
+   m_primitives(0), m_lamps(0), m_materials(0), m_primitiveRecords(0), m_materialRecords(0),
+   m_nbActivePrimitives(0), m_nbActiveLamps(0), m_nbActiveMaterials(0), m_nbActiveTextures(0),
+   m_textures(0)
+{
+   // Eye position
+   m_viewPos.s[0] =   0.0f;
+   m_viewPos.s[1] =   0.0f;
+   m_viewPos.s[2] = -40.0f;
+   m_viewPos.s[3] =   0.0f;
+
+   // View direction
+   m_viewDir.s[0] = 0.0f;
+   m_viewDir.s[1] = 0.0f;
+   m_viewDir.s[2] = 0.0f;
+   m_viewDir.s[3] = 0.0f;
+
+   // Rotation angles
+   m_angles.s[0] = 0.0f;
+   m_angles.s[1] = 0.0f;
+   m_angles.s[2] = 0.0f;
+   m_angles.s[3] = 0.0f;
+}
+
+SceneRenderer::~SceneRenderer()
+{
+   releaseScene();
+}
+
+void SceneRenderer::allocateScene(
+   int nbPrimitives,
+   int nbLamps,
+   int nbMaterials,
+   int nbTextures )
+{
+   // Setup World
+   m_primitives = new Primitive[nbPrimitives];
+   memset( m_primitives, 0, nbPrimitives*sizeof(Primitive) );
+   m_lamps      = new Lamp[nbLamps];
+   memset( m_lamps, 0, nbLamps*sizeof(Lamp) );
+   m_materials  = new Material[nbMaterials];
+   memset( m_materials, 0, nbMaterials*sizeof(Material) );
+   m_primitiveRecords = new PrimitiveRecord[nbPrimitives];
+   memset( m_primitiveRecords, 0, nbPrimitives*sizeof(PrimitiveRecord) );
+   m_materialRecords  = new MaterialRecord[nbMaterials];
+   memset( m_materialRecords, 0, nbMaterials*sizeof(MaterialRecord) );
+   m_textures   = new BYTE[gTextureWidth*gTextureHeight*gColorDepth*nbTextures];
+}
+
+void SceneRenderer::releaseScene()
+{
+   delete [] m_primitives;
+   delete [] m_lamps;
+   delete [] m_materials;
+   delete [] m_primitiveRecords;
+   delete [] m_materialRecords;
+   delete [] m_textures;
+
+   m_primitives=0;
+   m_lamps=0;
+   m_materials=0;
+   m_primitiveRecords=0;
+   m_materialRecords=0;
+   m_textures=0;
+   m_nbActivePrimitives=0;
+   m_nbActiveLamps=0;
+   m_nbActiveMaterials=0;
+   m_nbActiveTextures=0;
+   m_dirtyPrimitives.clear();
+   m_dirtyLamps.clear();
+   m_dirtyMaterials.clear();
+}
+
+// ---------- Rendering ----------
+void SceneRenderer::setShadows( bool enabled )
+{
+   m_shadows = enabled;
+   m_featuresDirty = true;
+}
+
+void SceneRenderer::setMaxIterations( int iterations )
+{
+   // Kernels are built for the maximum number of bounces at most
+   m_maxIterations = (iterations<1) ? 1 : (iterations>gNbIterations) ? gNbIterations : iterations;
+   m_featuresDirty = true;
+}
+
+void SceneRenderer::setContributionThreshold( float threshold )
+{
+   m_contributionThreshold = (threshold<0.f) ? 0.f : (threshold>1.f) ? 1.f : threshold;
+   m_featuresDirty = true;
+}
+
+// ---------- Camera ----------
+void SceneRenderer::setCamera(
+   Float4 eye, Float4 dir, Float4 angles )
+{
+   for( int i(0); i<4; ++i )
+   {
+      m_viewPos.s[i] = eye.s[i];
+      m_viewDir.s[i] = dir.s[i];
+   }
+   m_angles.s[0]  += angles.s[0];
+   m_angles.s[1]  += angles.s[1];
+   m_angles.s[2]  += angles.s[2];
+}
+
+// ---------- Primitives ----------
+long SceneRenderer::addPrimitive( int type )
+{
+   long result = m_nbActivePrimitives;
+   m_primitives[m_nbActivePrimitives].type = type;
+   m_primitives[m_nbActivePrimitives].materialId = NO_MATERIAL;
+   packPrimitive( m_primitives[m_nbActivePrimitives], m_primitiveRecords[m_nbActivePrimitives] );
+   m_dirtyPrimitives.push_back(m_nbActivePrimitives);
+   m_nbActivePrimitives++;
+   m_featuresDirty = true;
+   return result;
+}
+
+void SceneRenderer::setPrimitive(
+   int index,
+   float x,
+   float y,
+   float z,
+   float width,
+   float height,
+   int   materialId,
+   int   materialPadding )
+{
+   if( index>= 0 && index < m_nbActivePrimitives)
+   {
+      fillPrimitive( m_primitives[index], x, y, z, width, height, materialId, materialPadding );
+      packPrimitive( m_primitives[index], m_primitiveRecords[index] );
+      m_dirtyPrimitives.push_back(index);
+   }
+}
+
+void SceneRenderer::fillPrimitive(
+   Primitive& primitive,
+   float      x,
+   float      y,
+   float      z,
+   float      width,
+   float      height,
+   int        materialId,
+   int        materialPadding )
+{
+   primitive.center.s[0]   = x;
+   primitive.center.s[1]   = y;
+   primitive.center.s[2]   = z;
+   primitive.center.s[3]   = width; // Deprecated
+   /*
+   primitive.rotation.s[0] = 0.f;
+   primitive.rotation.s[1] = 0.f;
+   primitive.rotation.s[2] = 0.f;
+   primitive.rotation.s[3] = 0.f; // Not used
+   */
+   primitive.size.s[0] = width;
+   primitive.size.s[1] = height;
+   primitive.size.s[2] = 0.f;
+   primitive.size.s[3] = 0.f; // Not used
+   primitive.materialId    = materialId;
+   primitive.materialRatioX = (gTextureWidth/width/2)*materialPadding;
+   primitive.materialRatioY = (gTextureHeight/height/2)*materialPadding;
+}
+
+void SceneRenderer::rotatePrimitive(
+   int   index,
+   float x,
+   float y,
+   float z )
+{
+   /*
+   if( index>= 0 && index < m_nbActivePrimitives)
+   {
+      m_primitives[index].rotation.s[0]   = x;
+      m_primitives[index].rotation.s[1]   = y;
+      m_primitives[index].rotation.s[2]   = z;
+      m_primitives[index].rotation.s[3]   = 0.f; // Not used
+   }
+   */
+}
+
+void SceneRenderer::setPrimitiveMaterial(
+   int   index,
+   int   materialId )
+{
+   if( index>= 0 && index < m_nbActivePrimitives) {
+      m_primitives[index].materialId = materialId;
+      m_primitiveRecords[index].materialId = static_cast<cl_short>(materialId);
+      m_dirtyPrimitives.push_back(index);
+   }
+}
+
+// ---------- Lamps ----------
+long SceneRenderer::addLamp()
+{
+   long result = m_nbActiveLamps;
+   m_dirtyLamps.push_back(m_nbActiveLamps);
+   m_nbActiveLamps++;
+   return result;
+}
+
+void SceneRenderer::setLamp(
+   int index,
+   float x, float y, float z,
+   float intensity,
+   float r, float g, float b )
+{
+   if( index>= 0 && index < m_nbActiveLamps ) {
+      m_lamps[index].center.s[0]   = x;
+      m_lamps[index].center.s[1]   = y;
+      m_lamps[index].center.s[2]   = z;
+      m_lamps[index].center.s[3]   = 0.5f; // radius
+      m_lamps[index].color.s[0]    = r;
+      m_lamps[index].color.s[1]    = g;
+      m_lamps[index].color.s[2]    = b;
+      m_lamps[index].color.s[3]    = intensity;
+      m_dirtyLamps.push_back(index);
+   }
+}
+
+// ---------- Materials ----------
+long SceneRenderer::addMaterial()
+{
+   long result = m_nbActiveMaterials;
+   m_materials[m_nbActiveMaterials].textureId = NO_MATERIAL;
+   packMaterial( m_materials[m_nbActiveMaterials], m_materialRecords[m_nbActiveMaterials] );
+   m_dirtyMaterials.push_back(m_nbActiveMaterials);
+   m_nbActiveMaterials++;
+   m_featuresDirty = true;
+   return result;
+}
+
+void SceneRenderer::setMaterial(
+   int   index,
+   float r, float g, float b,
+   float reflection,
+   float refraction,
+   int   textured,
+   float transparency,
+   int   textureId,
+   float specValue, float specPower, float specCoef, float innerIllumination )
+{
+   if( index>= 0 && index < m_nbActiveMaterials ) {
+      m_materials[index].color.s[0]  = r;
+      m_materials[index].color.s[1]  = g;
+      m_materials[index].color.s[2]  = b;
+      m_materials[index].color.s[3]  = reflection;
+      m_materials[index].refraction  = refraction;
+      m_materials[index].textured    = textured;
+      m_materials[index].textureId   = textureId;
+      m_materials[index].transparency= transparency;
+      m_materials[index].specular.s[0]  = specValue;
+      m_materials[index].specular.s[1]  = specPower;
+      m_materials[index].specular.s[2]  = innerIllumination;
+      m_materials[index].specular.s[3]  = specCoef;
+      packMaterial( m_materials[index], m_materialRecords[index] );
+      m_dirtyMaterials.push_back(index);
+      m_featuresDirty = true;
+   }
+}
+
+// ---------- Compact records ----------
+void SceneRenderer::packPrimitive(
+   const Primitive& primitive,
+   PrimitiveRecord& record )
+{
+   record.x          = primitive.center.s[0];
+   record.y          = primitive.center.s[1];
+   record.z          = primitive.center.s[2];
+   record.width      = primitive.size.s[0];
+   record.height     = primitive.size.s[1];
+   record.materialId = static_cast<cl_short>(primitive.materialId);
+   record.type       = static_cast<cl_uchar>(primitive.type);
+
+   // The device derives the texture ratios from the padding, see fillPrimitive
+   float padding = (primitive.size.s[0] != 0.f) ? primitive.materialRatioX*2.f*primitive.size.s[0]/gTextureWidth : 0.f;
+   padding = (padding<0.f) ? 0.f : (padding>255.f) ? 255.f : padding;
+   record.padding = static_cast<cl_uchar>(padding+0.5f);
+}
+
+void SceneRenderer::packMaterial(
+   const Material& material,
+   MaterialRecord& record )
+{
+   for( int i(0); i<4; ++i )
+   {
+      record.color[i]    = floatToHalf( material.color.s[i] );
+      record.specular[i] = floatToHalf( material.specular.s[i] );
+   }
+   record.refraction   = floatToHalf( material.refraction );
+   record.transparency = floatToHalf( material.transparency );
+   record.textureId    = static_cast<cl_short>(material.textureId);
+   record.flags        = material.textured ? gMaterialTextured : 0;
+}
+
+// ---------- Textures ----------
+void SceneRenderer::setTexture(
+   int   index,
+   BYTE* texture )
+{
+   BYTE* idx = m_textures+index*gTextureWidth*gTextureHeight*gTextureDepth;
+   int j(0);
+   for( int i(0); i<gTextureWidth*gTextureHeight*gColorDepth; i += gColorDepth ) {
+      idx[j]   = texture[i+2];
+      idx[j+1] = texture[i+1];
+      idx[j+2] = texture[i];
+      j+=gTextureDepth;
+   }
+}
+
+long SceneRenderer::addTexture( const std::string& filename )
+{
+   FILE *filePtr(0); //our file pointer
+   BITMAPFILEHEADER bitmapFileHeader; //our bitmap file header
+   unsigned char *bitmapImage;  //store image data
+   BITMAPINFOHEADER bitmapInfoHeader;
+   DWORD imageIdx=0;  //image index counter
+   unsigned char tempRGB;  //our swap variable
+
+   //open filename in read binary mode
+   fopen_s(&filePtr, filename.c_str(), "rb");
+   if (filePtr == NULL) {
+      return 1;
+   }
+
+   //read the bitmap file header
+   fread(&bitmapFileHeader, sizeof(BITMAPFILEHEADER), 1, filePtr);
+
+   //verify that this is a bmp file by check bitmap id
+   if (bitmapFileHeader.bfType !=0x4D42) {
+      fclose(filePtr);
+      return 1;
+   }
+
+   //read the bitmap info header
+   fread(&bitmapInfoHeader, sizeof(BITMAPINFOHEADER),1,filePtr);
+
+   //move file point to the begging of bitmap data
+   fseek(filePtr, bitmapFileHeader.bfOffBits, SEEK_SET);
+
+   //allocate enough memory for the bitmap image data
+   bitmapImage = (unsigned char*)malloc(bitmapInfoHeader.biSizeImage);
+
+   //verify memory allocation
+   if (!bitmapImage)
+   {
+      free(bitmapImage);
+      fclose(filePtr);
+      return 1;
+   }
+
+   //read in the bitmap image data
+   fread( bitmapImage, bitmapInfoHeader.biSizeImage, 1, filePtr);
+
+   //make sure bitmap image data was read
+   if (bitmapImage == NULL)
+   {
+      fclose(filePtr);
+      return NULL;
+   }
+
+   //swap the r and b values to get RGB (bitmap is BGR)
+   for (imageIdx = 0; imageIdx < bitmapInfoHeader.biSizeImage; imageIdx += 3)
+   {
+      tempRGB = bitmapImage[imageIdx];
+      bitmapImage[imageIdx] = bitmapImage[imageIdx + 2];
+      bitmapImage[imageIdx + 2] = tempRGB;
+   }
+
+   //close file and return bitmap iamge data
+   fclose(filePtr);
+
+   BYTE* index = m_textures + (m_nbActiveTextures*bitmapInfoHeader.biSizeImage*sizeof(BYTE));
+   memcpy( index, bitmapImage, bitmapInfoHeader.biSizeImage );
+   m_nbActiveTextures++;
+
+   free( bitmapImage );
+   return m_nbActiveTextures-1;
+}
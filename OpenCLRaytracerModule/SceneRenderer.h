@@ -0,0 +1,235 @@
+/*
+ * OpenCL Raytracer
+ * Copyright (C) 2011-2012 Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+ *
+ */
+
+#pragma once
+
+#include <CL/opencl.h>
+
+#include "DLL_API.h"
+#include "Renderer.h"
+#include <string>
+#include <vector>
+#include <windows.h>
+
+const int gTextureWidth  = 512;
+const int gTextureHeight = 512;
+const int gTextureDepth  = 3;
+const int gColorDepth    = 4;
+const int gNbIterations  = 10; // Must match the default number of bounces in Kernel.cl
+
+const float gContributionThreshold = 0.01f; // Bounces weighing less in the pixel are not traced
+
+enum PrimitiveType
+{
+   ptSphere = 0,
+   ptTriangle,
+   ptCheckboard,
+   ptCamera,
+   ptXYPlane,
+   ptYZPlane,
+   ptXZPlane,
+   ptCylinder
+};
+
+const int NO_MATERIAL = -1;
+
+struct Material
+{
+   cl_float4 color;
+   cl_float  refraction;
+   cl_int    textured;
+   cl_float  transparency;
+   cl_int    textureId;
+   cl_float4 specular;
+};
+
+struct Primitive
+{
+   cl_float4 center;
+   //cl_float4 rotation;
+   cl_float4 size;
+   cl_int    type;
+   cl_int    materialId;
+   cl_float  materialRatioX;
+   cl_float  materialRatioY;
+};
+
+// Compact records, as stored in device memory. Must match Kernel.cl
+struct PrimitiveRecord
+{
+   cl_float  x, y, z;       // Center
+   cl_float  width, height; // Size
+   cl_short  materialId;
+   cl_uchar  type;
+   cl_uchar  padding;       // Material padding, texture ratios are derived from it
+};
+
+struct MaterialRecord
+{
+   cl_ushort color[4];      // Half floats
+   cl_ushort specular[4];   // Half floats
+   cl_ushort refraction;    // Half float
+   cl_ushort transparency;  // Half float
+   cl_short  textureId;
+   cl_ushort flags;         // Bit 0: textured
+};
+
+const cl_ushort gMaterialTextured = 1;
+
+struct Lamp
+{
+   cl_float4 center;
+   cl_float4 color;
+};
+
+/*
+* Host copy of the scene behind the scene edits of Renderer: primitives,
+* lamps, materials, textures and camera, with the compact records of the
+* device and the elements changed since the last rendering. Renderers
+* consume the dirty lists when they trace a frame.
+*/
+class OPENCLRAYTRACERMODULE_API SceneRenderer : public Renderer
+{
+public:
+   SceneRenderer();
+   virtual ~SceneRenderer();
+
+public:
+   // ---------- Rendering ----------
+   virtual void setShadows( bool enabled );
+   virtual void setMaxIterations( int iterations );
+   virtual void setContributionThreshold( float threshold );
+
+public:
+   // ---------- Primitives ----------
+   virtual long addPrimitive( int type );
+   virtual void setPrimitive(
+      int   index,
+      float x,
+      float y,
+      float z,
+      float width,
+      float height,
+      int   materialId,
+      int   materialPadding );
+   virtual void rotatePrimitive(
+      int   index,
+      float x,
+      float y,
+      float z );
+   virtual void setPrimitiveMaterial(
+      int   index,
+      int   materialId );
+
+public:
+   // ---------- Lamps ----------
+   virtual long addLamp();
+   virtual void setLamp(
+      int index,
+      float x, float y, float z,
+      float intensity,
+      float r, float g, float b );
+
+public:
+   // ---------- Materials ----------
+   virtual long addMaterial();
+   virtual void setMaterial(
+      int   index,
+      float r, float g, float b,
+      float reflection,
+      float refraction,
+      int   textured,
+      float transparency,
+      int   textureId,
+      float specValue, float specPower, float specCoef,
+      float innerIllumination );
+
+public:
+   // ---------- Camera ----------
+   virtual void setCamera(
+      Float4 eye, Float4 dir, Float4 angles );
+
+public:
+   // ---------- Textures ----------
+   virtual void setTexture(
+      int   index,
+      BYTE* texture );
+   virtual long addTexture(
+      const std::string& filename );
+
+public:
+   cl_int getNbActivePrimitives() { return m_nbActivePrimitives; };
+   cl_int getNbActiveLamps()      { return m_nbActiveLamps; };
+   cl_int getNbActiveMaterials()  { return m_nbActiveMaterials; };
+
+protected:
+   void  allocateScene(
+      int nbPrimitives,
+      int nbLamps,
+      int nbMaterials,
+      int nbTextures );
+   void  releaseScene();
+
+protected:
+   void  fillPrimitive(
+      Primitive& primitive,
+      float      x,
+      float      y,
+      float      z,
+      float      width,
+      float      height,
+      int        materialId,
+      int        materialPadding );
+
+   // ---------- Compact records ----------
+   void  packPrimitive( const Primitive& primitive, PrimitiveRecord& record );
+   void  packMaterial( const Material& material, MaterialRecord& record );
+
+protected:
+   // Rendering features
+   bool        m_featuresDirty;  // Primitive types or materials have changed
+   bool        m_shadows;
+   int         m_maxIterations;
+   float       m_contributionThreshold;
+
+protected:
+   Primitive*  m_primitives;
+   Lamp*       m_lamps;
+   Material*   m_materials;
+   PrimitiveRecord* m_primitiveRecords;
+   MaterialRecord*  m_materialRecords;
+   cl_int      m_nbActivePrimitives;
+   cl_int      m_nbActiveLamps;
+   cl_int      m_nbActiveMaterials;
+   cl_int      m_nbActiveTextures;
+   cl_float4   m_viewPos;
+   cl_float4   m_viewDir;
+   cl_float4   m_angles;
+   BYTE*       m_textures;
+
+protected:
+   // Elements changed since the last rendering, only those are uploaded
+   std::vector<cl_int> m_dirtyPrimitives;
+   std::vector<cl_int> m_dirtyLamps;
+   std::vector<cl_int> m_dirtyMaterials;
+};